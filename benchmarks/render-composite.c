@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Measure the rate of small composites for every pairing of source and
+ * mask transform, i.e. for each of the vertex emitters chosen by
+ * gen4_choose_composite_emitter(), plus a solid source against each mask.
+ * The rectangles are kept tiny so that the cost is dominated by the CPU
+ * emitting vertices rather than by the GPU filling pixels.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define SIZE 256
+#define RECT 8
+
+enum transform {
+	NONE,
+	SOLID,
+	IDENTITY,
+	SCALE,
+	ROTATE,
+	PROJECTIVE,
+	NUM_TRANSFORMS
+};
+
+static const char *transform_name[NUM_TRANSFORMS] = {
+	"none", "solid", "identity", "scale", "rotate", "projective"
+};
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return 1e6*(end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec)/1000;
+}
+
+static Picture
+create_picture(Display *dpy, Drawable d, int depth, int format,
+	       enum transform t)
+{
+	XRenderPictureAttributes pa;
+	XTransform xf;
+	Picture picture;
+	Pixmap pixmap;
+
+	if (t == SOLID) {
+		XRenderColor color = { 0x8000, 0x4000, 0x2000, 0x8000 };
+		return XRenderCreateSolidFill(dpy, &color);
+	}
+
+	pixmap = XCreatePixmap(dpy, d, SIZE, SIZE, depth);
+	pa.repeat = RepeatNormal;
+	picture = XRenderCreatePicture(dpy, pixmap,
+				       XRenderFindStandardFormat(dpy, format),
+				       CPRepeat, &pa);
+	XFreePixmap(dpy, pixmap);
+
+	memset(&xf, 0, sizeof(xf));
+	xf.matrix[0][0] = xf.matrix[1][1] = xf.matrix[2][2] = XDoubleToFixed(1);
+	switch (t) {
+	case NONE:
+		return picture;
+	case IDENTITY:
+		/* An explicit identity transform, not merely none */
+		XRenderSetPictureTransform(dpy, picture, &xf);
+		return picture;
+	case SCALE:
+		xf.matrix[0][0] = XDoubleToFixed(.5);
+		xf.matrix[1][1] = XDoubleToFixed(2);
+		xf.matrix[0][2] = XDoubleToFixed(3);
+		break;
+	case ROTATE:
+		xf.matrix[0][0] = xf.matrix[1][1] = XDoubleToFixed(.8);
+		xf.matrix[0][1] = XDoubleToFixed(-.6);
+		xf.matrix[1][0] = XDoubleToFixed(.6);
+		break;
+	case PROJECTIVE:
+		xf.matrix[2][0] = XDoubleToFixed(.001);
+		xf.matrix[2][1] = XDoubleToFixed(.002);
+		break;
+	default:
+		break;
+	}
+	XRenderSetPictureTransform(dpy, picture, &xf);
+	XRenderSetPictureFilter(dpy, picture, FilterBilinear, NULL, 0);
+
+	return picture;
+}
+
+static void run(Display *dpy, Picture dst, Window root,
+		enum transform src_t, enum transform mask_t,
+		int duration)
+{
+	struct timespec start, end;
+	Picture src, mask;
+	unsigned long count;
+	double t;
+	int i;
+
+	src = create_picture(dpy, root, 32, PictStandardARGB32, src_t);
+	mask = None;
+	if (mask_t != NONE)
+		mask = create_picture(dpy, root, 8, PictStandardA8, mask_t);
+
+	XSync(dpy, True);
+
+	count = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (i = 0; i < 1024; i++) {
+			int x = (i * 37) % (SIZE - RECT);
+			int y = (i * 91) % (SIZE - RECT);
+
+			XRenderComposite(dpy, PictOpOver, src, mask, dst,
+					 x, y, y, x, x, y, RECT, RECT);
+		}
+		XSync(dpy, False);
+		count += i;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t = elapsed(&start, &end);
+	} while (t < duration * 1e6);
+
+	printf("src=%-10s mask=%-10s %10.0f composites/s\n",
+	       transform_name[src_t], transform_name[mask_t],
+	       count / (t / 1e6));
+
+	if (mask)
+		XRenderFreePicture(dpy, mask);
+	XRenderFreePicture(dpy, src);
+}
+
+int main(int argc, char **argv)
+{
+	Display *dpy;
+	Window root;
+	Pixmap pixmap;
+	Picture dst;
+	int duration = 1;
+	int s, m, i;
+
+	while ((i = getopt(argc, argv, "d:")) != -1) {
+		switch (i) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		}
+	}
+
+	dpy = XOpenDisplay(NULL);
+	if (dpy == NULL)
+		return 77;
+
+	if (!XRenderQueryExtension(dpy, &i, &i))
+		return 77;
+
+	root = DefaultRootWindow(dpy);
+	pixmap = XCreatePixmap(dpy, root, SIZE, SIZE, 32);
+	dst = XRenderCreatePicture(dpy, pixmap,
+				   XRenderFindStandardFormat(dpy, PictStandardARGB32),
+				   0, NULL);
+	XFreePixmap(dpy, pixmap);
+
+	for (s = SOLID; s < NUM_TRANSFORMS; s++)
+		for (m = NONE; m < NUM_TRANSFORMS; m++)
+			if (m != SOLID)
+				run(dpy, dst, root, s, m, duration);
+
+	XRenderFreePicture(dpy, dst);
+	XCloseDisplay(dpy);
+	return 0;
+}
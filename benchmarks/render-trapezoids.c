@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/* Measure the rate of precise antialiased trapezoids for filled discs,
+ * whose rows are dominated by long interior spans, for thin rings of
+ * the same size, whose rows are nothing but edges, and for a comb of
+ * slanted teeth across the same extents, whose rows hold many more
+ * edges than a ring. The discs and rings are formed from a handful of
+ * cells per row, whereas the comb is dense enough for the rasteriser
+ * to switch to its dense coverage row, so comparing the three across
+ * sizes shows where each pays off.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#define SIZE 1024
+#define BANDS 64
+
+enum shape {
+	DISC,
+	RING,
+	COMB,
+	NUM_SHAPES
+};
+
+static const char *shape_name[NUM_SHAPES] = { "disc", "ring", "comb" };
+
+static double elapsed(const struct timespec *start,
+		      const struct timespec *end)
+{
+	return 1e6*(end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec)/1000;
+}
+
+static void set_trap(XTrapezoid *t,
+		     double top, double bottom,
+		     double l1, double l2,
+		     double r1, double r2)
+{
+	t->top = XDoubleToFixed(top);
+	t->bottom = XDoubleToFixed(bottom);
+	t->left.p1.x = XDoubleToFixed(l1);
+	t->left.p1.y = t->top;
+	t->left.p2.x = XDoubleToFixed(l2);
+	t->left.p2.y = t->bottom;
+	t->right.p1.x = XDoubleToFixed(r1);
+	t->right.p1.y = t->top;
+	t->right.p2.x = XDoubleToFixed(r2);
+	t->right.p2.y = t->bottom;
+}
+
+/* Approximate a circle of the given radius by BANDS slabs, either
+ * filled or as a ring one and a half pixels wide, or cover its bounding
+ * box with BANDS slanted teeth.
+ */
+static int build(XTrapezoid *traps, enum shape s, double radius)
+{
+	double c = SIZE / 2. + .3;
+	int n, count = 0;
+
+	for (n = 0; n < BANDS; n++) {
+		double a0 = M_PI * n / BANDS;
+		double a1 = M_PI * (n + 1) / BANDS;
+		double y0 = c - radius * cos(a0);
+		double y1 = c - radius * cos(a1);
+		double w0 = radius * sin(a0);
+		double w1 = radius * sin(a1);
+
+		switch (s) {
+		case DISC:
+			set_trap(&traps[count++], y0, y1,
+				 c - w0, c - w1, c + w0, c + w1);
+			break;
+		case RING:
+			set_trap(&traps[count++], y0, y1,
+				 c - w0, c - w1, c - w0 + 1.5, c - w1 + 1.5);
+			set_trap(&traps[count++], y0, y1,
+				 c + w0 - 1.5, c + w1 - 1.5, c + w0, c + w1);
+			break;
+		case COMB:
+			w0 = c - radius + 2 * radius * n / BANDS;
+			set_trap(&traps[count++], c - radius, c + radius,
+				 w0, w0 + 3.3, w0 + .7, w0 + 4.);
+			break;
+		default:
+			break;
+		}
+	}
+
+	return count;
+}
+
+static void run(Display *dpy, Picture src, Picture dst,
+		enum shape s, int radius, int duration)
+{
+	XRenderPictFormat *mask = XRenderFindStandardFormat(dpy, PictStandardA8);
+	XTrapezoid traps[2*BANDS];
+	struct timespec start, end;
+	unsigned long count;
+	double t;
+	int n, i;
+
+	n = build(traps, s, radius);
+
+	XSync(dpy, True);
+
+	count = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (i = 0; i < 64; i++)
+			XRenderCompositeTrapezoids(dpy, PictOpOver,
+						   src, dst, mask,
+						   0, 0, traps, n);
+		XSync(dpy, False);
+		count += i;
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t = elapsed(&start, &end);
+	} while (t < duration * 1e6);
+
+	printf("%-5s radius=%-4d %10.0f shapes/s\n",
+	       shape_name[s], radius, count / (t / 1e6));
+}
+
+int main(int argc, char **argv)
+{
+	static const int radius[] = { 16, 64, 256, 500 };
+	XRenderPictureAttributes pa;
+	XRenderColor white = { 0xffff, 0xffff, 0xffff, 0xffff };
+	Display *dpy;
+	Window root;
+	Pixmap pixmap;
+	Picture src, dst;
+	int duration = 1;
+	int s, r, i;
+
+	while ((i = getopt(argc, argv, "d:")) != -1) {
+		switch (i) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		}
+	}
+
+	dpy = XOpenDisplay(NULL);
+	if (dpy == NULL)
+		return 77;
+
+	if (!XRenderQueryExtension(dpy, &i, &i))
+		return 77;
+
+	root = DefaultRootWindow(dpy);
+	pixmap = XCreatePixmap(dpy, root, SIZE, SIZE, 32);
+	pa.poly_mode = PolyModePrecise;
+	pa.poly_edge = PolyEdgeSmooth;
+	dst = XRenderCreatePicture(dpy, pixmap,
+				   XRenderFindStandardFormat(dpy, PictStandardARGB32),
+				   CPPolyMode | CPPolyEdge, &pa);
+	XFreePixmap(dpy, pixmap);
+
+	src = XRenderCreateSolidFill(dpy, &white);
+
+	for (s = 0; s < NUM_SHAPES; s++)
+		for (r = 0; r < sizeof(radius)/sizeof(radius[0]); r++)
+			run(dpy, src, dst, s, radius[r], duration);
+
+	XRenderFreePicture(dpy, src);
+	XRenderFreePicture(dpy, dst);
+	XCloseDisplay(dpy);
+	return 0;
+}
@@ -39,6 +39,9 @@ enum intel_options {
 	OPTION_VIRTUAL,
 	OPTION_TEAR_FREE,
 	OPTION_CRTC_PIXMAPS,
+	OPTION_GRADIENT_CACHE,
+	OPTION_GLYPH_CACHE_PERSIST,
+	OPTION_ANALYTIC_COVERAGE,
 #endif
 #ifdef USE_UXA
 	OPTION_FALLBACKDEBUG,
@@ -717,6 +717,100 @@ memcpy_blt(const void *src, void *dst, int bpp,
 	}
 }
 
+/* Uploads into a write-combined (or otherwise uncached) mapping gain
+ * nothing from passing through the CPU cache, so for wide rows write
+ * whole cachelines with non-temporal stores and leave the cache to the
+ * client's own image.
+ */
+fast void
+memcpy_blt__stream(const void *src, void *dst, int bpp,
+		   int32_t src_stride, int32_t dst_stride,
+		   int16_t src_x, int16_t src_y,
+		   int16_t dst_x, int16_t dst_y,
+		   uint16_t width, uint16_t height)
+{
+#if defined(sse2)
+	const uint8_t *src_bytes;
+	uint8_t *dst_bytes;
+	int byte_width;
+
+	assert(src);
+	assert(dst);
+	assert(width && height);
+	assert(bpp >= 8);
+
+	byte_width = width * bpp / 8;
+	if (byte_width < 128 || !have_sse2()) {
+		memcpy_blt(src, dst, bpp,
+			   src_stride, dst_stride,
+			   src_x, src_y,
+			   dst_x, dst_y,
+			   width, height);
+		return;
+	}
+
+	DBG(("%s: src=(%d, %d), dst=(%d, %d), size=%dx%d, pitch=%d/%d\n",
+	     __FUNCTION__, src_x, src_y, dst_x, dst_y, width, height, src_stride, dst_stride));
+
+	src_bytes = (const uint8_t *)src + src_stride * src_y + src_x * bpp / 8;
+	dst_bytes = (uint8_t *)dst + dst_stride * dst_y + dst_x * bpp / 8;
+
+	do {
+		const uint8_t *s = src_bytes;
+		uint8_t *d = dst_bytes;
+		int i = byte_width;
+
+		if ((uintptr_t)d & 15) {
+			int head = 16 - ((uintptr_t)d & 15);
+			memcpy(d, s, head);
+			d += head;
+			s += head;
+			i -= head;
+		}
+
+		while (i >= 64) {
+			__m128i xmm1, xmm2, xmm3, xmm4;
+
+			xmm1 = xmm_load_128u((const __m128i*)s + 0);
+			xmm2 = xmm_load_128u((const __m128i*)s + 1);
+			xmm3 = xmm_load_128u((const __m128i*)s + 2);
+			xmm4 = xmm_load_128u((const __m128i*)s + 3);
+
+			_mm_stream_si128((__m128i*)d + 0, xmm1);
+			_mm_stream_si128((__m128i*)d + 1, xmm2);
+			_mm_stream_si128((__m128i*)d + 2, xmm3);
+			_mm_stream_si128((__m128i*)d + 3, xmm4);
+
+			d += 64;
+			s += 64;
+			i -= 64;
+		}
+
+		while (i >= 16) {
+			_mm_stream_si128((__m128i*)d,
+					 xmm_load_128u((const __m128i*)s));
+			d += 16;
+			s += 16;
+			i -= 16;
+		}
+
+		if (i)
+			memcpy(d, s, i);
+
+		src_bytes += src_stride;
+		dst_bytes += dst_stride;
+	} while (--height);
+
+	_mm_sfence();
+#else
+	memcpy_blt(src, dst, bpp,
+		   src_stride, dst_stride,
+		   src_x, src_y,
+		   dst_x, dst_y,
+		   width, height);
+#endif
+}
+
 static fast_memcpy void
 memcpy_to_tiled_x__swizzle_0(const void *src, void *dst, int bpp,
 			     int32_t src_stride, int32_t dst_stride,
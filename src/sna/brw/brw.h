@@ -3,6 +3,9 @@
 bool brw_sf_kernel__nomask(struct brw_compile *p);
 bool brw_sf_kernel__mask(struct brw_compile *p);
 
+bool brw_vs_kernel__rectangle(struct brw_compile *p);
+bool brw_vs_kernel__rectangle_mask(struct brw_compile *p);
+
 bool brw_wm_kernel__affine(struct brw_compile *p, int dispatch_width);
 bool brw_wm_kernel__affine_mask(struct brw_compile *p, int dispatch_width);
 bool brw_wm_kernel__affine_mask_ca(struct brw_compile *p, int dispatch_width);
@@ -15,3 +18,20 @@ bool brw_wm_kernel__projective_mask_sa(struct brw_compile *p, int dispatch_width
 
 bool brw_wm_kernel__affine_opacity(struct brw_compile *p, int dispatch_width);
 bool brw_wm_kernel__projective_opacity(struct brw_compile *p, int dispatch_width);
+
+enum brw_wm_mask {
+	BRW_WM_NOMASK,
+	BRW_WM_MASK,
+	BRW_WM_OPACITY,
+};
+
+bool brw_wm_kernel__radial(struct brw_compile *p, int dispatch_width,
+			   enum brw_wm_mask mask,
+			   float cdx, float cdy, float r1, float dr,
+			   bool extend_none);
+bool brw_wm_kernel__conical(struct brw_compile *p, int dispatch_width,
+			    enum brw_wm_mask mask);
+
+bool brw_wm_kernel__affine_convolve(struct brw_compile *p, int dispatch_width,
+				    int cw, int ch, int x0, int y0,
+				    const float *weight);
@@ -56,6 +56,7 @@
 
 #define WRITEMASK_XY (WRITEMASK_X | WRITEMASK_Y)
 #define WRITEMASK_XYZ (WRITEMASK_X | WRITEMASK_Y | WRITEMASK_Z)
+#define WRITEMASK_ZW (WRITEMASK_Z | WRITEMASK_W)
 #define WRITEMASK_XYZW (WRITEMASK_X | WRITEMASK_Y | WRITEMASK_Z | WRITEMASK_W)
 
 /** Number of general purpose registers (VS, WM, etc) */
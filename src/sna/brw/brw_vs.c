@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include "brw.h"
+
+/* Expand a single instanced rectangle into one of its three RECTLIST
+ * vertices. Runs SIMD4x2 with the vertex attributes delivered as
+ *
+ *   g1: corner (cx, cy, 0, 1), one of (1, 1), (0, 1), (0, 0)
+ *   g2: destination (x, y, w, h)
+ *   g3: source origin (sx, sy, 0, 1)
+ *   g4: texture scale (src_x, src_y, mask_x, mask_y)
+ *   g5: mask origin (mx, my, 0, 1)
+ *
+ * and writes the same VUE that the pass-through VS would have produced
+ * from a fully expanded vertex:
+ *
+ *   pad, (x + cx*w, y + cy*h, 0, 1), ((sx + cx*w)*src_x, ..., 0, 1), ...
+ */
+static void brw_vs_texcoord(struct brw_compile *p, int msg,
+			    struct brw_reg origin, struct brw_reg scale)
+{
+	struct brw_reg corner = brw_vec8_grf(1, 0);
+	struct brw_reg delta = brw_vec8_grf(6, 0);
+	struct brw_reg tmp = brw_vec8_grf(7, 0);
+	struct brw_reg dst = brw_message_reg(msg);
+
+	brw_ADD(p, brw_writemask(tmp, WRITEMASK_XY), origin, delta);
+	brw_MUL(p, brw_writemask(dst, WRITEMASK_XY), tmp, scale);
+	brw_MOV(p, brw_writemask(dst, WRITEMASK_ZW), corner);
+}
+
+static bool brw_vs_rectangle(struct brw_compile *p, bool has_mask)
+{
+	struct brw_reg corner = brw_vec8_grf(1, 0);
+	struct brw_reg box = brw_vec8_grf(2, 0);
+	struct brw_reg scale = brw_vec8_grf(4, 0);
+	struct brw_reg delta = brw_vec8_grf(6, 0);
+
+	if (p->gen < 070)
+		return false;
+
+	brw_set_access_mode(p, BRW_ALIGN_16);
+
+	/* (cx*w, cy*h) */
+	brw_MUL(p, brw_writemask(delta, WRITEMASK_XY),
+		corner, brw_swizzle(box, 2, 3, 2, 3));
+
+	/* VUE header */
+	brw_MOV(p, brw_message_reg(2), brw_imm_f(0));
+
+	/* position */
+	brw_ADD(p, brw_writemask(brw_message_reg(3), WRITEMASK_XY),
+		box, delta);
+	brw_MOV(p, brw_writemask(brw_message_reg(3), WRITEMASK_ZW), corner);
+
+	brw_vs_texcoord(p, 4, brw_vec8_grf(3, 0), scale);
+	if (has_mask)
+		brw_vs_texcoord(p, 5, brw_vec8_grf(5, 0),
+				brw_swizzle(scale, 2, 3, 2, 3));
+
+	brw_urb_WRITE(p, brw_null_reg(), 1, brw_vec8_grf(0, 0),
+		      false, true, 4 + has_mask, 0, true, true, 0,
+		      BRW_URB_SWIZZLE_INTERLEAVE);
+
+	return true;
+}
+
+bool brw_vs_kernel__rectangle(struct brw_compile *p)
+{
+	return brw_vs_rectangle(p, false);
+}
+
+bool brw_vs_kernel__rectangle_mask(struct brw_compile *p)
+{
+	return brw_vs_rectangle(p, true);
+}
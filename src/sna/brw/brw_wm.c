@@ -679,3 +679,338 @@ brw_wm_kernel__projective_opacity(struct brw_compile *p, int dispatch)
 
 	return true;
 }
+
+/* Convolution: sample the source once per non-zero tap, offsetting the
+ * interpolated texture coordinate by the tap position, and accumulate
+ * the weighted samples before a single write. The size of a texel in
+ * normalised units is read from the plane equation of the coordinate in
+ * the payload, so the same kernel serves any source size.
+ */
+bool
+brw_wm_kernel__affine_convolve(struct brw_compile *p, int dispatch,
+			       int cw, int ch, int x0, int y0,
+			       const float *weight)
+{
+	enum brw_compression compression;
+	int uv = dispatch == 16 ? 6 : 4;
+	int src = 12, acc = 32;
+	int i, j, n, taps;
+
+	if (p->gen < 060)
+		return false;
+
+	if (dispatch == 16)
+		compression = BRW_COMPRESSION_COMPRESSED;
+	else
+		compression = BRW_COMPRESSION_NONE;
+
+	brw_set_compression_control(p, compression);
+	brw_PLN(p,
+		brw_vec8_grf(26, 0),
+		brw_vec1_grf(uv, 0),
+		brw_vec8_grf(2, 0));
+	brw_PLN(p,
+		brw_vec8_grf(28, 0),
+		brw_vec1_grf(uv, 4),
+		brw_vec8_grf(2, 0));
+
+	taps = 0;
+	for (j = 0; j < ch; j++) {
+		for (i = 0; i < cw; i++) {
+			float w = *weight++;
+
+			if (w == 0.f)
+				continue;
+
+			/* u += (x0 + i) * du/dx, v += (y0 + j) * dv/dy */
+			brw_set_compression_control(p, compression);
+			brw_MUL(p,
+				brw_vec8_grf(22, 0),
+				brw_vec1_grf(uv, 0),
+				brw_imm_f(x0 + i));
+			brw_ADD(p,
+				brw_message_reg(2),
+				brw_vec8_grf(26, 0),
+				brw_vec8_grf(22, 0));
+			brw_MUL(p,
+				brw_vec8_grf(24, 0),
+				brw_vec1_grf(uv, 5),
+				brw_imm_f(y0 + j));
+			brw_ADD(p,
+				brw_message_reg(2 + dispatch/8),
+				brw_vec8_grf(28, 0),
+				brw_vec8_grf(24, 0));
+			brw_wm_sample(p, dispatch, 0, 1, src);
+
+			brw_set_compression_control(p, compression);
+			for (n = 0; n < 4; n++) {
+				int c = dispatch == 16 ? 2*n : n;
+
+				if (taps == 0) {
+					brw_MUL(p,
+						brw_vec8_grf(acc + c, 0),
+						brw_vec8_grf(src + c, 0),
+						brw_imm_f(w));
+				} else {
+					brw_MUL(p,
+						brw_vec8_grf(src + c, 0),
+						brw_vec8_grf(src + c, 0),
+						brw_imm_f(w));
+					brw_ADD(p,
+						brw_vec8_grf(acc + c, 0),
+						brw_vec8_grf(acc + c, 0),
+						brw_vec8_grf(src + c, 0));
+				}
+			}
+			taps++;
+		}
+	}
+	if (taps == 0)
+		return false;
+
+	brw_wm_write(p, dispatch, acc);
+	return true;
+}
+
+/* Gradients: the source channel carries the position in gradient space,
+ * from which we compute the parameter t per pixel and then look up the
+ * colour in the 1D ramp bound as the source texture.
+ */
+
+#define GRAD_X 26
+#define GRAD_Y 28
+
+static struct brw_reg grf(int nr)
+{
+	return brw_vec8_grf(nr, 0);
+}
+
+static void brw_wm_gradient_xy(struct brw_compile *p, int dw)
+{
+	int uv = dw == 16 ? 6 : 4;
+
+	brw_PLN(p, grf(GRAD_X), brw_vec1_grf(uv, 0), brw_vec8_grf(2, 0));
+	brw_PLN(p, grf(GRAD_Y), brw_vec1_grf(uv, 4), brw_vec8_grf(2, 0));
+}
+
+/* The ramp is a row of the gradient atlas, selected by the third texture
+ * coordinate which is constant across the primitive.
+ */
+static void brw_wm_gradient_row(struct brw_compile *p, int dw, int msg)
+{
+	int uv = dw == 16 ? 6 : 4;
+
+	brw_PLN(p, brw_message_reg(msg), brw_vec1_grf(uv + 1, 0), brw_vec8_grf(2, 0));
+}
+
+static void brw_wm_math(struct brw_compile *p, int dw,
+			unsigned function, int dst, int src)
+{
+	if (dw == 16) {
+		brw_set_compression_control(p, BRW_COMPRESSION_NONE);
+		brw_math(p, grf(dst), function, BRW_MATH_SATURATE_NONE, 0,
+			 grf(src), BRW_MATH_PRECISION_FULL, BRW_MATH_DATA_VECTOR);
+		brw_set_compression_control(p, BRW_COMPRESSION_2NDHALF);
+		brw_math(p, grf(dst+1), function, BRW_MATH_SATURATE_NONE, 0,
+			 grf(src+1), BRW_MATH_PRECISION_FULL, BRW_MATH_DATA_VECTOR);
+		brw_set_compression_control(p, BRW_COMPRESSION_COMPRESSED);
+	} else
+		brw_math(p, grf(dst), function, BRW_MATH_SATURATE_NONE, 0,
+			 grf(src), BRW_MATH_PRECISION_FULL, BRW_MATH_DATA_VECTOR);
+}
+
+static void brw_wm_minmax(struct brw_compile *p, unsigned cond,
+			  struct brw_reg dst,
+			  struct brw_reg src0,
+			  struct brw_reg src1)
+{
+	brw_set_conditionalmod(p, cond);
+	brw_SEL(p, dst, src0, src1);
+	brw_set_conditionalmod(p, BRW_CONDITIONAL_NONE);
+	brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+}
+
+/* Non-negative iff t lies upon a valid circle; for RepeatNone we also
+ * require t to be within [0, 1] as pixman does.
+ */
+static void brw_wm_radial_valid(struct brw_compile *p, int dst, int t,
+				float r1, float dr, bool extend_none)
+{
+	if (extend_none) {
+		brw_MUL(p, grf(dst), grf(t), grf(t));
+		brw_ADD(p, grf(dst), grf(t), brw_negate(grf(dst)));
+	} else {
+		brw_MUL(p, grf(dst), grf(t), brw_imm_f(dr));
+		brw_ADD(p, grf(dst), grf(dst), brw_imm_f(r1));
+	}
+}
+
+static int brw_wm_radial(struct brw_compile *p, int dw,
+			 float cdx, float cdy, float r1, float dr,
+			 bool extend_none)
+{
+	const int b = 40, c = 42, t = 46, w = 48, tmp = 44;
+	float a = cdx*cdx + cdy*cdy - dr*dr;
+	int result = 12, n;
+
+	brw_set_compression_control(p, dw == 16 ? BRW_COMPRESSION_COMPRESSED : BRW_COMPRESSION_NONE);
+	brw_wm_gradient_xy(p, dw);
+
+	/* b = p.cd + r1.dr */
+	brw_MUL(p, grf(b), grf(GRAD_X), brw_imm_f(cdx));
+	brw_MUL(p, grf(tmp), grf(GRAD_Y), brw_imm_f(cdy));
+	brw_ADD(p, grf(b), grf(b), grf(tmp));
+	brw_ADD(p, grf(b), grf(b), brw_imm_f(r1*dr));
+
+	/* c = p.p - r1² */
+	brw_MUL(p, grf(c), grf(GRAD_X), grf(GRAD_X));
+	brw_MUL(p, grf(tmp), grf(GRAD_Y), grf(GRAD_Y));
+	brw_ADD(p, grf(c), grf(c), grf(tmp));
+	brw_ADD(p, grf(c), grf(c), brw_imm_f(-r1*r1));
+
+	if (a == 0.f) {
+		/* t = c / 2b */
+		brw_wm_math(p, dw, BRW_MATH_FUNCTION_INV, tmp, b);
+		brw_MUL(p, grf(t), grf(c), grf(tmp));
+		brw_MUL(p, grf(t), grf(t), brw_imm_f(.5f));
+
+		brw_wm_radial_valid(p, w, t, r1, dr, extend_none);
+	} else {
+		/* discriminant, d = b² - ac, kept in tmp */
+		brw_MUL(p, grf(tmp), grf(b), grf(b));
+		brw_MUL(p, grf(c), grf(c), brw_imm_f(-a));
+		brw_ADD(p, grf(tmp), grf(tmp), grf(c));
+
+		/* the larger root t1 in w, the smaller t2 in t */
+		brw_wm_minmax(p, BRW_CONDITIONAL_GE, grf(c), grf(tmp), brw_imm_f(0.f));
+		brw_wm_math(p, dw, BRW_MATH_FUNCTION_SQRT, c, c);
+		if (a < 0)
+			brw_MOV(p, grf(c), brw_negate(grf(c)));
+		brw_ADD(p, grf(w), grf(b), grf(c));
+		brw_MUL(p, grf(w), grf(w), brw_imm_f(1.f / a));
+		brw_ADD(p, grf(t), grf(b), brw_negate(grf(c)));
+		brw_MUL(p, grf(t), grf(t), brw_imm_f(1.f / a));
+
+		/* prefer t1 if valid, otherwise fallback to t2 */
+		brw_wm_radial_valid(p, c, w, r1, dr, extend_none);
+		brw_CMP(p, brw_null_reg(), BRW_CONDITIONAL_GE, grf(c), brw_imm_f(0.f));
+		brw_MOV(p, grf(t), grf(w));
+		brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+
+		/* and the chosen root must also be real */
+		brw_wm_radial_valid(p, w, t, r1, dr, extend_none);
+		brw_wm_minmax(p, BRW_CONDITIONAL_L, grf(w), grf(w), grf(tmp));
+	}
+
+	brw_MOV(p, brw_message_reg(2), grf(t));
+	brw_wm_gradient_row(p, dw, 2 + dw/8);
+	brw_wm_sample(p, dw, 0, 1, result);
+
+	/* pixels without a solution are transparent */
+	brw_set_compression_control(p, dw == 16 ? BRW_COMPRESSION_COMPRESSED : BRW_COMPRESSION_NONE);
+	brw_CMP(p, brw_null_reg(), BRW_CONDITIONAL_L, grf(w), brw_imm_f(0.f));
+	for (n = 0; n < 4; n++)
+		brw_MOV(p, grf(result + n * dw/8), brw_imm_f(0.f));
+	brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+
+	return result;
+}
+
+static int brw_wm_conical(struct brw_compile *p, int dw)
+{
+	static const float coeff[] = {
+		0.0208351f, -0.0851330f, 0.1801410f, -0.3302995f, 0.9998660f
+	};
+	const int mx = 40, mn = 42, r = 44, s = 46, t = 48;
+	unsigned n;
+
+	brw_set_compression_control(p, dw == 16 ? BRW_COMPRESSION_COMPRESSED : BRW_COMPRESSION_NONE);
+	brw_wm_gradient_xy(p, dw);
+
+	/* atan(min/max) over the first octant */
+	brw_wm_minmax(p, BRW_CONDITIONAL_GE, grf(mx),
+		      brw_abs(grf(GRAD_X)), brw_abs(grf(GRAD_Y)));
+	brw_wm_minmax(p, BRW_CONDITIONAL_L, grf(mn),
+		      brw_abs(grf(GRAD_X)), brw_abs(grf(GRAD_Y)));
+	brw_wm_minmax(p, BRW_CONDITIONAL_GE, grf(mx), grf(mx), brw_imm_f(1e-20f));
+	brw_wm_math(p, dw, BRW_MATH_FUNCTION_INV, r, mx);
+	brw_MUL(p, grf(r), grf(mn), grf(r));
+	brw_MUL(p, grf(s), grf(r), grf(r));
+
+	brw_MUL(p, grf(t), grf(s), brw_imm_f(coeff[0]));
+	for (n = 1; n < sizeof(coeff)/sizeof(coeff[0]) - 1; n++) {
+		brw_ADD(p, grf(t), grf(t), brw_imm_f(coeff[n]));
+		brw_MUL(p, grf(t), grf(t), grf(s));
+	}
+	brw_ADD(p, grf(t), grf(t), brw_imm_f(coeff[n]));
+	brw_MUL(p, grf(t), grf(t), grf(r));
+
+	/* and reflect into the other octants */
+	brw_CMP(p, brw_null_reg(), BRW_CONDITIONAL_G,
+		brw_abs(grf(GRAD_Y)), brw_abs(grf(GRAD_X)));
+	brw_ADD(p, grf(t), brw_negate(grf(t)), brw_imm_f(1.57079633f));
+	brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+	brw_CMP(p, brw_null_reg(), BRW_CONDITIONAL_L,
+		grf(GRAD_X), brw_imm_f(0.f));
+	brw_ADD(p, grf(t), brw_negate(grf(t)), brw_imm_f(3.14159265f));
+	brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+	brw_CMP(p, brw_null_reg(), BRW_CONDITIONAL_L,
+		grf(GRAD_Y), brw_imm_f(0.f));
+	brw_MOV(p, grf(t), brw_negate(grf(t)));
+	brw_set_predicate_control(p, BRW_PREDICATE_NONE);
+
+	/* t = 1 - atan2(y, x) / 2π, wrapped into [0, 1) */
+	brw_MUL(p, grf(t), grf(t), brw_imm_f(-0.159154943f));
+	brw_FRC(p, grf(t), grf(t));
+
+	brw_MOV(p, brw_message_reg(2), grf(t));
+	brw_wm_gradient_row(p, dw, 2 + dw/8);
+	return brw_wm_sample(p, dw, 0, 1, 12);
+}
+
+static bool brw_wm_gradient_write(struct brw_compile *p, int dw,
+				  int src, enum brw_wm_mask mask)
+{
+	switch (mask) {
+	case BRW_WM_NOMASK:
+		brw_wm_write(p, dw, src);
+		return true;
+	case BRW_WM_MASK:
+		brw_wm_write__mask(p, dw, src,
+				   brw_wm_affine__alpha(p, dw, 1, 6, 20));
+		return true;
+	case BRW_WM_OPACITY:
+		brw_wm_write__opacity(p, dw, src, dw == 16 ? 8 : 6);
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool
+brw_wm_kernel__radial(struct brw_compile *p, int dispatch,
+		      enum brw_wm_mask mask,
+		      float cdx, float cdy, float r1, float dr,
+		      bool extend_none)
+{
+	if (p->gen < 060)
+		return false;
+
+	return brw_wm_gradient_write(p, dispatch,
+				     brw_wm_radial(p, dispatch,
+						   cdx, cdy, r1, dr,
+						   extend_none),
+				     mask);
+}
+
+bool
+brw_wm_kernel__conical(struct brw_compile *p, int dispatch,
+		       enum brw_wm_mask mask)
+{
+	if (p->gen < 060)
+		return false;
+
+	return brw_wm_gradient_write(p, dispatch,
+				     brw_wm_conical(p, dispatch),
+				     mask);
+}
@@ -2239,6 +2239,9 @@ static bool gen3_magic_ca_pass(struct sna *sna,
 
 static void gen3_vertex_flush(struct sna *sna)
 {
+	/* Close the primitive to other threads before reading the count */
+	sna_vertex_wait__locked(&sna->render);
+
 	assert(sna->render.vertex_offset);
 
 	DBG(("%s[%x] = %d\n", __FUNCTION__,
@@ -2638,29 +2641,21 @@ gen3_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen3_get_rectangles(sna, op, nbox);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen3_get_rectangles);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-		assert(sna->render.vertex_used <= sna->render.vertex_size);
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 static void
@@ -4308,22 +4303,16 @@ gen3_render_composite_spans_constant_thread__sse2__boxes(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen3_get_rectangles(sna, &op->base, nbox);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, 9,
+					       3, true,
+					       &nbox_this_time, gen3_get_rectangles);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * 9;
-		assert(sna->render.vertex_used <= sna->render.vertex_size);
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		do {
 			v[0] = box->box.x2;
 			v[6] = v[3] = box->box.x1;
@@ -4334,10 +4323,8 @@ gen3_render_composite_spans_constant_thread__sse2__boxes(struct sna *sna,
 			box++;
 		} while (--nbox_this_time);
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 sse2 fastcall static void
@@ -4763,22 +4750,16 @@ gen3_render_composite_spans_constant_thread_boxes(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen3_get_rectangles(sna, &op->base, nbox);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, 9,
+					       3, true,
+					       &nbox_this_time, gen3_get_rectangles);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * 9;
-		assert(sna->render.vertex_used <= sna->render.vertex_size);
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		do {
 			v[0] = box->box.x2;
 			v[6] = v[3] = box->box.x1;
@@ -4789,10 +4770,8 @@ gen3_render_composite_spans_constant_thread_boxes(struct sna *sna,
 			box++;
 		} while (--nbox_this_time);
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -4853,29 +4832,21 @@ gen3_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen3_get_rectangles(sna, &op->base, nbox);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen3_get_rectangles);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-		assert(sna->render.vertex_used <= sna->render.vertex_size);
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
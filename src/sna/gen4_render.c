@@ -1138,13 +1138,9 @@ gen4_bind_surfaces(struct sna *sna,
 				     false);
 	}
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen4.surface_table) == *(uint64_t*)binding_table &&
-	    (op->mask.bo == NULL ||
-	     sna->kgem.batch[sna->render_state.gen4.surface_table+2] == binding_table[2])) {
-		sna->kgem.surface += sizeof(struct gen4_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen4.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen4.binding_cache,
+					  offset, sizeof(struct gen4_surface_state_padded) / sizeof(uint32_t));
 
 	if (!ALWAYS_FLUSH && sna->kgem.batch[sna->render_state.gen4.surface_table] == binding_table[0])
 		dirty = 0;
@@ -1251,6 +1247,13 @@ gen4_render_composite_boxes(struct sna *sna,
 	} while (nbox);
 }
 
+static int gen4_get_rectangles__thread(struct sna *sna,
+				       const struct sna_composite_op *op,
+				       int want)
+{
+	return gen4_get_rectangles(sna, op, want, gen4_bind_surfaces);
+}
+
 #if !FORCE_FLUSH
 static void
 gen4_render_composite_boxes__thread(struct sna *sna,
@@ -1259,29 +1262,21 @@ gen4_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen4_get_rectangles(sna, op, nbox,
-						     gen4_bind_surfaces);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen4_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 #endif
 
@@ -2132,29 +2127,22 @@ gen4_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.dst.x, op->base.dst.y));
 	assert(nbox);
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen4_get_rectangles(sna, &op->base, nbox,
-						     gen4_bind_surfaces);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		/* FORCE_FLUSH limits each primitive to MAX_FLUSH_VERTICES */
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       3, !FORCE_FLUSH,
+					       &nbox_this_time, gen4_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -2330,11 +2318,9 @@ gen4_copy_bind_surfaces(struct sna *sna, const struct sna_composite_op *op)
 			     op->src.card_format,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen4.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += sizeof(struct gen4_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen4.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen4.binding_cache,
+					  offset, sizeof(struct gen4_surface_state_padded) / sizeof(uint32_t));
 
 	if (!ALWAYS_FLUSH && sna->kgem.batch[sna->render_state.gen4.surface_table] == binding_table[0])
 		dirty = 0;
@@ -2969,6 +2955,7 @@ static void gen4_render_reset(struct sna *sna)
 	sna->render_state.gen4.drawrect_offset = -1;
 	sna->render_state.gen4.drawrect_limit = -1;
 	sna->render_state.gen4.surface_table = 0;
+	sna_binding_cache_reset(&sna->render_state.gen4.binding_cache);
 
 	if (sna->render.vbo && !kgem_bo_can_map(&sna->kgem, sna->render.vbo)) {
 		DBG(("%s: discarding unmappable vbo\n", __FUNCTION__));
@@ -43,7 +43,9 @@ void gen4_vertex_align(struct sna *sna, const struct sna_composite_op *op)
 	int vertex_index;
 
 	assert(op->floats_per_vertex);
-	assert(op->floats_per_rect == 3*op->floats_per_vertex);
+	/* Instanced ops (gen7+) emit a single record per rectangle */
+	assert(op->floats_per_rect == 3*op->floats_per_vertex ||
+	       op->floats_per_rect == op->floats_per_vertex);
 	assert(sna->render.vertex_used <= sna->render.vertex_size);
 
 	vertex_index = (sna->render.vertex_used + op->floats_per_vertex - 1) / op->floats_per_vertex;
@@ -66,6 +68,9 @@ void gen4_vertex_align(struct sna *sna, const struct sna_composite_op *op)
 
 void gen4_vertex_flush(struct sna *sna)
 {
+	/* Close the primitive to other threads before reading the count */
+	sna_vertex_wait__locked(&sna->render);
+
 	DBG(("%s[%x] = %d\n", __FUNCTION__,
 	     4*sna->render.vertex_offset,
 	     sna->render.vertex_index - sna->render.vertex_start));
@@ -350,36 +355,10 @@ emit_texcoord(struct sna *sna,
 	}
 }
 
-sse2 force_inline static void
-emit_vertex(struct sna *sna,
-	    const struct sna_composite_op *op,
-	    int16_t srcX, int16_t srcY,
-	    int16_t mskX, int16_t mskY,
-	    int16_t dstX, int16_t dstY)
-{
-	OUT_VERTEX(dstX, dstY);
-	emit_texcoord(sna, &op->src, srcX, srcY);
-}
-
-sse2 fastcall static void
-emit_primitive(struct sna *sna,
-	       const struct sna_composite_op *op,
-	       const struct sna_composite_rectangles *r)
-{
-	emit_vertex(sna, op,
-		    r->src.x + r->width,  r->src.y + r->height,
-		    r->mask.x + r->width, r->mask.y + r->height,
-		    r->dst.x + r->width, r->dst.y + r->height);
-	emit_vertex(sna, op,
-		    r->src.x,  r->src.y + r->height,
-		    r->mask.x, r->mask.y + r->height,
-		    r->dst.x,  r->dst.y + r->height);
-	emit_vertex(sna, op,
-		    r->src.x,  r->src.y,
-		    r->mask.x, r->mask.y,
-		    r->dst.x,  r->dst.y);
-}
-
+/* Only the span emitters, which see any type of source, still need to
+ * pick the channel layout per vertex; the composite emitters are
+ * generated from the typed template below.
+ */
 sse2 inline static float *
 vemit_texcoord(float *v,
 	      const struct sna_composite_channel *channel,
@@ -423,77 +402,6 @@ vemit_vertex(float *v,
 	return vemit_texcoord(v, &op->src, x, y);
 }
 
-sse2 fastcall static void
-emit_boxes(const struct sna_composite_op *op,
-	   const BoxRec *box, int nbox,
-	   float *v)
-{
-	do {
-		v = vemit_vertex(v, op, box->x2, box->y2);
-		v = vemit_vertex(v, op, box->x1, box->y2);
-		v = vemit_vertex(v, op, box->x1, box->y1);
-
-		box++;
-	} while (--nbox);
-}
-
-sse2 force_inline static void
-emit_vertex_mask(struct sna *sna,
-		 const struct sna_composite_op *op,
-		 int16_t srcX, int16_t srcY,
-		 int16_t mskX, int16_t mskY,
-		 int16_t dstX, int16_t dstY)
-{
-	OUT_VERTEX(dstX, dstY);
-	emit_texcoord(sna, &op->src, srcX, srcY);
-	emit_texcoord(sna, &op->mask, mskX, mskY);
-}
-
-sse2 fastcall static void
-emit_primitive_mask(struct sna *sna,
-		    const struct sna_composite_op *op,
-		    const struct sna_composite_rectangles *r)
-{
-	emit_vertex_mask(sna, op,
-			 r->src.x + r->width,  r->src.y + r->height,
-			 r->mask.x + r->width, r->mask.y + r->height,
-			 r->dst.x + r->width, r->dst.y + r->height);
-	emit_vertex_mask(sna, op,
-			 r->src.x,  r->src.y + r->height,
-			 r->mask.x, r->mask.y + r->height,
-			 r->dst.x,  r->dst.y + r->height);
-	emit_vertex_mask(sna, op,
-			 r->src.x,  r->src.y,
-			 r->mask.x, r->mask.y,
-			 r->dst.x,  r->dst.y);
-}
-
-sse2 force_inline static float *
-vemit_vertex_mask(float *v,
-		  const struct sna_composite_op *op,
-		  int16_t x, int16_t y)
-{
-	*v++ = pack_2s(x, y);
-	v = vemit_texcoord(v, &op->src, x, y);
-	v = vemit_texcoord(v, &op->mask, x, y);
-	return v;
-}
-
-sse2 fastcall static void
-emit_boxes_mask(const struct sna_composite_op *op,
-		const BoxRec *box, int nbox,
-		float *v)
-{
-	do {
-		v = vemit_vertex_mask(v, op, box->x2, box->y2);
-		v = vemit_vertex_mask(v, op, box->x1, box->y2);
-		v = vemit_vertex_mask(v, op, box->x1, box->y1);
-
-		box++;
-	} while (--nbox);
-}
-
-
 sse2 fastcall static void
 emit_primitive_solid(struct sna *sna,
 		     const struct sna_composite_op *op,
@@ -980,154 +888,6 @@ emit_boxes_linear_identity_mask(const struct sna_composite_op *op,
 	} while (--nbox);
 }
 
-sse2 fastcall static void
-emit_primitive_identity_source_mask(struct sna *sna,
-				    const struct sna_composite_op *op,
-				    const struct sna_composite_rectangles *r)
-{
-	union {
-		struct sna_coordinate p;
-		float f;
-	} dst;
-	float src_x, src_y;
-	float msk_x, msk_y;
-	float w, h;
-	float *v;
-
-	src_x = r->src.x + op->src.offset[0];
-	src_y = r->src.y + op->src.offset[1];
-	msk_x = r->mask.x + op->mask.offset[0];
-	msk_y = r->mask.y + op->mask.offset[1];
-	w = r->width;
-	h = r->height;
-
-	assert(op->floats_per_rect == 15);
-	assert((sna->render.vertex_used % 5) == 0);
-	v = sna->render.vertices + sna->render.vertex_used;
-	sna->render.vertex_used += 15;
-
-	dst.p.x = r->dst.x + r->width;
-	dst.p.y = r->dst.y + r->height;
-	v[0] = dst.f;
-	v[1] = (src_x + w) * op->src.scale[0];
-	v[2] = (src_y + h) * op->src.scale[1];
-	v[3] = (msk_x + w) * op->mask.scale[0];
-	v[4] = (msk_y + h) * op->mask.scale[1];
-
-	dst.p.x = r->dst.x;
-	v[5] = dst.f;
-	v[6] = src_x * op->src.scale[0];
-	v[7] = v[2];
-	v[8] = msk_x * op->mask.scale[0];
-	v[9] = v[4];
-
-	dst.p.y = r->dst.y;
-	v[10] = dst.f;
-	v[11] = v[6];
-	v[12] = src_y * op->src.scale[1];
-	v[13] = v[8];
-	v[14] = msk_y * op->mask.scale[1];
-}
-
-sse2 fastcall static void
-emit_primitive_simple_source_identity(struct sna *sna,
-				      const struct sna_composite_op *op,
-				      const struct sna_composite_rectangles *r)
-{
-	float *v;
-	union {
-		struct sna_coordinate p;
-		float f;
-	} dst;
-
-	float xx = op->src.transform->matrix[0][0];
-	float x0 = op->src.transform->matrix[0][2];
-	float yy = op->src.transform->matrix[1][1];
-	float y0 = op->src.transform->matrix[1][2];
-	float sx = op->src.scale[0];
-	float sy = op->src.scale[1];
-	int16_t tx = op->src.offset[0];
-	int16_t ty = op->src.offset[1];
-	float msk_x = r->mask.x + op->mask.offset[0];
-	float msk_y = r->mask.y + op->mask.offset[1];
-	float w = r->width, h = r->height;
-
-	assert(op->floats_per_rect == 15);
-	assert((sna->render.vertex_used % 5) == 0);
-	v = sna->render.vertices + sna->render.vertex_used;
-	sna->render.vertex_used += 3*5;
-
-	dst.p.x = r->dst.x + r->width;
-	dst.p.y = r->dst.y + r->height;
-	v[0] = dst.f;
-	v[1] = ((r->src.x + r->width + tx) * xx + x0) * sx;
-	v[2] = ((r->src.y + r->height + ty) * yy + y0) * sy;
-	v[3] = (msk_x + w) * op->mask.scale[0];
-	v[4] = (msk_y + h) * op->mask.scale[1];
-
-	dst.p.x = r->dst.x;
-	v[5] = dst.f;
-	v[6] = ((r->src.x + tx) * xx + x0) * sx;
-	v[7] = v[2];
-	v[8] = msk_x * op->mask.scale[0];
-	v[9] = v[4];
-
-	dst.p.y = r->dst.y;
-	v[10] = dst.f;
-	v[11] = v[6];
-	v[12] = ((r->src.y + ty) * yy + y0) * sy;
-	v[13] = v[8];
-	v[14] = msk_y * op->mask.scale[1];
-}
-
-sse2 fastcall static void
-emit_primitive_affine_source_identity(struct sna *sna,
-				      const struct sna_composite_op *op,
-				      const struct sna_composite_rectangles *r)
-{
-	float *v;
-	union {
-		struct sna_coordinate p;
-		float f;
-	} dst;
-	float msk_x = r->mask.x + op->mask.offset[0];
-	float msk_y = r->mask.y + op->mask.offset[1];
-	float w = r->width, h = r->height;
-
-	assert(op->floats_per_rect == 15);
-	assert((sna->render.vertex_used % 5) == 0);
-	v = sna->render.vertices + sna->render.vertex_used;
-	sna->render.vertex_used += 3*5;
-
-	dst.p.x = r->dst.x + r->width;
-	dst.p.y = r->dst.y + r->height;
-	v[0] = dst.f;
-	_sna_get_transformed_scaled(op->src.offset[0] + r->src.x + r->width,
-				    op->src.offset[1] + r->src.y + r->height,
-				    op->src.transform, op->src.scale,
-				    &v[1], &v[2]);
-	v[3] = (msk_x + w) * op->mask.scale[0];
-	v[4] = (msk_y + h) * op->mask.scale[1];
-
-	dst.p.x = r->dst.x;
-	v[5] = dst.f;
-	_sna_get_transformed_scaled(op->src.offset[0] + r->src.x,
-				    op->src.offset[1] + r->src.y + r->height,
-				    op->src.transform, op->src.scale,
-				    &v[6], &v[7]);
-	v[8] = msk_x * op->mask.scale[0];
-	v[9] = v[4];
-
-	dst.p.y = r->dst.y;
-	v[10] = dst.f;
-	_sna_get_transformed_scaled(op->src.offset[0] + r->src.x,
-				    op->src.offset[1] + r->src.y,
-				    op->src.transform, op->src.scale,
-				    &v[11], &v[12]);
-	v[13] = v[8];
-	v[14] = msk_y * op->mask.scale[1];
-}
-
 /* SSE4_2 */
 #if defined(sse4_2)
 
@@ -1852,6 +1612,386 @@ emit_boxes_linear_identity_mask__avx2(const struct sna_composite_op *op,
 
 #endif
 
+/* The remaining pairings of source and mask channel are handled by a
+ * family of emitters generated from a single template. The channel type is
+ * passed as a constant into the force_inline helpers below, so each
+ * instance is compiled with the per-vertex type checks of emit_texcoord()
+ * folded away, and the family is cloned for each CPU feature level.
+ */
+enum {
+	CHANNEL_NONE,
+	CHANNEL_SOLID,
+	CHANNEL_IDENTITY,
+	CHANNEL_SIMPLE,
+	CHANNEL_AFFINE,
+	CHANNEL_PROJECTIVE,
+	NUM_CHANNEL_TYPES
+};
+
+static const uint8_t channel_floats[NUM_CHANNEL_TYPES] = {
+	[CHANNEL_NONE] = 0,
+	[CHANNEL_SOLID] = 1,
+	[CHANNEL_IDENTITY] = 2,
+	[CHANNEL_SIMPLE] = 2,
+	[CHANNEL_AFFINE] = 2,
+	[CHANNEL_PROJECTIVE] = 3,
+};
+
+force_inline static float *
+vemit_channel(float *v, const int type,
+	      const struct sna_composite_channel *channel,
+	      int16_t x, int16_t y)
+{
+	const PictTransform *m = channel->transform;
+	float s, t, w;
+
+	switch (type) {
+	case CHANNEL_NONE:
+		break;
+
+	case CHANNEL_SOLID:
+		*v++ = 0.5;
+		break;
+
+	case CHANNEL_IDENTITY:
+		*v++ = (x + channel->offset[0]) * channel->scale[0];
+		*v++ = (y + channel->offset[1]) * channel->scale[1];
+		break;
+
+	case CHANNEL_SIMPLE:
+		*v++ = ((x + channel->offset[0]) * (float)m->matrix[0][0] +
+			m->matrix[0][2]) * channel->scale[0];
+		*v++ = ((y + channel->offset[1]) * (float)m->matrix[1][1] +
+			m->matrix[1][2]) * channel->scale[1];
+		break;
+
+	case CHANNEL_AFFINE:
+		_sna_get_transformed_scaled(x + channel->offset[0],
+					    y + channel->offset[1],
+					    m, channel->scale,
+					    &v[0], &v[1]);
+		v += 2;
+		break;
+
+	case CHANNEL_PROJECTIVE:
+		sna_get_transformed_coordinates_3d(x + channel->offset[0],
+						   y + channel->offset[1],
+						   m, &s, &t, &w);
+		*v++ = s * channel->scale[0];
+		*v++ = t * channel->scale[1];
+		*v++ = w;
+		break;
+	}
+
+	return v;
+}
+
+force_inline static float *
+vemit_vertex_typed(float *v,
+		   const struct sna_composite_op *op,
+		   const int src, const int mask,
+		   int16_t dstX, int16_t dstY,
+		   int16_t srcX, int16_t srcY,
+		   int16_t mskX, int16_t mskY)
+{
+	*v++ = pack_2s(dstX, dstY);
+	v = vemit_channel(v, src, &op->src, srcX, srcY);
+	v = vemit_channel(v, mask, &op->mask, mskX, mskY);
+	return v;
+}
+
+force_inline static void
+emit_primitive_typed(struct sna *sna,
+		     const struct sna_composite_op *op,
+		     const struct sna_composite_rectangles *r,
+		     const int src, const int mask)
+{
+	float *v;
+
+	assert(op->floats_per_vertex == 1 + channel_floats[src] + channel_floats[mask]);
+	assert((sna->render.vertex_used % op->floats_per_vertex) == 0);
+	v = sna->render.vertices + sna->render.vertex_used;
+	sna->render.vertex_used += op->floats_per_rect;
+
+	v = vemit_vertex_typed(v, op, src, mask,
+			       r->dst.x + r->width, r->dst.y + r->height,
+			       r->src.x + r->width, r->src.y + r->height,
+			       r->mask.x + r->width, r->mask.y + r->height);
+	v = vemit_vertex_typed(v, op, src, mask,
+			       r->dst.x, r->dst.y + r->height,
+			       r->src.x, r->src.y + r->height,
+			       r->mask.x, r->mask.y + r->height);
+	vemit_vertex_typed(v, op, src, mask,
+			   r->dst.x, r->dst.y,
+			   r->src.x, r->src.y,
+			   r->mask.x, r->mask.y);
+}
+
+force_inline static void
+emit_boxes_typed(const struct sna_composite_op *op,
+		 const BoxRec *box, int nbox,
+		 float *v,
+		 const int src, const int mask)
+{
+	do {
+		v = vemit_vertex_typed(v, op, src, mask,
+				       box->x2, box->y2,
+				       box->x2, box->y2,
+				       box->x2, box->y2);
+		v = vemit_vertex_typed(v, op, src, mask,
+				       box->x1, box->y2,
+				       box->x1, box->y2,
+				       box->x1, box->y2);
+		v = vemit_vertex_typed(v, op, src, mask,
+				       box->x1, box->y1,
+				       box->x1, box->y1,
+				       box->x1, box->y1);
+		box++;
+	} while (--nbox);
+}
+
+struct composite_emitter {
+	fastcall void (*prim_emit)(struct sna *sna,
+				   const struct sna_composite_op *op,
+				   const struct sna_composite_rectangles *r);
+	fastcall void (*emit_boxes)(const struct sna_composite_op *op,
+				    const BoxRec *box, int nbox,
+				    float *v);
+};
+
+/* Pairings with a hand-written emitter above are omitted. A linear
+ * gradient is only reduced to a single coordinate by those, otherwise it
+ * is sampled through its embedded affine transform.
+ */
+#define COMPOSITE_EMITTERS(X, suffix, attr) \
+	X(SOLID, SOLID, suffix, attr) \
+	X(SOLID, SIMPLE, suffix, attr) \
+	X(SOLID, AFFINE, suffix, attr) \
+	X(SOLID, PROJECTIVE, suffix, attr) \
+	X(IDENTITY, SOLID, suffix, attr) \
+	X(IDENTITY, IDENTITY, suffix, attr) \
+	X(IDENTITY, SIMPLE, suffix, attr) \
+	X(IDENTITY, AFFINE, suffix, attr) \
+	X(IDENTITY, PROJECTIVE, suffix, attr) \
+	X(SIMPLE, SOLID, suffix, attr) \
+	X(SIMPLE, IDENTITY, suffix, attr) \
+	X(SIMPLE, SIMPLE, suffix, attr) \
+	X(SIMPLE, AFFINE, suffix, attr) \
+	X(SIMPLE, PROJECTIVE, suffix, attr) \
+	X(AFFINE, SOLID, suffix, attr) \
+	X(AFFINE, IDENTITY, suffix, attr) \
+	X(AFFINE, SIMPLE, suffix, attr) \
+	X(AFFINE, AFFINE, suffix, attr) \
+	X(AFFINE, PROJECTIVE, suffix, attr) \
+	X(PROJECTIVE, NONE, suffix, attr) \
+	X(PROJECTIVE, SOLID, suffix, attr) \
+	X(PROJECTIVE, IDENTITY, suffix, attr) \
+	X(PROJECTIVE, SIMPLE, suffix, attr) \
+	X(PROJECTIVE, AFFINE, suffix, attr) \
+	X(PROJECTIVE, PROJECTIVE, suffix, attr)
+
+#define DEFINE_EMITTER(src, mask, suffix, attr) \
+attr fastcall static void \
+emit_primitive__##src##_##mask##suffix(struct sna *sna, \
+				       const struct sna_composite_op *op, \
+				       const struct sna_composite_rectangles *r) \
+{ \
+	emit_primitive_typed(sna, op, r, CHANNEL_##src, CHANNEL_##mask); \
+} \
+attr fastcall static void \
+emit_boxes__##src##_##mask##suffix(const struct sna_composite_op *op, \
+				   const BoxRec *box, int nbox, \
+				   float *v) \
+{ \
+	emit_boxes_typed(op, box, nbox, v, CHANNEL_##src, CHANNEL_##mask); \
+}
+
+#define EMITTER_ENTRY(src, mask, suffix, attr) \
+	[CHANNEL_##src][CHANNEL_##mask] = { \
+		emit_primitive__##src##_##mask##suffix, \
+		emit_boxes__##src##_##mask##suffix, \
+	},
+
+COMPOSITE_EMITTERS(DEFINE_EMITTER, , sse2)
+static const struct composite_emitter
+composite_emitters[NUM_CHANNEL_TYPES][NUM_CHANNEL_TYPES] = {
+	COMPOSITE_EMITTERS(EMITTER_ENTRY, , sse2)
+};
+
+#if defined(sse4_2)
+COMPOSITE_EMITTERS(DEFINE_EMITTER, __sse4_2, sse4_2)
+static const struct composite_emitter
+composite_emitters__sse4_2[NUM_CHANNEL_TYPES][NUM_CHANNEL_TYPES] = {
+	COMPOSITE_EMITTERS(EMITTER_ENTRY, __sse4_2, sse4_2)
+};
+#endif
+
+#if defined(avx2)
+COMPOSITE_EMITTERS(DEFINE_EMITTER, __avx2, avx2)
+static const struct composite_emitter
+composite_emitters__avx2[NUM_CHANNEL_TYPES][NUM_CHANNEL_TYPES] = {
+	COMPOSITE_EMITTERS(EMITTER_ENTRY, __avx2, avx2)
+};
+#endif
+
+static int
+composite_channel_type(struct sna_composite_channel *channel)
+{
+	if (channel->is_solid)
+		return CHANNEL_SOLID;
+
+	if (channel->transform == NULL)
+		return CHANNEL_IDENTITY;
+
+	if (!channel->is_affine)
+		return CHANNEL_PROJECTIVE;
+
+	channel->scale[0] /= channel->transform->matrix[2][2];
+	channel->scale[1] /= channel->transform->matrix[2][2];
+	if (!sna_affine_transform_is_rotation(channel->transform))
+		return CHANNEL_SIMPLE;
+
+	return CHANNEL_AFFINE;
+}
+
+static unsigned
+choose_typed_emitter(struct sna *sna, struct sna_composite_op *tmp,
+		     int src, int mask)
+{
+	const struct composite_emitter *e;
+
+#if defined(avx2)
+	if (sna->cpu_features & AVX2)
+		e = &composite_emitters__avx2[src][mask];
+	else
+#endif
+#if defined(sse4_2)
+	if (sna->cpu_features & SSE4_2)
+		e = &composite_emitters__sse4_2[src][mask];
+	else
+#endif
+		e = &composite_emitters[src][mask];
+	assert(e->prim_emit && e->emit_boxes);
+
+	tmp->prim_emit = e->prim_emit;
+	tmp->emit_boxes = e->emit_boxes;
+	tmp->floats_per_vertex = 1 + channel_floats[src] + channel_floats[mask];
+
+	DBG(("%s: src=%d, mask=%d, floats-per-vertex=%d\n",
+	     __FUNCTION__, src, mask, tmp->floats_per_vertex));
+	return channel_floats[src] | channel_floats[mask] << 2;
+}
+
+fastcall static void
+emit_primitive_instance_identity_source(struct sna *sna,
+					const struct sna_composite_op *op,
+					const struct sna_composite_rectangles *r)
+{
+	union {
+		struct sna_coordinate p;
+		float f;
+	} dst;
+	float *v;
+
+	assert(op->floats_per_rect == 4);
+	v = sna->render.vertices + sna->render.vertex_used;
+	sna->render.vertex_used += 4;
+
+	dst.p.x = r->dst.x;
+	dst.p.y = r->dst.y;
+	v[0] = dst.f;
+	dst.p.x = r->width;
+	dst.p.y = r->height;
+	v[1] = dst.f;
+
+	v[2] = r->src.x + op->src.offset[0];
+	v[3] = r->src.y + op->src.offset[1];
+}
+
+fastcall static void
+emit_boxes_instance_identity_source(const struct sna_composite_op *op,
+				    const BoxRec *box, int nbox,
+				    float *v)
+{
+	do {
+		union {
+			struct sna_coordinate p;
+			float f;
+		} dst;
+
+		dst.p.x = box->x1;
+		dst.p.y = box->y1;
+		v[0] = dst.f;
+		dst.p.x = box->x2 - box->x1;
+		dst.p.y = box->y2 - box->y1;
+		v[1] = dst.f;
+
+		v[2] = box->x1 + op->src.offset[0];
+		v[3] = box->y1 + op->src.offset[1];
+
+		v += 4;
+		box++;
+	} while (--nbox);
+}
+
+fastcall static void
+emit_primitive_instance_identity_source_mask(struct sna *sna,
+					     const struct sna_composite_op *op,
+					     const struct sna_composite_rectangles *r)
+{
+	union {
+		struct sna_coordinate p;
+		float f;
+	} dst;
+	float *v;
+
+	assert(op->floats_per_rect == 6);
+	v = sna->render.vertices + sna->render.vertex_used;
+	sna->render.vertex_used += 6;
+
+	dst.p.x = r->dst.x;
+	dst.p.y = r->dst.y;
+	v[0] = dst.f;
+	dst.p.x = r->width;
+	dst.p.y = r->height;
+	v[1] = dst.f;
+
+	v[2] = r->src.x + op->src.offset[0];
+	v[3] = r->src.y + op->src.offset[1];
+
+	v[4] = r->mask.x + op->mask.offset[0];
+	v[5] = r->mask.y + op->mask.offset[1];
+}
+
+fastcall static void
+emit_boxes_instance_identity_source_mask(const struct sna_composite_op *op,
+					 const BoxRec *box, int nbox,
+					 float *v)
+{
+	do {
+		union {
+			struct sna_coordinate p;
+			float f;
+		} dst;
+
+		dst.p.x = box->x1;
+		dst.p.y = box->y1;
+		v[0] = dst.f;
+		dst.p.x = box->x2 - box->x1;
+		dst.p.y = box->y2 - box->y1;
+		v[1] = dst.f;
+
+		v[2] = box->x1 + op->src.offset[0];
+		v[3] = box->y1 + op->src.offset[1];
+
+		v[4] = box->x1 + op->mask.offset[0];
+		v[5] = box->y1 + op->mask.offset[1];
+
+		v += 6;
+		box++;
+	} while (--nbox);
+}
+
 unsigned gen4_choose_composite_emitter(struct sna *sna, struct sna_composite_op *tmp)
 {
 	unsigned vb;
@@ -1898,56 +2038,14 @@ unsigned gen4_choose_composite_emitter(struct sna *sna, struct sna_composite_op
 				}
 				tmp->floats_per_vertex = 4;
 				vb = 1 | 2 << 2;
-			} else if (tmp->src.transform == NULL) {
-				DBG(("%s: identity source, identity mask\n", __FUNCTION__));
-				tmp->prim_emit = emit_primitive_identity_source_mask;
-				tmp->floats_per_vertex = 5;
-				vb = 2 << 2 | 2;
-			} else if (tmp->src.is_affine) {
-				tmp->src.scale[0] /= tmp->src.transform->matrix[2][2];
-				tmp->src.scale[1] /= tmp->src.transform->matrix[2][2];
-				if (!sna_affine_transform_is_rotation(tmp->src.transform)) {
-					DBG(("%s: simple src, identity mask\n", __FUNCTION__));
-					tmp->prim_emit = emit_primitive_simple_source_identity;
-				} else {
-					DBG(("%s: affine src, identity mask\n", __FUNCTION__));
-					tmp->prim_emit = emit_primitive_affine_source_identity;
-				}
-				tmp->floats_per_vertex = 5;
-				vb = 2 << 2 | 2;
-			} else {
-				DBG(("%s: projective source, identity mask\n", __FUNCTION__));
-				tmp->prim_emit = emit_primitive_mask;
-				tmp->floats_per_vertex = 6;
-				vb = 2 << 2 | 3;
-			}
+			} else
+				vb = choose_typed_emitter(sna, tmp,
+							  composite_channel_type(&tmp->src),
+							  CHANNEL_IDENTITY);
 		} else {
-			tmp->prim_emit = emit_primitive_mask;
-			tmp->emit_boxes = emit_boxes_mask;
-			tmp->floats_per_vertex = 1;
-			vb = 0;
-			if (tmp->mask.is_solid) {
-				tmp->floats_per_vertex += 1;
-				vb |= 1 << 2;
-			} else if (tmp->mask.is_affine) {
-				tmp->floats_per_vertex += 2;
-				vb |= 2 << 2;
-			}else {
-				tmp->floats_per_vertex += 3;
-				vb |= 3 << 2;
-			}
-			if (tmp->src.is_solid) {
-				tmp->floats_per_vertex += 1;
-				vb |= 1;
-			} else if (tmp->src.is_affine) {
-				tmp->floats_per_vertex += 2;
-				vb |= 2 ;
-			}else {
-				tmp->floats_per_vertex += 3;
-				vb |= 3;
-			}
-			DBG(("%s: general mask: floats-per-vertex=%d, vb=%x\n",
-			     __FUNCTION__,tmp->floats_per_vertex, vb));
+			vb = choose_typed_emitter(sna, tmp,
+						  composite_channel_type(&tmp->src),
+						  composite_channel_type(&tmp->mask));
 		}
 	} else {
 		if (tmp->src.is_solid) {
@@ -2029,10 +2127,9 @@ unsigned gen4_choose_composite_emitter(struct sna *sna, struct sna_composite_op
 		} else {
 			DBG(("%s: projective src, no mask\n", __FUNCTION__));
 			assert(!tmp->src.is_solid);
-			tmp->prim_emit = emit_primitive;
-			tmp->emit_boxes = emit_boxes;
-			tmp->floats_per_vertex = 4;
-			vb = 3;
+			vb = choose_typed_emitter(sna, tmp,
+						  CHANNEL_PROJECTIVE,
+						  CHANNEL_NONE);
 		}
 	}
 	tmp->floats_per_rect = 3 * tmp->floats_per_vertex;
@@ -2040,6 +2137,42 @@ unsigned gen4_choose_composite_emitter(struct sna *sna, struct sna_composite_op
 	return vb;
 }
 
+/* Replace the three vertices per rectangle chosen by
+ * gen4_choose_composite_emitter() with a single instance record (gen7+),
+ * 16 bytes instead of 36 (24 instead of 60 with a mask), which the VS
+ * then expands. Only untransformed channels can be described by their
+ * origin alone.
+ */
+bool gen4_choose_instance_emitter(struct sna_composite_op *tmp)
+{
+	bool has_mask = tmp->mask.bo != NULL;
+
+	if (tmp->need_magic_ca_pass)
+		return false;
+
+	if (tmp->src.is_solid || tmp->src.is_linear || tmp->src.transform)
+		return false;
+
+	if (has_mask &&
+	    (tmp->mask.is_solid || tmp->mask.is_linear || tmp->mask.transform))
+		return false;
+
+	DBG(("%s: instancing identity source%s\n",
+	     __FUNCTION__, has_mask ? ", identity mask" : ""));
+
+	if (has_mask) {
+		tmp->prim_emit = emit_primitive_instance_identity_source_mask;
+		tmp->emit_boxes = emit_boxes_instance_identity_source_mask;
+		tmp->floats_per_vertex = 6;
+	} else {
+		tmp->prim_emit = emit_primitive_instance_identity_source;
+		tmp->emit_boxes = emit_boxes_instance_identity_source;
+		tmp->floats_per_vertex = 4;
+	}
+	tmp->floats_per_rect = tmp->floats_per_vertex;
+	return true;
+}
+
 sse2 force_inline static void
 emit_span_vertex(struct sna *sna,
 		  const struct sna_composite_spans_op *op,
@@ -12,6 +12,7 @@ int gen4_vertex_finish(struct sna *sna);
 void gen4_vertex_close(struct sna *sna);
 
 unsigned gen4_choose_composite_emitter(struct sna *sna, struct sna_composite_op *tmp);
+bool gen4_choose_instance_emitter(struct sna_composite_op *tmp);
 unsigned gen4_choose_spans_emitter(struct sna *sna, struct sna_composite_spans_op *tmp);
 
 #endif /* GEN4_VERTEX_H */
@@ -1096,13 +1096,9 @@ static void gen5_bind_surfaces(struct sna *sna,
 				     false);
 	}
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen5.surface_table) == *(uint64_t*)binding_table &&
-	    (op->mask.bo == NULL ||
-	     sna->kgem.batch[sna->render_state.gen5.surface_table+2] == binding_table[2])) {
-		sna->kgem.surface += sizeof(struct gen5_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen5.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen5.binding_cache,
+					  offset, sizeof(struct gen5_surface_state_padded) / sizeof(uint32_t));
 
 	gen5_emit_state(sna, op, offset | dirty);
 }
@@ -1206,6 +1202,13 @@ gen5_render_composite_boxes(struct sna *sna,
 	} while (nbox);
 }
 
+static int gen5_get_rectangles__thread(struct sna *sna,
+				       const struct sna_composite_op *op,
+				       int want)
+{
+	return gen5_get_rectangles(sna, op, want, gen5_bind_surfaces);
+}
+
 static void
 gen5_render_composite_boxes__thread(struct sna *sna,
 				    const struct sna_composite_op *op,
@@ -1213,29 +1216,21 @@ gen5_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen5_get_rectangles(sna, op, nbox,
-						     gen5_bind_surfaces);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen5_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 #ifndef MAX
@@ -2082,29 +2077,21 @@ gen5_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen5_get_rectangles(sna, &op->base, nbox,
-						     gen5_bind_surfaces);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen5_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -2272,11 +2259,9 @@ gen5_copy_bind_surfaces(struct sna *sna,
 			     op->src.card_format,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen5.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += sizeof(struct gen5_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen5.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen5.binding_cache,
+					  offset, sizeof(struct gen5_surface_state_padded) / sizeof(uint32_t));
 
 	gen5_emit_state(sna, op, offset | dirty);
 }
@@ -2622,12 +2607,9 @@ gen5_fill_bind_surfaces(struct sna *sna,
 			     GEN5_SURFACEFORMAT_B8G8R8A8_UNORM,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen5.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface +=
-			sizeof(struct gen5_surface_state_padded)/sizeof(uint32_t);
-		offset = sna->render_state.gen5.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen5.binding_cache,
+					  offset, sizeof(struct gen5_surface_state_padded) / sizeof(uint32_t));
 
 	gen5_emit_state(sna, op, offset | dirty);
 }
@@ -3076,6 +3058,7 @@ static void gen5_render_reset(struct sna *sna)
 	sna->render_state.gen5.drawrect_offset = -1;
 	sna->render_state.gen5.drawrect_limit = -1;
 	sna->render_state.gen5.surface_table = -1;
+	sna_binding_cache_reset(&sna->render_state.gen5.binding_cache);
 
 	if (sna->render.vbo && !kgem_bo_can_map(&sna->kgem, sna->render.vbo)) {
 		DBG(("%s: discarding unmappable vbo\n", __FUNCTION__));
@@ -1339,13 +1339,9 @@ static void gen6_emit_composite_state(struct sna *sna,
 				     false);
 	}
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen6.surface_table) == *(uint64_t*)binding_table &&
-	    (op->mask.bo == NULL ||
-	     sna->kgem.batch[sna->render_state.gen6.surface_table+2] == binding_table[2])) {
-		sna->kgem.surface += sizeof(struct gen6_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen6.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen6.binding_cache,
+					  offset, sizeof(struct gen6_surface_state_padded) / sizeof(uint32_t));
 
 	gen6_emit_state(sna, op, offset | dirty);
 }
@@ -1452,6 +1448,13 @@ gen6_render_composite_boxes(struct sna *sna,
 	} while (nbox);
 }
 
+static int gen6_get_rectangles__thread(struct sna *sna,
+				       const struct sna_composite_op *op,
+				       int want)
+{
+	return gen6_get_rectangles(sna, op, want, gen6_emit_composite_state);
+}
+
 static void
 gen6_render_composite_boxes__thread(struct sna *sna,
 				    const struct sna_composite_op *op,
@@ -1459,29 +1462,21 @@ gen6_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen6_get_rectangles(sna, op, nbox,
-						     gen6_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen6_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 #ifndef MAX
@@ -2473,29 +2468,21 @@ gen6_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen6_get_rectangles(sna, &op->base, nbox,
-						     gen6_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen6_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -2667,11 +2654,9 @@ gen6_emit_copy_state(struct sna *sna,
 			     op->src.card_format,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen6.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += sizeof(struct gen6_surface_state_padded) / sizeof(uint32_t);
-		offset = sna->render_state.gen6.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen6.binding_cache,
+					  offset, sizeof(struct gen6_surface_state_padded) / sizeof(uint32_t));
 
 	gen6_emit_state(sna, op, offset | dirty);
 }
@@ -3084,12 +3069,9 @@ gen6_emit_fill_state(struct sna *sna, const struct sna_composite_op *op)
 			     GEN6_SURFACEFORMAT_B8G8R8A8_UNORM,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen6.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface +=
-			sizeof(struct gen6_surface_state_padded)/sizeof(uint32_t);
-		offset = sna->render_state.gen6.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen6.binding_cache,
+					  offset, sizeof(struct gen6_surface_state_padded) / sizeof(uint32_t));
 
 	gen6_emit_state(sna, op, offset | dirty);
 }
@@ -3586,6 +3568,7 @@ static void gen6_render_reset(struct sna *sna)
 	sna->render_state.gen6.drawrect_offset = -1;
 	sna->render_state.gen6.drawrect_limit = -1;
 	sna->render_state.gen6.surface_table = -1;
+	sna_binding_cache_reset(&sna->render_state.gen6.binding_cache);
 
 	if (sna->render.vbo && !kgem_bo_can_map(&sna->kgem, sna->render.vbo)) {
 		DBG(("%s: discarding unmappable vbo\n", __FUNCTION__));
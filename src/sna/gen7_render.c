@@ -47,6 +47,8 @@
 #include "gen4_vertex.h"
 #include "gen6_common.h"
 
+#include <math.h>
+
 #define ALWAYS_INVALIDATE 0
 #define ALWAYS_FLUSH 0
 #define ALWAYS_STALL 0
@@ -59,6 +61,10 @@
 #define NO_FILL_BOXES 0
 #define NO_FILL_ONE 0
 #define NO_FILL_CLEAR 0
+#define NO_CONVOLVE 0
+#define NO_GRADIENT 0
+#define NO_INSTANCING 0
+#define NO_CONTEXT_STATE 0
 
 #define USE_8_PIXEL_DISPATCH 1
 #define USE_16_PIXEL_DISPATCH 1
@@ -300,7 +306,19 @@ static const struct blendinfo {
 #define GEN7_BLEND(f) (((f) >> 0) & 0x7ff0)
 #define GEN7_READS_DST(f) (((f) >> 15) & 1)
 #define GEN7_KERNEL(f) (((f) >> 16) & 0xf)
+#define GEN7_WM_KERNEL_SHADER 0xf /* generated, see op->u.gen7.shader */
+
+enum {
+	GEN7_SHADER_CONVOLVE = 1,
+	GEN7_SHADER_RADIAL,
+	GEN7_SHADER_CONICAL,
+};
+
+#define GEN7_MAX_CONVOLVE_TAPS 32
 #define GEN7_VERTEX(f) (((f) >> 0) & 0xf)
+#define GEN7_VB_INSTANCE 16 /* + has_mask */
+#define GEN7_VB_CORNER 18
+#define GEN7_VB_CONSTANTS 19
 #define GEN7_SET_FLAGS(S, B, K, V)  (((S) | (K)) << 16 | ((B) | (V)))
 
 #define OUT_BATCH(v) batch_emit(sna, v)
@@ -775,6 +793,16 @@ gen7_emit_null_depth_buffer(struct sna *sna)
 static void
 gen7_emit_invariant(struct sna *sna)
 {
+	/* The surface state lives inside each batch, so its base address
+	 * has to be reprogrammed every time. The rest of the invariant
+	 * state is retained by the logical context.
+	 */
+	if (!sna->render_state.gen7.needs_context) {
+		gen7_emit_state_base_address(sna);
+		sna->render_state.gen7.needs_invariant = false;
+		return;
+	}
+
 	OUT_BATCH(GEN7_PIPELINE_SELECT | PIPELINE_SELECT_3D);
 
 	OUT_BATCH(GEN7_3DSTATE_MULTISAMPLE | (4 - 2));
@@ -802,6 +830,7 @@ gen7_emit_invariant(struct sna *sna)
 	gen7_disable_streamout(sna);
 	gen7_emit_null_depth_buffer(sna);
 
+	sna->render_state.gen7.needs_context = false;
 	sna->render_state.gen7.needs_invariant = false;
 }
 
@@ -872,11 +901,32 @@ gen7_emit_sf(struct sna *sna, bool has_mask)
 	OUT_BATCH(0);
 }
 
+static void
+__gen7_emit_wm(struct sna *sna, const uint32_t *kernels, int num_surfaces)
+{
+	OUT_BATCH(GEN7_3DSTATE_PS | (8 - 2));
+	OUT_BATCH(kernels[0] ?: kernels[1] ?: kernels[2]);
+	OUT_BATCH(1 << GEN7_PS_SAMPLER_COUNT_SHIFT |
+		  num_surfaces << GEN7_PS_BINDING_TABLE_ENTRY_COUNT_SHIFT);
+	OUT_BATCH(0); /* scratch address */
+	OUT_BATCH(sna->render_state.gen7.info->max_wm_threads |
+		  (kernels[0] ? GEN7_PS_8_DISPATCH_ENABLE : 0) |
+		  (kernels[1] ? GEN7_PS_16_DISPATCH_ENABLE : 0) |
+		  (kernels[2] ? GEN7_PS_32_DISPATCH_ENABLE : 0) |
+		  GEN7_PS_ATTRIBUTE_ENABLE);
+	OUT_BATCH((kernels[0] ? 4 : kernels[1] ? 6 : 8) << GEN7_PS_DISPATCH_START_GRF_SHIFT_0 |
+		  8 << GEN7_PS_DISPATCH_START_GRF_SHIFT_1 |
+		  6 << GEN7_PS_DISPATCH_START_GRF_SHIFT_2);
+	OUT_BATCH(kernels[2]);
+	OUT_BATCH(kernels[1]);
+}
+
 static void
 gen7_emit_wm(struct sna *sna, int kernel)
 {
 	const uint32_t *kernels;
 
+	assert(kernel < GEN7_WM_KERNEL_COUNT);
 	if (sna->render_state.gen7.kernel == kernel)
 		return;
 
@@ -889,21 +939,189 @@ gen7_emit_wm(struct sna *sna, int kernel)
 	     wm_kernels[kernel].num_surfaces,
 	     kernels[0], kernels[1], kernels[2]));
 
-	OUT_BATCH(GEN7_3DSTATE_PS | (8 - 2));
-	OUT_BATCH(kernels[0] ?: kernels[1] ?: kernels[2]);
-	OUT_BATCH(1 << GEN7_PS_SAMPLER_COUNT_SHIFT |
-		  wm_kernels[kernel].num_surfaces << GEN7_PS_BINDING_TABLE_ENTRY_COUNT_SHIFT);
-	OUT_BATCH(0); /* scratch address */
-	OUT_BATCH(sna->render_state.gen7.info->max_wm_threads |
-		  (kernels[0] ? GEN7_PS_8_DISPATCH_ENABLE : 0) |
-		  (kernels[1] ? GEN7_PS_16_DISPATCH_ENABLE : 0) |
-		  (kernels[2] ? GEN7_PS_32_DISPATCH_ENABLE : 0) |
-		  GEN7_PS_ATTRIBUTE_ENABLE);
-	OUT_BATCH((kernels[0] ? 4 : kernels[1] ? 6 : 8) << GEN7_PS_DISPATCH_START_GRF_SHIFT_0 |
-		  8 << GEN7_PS_DISPATCH_START_GRF_SHIFT_1 |
-		  6 << GEN7_PS_DISPATCH_START_GRF_SHIFT_2);
-	OUT_BATCH(kernels[2]);
-	OUT_BATCH(kernels[1]);
+	__gen7_emit_wm(sna, kernels, wm_kernels[kernel].num_surfaces);
+}
+
+static void
+gen7_emit_wm__shader(struct sna *sna, const struct sna_shader *shader)
+{
+	/* Each compilation gets a fresh serial, so a recycled slot can
+	 * never be mistaken for the kernel already bound.
+	 */
+	uint32_t kernel = GEN7_WM_KERNEL_COUNT + shader->serial;
+
+	if (sna->render_state.gen7.kernel == kernel)
+		return;
+
+	sna->render_state.gen7.kernel = kernel;
+
+	DBG(("%s: switching to generated shader %d, num_surfaces=%d (8-wide? %d, 16-wide? %d, 32-wide? %d)\n",
+	     __FUNCTION__, shader->serial, shader->num_surfaces,
+	     shader->kernel[0], shader->kernel[1], shader->kernel[2]));
+
+	__gen7_emit_wm(sna, shader->kernel, shader->num_surfaces);
+}
+
+static void
+gen7_emit_op_wm(struct sna *sna, const struct sna_composite_op *op)
+{
+	if (GEN7_KERNEL(op->u.gen7.flags) == GEN7_WM_KERNEL_SHADER)
+		gen7_emit_wm__shader(sna, op->u.gen7.shader);
+	else
+		gen7_emit_wm(sna, GEN7_KERNEL(op->u.gen7.flags));
+}
+
+/* Assume nothing about the state held by the hardware context */
+static void gen7_forget_state(struct sna *sna)
+{
+	sna->render_state.gen7.needs_context = true;
+	sna->render_state.gen7.ve_id = -1;
+	sna->render_state.gen7.vs = -1;
+
+	sna->render_state.gen7.num_sf_outputs = 0;
+	sna->render_state.gen7.samplers = -1;
+	sna->render_state.gen7.blend = -1;
+	sna->render_state.gen7.kernel = -1;
+	sna->render_state.gen7.drawrect_offset = -1;
+	sna->render_state.gen7.drawrect_limit = -1;
+}
+
+/* Look up (or assemble) a kernel for the parameters described by key,
+ * which must uniquely identify whatever compile() bakes into the kernel.
+ */
+static const struct sna_shader *
+gen7_get_shader(struct sna *sna,
+		const void *key, int len,
+		int num_surfaces,
+		sna_shader_compile_func compile)
+{
+	struct gen7_render_state *render = &sna->render_state.gen7;
+	const struct sna_shader *shader;
+
+	shader = sna_shader_cache_get(sna, &render->shaders,
+				      key, len, num_surfaces,
+				      USE_8_PIXEL_DISPATCH << 0 |
+				      USE_16_PIXEL_DISPATCH << 1 |
+				      USE_32_PIXEL_DISPATCH << 2,
+				      compile);
+
+	/* A full arena is compacted into a fresh copy of the general
+	 * state. The current batch keeps running from the old one, so
+	 * start the next batch before using the new kernels.
+	 */
+	if (render->shaders.map && render->shaders.bo != render->general_bo) {
+		DBG(("%s: switching to the compacted arena, handle=%d\n",
+		     __FUNCTION__, render->shaders.bo->handle));
+		if (sna->kgem.nbatch)
+			kgem_submit(&sna->kgem);
+
+		kgem_bo_destroy(&sna->kgem, render->general_bo);
+		render->general_bo = kgem_bo_reference(render->shaders.bo);
+		gen7_forget_state(sna);
+	}
+
+	return shader;
+}
+
+/* Replace the precompiled kernel chosen from the flags */
+inline static void
+gen7_composite_set_shader(struct sna_composite_op *op,
+			  const struct sna_shader *shader)
+{
+	op->u.gen7.shader = shader;
+	op->u.gen7.flags &= ~(0xf << 16);
+	op->u.gen7.flags |= GEN7_WM_KERNEL_SHADER << 16;
+}
+
+/* Instanced rectangles emit a single record per rectangle (rather than
+ * three vertices) and leave their expansion to the VS.
+ */
+inline static bool
+gen7_is_instanced(const struct sna_composite_op *op)
+{
+	return op->floats_per_rect == op->floats_per_vertex;
+}
+
+static void
+gen7_emit_vs(struct sna *sna, const struct sna_composite_op *op)
+{
+	struct gen7_render_state *render = &sna->render_state.gen7;
+	int vs = 0;
+
+	if (gen7_is_instanced(op))
+		vs = 1 + (op->mask.bo != NULL);
+
+	if (render->vs == vs)
+		return;
+
+	DBG(("%s: %s VS\n", __FUNCTION__,
+	     vs == 0 ? "disabling" : vs == 1 ? "rectangle" : "rectangle+mask"));
+
+	/* A PIPE_CONTROL with post-sync op set to 1 and a depth stall needs
+	 * to be emitted just prior to changing the VS state.
+	 */
+	if (is_ivb(sna)) {
+		OUT_BATCH(GEN7_PIPE_CONTROL | (4 - 2));
+		OUT_BATCH(GEN7_PIPE_CONTROL_DEPTH_STALL |
+			  GEN7_PIPE_CONTROL_WRITE_QWORD);
+		OUT_BATCH(kgem_add_reloc(&sna->kgem, sna->kgem.nbatch,
+					 render->general_bo,
+					 I915_GEM_DOMAIN_INSTRUCTION << 16 |
+					 I915_GEM_DOMAIN_INSTRUCTION,
+					 render->vs_scratch));
+		OUT_BATCH(0);
+	}
+
+	if (vs == 0) {
+		gen7_disable_vs(sna);
+	} else {
+		OUT_BATCH(GEN7_3DSTATE_VS | (6 - 2));
+		OUT_BATCH(render->vs_kernel[vs - 1]);
+		OUT_BATCH(0); /* no samplers or surfaces */
+		OUT_BATCH(0); /* scratch address */
+		/* corner, box, source, scale [, mask] */
+		OUT_BATCH(1 << GEN7_VS_DISPATCH_START_GRF_SHIFT |
+			  (4 + vs) / 2 << GEN7_VS_URB_READ_LENGTH_SHIFT |
+			  0 << GEN7_VS_URB_ENTRY_READ_OFFSET_SHIFT);
+		OUT_BATCH((render->info->max_vs_threads - 1) <<
+			  (is_hsw(sna) ? HSW_VS_MAX_THREADS_SHIFT : IVB_VS_MAX_THREADS_SHIFT) |
+			  GEN7_VS_ENABLE);
+	}
+
+	render->vs = vs;
+}
+
+/* The texture scale factors are constant for the operation, so rather
+ * than repeat them in every record they are fetched from a zero-pitch
+ * buffer alongside the surface state.
+ */
+static void
+gen7_emit_instance_constants(struct sna *sna,
+			     const struct sna_composite_op *op)
+{
+	float *c;
+
+	sna->kgem.surface -=
+		sizeof(struct gen7_surface_state) / sizeof(uint32_t);
+	c = (float *)(sna->kgem.batch + sna->kgem.surface);
+	c[0] = op->src.scale[0];
+	c[1] = op->src.scale[1];
+	c[2] = op->mask.scale[0];
+	c[3] = op->mask.scale[1];
+
+	OUT_BATCH(GEN7_3DSTATE_VERTEX_BUFFERS | (5 - 2));
+	OUT_BATCH(GEN7_VB_CONSTANTS << GEN7_VB0_BUFFER_INDEX_SHIFT |
+		  GEN7_VB0_VERTEXDATA |
+		  GEN7_VB0_ADDRESS_MODIFY_ENABLE |
+		  0 << GEN7_VB0_BUFFER_PITCH_SHIFT);
+	/* an instruction read domain so the offset follows the surface
+	 * state should the batch be shrunk
+	 */
+	OUT_BATCH(kgem_add_reloc(&sna->kgem, sna->kgem.nbatch, NULL,
+				 I915_GEM_DOMAIN_INSTRUCTION << 16,
+				 sna->kgem.surface * sizeof(uint32_t)));
+	OUT_BATCH(~0); /* max address: disabled */
+	OUT_BATCH(0);
 }
 
 static bool
@@ -945,6 +1163,74 @@ gen7_emit_drawing_rectangle(struct sna *sna,
 	return false;
 }
 
+static void
+gen7_emit_instance_elements(struct sna *sna,
+			    const struct sna_composite_op *op)
+{
+	/*
+	 * per-vertex corner: (cx, cy)
+	 * per-instance record
+	 *    destination: (x, y, w, h) as int16
+	 *    source origin: (sx, sy)
+	 *    mask origin if (has_mask is true): (mx, my)
+	 * per-operation constants: (src_x, src_y, mask_x, mask_y) scale
+	 */
+	struct gen7_render_state *render = &sna->render_state.gen7;
+	bool has_mask = op->mask.bo != NULL;
+	int id = GEN7_VB_INSTANCE + has_mask;
+
+	DBG(("%s: setup id=%d\n", __FUNCTION__, id));
+
+	if (render->ve_id == id)
+		return;
+	render->ve_id = id;
+
+	OUT_BATCH(GEN7_3DSTATE_VERTEX_ELEMENTS |
+		((2 * (4 + has_mask)) + 1 - 2));
+
+	OUT_BATCH(GEN7_VB_CORNER << GEN7_VE0_VERTEX_BUFFER_INDEX_SHIFT | GEN7_VE0_VALID |
+		  GEN7_SURFACEFORMAT_R32G32_FLOAT << GEN7_VE0_FORMAT_SHIFT |
+		  0 << GEN7_VE0_OFFSET_SHIFT);
+	OUT_BATCH(GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_0_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_1_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_0 << GEN7_VE1_VFCOMPONENT_2_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_1_FLT << GEN7_VE1_VFCOMPONENT_3_SHIFT);
+
+	OUT_BATCH(id << GEN7_VE0_VERTEX_BUFFER_INDEX_SHIFT | GEN7_VE0_VALID |
+		  GEN7_SURFACEFORMAT_R16G16B16A16_SSCALED << GEN7_VE0_FORMAT_SHIFT |
+		  0 << GEN7_VE0_OFFSET_SHIFT);
+	OUT_BATCH(GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_0_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_1_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_2_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_3_SHIFT);
+
+	OUT_BATCH(id << GEN7_VE0_VERTEX_BUFFER_INDEX_SHIFT | GEN7_VE0_VALID |
+		  GEN7_SURFACEFORMAT_R32G32_FLOAT << GEN7_VE0_FORMAT_SHIFT |
+		  8 << GEN7_VE0_OFFSET_SHIFT);
+	OUT_BATCH(GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_0_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_1_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_0 << GEN7_VE1_VFCOMPONENT_2_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_1_FLT << GEN7_VE1_VFCOMPONENT_3_SHIFT);
+
+	OUT_BATCH(GEN7_VB_CONSTANTS << GEN7_VE0_VERTEX_BUFFER_INDEX_SHIFT | GEN7_VE0_VALID |
+		  GEN7_SURFACEFORMAT_R32G32B32A32_FLOAT << GEN7_VE0_FORMAT_SHIFT |
+		  0 << GEN7_VE0_OFFSET_SHIFT);
+	OUT_BATCH(GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_0_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_1_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_2_SHIFT |
+		  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_3_SHIFT);
+
+	if (has_mask) {
+		OUT_BATCH(id << GEN7_VE0_VERTEX_BUFFER_INDEX_SHIFT | GEN7_VE0_VALID |
+			  GEN7_SURFACEFORMAT_R32G32_FLOAT << GEN7_VE0_FORMAT_SHIFT |
+			  16 << GEN7_VE0_OFFSET_SHIFT);
+		OUT_BATCH(GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_0_SHIFT |
+			  GEN7_VFCOMPONENT_STORE_SRC << GEN7_VE1_VFCOMPONENT_1_SHIFT |
+			  GEN7_VFCOMPONENT_STORE_0 << GEN7_VE1_VFCOMPONENT_2_SHIFT |
+			  GEN7_VFCOMPONENT_STORE_1_FLT << GEN7_VE1_VFCOMPONENT_3_SHIFT);
+	}
+}
+
 static void
 gen7_emit_vertex_elements(struct sna *sna,
 			  const struct sna_composite_op *op)
@@ -960,6 +1246,11 @@ gen7_emit_vertex_elements(struct sna *sna,
 	int id = GEN7_VERTEX(op->u.gen7.flags);
 	bool has_mask;
 
+	if (gen7_is_instanced(op)) {
+		gen7_emit_instance_elements(sna, op);
+		return;
+	}
+
 	DBG(("%s: setup id=%d\n", __FUNCTION__, id));
 
 	if (render->ve_id == id)
@@ -1156,8 +1447,11 @@ gen7_emit_state(struct sna *sna,
 	gen7_emit_cc(sna, GEN7_BLEND(op->u.gen7.flags));
 	gen7_emit_sampler(sna, GEN7_SAMPLER(op->u.gen7.flags));
 	gen7_emit_sf(sna, GEN7_VERTEX(op->u.gen7.flags) >> 2);
-	gen7_emit_wm(sna, GEN7_KERNEL(op->u.gen7.flags));
+	gen7_emit_op_wm(sna, op);
+	gen7_emit_vs(sna, op);
 	gen7_emit_vertex_elements(sna, op);
+	if (gen7_is_instanced(op))
+		gen7_emit_instance_constants(sna, op);
 	gen7_emit_binding_table(sna, wm_binding_table);
 
 	sna->render_state.gen7.emit_flush = GEN7_READS_DST(op->u.gen7.flags);
@@ -1171,6 +1465,7 @@ static bool gen7_magic_ca_pass(struct sna *sna,
 	if (!op->need_magic_ca_pass)
 		return false;
 
+	assert(!gen7_is_instanced(op));
 	DBG(("%s: CA fixup (%d -> %d)\n", __FUNCTION__,
 	     sna->render.vertex_start, sna->render.vertex_index));
 
@@ -1202,6 +1497,14 @@ static void null_create(struct sna_static_stream *stream)
 	sna_static_stream_map(stream, 64, 64);
 }
 
+static uint32_t gen7_create_corners(struct sna_static_stream *stream)
+{
+	/* The RECTLIST vertices in the order emitted by gen4_vertex.c */
+	static const float corners[] = { 1, 1, 0, 1, 0, 0 };
+
+	return sna_static_stream_add(stream, corners, sizeof(corners), 32);
+}
+
 static void
 sampler_state_init(struct gen7_sampler_state *sampler_state,
 		   sampler_filter_t filter,
@@ -1359,6 +1662,56 @@ static void gen7_emit_vertex_buffer(struct sna *sna,
 	sna->render.vb_id |= 1 << id;
 }
 
+static void gen7_emit_instance_buffers(struct sna *sna,
+				       const struct sna_composite_op *op)
+{
+	int id = GEN7_VB_INSTANCE + (op->mask.bo != NULL);
+
+	OUT_BATCH(GEN7_3DSTATE_VERTEX_BUFFERS | (9 - 2));
+	OUT_BATCH(id << GEN7_VB0_BUFFER_INDEX_SHIFT |
+		  GEN7_VB0_INSTANCEDATA |
+		  GEN7_VB0_ADDRESS_MODIFY_ENABLE |
+		  4*op->floats_per_vertex << GEN7_VB0_BUFFER_PITCH_SHIFT);
+	sna->render.vertex_reloc[sna->render.nvertex_reloc++] = sna->kgem.nbatch;
+	OUT_BATCH(0);
+	OUT_BATCH(~0); /* max address: disabled */
+	OUT_BATCH(1); /* step rate: one record per instance */
+
+	OUT_BATCH(GEN7_VB_CORNER << GEN7_VB0_BUFFER_INDEX_SHIFT |
+		  GEN7_VB0_VERTEXDATA |
+		  GEN7_VB0_ADDRESS_MODIFY_ENABLE |
+		  2*sizeof(float) << GEN7_VB0_BUFFER_PITCH_SHIFT);
+	OUT_BATCH(kgem_add_reloc(&sna->kgem, sna->kgem.nbatch,
+				 sna->render_state.gen7.general_bo,
+				 I915_GEM_DOMAIN_VERTEX << 16,
+				 sna->render_state.gen7.vs_corners));
+	OUT_BATCH(~0); /* max address: disabled */
+	OUT_BATCH(0);
+
+	sna->render.vb_id |= 1 << id;
+}
+
+static void gen7_emit_instance_primitive(struct sna *sna)
+{
+	if (sna->kgem.nbatch == sna->render_state.gen7.last_primitive) {
+		sna->render.vertex_offset = sna->kgem.nbatch - 3;
+		return;
+	}
+
+	/* vertex_index counts instance records rather than vertices */
+	OUT_BATCH(GEN7_3DPRIMITIVE | (7- 2));
+	OUT_BATCH(GEN7_3DPRIMITIVE_VERTEX_SEQUENTIAL | _3DPRIM_RECTLIST);
+	OUT_BATCH(3);	/* corners per rectangle */
+	OUT_BATCH(0);	/* start vertex location */
+	sna->render.vertex_offset = sna->kgem.nbatch;
+	OUT_BATCH(0);	/* instance count, to be filled in later */
+	OUT_BATCH(sna->render.vertex_index);
+	OUT_BATCH(0);	/* index buffer offset, ignored */
+	sna->render.vertex_start = sna->render.vertex_index;
+
+	sna->render_state.gen7.last_primitive = sna->kgem.nbatch;
+}
+
 static void gen7_emit_primitive(struct sna *sna)
 {
 	if (sna->kgem.nbatch == sna->render_state.gen7.last_primitive) {
@@ -1379,6 +1732,26 @@ static void gen7_emit_primitive(struct sna *sna)
 	sna->render_state.gen7.last_primitive = sna->kgem.nbatch;
 }
 
+static bool gen7_rectangle_begin__instanced(struct sna *sna,
+					    const struct sna_composite_op *op)
+{
+	int id = 1 << (GEN7_VB_INSTANCE + (op->mask.bo != NULL));
+	int ndwords;
+
+	ndwords = 7;
+	if ((sna->render.vb_id & id) == 0)
+		ndwords += 9;
+	if (!kgem_check_batch(&sna->kgem, ndwords) ||
+	    !kgem_check_reloc(&sna->kgem, 1))
+		return false;
+
+	if ((sna->render.vb_id & id) == 0)
+		gen7_emit_instance_buffers(sna, op);
+
+	gen7_emit_instance_primitive(sna);
+	return true;
+}
+
 static bool gen7_rectangle_begin(struct sna *sna,
 				 const struct sna_composite_op *op)
 {
@@ -1388,6 +1761,9 @@ static bool gen7_rectangle_begin(struct sna *sna,
 	if (sna_vertex_wait__locked(&sna->render) && sna->render.vertex_offset)
 		return true;
 
+	if (gen7_is_instanced(op))
+		return gen7_rectangle_begin__instanced(sna, op);
+
 	ndwords = op->need_magic_ca_pass ? 60 : 6;
 	if ((sna->render.vb_id & id) == 0)
 		ndwords += 5;
@@ -1421,7 +1797,7 @@ static int gen7_get_rectangles__flush(struct sna *sna,
 		if (gen7_magic_ca_pass(sna, op)) {
 			gen7_emit_pipe_stall(sna);
 			gen7_emit_cc(sna, GEN7_BLEND(op->u.gen7.flags));
-			gen7_emit_wm(sna, GEN7_KERNEL(op->u.gen7.flags));
+			gen7_emit_op_wm(sna, op);
 		}
 	}
 
@@ -1460,7 +1836,7 @@ start:
 		want = rem / op->floats_per_rect;
 
 	assert(want > 0);
-	sna->render.vertex_index += 3*want;
+	sna->render.vertex_index += gen7_is_instanced(op) ? want : 3*want;
 	return want;
 
 flush:
@@ -1496,10 +1872,10 @@ gen7_get_batch(struct sna *sna, const struct sna_composite_op *op)
 {
 	kgem_set_mode(&sna->kgem, KGEM_RENDER, op->dst.bo);
 
-	if (!kgem_check_batch_with_surfaces(&sna->kgem, 150, 4)) {
+	if (!kgem_check_batch_with_surfaces(&sna->kgem, 150, 5)) {
 		DBG(("%s: flushing batch: %d < %d+%d\n",
 		     __FUNCTION__, sna->kgem.surface - sna->kgem.nbatch,
-		     150, 4*8));
+		     150, 5*8));
 		_kgem_submit(&sna->kgem);
 		_kgem_set_mode(&sna->kgem, KGEM_RENDER);
 	}
@@ -1507,8 +1883,19 @@ gen7_get_batch(struct sna *sna, const struct sna_composite_op *op)
 	assert(sna->kgem.mode == KGEM_RENDER);
 	assert(sna->kgem.ring == KGEM_RENDER);
 
-	if (sna->render_state.gen7.needs_invariant)
+	if (sna->render_state.gen7.needs_invariant) {
+		/* Everything that only refers to the general state (or to
+		 * nothing at all) survives in the hardware context between
+		 * batches, so only forget it when the kernel cannot vouch
+		 * for the context we are about to run in.
+		 */
+		if (NO_CONTEXT_STATE || kgem_context_lost(&sna->kgem)) {
+			DBG(("%s: context lost, resetting render state\n",
+			     __FUNCTION__));
+			gen7_forget_state(sna);
+		}
 		gen7_emit_invariant(sna);
+	}
 }
 
 static void gen7_emit_composite_state(struct sna *sna,
@@ -1543,13 +1930,9 @@ static void gen7_emit_composite_state(struct sna *sna,
 				     false);
 	}
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen7.surface_table) == *(uint64_t*)binding_table &&
-	    (op->mask.bo == NULL ||
-	     sna->kgem.batch[sna->render_state.gen7.surface_table+2] == binding_table[2])) {
-		sna->kgem.surface += sizeof(struct gen7_surface_state) / sizeof(uint32_t);
-		offset = sna->render_state.gen7.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen7.binding_cache,
+					  offset, sizeof(struct gen7_surface_state) / sizeof(uint32_t));
 
 	if (sna->kgem.batch[sna->render_state.gen7.surface_table] == binding_table[0])
 		dirty = 0;
@@ -1656,6 +2039,13 @@ gen7_render_composite_boxes(struct sna *sna,
 	} while (nbox);
 }
 
+static int gen7_get_rectangles__thread(struct sna *sna,
+				       const struct sna_composite_op *op,
+				       int want)
+{
+	return gen7_get_rectangles(sna, op, want, gen7_emit_composite_state);
+}
+
 static void
 gen7_render_composite_boxes__thread(struct sna *sna,
 				    const struct sna_composite_op *op,
@@ -1663,29 +2053,21 @@ gen7_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen7_get_rectangles(sna, op, nbox,
-						     gen7_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       gen7_is_instanced(op) ? 1 : 3, true,
+					       &nbox_this_time, gen7_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 #ifndef MAX
@@ -2108,6 +2490,529 @@ inline static void gen7_composite_channel_convert(struct sna_composite_channel *
 	assert(channel->card_format != (unsigned)-1);
 }
 
+/* The kernel reads the texel size from its payload, so it depends only
+ * upon the shape and weights of the filter and not upon the source.
+ */
+struct gen7_convolve_key {
+	uint16_t type;
+	uint8_t cw, ch;
+	float weight[GEN7_MAX_CONVOLVE_TAPS];
+};
+
+/* First tap of the kernel relative to the sample, as per pixman */
+static inline int gen7_convolve_origin(int n)
+{
+	return pixman_fixed_to_int(pixman_fixed_1/2 - pixman_fixed_e -
+				   ((pixman_int_to_fixed(n) - pixman_fixed_1) >> 1));
+}
+
+static bool
+gen7_wm_kernel__convolve(struct brw_compile *p, int dispatch, const void *data)
+{
+	const struct gen7_convolve_key *key = data;
+
+	return brw_wm_kernel__affine_convolve(p, dispatch,
+					      key->cw, key->ch,
+					      gen7_convolve_origin(key->cw),
+					      gen7_convolve_origin(key->ch),
+					      key->weight);
+}
+
+static bool
+gen7_check_convolve(struct sna *sna, PicturePtr picture)
+{
+	pixman_fixed_t *params = picture->filter_params;
+	int16_t dx, dy;
+
+	if (NO_CONVOLVE)
+		return false;
+
+	if (sna->render_state.gen7.shaders.map == NULL)
+		return false;
+
+	if (picture->filter != PictFilterConvolution)
+		return false;
+
+	if (picture->pDrawable == NULL || picture->alphaMap)
+		return false;
+
+	if (!gen7_check_repeat(picture))
+		return false;
+
+	if (!sna_transform_is_integer_translation(picture->transform, &dx, &dy)) {
+		DBG(("%s: transformed convolution\n", __FUNCTION__));
+		return false;
+	}
+
+	if (picture->filter_nparams < 2 ||
+	    pixman_fixed_fraction(params[0]) ||
+	    pixman_fixed_fraction(params[1]) ||
+	    params[0] <= 0 || params[1] <= 0 ||
+	    pixman_fixed_to_int(params[0]) > GEN7_MAX_CONVOLVE_TAPS ||
+	    pixman_fixed_to_int(params[1]) > GEN7_MAX_CONVOLVE_TAPS ||
+	    picture->filter_nparams < 2 + pixman_fixed_to_int(params[0]) * pixman_fixed_to_int(params[1])) {
+		DBG(("%s: unsupported kernel\n", __FUNCTION__));
+		return false;
+	}
+
+	return true;
+}
+
+static void gen7_emit_convolve_state(struct sna *sna,
+				     const struct sna_composite_op *op)
+{
+	uint32_t *binding_table;
+	uint16_t offset, dirty;
+
+	gen7_get_batch(sna, op);
+
+	binding_table = gen7_composite_get_binding_table(sna, &offset);
+
+	dirty = kgem_bo_is_dirty(op->dst.bo);
+
+	binding_table[0] =
+		gen7_bind_bo(sna,
+			     op->dst.bo, op->dst.width, op->dst.height,
+			     GEN7_SURFACEFORMAT_R16G16B16A16_UNORM,
+			     true);
+	binding_table[1] =
+		gen7_bind_bo(sna,
+			     op->src.bo, op->src.width, op->src.height,
+			     op->src.card_format,
+			     false);
+
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen7.binding_cache,
+					  offset, sizeof(struct gen7_surface_state) / sizeof(uint32_t));
+
+	if (sna->kgem.batch[sna->render_state.gen7.surface_table] == binding_table[0])
+		dirty = 0;
+
+	gen7_emit_state(sna, op, offset | dirty);
+}
+
+/* Filter the rows of the source into an intermediate covering the
+ * destination plus the kernel height, and replace the channel by it.
+ * The intermediate is only ever read back by the column pass, so it is
+ * kept at 16 bits per channel without a Picture format of its own.
+ */
+static bool
+gen7_convolve_rows(struct sna *sna,
+		   struct sna_composite_channel *channel,
+		   int w, int h, int dst_x, int dst_y,
+		   int cw, int ch,
+		   const pixman_fixed_t *row)
+{
+	struct gen7_convolve_key key;
+	struct sna_composite_op tmp;
+	const struct sna_shader *shader;
+	struct kgem_bo *bo;
+	float u0, v0, u1, v1;
+	int y0, n;
+
+	DBG(("%s: %dx%d, kernel=%dx%d\n", __FUNCTION__, w, h, cw, ch));
+
+	if (too_large(w, h + ch - 1))
+		return false;
+
+	memset(&key, 0, sizeof(key));
+	key.type = GEN7_SHADER_CONVOLVE;
+	key.cw = cw;
+	key.ch = 1;
+	for (n = 0; n < cw; n++)
+		key.weight[n] = pixman_fixed_to_double(row[n]);
+
+	shader = gen7_get_shader(sna, &key,
+				 offsetof(struct gen7_convolve_key, weight) + cw * sizeof(float),
+				 2, gen7_wm_kernel__convolve);
+	if (shader == NULL)
+		return false;
+
+	bo = kgem_create_2d(&sna->kgem, w, h + ch - 1, 64,
+			    kgem_choose_tiling(&sna->kgem, I915_TILING_X,
+					       w, h + ch - 1, 64),
+			    CREATE_TEMPORARY);
+	if (bo == NULL)
+		return false;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.op = PictOpSrc;
+	tmp.dst.bo = bo;
+	tmp.dst.width = w;
+	tmp.dst.height = h + ch - 1;
+
+	tmp.src = *channel;
+	gen7_composite_channel_convert(&tmp.src);
+	tmp.is_affine = true;
+
+	tmp.floats_per_vertex = 3;
+	tmp.floats_per_rect = 9;
+
+	tmp.u.gen7.flags =
+		GEN7_SET_FLAGS(SAMPLER_OFFSET(tmp.src.filter, tmp.src.repeat,
+					      SAMPLER_FILTER_NEAREST, SAMPLER_EXTEND_NONE),
+			       NO_BLEND,
+			       GEN7_WM_KERNEL_NOMASK,
+			       2);
+	gen7_composite_set_shader(&tmp, shader);
+
+	kgem_set_mode(&sna->kgem, KGEM_RENDER, bo);
+	if (!kgem_check_bo(&sna->kgem, bo, tmp.src.bo, NULL)) {
+		kgem_submit(&sna->kgem);
+		if (!kgem_check_bo(&sna->kgem, bo, tmp.src.bo, NULL)) {
+			kgem_bo_destroy(&sna->kgem, bo);
+			return false;
+		}
+		_kgem_set_mode(&sna->kgem, KGEM_RENDER);
+	}
+
+	gen7_align_vertex(sna, &tmp);
+	gen7_emit_convolve_state(sna, &tmp);
+
+	/* Row 0 of the intermediate is the first row under the kernel */
+	y0 = gen7_convolve_origin(ch);
+	u0 = (dst_x + channel->offset[0]) * channel->scale[0];
+	u1 = (dst_x + w + channel->offset[0]) * channel->scale[0];
+	v0 = (dst_y + y0 + channel->offset[1]) * channel->scale[1];
+	v1 = (dst_y + y0 + h + ch - 1 + channel->offset[1]) * channel->scale[1];
+
+	gen7_get_rectangles(sna, &tmp, 1, gen7_emit_convolve_state);
+
+	OUT_VERTEX(w, h + ch - 1);
+	OUT_VERTEX_F(u1);
+	OUT_VERTEX_F(v1);
+
+	OUT_VERTEX(0, h + ch - 1);
+	OUT_VERTEX_F(u0);
+	OUT_VERTEX_F(v1);
+
+	OUT_VERTEX(0, 0);
+	OUT_VERTEX_F(u0);
+	OUT_VERTEX_F(v0);
+
+	gen4_vertex_flush(sna);
+
+	/* and sample it so that the column kernel's origin lands on row 0 */
+	kgem_bo_destroy(&sna->kgem, channel->bo);
+	channel->bo = bo;
+	channel->pict_format = PICT_a8b8g8r8;
+	channel->card_format = GEN7_SURFACEFORMAT_R16G16B16A16_UNORM;
+	channel->filter = PictFilterNearest;
+	channel->repeat = RepeatNone;
+	channel->is_affine = true;
+	channel->width = w;
+	channel->height = h + ch - 1;
+	channel->scale[0] = 1.f / w;
+	channel->scale[1] = 1.f / (h + ch - 1);
+	channel->offset[0] = -dst_x;
+	channel->offset[1] = -dst_y - y0;
+	return true;
+}
+
+/* Sample the source through a generated kernel that evaluates the whole
+ * convolution in a single pass, rather than accumulating a temporary
+ * one tap at a time in sna_render_picture_convolve(). Kernels with more
+ * taps than a single pass can hold are split into a row and a column
+ * pass, through an intermediate kept at 16 bits per channel.
+ */
+static int
+gen7_composite_picture__convolve(struct sna *sna,
+				 PicturePtr picture,
+				 struct sna_composite_channel *channel,
+				 int x, int y,
+				 int w, int h,
+				 int dst_x, int dst_y,
+				 bool precise,
+				 const struct sna_shader **shader)
+{
+	pixman_fixed_t *params = picture->filter_params;
+	pixman_fixed_t row[GEN7_MAX_CONVOLVE_TAPS], col[GEN7_MAX_CONVOLVE_TAPS];
+	const pixman_fixed_t *weight;
+	struct gen7_convolve_key key;
+	PicturePtr src;
+	int cw, ch, x0, y0, n;
+	int ret;
+
+	*shader = NULL;
+	if (!gen7_check_convolve(sna, picture))
+		goto fallback;
+
+	cw = pixman_fixed_to_int(params[0]);
+	ch = pixman_fixed_to_int(params[1]);
+	x0 = gen7_convolve_origin(cw);
+	y0 = gen7_convolve_origin(ch);
+	DBG(("%s: kernel=%dx%d, origin=(%d, %d)\n", __FUNCTION__, cw, ch, x0, y0));
+
+	weight = params + 2;
+	if (cw * ch > GEN7_MAX_CONVOLVE_TAPS &&
+	    !sna_convolve_is_separable(weight, cw, ch, row, col)) {
+		DBG(("%s: too many taps for a single pass\n", __FUNCTION__));
+		goto fallback;
+	}
+
+	/* Sample the source by its texels, but include the neighbourhood
+	 * covered by the kernel when choosing what to upload.
+	 */
+	src = sna_render_picture_private(picture, PictFilterNearest, NULL, 0);
+	if (src == NULL)
+		goto fallback;
+
+	ret = gen7_composite_picture(sna, src, channel,
+				     x + x0, y + y0,
+				     w + cw - 1, h + ch - 1,
+				     dst_x + x0, dst_y + y0,
+				     precise);
+	sna_render_picture_private_free(src);
+	if (ret != 1)
+		return ret;
+
+	if (channel->is_solid || channel->transform) {
+		DBG(("%s: reduced to a solid, or retained a transform\n",
+		     __FUNCTION__));
+		goto cleanup;
+	}
+
+	if (cw * ch > GEN7_MAX_CONVOLVE_TAPS) {
+		if (!gen7_convolve_rows(sna, channel, w, h, dst_x, dst_y,
+					cw, ch, row))
+			goto cleanup;
+
+		weight = col;
+		cw = 1;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.type = GEN7_SHADER_CONVOLVE;
+	key.cw = cw;
+	key.ch = ch;
+	for (n = 0; n < cw * ch; n++)
+		key.weight[n] = pixman_fixed_to_double(weight[n]);
+
+	*shader = gen7_get_shader(sna, &key,
+				  offsetof(struct gen7_convolve_key, weight) + cw * ch * sizeof(float),
+				  2, gen7_wm_kernel__convolve);
+	if (*shader)
+		return 1;
+
+cleanup:
+	if (channel->bo) {
+		kgem_bo_destroy(&sna->kgem, channel->bo);
+		channel->bo = NULL;
+	}
+fallback:
+	return gen7_composite_picture(sna, picture, channel,
+				      x, y, w, h, dst_x, dst_y,
+				      precise);
+}
+
+struct gen7_gradient_key {
+	uint16_t type;
+	uint8_t mask;
+	uint8_t extend_none;
+	float cdx, cdy, r1, dr;
+};
+
+static bool
+gen7_wm_kernel__radial(struct brw_compile *p, int dispatch, const void *data)
+{
+	const struct gen7_gradient_key *key = data;
+
+	return brw_wm_kernel__radial(p, dispatch, key->mask,
+				     key->cdx, key->cdy,
+				     key->r1, key->dr,
+				     key->extend_none);
+}
+
+static bool
+gen7_wm_kernel__conical(struct brw_compile *p, int dispatch, const void *data)
+{
+	const struct gen7_gradient_key *key = data;
+
+	return brw_wm_kernel__conical(p, dispatch, key->mask);
+}
+
+static bool
+gen7_check_gradient(struct sna *sna, PicturePtr picture)
+{
+	if (NO_GRADIENT)
+		return false;
+
+	if (sna->render_state.gen7.shaders.map == NULL)
+		return false;
+
+	if (picture->pDrawable || picture->alphaMap)
+		return false;
+
+	switch (picture->pSourcePict->type) {
+	case SourcePictTypeRadial:
+	case SourcePictTypeConical:
+		break;
+	default:
+		return false;
+	}
+
+	if (!gen7_check_repeat(picture))
+		return false;
+
+	if (!sna_transform_is_affine(picture->transform)) {
+		DBG(("%s: projective gradient\n", __FUNCTION__));
+		return false;
+	}
+
+	return true;
+}
+
+/* Compute the gradient parameter for every pixel in the kernel and then
+ * only use the ramp texture for the colour lookup, rather than rendering
+ * the whole gradient on the CPU with sna_render_picture_fixup().
+ *
+ * The channel coordinates are the sample position in gradient space,
+ * relative to the first circle (or the centre) and uniformly scaled so
+ * that the remaining geometry baked into the kernel is normalised.
+ */
+static int
+gen7_composite_picture__gradient(struct sna *sna,
+				 PicturePtr picture,
+				 struct sna_composite_channel *channel,
+				 int x, int y,
+				 int w, int h,
+				 int dst_x, int dst_y,
+				 bool precise,
+				 enum brw_wm_mask mask,
+				 const struct sna_shader **shader)
+{
+	struct pixman_f_transform m, e;
+	struct gen7_gradient_key key;
+	sna_shader_compile_func compile;
+	int len, row;
+
+	*shader = NULL;
+	if (!gen7_check_gradient(sna, picture))
+		goto fallback;
+
+	memset(&key, 0, sizeof(key));
+	key.mask = mask;
+
+	if (picture->transform)
+		pixman_f_transform_from_pixman_transform(&m, picture->transform);
+	else
+		pixman_f_transform_init_identity(&m);
+
+	if (picture->pSourcePict->type == SourcePictTypeRadial) {
+		PictRadialGradient *radial =
+			(PictRadialGradient *)picture->pSourcePict;
+		double dx, dy, dr, r1, k;
+
+		if (radial->c2.x == radial->c1.x &&
+		    radial->c2.y == radial->c1.y &&
+		    radial->c2.radius == radial->c1.radius)
+			return 0;
+
+		dx = pixman_fixed_to_double(radial->c2.x - radial->c1.x);
+		dy = pixman_fixed_to_double(radial->c2.y - radial->c1.y);
+		dr = pixman_fixed_to_double(radial->c2.radius - radial->c1.radius);
+		r1 = pixman_fixed_to_double(radial->c1.radius);
+
+		k = MAX(r1, r1 + dr);
+		if (k == 0)
+			k = sqrt(dx*dx + dy*dy);
+		k = 1 / k;
+
+		pixman_f_transform_init_translate(&e,
+						  -pixman_fixed_to_double(radial->c1.x),
+						  -pixman_fixed_to_double(radial->c1.y));
+		channel->scale[0] = channel->scale[1] = k;
+
+		key.type = GEN7_SHADER_RADIAL;
+		key.extend_none = !picture->repeat || picture->repeatType == RepeatNone;
+		key.cdx = dx * k;
+		key.cdy = dy * k;
+		key.r1 = r1 * k;
+		key.dr = dr * k;
+		len = sizeof(key);
+		compile = gen7_wm_kernel__radial;
+	} else {
+		PictConicalGradient *conical =
+			(PictConicalGradient *)picture->pSourcePict;
+		double angle;
+
+		angle = pixman_fixed_to_double(conical->angle) * M_PI / 180;
+
+		pixman_f_transform_init_translate(&e,
+						  -pixman_fixed_to_double(conical->center.x),
+						  -pixman_fixed_to_double(conical->center.y));
+		pixman_f_transform_rotate(&e, NULL, cos(angle), sin(angle));
+		channel->scale[0] = channel->scale[1] = 1;
+
+		key.type = GEN7_SHADER_CONICAL;
+		len = offsetof(struct gen7_gradient_key, cdx);
+		compile = gen7_wm_kernel__conical;
+	}
+
+	pixman_f_transform_multiply(&e, &e, &m);
+	if (!pixman_transform_from_pixman_f_transform(&channel->embedded_transform, &e)) {
+		DBG(("%s: gradient transform overflow\n", __FUNCTION__));
+		goto fallback;
+	}
+
+	*shader = gen7_get_shader(sna, &key, len,
+				  mask == BRW_WM_MASK ? 3 : 2,
+				  compile);
+	if (*shader == NULL)
+		goto fallback;
+
+	channel->bo = sna_render_get_gradient_row(sna,
+						  (PictGradient *)picture->pSourcePict,
+						  &row);
+	if (channel->bo == NULL) {
+		*shader = NULL;
+		goto fallback;
+	}
+
+	DBG(("%s: type=%d, mask=%d, scale=%f, row=%d\n",
+	     __FUNCTION__, key.type, mask, channel->scale[0], row));
+
+	/* Bind the whole atlas, so that gradients share its surface, and
+	 * pass the ramp's row to the kernel as the third coordinate.
+	 */
+	channel->filter = PictFilterNearest;
+	channel->repeat = picture->repeat ? picture->repeatType : RepeatNone;
+	channel->width  = channel->bo->pitch / 4;
+	channel->height = row < 0 ? 1 : GRADIENT_ATLAS_ROWS;
+	channel->pict_format = PICT_a8r8g8b8;
+	channel->card_format = GEN7_SURFACEFORMAT_B8G8R8A8_UNORM;
+	channel->is_solid = false;
+	channel->is_linear = 0;
+	channel->is_affine = 0;
+
+	channel->embedded_transform.matrix[2][0] = 0;
+	channel->embedded_transform.matrix[2][1] = 0;
+	channel->embedded_transform.matrix[2][2] =
+		pixman_double_to_fixed((MAX(row, 0) + .5) / channel->height);
+
+	channel->offset[0] = x - dst_x;
+	channel->offset[1] = y - dst_y;
+	channel->transform = &channel->embedded_transform;
+	return 1;
+
+fallback:
+	return gen7_composite_picture(sna, picture, channel,
+				      x, y, w, h, dst_x, dst_y,
+				      precise);
+}
+
+static bool
+gen7_composite_instanced(struct sna *sna, struct sna_composite_op *tmp)
+{
+	if (NO_INSTANCING)
+		return false;
+
+	if (sna->render_state.gen7.vs_kernel[tmp->mask.bo != NULL] == 0)
+		return false;
+
+	return gen4_choose_instance_emitter(tmp);
+}
+
 static void gen7_render_composite_done(struct sna *sna,
 				       const struct sna_composite_op *op)
 {
@@ -2265,7 +3170,7 @@ execute:
 }
 
 static bool
-check_gradient(PicturePtr picture, bool precise)
+check_gradient(struct sna *sna, PicturePtr picture, bool precise)
 {
 	if (picture->pDrawable)
 		return false;
@@ -2275,7 +3180,7 @@ check_gradient(PicturePtr picture, bool precise)
 	case SourcePictTypeLinear:
 		return false;
 	default:
-		return precise;
+		return precise && !gen7_check_gradient(sna, picture);
 	}
 }
 
@@ -2308,13 +3213,13 @@ source_is_busy(PixmapPtr pixmap)
 }
 
 static bool
-source_fallback(PicturePtr p, PixmapPtr pixmap, bool precise)
+source_fallback(struct sna *sna, PicturePtr p, PixmapPtr pixmap, bool precise)
 {
 	if (sna_picture_is_solid(p, NULL))
 		return false;
 
 	if (p->pSourcePict)
-		return check_gradient(p, precise);
+		return check_gradient(sna, p, precise);
 
 	if (!gen7_check_repeat(p) || !gen7_check_format(p->format))
 		return true;
@@ -2345,12 +3250,12 @@ gen7_composite_fallback(struct sna *sna,
 	dst_pixmap = get_drawable_pixmap(dst->pDrawable);
 
 	src_pixmap = src->pDrawable ? get_drawable_pixmap(src->pDrawable) : NULL;
-	src_fallback = source_fallback(src, src_pixmap,
+	src_fallback = source_fallback(sna, src, src_pixmap,
 				       dst->polyMode == PolyModePrecise);
 
 	if (mask) {
 		mask_pixmap = mask->pDrawable ? get_drawable_pixmap(mask->pDrawable) : NULL;
-		mask_fallback = source_fallback(mask, mask_pixmap,
+		mask_fallback = source_fallback(sna, mask, mask_pixmap,
 						dst->polyMode == PolyModePrecise);
 	} else {
 		mask_pixmap = NULL;
@@ -2471,6 +3376,24 @@ reuse_source(struct sna *sna,
 	return true;
 }
 
+/* The generated gradient kernels only know how to apply an affine,
+ * single channel mask.
+ */
+static bool
+gen7_check_gradient_mask(PicturePtr src, PicturePtr mask)
+{
+	if (src->pDrawable || src == mask)
+		return false;
+
+	if (mask == NULL)
+		return true;
+
+	if (mask->componentAlpha && PICT_FORMAT_RGB(mask->format))
+		return false;
+
+	return sna_transform_is_affine(mask->transform);
+}
+
 static bool
 gen7_render_composite(struct sna *sna,
 		      uint8_t op,
@@ -2484,6 +3407,9 @@ gen7_render_composite(struct sna *sna,
 		      unsigned flags,
 		      struct sna_composite_op *tmp)
 {
+	const struct sna_shader *shader;
+	int ret;
+
 	if (op >= ARRAY_SIZE(gen7_blend_op))
 		return false;
 
@@ -2519,11 +3445,29 @@ gen7_render_composite(struct sna *sna,
 				       flags & COMPOSITE_PARTIAL || op > PictOpSrc))
 		goto fallback;
 
-	switch (gen7_composite_picture(sna, src, &tmp->src,
-				       src_x, src_y,
-				       width, height,
-				       dst_x, dst_y,
-				       dst->polyMode == PolyModePrecise)) {
+	shader = NULL;
+	if (mask == NULL && src->filter == PictFilterConvolution)
+		ret = gen7_composite_picture__convolve(sna, src, &tmp->src,
+						       src_x, src_y,
+						       width, height,
+						       dst_x, dst_y,
+						       dst->polyMode == PolyModePrecise,
+						       &shader);
+	else if (gen7_check_gradient_mask(src, mask))
+		ret = gen7_composite_picture__gradient(sna, src, &tmp->src,
+						       src_x, src_y,
+						       width, height,
+						       dst_x, dst_y,
+						       dst->polyMode == PolyModePrecise,
+						       mask ? BRW_WM_MASK : BRW_WM_NOMASK,
+						       &shader);
+	else
+		ret = gen7_composite_picture(sna, src, &tmp->src,
+					     src_x, src_y,
+					     width, height,
+					     dst_x, dst_y,
+					     dst->polyMode == PolyModePrecise);
+	switch (ret) {
 	case -1:
 		goto cleanup_dst;
 	case 0:
@@ -2532,7 +3476,7 @@ gen7_render_composite(struct sna *sna,
 		/* fall through to fixup */
 	case 1:
 		/* Did we just switch rings to prepare the source? */
-		if (mask == NULL &&
+		if (mask == NULL && shader == NULL &&
 		    prefer_blt_composite(sna, tmp) &&
 		    sna_blt_composite__convert(sna,
 					       dst_x, dst_y, width, height,
@@ -2605,6 +3549,9 @@ gen7_render_composite(struct sna *sna,
 							    tmp->has_component_alpha,
 							    tmp->is_affine),
 			       gen4_choose_composite_emitter(sna, tmp));
+	if (shader)
+		gen7_composite_set_shader(tmp, shader);
+	gen7_composite_instanced(sna, tmp);
 
 	tmp->blt   = gen7_render_composite_blt;
 	tmp->box   = gen7_render_composite_box;
@@ -2716,29 +3663,21 @@ gen7_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen7_get_rectangles(sna, &op->base, nbox,
-						     gen7_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       gen7_is_instanced(&op->base) ? 1 : 3, true,
+					       &nbox_this_time, gen7_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -2788,6 +3727,8 @@ gen7_render_composite_spans(struct sna *sna,
 			    unsigned flags,
 			    struct sna_composite_spans_op *tmp)
 {
+	const struct sna_shader *shader;
+
 	DBG(("%s: %dx%d with flags=%x, current mode=%d/%d\n", __FUNCTION__,
 	     width, height, flags, sna->kgem.mode, sna->kgem.ring));
 
@@ -2806,11 +3747,13 @@ gen7_render_composite_spans(struct sna *sna,
 				       dst_x, dst_y, width, height, true))
 		return false;
 
-	switch (gen7_composite_picture(sna, src, &tmp->base.src,
-				       src_x, src_y,
-				       width, height,
-				       dst_x, dst_y,
-				       dst->polyMode == PolyModePrecise)) {
+	switch (gen7_composite_picture__gradient(sna, src, &tmp->base.src,
+						 src_x, src_y,
+						 width, height,
+						 dst_x, dst_y,
+						 dst->polyMode == PolyModePrecise,
+						 BRW_WM_OPACITY,
+						 &shader)) {
 	case -1:
 		goto cleanup_dst;
 	case 0:
@@ -2834,6 +3777,8 @@ gen7_render_composite_spans(struct sna *sna,
 			       gen7_get_blend(tmp->base.op, false, tmp->base.dst.format),
 			       GEN7_WM_KERNEL_OPACITY | !tmp->base.is_affine,
 			       gen4_choose_spans_emitter(sna, tmp));
+	if (shader)
+		gen7_composite_set_shader(&tmp->base, shader);
 
 	tmp->box   = gen7_render_composite_spans_box;
 	tmp->boxes = gen7_render_composite_spans_boxes;
@@ -2891,11 +3836,9 @@ gen7_emit_copy_state(struct sna *sna,
 			     op->src.card_format,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen7.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += sizeof(struct gen7_surface_state) / sizeof(uint32_t);
-		offset = sna->render_state.gen7.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen7.binding_cache,
+					  offset, sizeof(struct gen7_surface_state) / sizeof(uint32_t));
 
 	if (sna->kgem.batch[sna->render_state.gen7.surface_table] == binding_table[0])
 		dirty = 0;
@@ -3308,12 +4251,9 @@ gen7_emit_fill_state(struct sna *sna, const struct sna_composite_op *op)
 			     GEN7_SURFACEFORMAT_B8G8R8A8_UNORM,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen7.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface +=
-			sizeof(struct gen7_surface_state)/sizeof(uint32_t);
-		offset = sna->render_state.gen7.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen7.binding_cache,
+					  offset, sizeof(struct gen7_surface_state) / sizeof(uint32_t));
 
 	if (sna->kgem.batch[sna->render_state.gen7.surface_table] == binding_table[0])
 		dirty = 0;
@@ -3802,16 +4742,10 @@ static void gen7_render_reset(struct sna *sna)
 	sna->render_state.gen7.pipe_controls_since_stall = 0;
 	sna->render_state.gen7.emit_flush = false;
 	sna->render_state.gen7.needs_invariant = true;
-	sna->render_state.gen7.ve_id = 3 << 2;
 	sna->render_state.gen7.last_primitive = -1;
 
-	sna->render_state.gen7.num_sf_outputs = 0;
-	sna->render_state.gen7.samplers = -1;
-	sna->render_state.gen7.blend = -1;
-	sna->render_state.gen7.kernel = -1;
-	sna->render_state.gen7.drawrect_offset = -1;
-	sna->render_state.gen7.drawrect_limit = -1;
 	sna->render_state.gen7.surface_table = 0;
+	sna_binding_cache_reset(&sna->render_state.gen7.binding_cache);
 
 	if (sna->render.vbo && !kgem_bo_can_map(&sna->kgem, sna->render.vbo)) {
 		DBG(("%s: discarding unmappable vbo\n", __FUNCTION__));
@@ -3825,6 +4759,7 @@ static void gen7_render_reset(struct sna *sna)
 
 static void gen7_render_fini(struct sna *sna)
 {
+	sna_shader_cache_fini(sna, &sna->render_state.gen7.shaders);
 	kgem_bo_destroy(&sna->kgem, sna->render_state.gen7.general_bo);
 }
 
@@ -3849,8 +4784,11 @@ static bool gen7_render_setup(struct sna *sna, int devid)
 	struct gen7_render_state *state = &sna->render_state.gen7;
 	struct sna_static_stream general;
 	struct gen7_sampler_state *ss;
+	uint32_t shaders;
 	int i, j, k, l, m;
 
+	COMPILE_TIME_ASSERT(GEN7_WM_KERNEL_COUNT < GEN7_WM_KERNEL_SHADER);
+
 	if (is_ivb(sna)) {
 		state->info = &ivb_gt_info;
 		if (devid & 0xf) {
@@ -3933,8 +4871,31 @@ static bool gen7_render_setup(struct sna *sna, int devid)
 
 	state->cc_blend = gen7_composite_create_blend_state(&general);
 
+	state->vs_kernel[0] =
+		sna_static_stream_compile_vs(sna, &general,
+					     brw_vs_kernel__rectangle);
+	state->vs_kernel[1] =
+		sna_static_stream_compile_vs(sna, &general,
+					     brw_vs_kernel__rectangle_mask);
+	state->vs_corners = gen7_create_corners(&general);
+	state->vs_scratch =
+		sna_static_stream_offsetof(&general,
+					   sna_static_stream_map(&general, 8, 64));
+
+	shaders = sna_static_stream_offsetof(&general,
+					     sna_static_stream_map(&general,
+								   SNA_SHADER_ARENA_SIZE,
+								   64));
+
 	state->general_bo = sna_static_stream_fini(sna, &general);
-	return state->general_bo != NULL;
+	if (state->general_bo == NULL)
+		return false;
+
+	/* Without the arena we simply stick to the precompiled kernels */
+	if (!sna_shader_cache_init(sna, &state->shaders, state->general_bo,
+				   shaders, SNA_SHADER_ARENA_SIZE))
+		DBG(("%s: no runtime kernel cache\n", __FUNCTION__));
+	return true;
 }
 
 const char *gen7_render_init(struct sna *sna, const char *backend)
@@ -57,6 +57,15 @@
 #define GEN7_3DSTATE_CC_STATE_POINTERS		GEN7_3D(3, 0, 0x0e)
 
 #define GEN7_3DSTATE_VS				GEN7_3D(3, 0, 0x10)
+/* DW4 */
+# define GEN7_VS_DISPATCH_START_GRF_SHIFT		20
+# define GEN7_VS_URB_READ_LENGTH_SHIFT			11
+# define GEN7_VS_URB_ENTRY_READ_OFFSET_SHIFT		4
+/* DW5 */
+# define IVB_VS_MAX_THREADS_SHIFT			25
+# define HSW_VS_MAX_THREADS_SHIFT			23
+# define GEN7_VS_STATISTICS_ENABLE			(1 << 10)
+# define GEN7_VS_ENABLE					(1 << 0)
 
 #define GEN7_3DSTATE_GS				GEN7_3D(3, 0, 0x11)
 /* DW4 */
@@ -602,7 +602,6 @@ __gen8_set_message_descriptor(struct gen8_instruction *inst,
 	__gen8_set_eot(inst, end_of_thread);
 }
 
-#if 0
 static void
 __gen8_set_urb_message(struct gen8_instruction *inst,
 		       unsigned opcode,
@@ -621,7 +620,6 @@ __gen8_set_urb_message(struct gen8_instruction *inst,
 	/* per_slot_offset = 0 makes it ignore offsets in message header */
 	__gen8_set_urb_per_slot_offset(inst, 0);
 }
-#endif
 
 static void
 __gen8_set_sampler_message(struct gen8_instruction *inst,
@@ -883,6 +881,11 @@ static inline void gen8_set_mask_control(struct brw_compile *p, unsigned value)
 	__gen8_set_mask_control((struct gen8_instruction *)p->current, value);
 }
 
+static inline void gen8_set_access_mode(struct brw_compile *p, unsigned value)
+{
+	__gen8_set_access_mode((struct gen8_instruction *)p->current, value);
+}
+
 static inline void gen8_set_saturate(struct brw_compile *p, unsigned value)
 {
 	__gen8_set_saturate((struct gen8_instruction *)p->current, value);
@@ -1357,3 +1360,93 @@ gen8_wm_kernel__projective_opacity(struct brw_compile *p, int dispatch)
 
 	return true;
 }
+
+/* Expand a single instanced rectangle into one of its three RECTLIST
+ * vertices, as brw_vs_kernel__rectangle() does for gen7. Runs SIMD4x2
+ * with the vertex attributes delivered as
+ *
+ *   g1: corner (cx, cy, 0, 1), one of (1, 1), (0, 1), (0, 0)
+ *   g2: destination (x, y, w, h)
+ *   g3: source origin (sx, sy, 0, 1)
+ *   g4: texture scale (src_x, src_y, mask_x, mask_y)
+ *   g5: mask origin (mx, my, 0, 1)
+ */
+static void vs_texcoord(struct brw_compile *p, int msg,
+			struct brw_reg origin, struct brw_reg scale)
+{
+	struct brw_reg corner = brw_vec8_grf(1, 0);
+	struct brw_reg delta = brw_vec8_grf(6, 0);
+	struct brw_reg tmp = brw_vec8_grf(7, 0);
+	struct brw_reg dst = brw_message_reg(msg);
+
+	gen8_ADD(p, brw_writemask(tmp, WRITEMASK_XY), origin, delta);
+	gen8_MUL(p, brw_writemask(dst, WRITEMASK_XY), tmp, scale);
+	gen8_MOV(p, brw_writemask(dst, WRITEMASK_ZW), corner);
+}
+
+static void vs_urb_write(struct brw_compile *p, int msg_len)
+{
+	struct brw_reg header = brw_message_reg(1);
+	struct gen8_instruction *insn;
+
+	gen8_MOV(p, __retype_ud(header), __retype_ud(brw_vec8_grf(0, 0)));
+
+	/* Enable all channels in the URB write header */
+	brw_push_insn_state(p);
+	gen8_set_access_mode(p, BRW_ALIGN_1);
+	gen8_set_mask_control(p, BRW_MASK_DISABLE);
+	gen8_OR(p, get_element_ud(header, 5),
+		get_element_ud(brw_vec8_grf(0, 0), 5),
+		brw_imm_ud(0xff00));
+	brw_pop_insn_state(p);
+
+	insn = gen8_next_insn(p, BRW_OPCODE_SEND);
+	__gen8_set_pred_control(insn, 0);
+	__gen8_set_cmpt_control(insn, GEN6_COMPRESSION_1Q);
+
+	__gen8_set_dst(p, insn, brw_null_reg());
+	__gen8_set_urb_message(insn, 0, msg_len, 0, true, 0, true);
+}
+
+static bool vs_rectangle(struct brw_compile *p, bool has_mask)
+{
+	struct brw_reg corner = brw_vec8_grf(1, 0);
+	struct brw_reg box = brw_vec8_grf(2, 0);
+	struct brw_reg scale = brw_vec8_grf(4, 0);
+	struct brw_reg delta = brw_vec8_grf(6, 0);
+
+	gen8_compile_init(p);
+	gen8_set_access_mode(p, BRW_ALIGN_16);
+
+	/* (cx*w, cy*h) */
+	gen8_MUL(p, brw_writemask(delta, WRITEMASK_XY),
+		 corner, brw_swizzle(box, 2, 3, 2, 3));
+
+	/* VUE header */
+	gen8_MOV(p, brw_message_reg(2), brw_imm_f(0));
+
+	/* position */
+	gen8_ADD(p, brw_writemask(brw_message_reg(3), WRITEMASK_XY),
+		 box, delta);
+	gen8_MOV(p, brw_writemask(brw_message_reg(3), WRITEMASK_ZW), corner);
+
+	vs_texcoord(p, 4, brw_vec8_grf(3, 0), scale);
+	if (has_mask)
+		vs_texcoord(p, 5, brw_vec8_grf(5, 0),
+			    brw_swizzle(scale, 2, 3, 2, 3));
+
+	vs_urb_write(p, 4 + has_mask);
+	return true;
+}
+
+bool
+gen8_vs_kernel__rectangle(struct brw_compile *p)
+{
+	return vs_rectangle(p, false);
+}
+
+bool
+gen8_vs_kernel__rectangle_mask(struct brw_compile *p)
+{
+	return vs_rectangle(p, true);
+}
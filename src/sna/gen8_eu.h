@@ -3,6 +3,9 @@
 
 #include "brw/brw_eu.h"
 
+bool gen8_vs_kernel__rectangle(struct brw_compile *p);
+bool gen8_vs_kernel__rectangle_mask(struct brw_compile *p);
+
 bool gen8_wm_kernel__affine(struct brw_compile *p, int dispatch_width);
 bool gen8_wm_kernel__affine_mask(struct brw_compile *p, int dispatch_width);
 bool gen8_wm_kernel__affine_mask_ca(struct brw_compile *p, int dispatch_width);
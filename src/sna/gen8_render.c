@@ -58,6 +58,7 @@
 #define NO_FILL_ONE 0
 #define NO_FILL_CLEAR 0
 #define NO_VIDEO 0
+#define NO_INSTANCING 0
 
 #define USE_8_PIXEL_DISPATCH 1
 #define USE_16_PIXEL_DISPATCH 1
@@ -205,6 +206,9 @@ static const struct blendinfo {
 #define GEN8_READS_DST(f) (((f) >> 15) & 1)
 #define GEN8_KERNEL(f) (((f) >> 16) & 0xf)
 #define GEN8_VERTEX(f) (((f) >> 0) & 0xf)
+#define GEN8_VB_INSTANCE 16 /* + has_mask */
+#define GEN8_VB_CORNER 18
+#define GEN8_VB_CONSTANTS 19
 #define GEN8_SET_FLAGS(S, B, K, V)  ((S) << 20 | (K) << 16 | (B) | (V))
 
 #define OUT_BATCH(v) batch_emit(sna, v)
@@ -214,6 +218,7 @@ static const struct blendinfo {
 
 struct gt_info {
 	const char *name;
+	int max_vs_threads;
 	struct {
 		int max_vs_entries;
 	} urb;
@@ -221,6 +226,7 @@ struct gt_info {
 
 static const struct gt_info bdw_gt_info = {
 	.name = "Broadwell (gen8)",
+	.max_vs_threads = 504,
 	.urb = { .max_vs_entries = 960 },
 };
 
@@ -231,6 +237,7 @@ static bool is_bdw(struct sna *sna)
 
 static const struct gt_info chv_gt_info = {
 	.name = "Cherryview (gen8)",
+	.max_vs_threads = 80,
 	.urb = { .max_vs_entries = 640 },
 };
 
@@ -1010,6 +1017,83 @@ gen8_emit_wm(struct sna *sna, int kernel)
 	OUT_BATCH64(kernels[1]);
 }
 
+/* Instanced rectangles emit a single record per rectangle (rather than
+ * three vertices) and leave their expansion to the VS.
+ */
+inline static bool
+gen8_is_instanced(const struct sna_composite_op *op)
+{
+	return op->floats_per_rect == op->floats_per_vertex;
+}
+
+static void
+gen8_emit_vs(struct sna *sna, const struct sna_composite_op *op)
+{
+	struct gen8_render_state *render = &sna->render_state.gen8;
+	int vs = 0;
+
+	if (gen8_is_instanced(op))
+		vs = 1 + (op->mask.bo != NULL);
+
+	if (render->vs == vs)
+		return;
+
+	DBG(("%s: %s VS\n", __FUNCTION__,
+	     vs == 0 ? "disabling" : vs == 1 ? "rectangle" : "rectangle+mask"));
+
+	OUT_BATCH(GEN8_3DSTATE_VS | (9 - 2));
+	if (vs == 0) {
+		OUT_BATCH64(0); /* no VS kernel */
+		OUT_BATCH(0);
+		OUT_BATCH64(0); /* scratch */
+		OUT_BATCH(0);
+		OUT_BATCH(1 << 1); /* pass-through */
+	} else {
+		OUT_BATCH64(render->vs_kernel[vs - 1]);
+		OUT_BATCH(0); /* no samplers or surfaces */
+		OUT_BATCH64(0); /* scratch */
+		/* corner, box, source, scale [, mask] */
+		OUT_BATCH(1 << VS_DISPATCH_START_GRF_SHIFT |
+			  (4 + vs) / 2 << VS_URB_READ_LENGTH_SHIFT |
+			  0 << VS_URB_ENTRY_READ_OFFSET_SHIFT);
+		OUT_BATCH((render->info->max_vs_threads - 1) << VS_MAX_THREADS_SHIFT |
+			  VS_ENABLE); /* SIMD4x2 */
+	}
+	OUT_BATCH(1 << VS_URB_OUTPUT_READ_OFFSET_SHIFT |
+		  1 << VS_URB_OUTPUT_LENGTH_SHIFT); /* urb write to SBE */
+
+	render->vs = vs;
+}
+
+/* The texture scale factors are constant for the operation, so rather
+ * than repeat them in every record they are fetched from a zero-pitch
+ * buffer alongside the surface state.
+ */
+static void
+gen8_emit_instance_constants(struct sna *sna,
+			     const struct sna_composite_op *op)
+{
+	float *c;
+
+	sna->kgem.surface -= SURFACE_DW;
+	c = (float *)(sna->kgem.batch + sna->kgem.surface);
+	c[0] = op->src.scale[0];
+	c[1] = op->src.scale[1];
+	c[2] = op->mask.scale[0];
+	c[3] = op->mask.scale[1];
+
+	OUT_BATCH(GEN8_3DSTATE_VERTEX_BUFFERS | (5 - 2));
+	OUT_BATCH(GEN8_VB_CONSTANTS << VB_INDEX_SHIFT | VB_MODIFY_ENABLE |
+		  0); /* pitch */
+	/* an instruction read domain so the offset follows the surface
+	 * state should the batch be shrunk
+	 */
+	OUT_BATCH64(kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch, NULL,
+				     I915_GEM_DOMAIN_INSTRUCTION << 16,
+				     sna->kgem.surface * sizeof(uint32_t)));
+	OUT_BATCH(4 * sizeof(float)); /* buffer size */
+}
+
 static bool
 gen8_emit_binding_table(struct sna *sna, uint16_t offset)
 {
@@ -1049,6 +1133,92 @@ gen8_emit_drawing_rectangle(struct sna *sna,
 	return false;
 }
 
+static void
+gen8_emit_vf_instancing(struct sna *sna, bool enable)
+{
+	/* The destination, source and mask origins step once per instance;
+	 * the corners and the zero-pitch constants once per vertex.
+	 */
+	static const uint8_t elements[] = { 1, 2, 4 };
+	int n;
+
+	for (n = 0; n < ARRAY_SIZE(elements); n++) {
+		OUT_BATCH(GEN8_3DSTATE_VF_INSTANCING | (3 - 2));
+		OUT_BATCH(elements[n] | (enable ? VF_INSTANCING_ENABLE : 0));
+		OUT_BATCH(enable); /* step rate */
+	}
+}
+
+static void
+gen8_emit_instance_elements(struct sna *sna,
+			    const struct sna_composite_op *op)
+{
+	/*
+	 * per-vertex corner: (cx, cy)
+	 * per-instance record
+	 *    destination: (x, y, w, h) as int16
+	 *    source origin: (sx, sy)
+	 *    mask origin if (has_mask is true): (mx, my)
+	 * per-operation constants: (src_x, src_y, mask_x, mask_y) scale
+	 */
+	struct gen8_render_state *render = &sna->render_state.gen8;
+	bool has_mask = op->mask.bo != NULL;
+	int id = GEN8_VB_INSTANCE + has_mask;
+
+	DBG(("%s: setup id=%d\n", __FUNCTION__, id));
+
+	if (render->ve_id == id)
+		return;
+	render->ve_id = id;
+
+	OUT_BATCH(GEN8_3DSTATE_VERTEX_ELEMENTS |
+		((2 * (4 + has_mask)) + 1 - 2));
+
+	OUT_BATCH(GEN8_VB_CORNER << VE_INDEX_SHIFT | VE_VALID |
+		  SURFACEFORMAT_R32G32_FLOAT << VE_FORMAT_SHIFT |
+		  0 << VE_OFFSET_SHIFT);
+	OUT_BATCH(COMPONENT_STORE_SRC << VE_COMPONENT_0_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_1_SHIFT |
+		  COMPONENT_STORE_0 << VE_COMPONENT_2_SHIFT |
+		  COMPONENT_STORE_1_FLT << VE_COMPONENT_3_SHIFT);
+
+	OUT_BATCH(id << VE_INDEX_SHIFT | VE_VALID |
+		  SURFACEFORMAT_R16G16B16A16_SSCALED << VE_FORMAT_SHIFT |
+		  0 << VE_OFFSET_SHIFT);
+	OUT_BATCH(COMPONENT_STORE_SRC << VE_COMPONENT_0_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_1_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_2_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_3_SHIFT);
+
+	OUT_BATCH(id << VE_INDEX_SHIFT | VE_VALID |
+		  SURFACEFORMAT_R32G32_FLOAT << VE_FORMAT_SHIFT |
+		  8 << VE_OFFSET_SHIFT);
+	OUT_BATCH(COMPONENT_STORE_SRC << VE_COMPONENT_0_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_1_SHIFT |
+		  COMPONENT_STORE_0 << VE_COMPONENT_2_SHIFT |
+		  COMPONENT_STORE_1_FLT << VE_COMPONENT_3_SHIFT);
+
+	OUT_BATCH(GEN8_VB_CONSTANTS << VE_INDEX_SHIFT | VE_VALID |
+		  SURFACEFORMAT_R32G32B32A32_FLOAT << VE_FORMAT_SHIFT |
+		  0 << VE_OFFSET_SHIFT);
+	OUT_BATCH(COMPONENT_STORE_SRC << VE_COMPONENT_0_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_1_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_2_SHIFT |
+		  COMPONENT_STORE_SRC << VE_COMPONENT_3_SHIFT);
+
+	if (has_mask) {
+		OUT_BATCH(id << VE_INDEX_SHIFT | VE_VALID |
+			  SURFACEFORMAT_R32G32_FLOAT << VE_FORMAT_SHIFT |
+			  16 << VE_OFFSET_SHIFT);
+		OUT_BATCH(COMPONENT_STORE_SRC << VE_COMPONENT_0_SHIFT |
+			  COMPONENT_STORE_SRC << VE_COMPONENT_1_SHIFT |
+			  COMPONENT_STORE_0 << VE_COMPONENT_2_SHIFT |
+			  COMPONENT_STORE_1_FLT << VE_COMPONENT_3_SHIFT);
+	}
+
+	gen8_emit_vf_instancing(sna, true);
+}
+
 static void
 gen8_emit_vertex_elements(struct sna *sna,
 			  const struct sna_composite_op *op)
@@ -1064,10 +1234,17 @@ gen8_emit_vertex_elements(struct sna *sna,
 	int id = GEN8_VERTEX(op->u.gen8.flags);
 	bool has_mask;
 
+	if (gen8_is_instanced(op)) {
+		gen8_emit_instance_elements(sna, op);
+		return;
+	}
+
 	DBG(("%s: setup id=%d\n", __FUNCTION__, id));
 
 	if (render->ve_id == id)
 		return;
+	if (render->ve_id >= GEN8_VB_INSTANCE)
+		gen8_emit_vf_instancing(sna, false);
 	render->ve_id = id;
 
 	/* The VUE layout
@@ -1255,7 +1432,10 @@ gen8_emit_state(struct sna *sna,
 	gen8_emit_sampler(sna, GEN8_SAMPLER(op->u.gen8.flags));
 	gen8_emit_sf(sna, GEN8_VERTEX(op->u.gen8.flags) >> 2);
 	gen8_emit_wm(sna, GEN8_KERNEL(op->u.gen8.flags));
+	gen8_emit_vs(sna, op);
 	gen8_emit_vertex_elements(sna, op);
+	if (gen8_is_instanced(op))
+		gen8_emit_instance_constants(sna, op);
 	gen8_emit_binding_table(sna, wm_binding_table);
 
 	sna->render_state.gen8.emit_flush = GEN8_READS_DST(op->u.gen8.flags);
@@ -1269,6 +1449,7 @@ static bool gen8_magic_ca_pass(struct sna *sna,
 	if (!op->need_magic_ca_pass)
 		return false;
 
+	assert(!gen8_is_instanced(op));
 	DBG(("%s: CA fixup (%d -> %d)\n", __FUNCTION__,
 	     sna->render.vertex_start, sna->render.vertex_index));
 
@@ -1300,6 +1481,14 @@ static void null_create(struct sna_static_stream *stream)
 	sna_static_stream_map(stream, 64, 64);
 }
 
+static uint32_t gen8_create_corners(struct sna_static_stream *stream)
+{
+	/* The RECTLIST vertices in the order emitted by gen4_vertex.c */
+	static const float corners[] = { 1, 1, 0, 1, 0, 0 };
+
+	return sna_static_stream_add(stream, corners, sizeof(corners), 32);
+}
+
 static void
 sampler_state_init(struct gen8_sampler_state *sampler_state,
 		   sampler_filter_t filter,
@@ -1463,6 +1652,50 @@ static void gen8_emit_vertex_buffer(struct sna *sna,
 	sna->render.vb_id |= 1 << id;
 }
 
+static void gen8_emit_instance_buffers(struct sna *sna,
+				       const struct sna_composite_op *op)
+{
+	int id = GEN8_VB_INSTANCE + (op->mask.bo != NULL);
+
+	OUT_BATCH(GEN8_3DSTATE_VERTEX_BUFFERS | (9 - 2));
+	OUT_BATCH(id << VB_INDEX_SHIFT | VB_MODIFY_ENABLE |
+		  4*op->floats_per_vertex);
+	sna->render.vertex_reloc[sna->render.nvertex_reloc++] = sna->kgem.nbatch;
+	OUT_BATCH64(0);
+	OUT_BATCH(~0); /* buffer size: disabled */
+
+	OUT_BATCH(GEN8_VB_CORNER << VB_INDEX_SHIFT | VB_MODIFY_ENABLE |
+		  2*sizeof(float));
+	OUT_BATCH64(kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch,
+				     sna->render_state.gen8.general_bo,
+				     I915_GEM_DOMAIN_VERTEX << 16,
+				     sna->render_state.gen8.vs_corners));
+	OUT_BATCH(6*sizeof(float)); /* buffer size */
+
+	sna->render.vb_id |= 1 << id;
+}
+
+static void gen8_emit_instance_primitive(struct sna *sna)
+{
+	if (sna->kgem.nbatch == sna->render_state.gen8.last_primitive) {
+		sna->render.vertex_offset = sna->kgem.nbatch - 3;
+		return;
+	}
+
+	/* vertex_index counts instance records rather than vertices */
+	OUT_BATCH(GEN8_3DPRIMITIVE | (7 - 2));
+	OUT_BATCH(0); /* ignored, see VF_TOPOLOGY */
+	OUT_BATCH(3);	/* corners per rectangle */
+	OUT_BATCH(0);	/* start vertex location */
+	sna->render.vertex_offset = sna->kgem.nbatch;
+	OUT_BATCH(0);	/* instance count, to be filled in later */
+	OUT_BATCH(sna->render.vertex_index);
+	OUT_BATCH(0);	/* index buffer offset, ignored */
+	sna->render.vertex_start = sna->render.vertex_index;
+
+	sna->render_state.gen8.last_primitive = sna->kgem.nbatch;
+}
+
 static void gen8_emit_primitive(struct sna *sna)
 {
 	if (sna->kgem.nbatch == sna->render_state.gen8.last_primitive) {
@@ -1483,6 +1716,26 @@ static void gen8_emit_primitive(struct sna *sna)
 	sna->render_state.gen8.last_primitive = sna->kgem.nbatch;
 }
 
+static bool gen8_rectangle_begin__instanced(struct sna *sna,
+					    const struct sna_composite_op *op)
+{
+	int id = 1 << (GEN8_VB_INSTANCE + (op->mask.bo != NULL));
+	int ndwords;
+
+	ndwords = 7;
+	if ((sna->render.vb_id & id) == 0)
+		ndwords += 9;
+	if (!kgem_check_batch(&sna->kgem, ndwords) ||
+	    !kgem_check_reloc(&sna->kgem, 1))
+		return false;
+
+	if ((sna->render.vb_id & id) == 0)
+		gen8_emit_instance_buffers(sna, op);
+
+	gen8_emit_instance_primitive(sna);
+	return true;
+}
+
 static bool gen8_rectangle_begin(struct sna *sna,
 				 const struct sna_composite_op *op)
 {
@@ -1492,6 +1745,9 @@ static bool gen8_rectangle_begin(struct sna *sna,
 	if (sna_vertex_wait__locked(&sna->render) && sna->render.vertex_offset)
 		return true;
 
+	if (gen8_is_instanced(op))
+		return gen8_rectangle_begin__instanced(sna, op);
+
 	ndwords = op->need_magic_ca_pass ? 60 : 6;
 	if ((sna->render.vb_id & id) == 0)
 		ndwords += 5;
@@ -1564,7 +1820,7 @@ start:
 		want = rem / op->floats_per_rect;
 
 	assert(want > 0);
-	sna->render.vertex_index += 3*want;
+	sna->render.vertex_index += gen8_is_instanced(op) ? want : 3*want;
 	return want;
 
 flush:
@@ -1599,10 +1855,10 @@ gen8_get_batch(struct sna *sna, const struct sna_composite_op *op)
 {
 	kgem_set_mode(&sna->kgem, KGEM_RENDER, op->dst.bo);
 
-	if (!kgem_check_batch_with_surfaces(&sna->kgem, 150, 2*(1+3))) {
+	if (!kgem_check_batch_with_surfaces(&sna->kgem, 150, 2*(1+3+1))) {
 		DBG(("%s: flushing batch: %d < %d+%d\n",
 		     __FUNCTION__, sna->kgem.surface - sna->kgem.nbatch,
-		     150, 4*8*2));
+		     150, 5*8*2));
 		_kgem_submit(&sna->kgem);
 		_kgem_set_mode(&sna->kgem, KGEM_RENDER);
 	}
@@ -1646,13 +1902,9 @@ static void gen8_emit_composite_state(struct sna *sna,
 				     false);
 	}
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen8.surface_table) == *(uint64_t*)binding_table &&
-	    (op->mask.bo == NULL ||
-	     sna->kgem.batch[sna->render_state.gen8.surface_table+2] == binding_table[2])) {
-		sna->kgem.surface += SURFACE_DW;
-		offset = sna->render_state.gen8.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen8.binding_cache,
+					  offset, SURFACE_DW);
 
 	if (sna->kgem.batch[sna->render_state.gen8.surface_table] == binding_table[0])
 		dirty = 0;
@@ -1759,6 +2011,13 @@ gen8_render_composite_boxes(struct sna *sna,
 	} while (nbox);
 }
 
+static int gen8_get_rectangles__thread(struct sna *sna,
+				       const struct sna_composite_op *op,
+				       int want)
+{
+	return gen8_get_rectangles(sna, op, want, gen8_emit_composite_state);
+}
+
 static void
 gen8_render_composite_boxes__thread(struct sna *sna,
 				    const struct sna_composite_op *op,
@@ -1766,29 +2025,21 @@ gen8_render_composite_boxes__thread(struct sna *sna,
 {
 	DBG(("%s: nbox=%d\n", __FUNCTION__, nbox));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen8_get_rectangles(sna, op, nbox,
-						     gen8_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, op, op->floats_per_rect,
+					       gen8_is_instanced(op) ? 1 : 3, true,
+					       &nbox_this_time, gen8_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 static uint32_t
@@ -1954,6 +2205,18 @@ inline static bool gen8_composite_channel_convert(struct sna_composite_channel *
 	return true;
 }
 
+static bool
+gen8_composite_instanced(struct sna *sna, struct sna_composite_op *tmp)
+{
+	if (NO_INSTANCING)
+		return false;
+
+	if (sna->render_state.gen8.vs_kernel[tmp->mask.bo != NULL] == 0)
+		return false;
+
+	return gen4_choose_instance_emitter(tmp);
+}
+
 static void gen8_render_composite_done(struct sna *sna,
 				       const struct sna_composite_op *op)
 {
@@ -2458,6 +2721,7 @@ gen8_render_composite(struct sna *sna,
 							    tmp->has_component_alpha,
 							    tmp->is_affine),
 			       gen4_choose_composite_emitter(sna, tmp));
+	gen8_composite_instanced(sna, tmp);
 
 	tmp->blt   = gen8_render_composite_blt;
 	tmp->box   = gen8_render_composite_box;
@@ -2569,29 +2833,21 @@ gen8_render_composite_spans_boxes__thread(struct sna *sna,
 	     op->base.src.offset[0], op->base.src.offset[1],
 	     op->base.dst.x, op->base.dst.y));
 
-	sna_vertex_lock(&sna->render);
 	do {
 		int nbox_this_time;
 		float *v;
 
-		nbox_this_time = gen8_get_rectangles(sna, &op->base, nbox,
-						     gen8_emit_composite_state);
-		assert(nbox_this_time);
+		nbox_this_time = nbox;
+		v = sna_vertex_reserve__thread(sna, &op->base, op->base.floats_per_rect,
+					       3, true,
+					       &nbox_this_time, gen8_get_rectangles__thread);
 		nbox -= nbox_this_time;
 
-		v = sna->render.vertices + sna->render.vertex_used;
-		sna->render.vertex_used += nbox_this_time * op->base.floats_per_rect;
-
-		sna_vertex_acquire__locked(&sna->render);
-		sna_vertex_unlock(&sna->render);
-
 		op->emit_boxes(op, box, nbox_this_time, v);
 		box += nbox_this_time;
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 	} while (nbox);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void
@@ -2745,11 +3001,9 @@ gen8_emit_copy_state(struct sna *sna,
 			     op->src.card_format,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen8.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += SURFACE_DW;
-		offset = sna->render_state.gen8.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen8.binding_cache,
+					  offset, SURFACE_DW);
 
 	if (sna->kgem.batch[sna->render_state.gen8.surface_table] == binding_table[0])
 		dirty = 0;
@@ -3165,11 +3419,9 @@ gen8_emit_fill_state(struct sna *sna, const struct sna_composite_op *op)
 			     SURFACEFORMAT_B8G8R8A8_UNORM,
 			     false);
 
-	if (sna->kgem.surface == offset &&
-	    *(uint64_t *)(sna->kgem.batch + sna->render_state.gen8.surface_table) == *(uint64_t*)binding_table) {
-		sna->kgem.surface += SURFACE_DW;
-		offset = sna->render_state.gen8.surface_table;
-	}
+	offset = sna_binding_cache_lookup(sna,
+					  &sna->render_state.gen8.binding_cache,
+					  offset, SURFACE_DW);
 
 	if (sna->kgem.batch[sna->render_state.gen8.surface_table] == binding_table[0])
 		dirty = 0;
@@ -3938,6 +4190,7 @@ static void gen8_render_reset(struct sna *sna)
 	sna->render_state.gen8.emit_flush = false;
 	sna->render_state.gen8.needs_invariant = true;
 	sna->render_state.gen8.ve_id = 3 << 2;
+	sna->render_state.gen8.vs = 0;
 	sna->render_state.gen8.last_primitive = -1;
 
 	sna->render_state.gen8.num_sf_outputs = 0;
@@ -3947,6 +4200,7 @@ static void gen8_render_reset(struct sna *sna)
 	sna->render_state.gen8.drawrect_offset = -1;
 	sna->render_state.gen8.drawrect_limit = -1;
 	sna->render_state.gen8.surface_table = 0;
+	sna_binding_cache_reset(&sna->render_state.gen8.binding_cache);
 
 	if (sna->render.vbo && !kgem_bo_can_map(&sna->kgem, sna->render.vbo)) {
 		DBG(("%s: discarding unmappable vbo\n", __FUNCTION__));
@@ -4042,6 +4296,14 @@ static bool gen8_render_setup(struct sna *sna)
 
 	state->cc_blend = gen8_create_blend_state(&general);
 
+	state->vs_kernel[0] =
+		sna_static_stream_compile_vs(sna, &general,
+					     gen8_vs_kernel__rectangle);
+	state->vs_kernel[1] =
+		sna_static_stream_compile_vs(sna, &general,
+					     gen8_vs_kernel__rectangle_mask);
+	state->vs_corners = gen8_create_corners(&general);
+
 	state->general_bo = sna_static_stream_fini(sna, &general);
 	return state->general_bo != NULL;
 }
@@ -53,6 +53,18 @@
 #define GEN8_3DSTATE_SCISSOR_STATE_POINTERS	GEN8_3D(3, 0, 0x0f)
 
 #define GEN8_3DSTATE_VS				GEN8_3D(3, 0, 0x10)
+/* DW6 */
+# define VS_DISPATCH_START_GRF_SHIFT		20
+# define VS_URB_READ_LENGTH_SHIFT		11
+# define VS_URB_ENTRY_READ_OFFSET_SHIFT		4
+/* DW7 */
+# define VS_MAX_THREADS_SHIFT			23
+# define VS_STATISTICS_ENABLE			(1 << 10)
+# define VS_SIMD8_DISPATCH_ENABLE		(1 << 2)
+# define VS_ENABLE				(1 << 0)
+/* DW8 */
+# define VS_URB_OUTPUT_READ_OFFSET_SHIFT	21
+# define VS_URB_OUTPUT_LENGTH_SHIFT		16
 #define GEN8_3DSTATE_GS				GEN8_3D(3, 0, 0x11)
 #define GEN8_3DSTATE_CLIP			GEN8_3D(3, 0, 0x12)
 #define GEN8_3DSTATE_SF				GEN8_3D(3, 0, 0x13)
@@ -195,6 +207,7 @@
 #define GEN8_3DSTATE_BINDING_TABLE_EDIT_PS       GEN8_3D(3, 0, 0x47)
 
 #define GEN8_3DSTATE_VF_INSTANCING		GEN8_3D(3, 0, 0x49)
+# define VF_INSTANCING_ENABLE			(1 << 8)
 #define GEN8_3DSTATE_VF_SGVS			GEN8_3D(3, 0, 0x4a)
 # define SGVS_ENABLE_INSTANCE_ID			(1 << 31)
 # define SGVS_INSTANCE_ID_COMPONENT_SHIFT		29
@@ -59,6 +59,9 @@ void gen8_vertex_align(struct sna *sna, const struct sna_composite_op *op)
 
 void gen8_vertex_flush(struct sna *sna)
 {
+	/* Close the primitive to other threads before reading the count */
+	sna_vertex_wait__locked(&sna->render);
+
 	DBG(("%s[%x] = %d\n", __FUNCTION__,
 	     4*sna->render.vertex_offset,
 	     sna->render.vertex_index - sna->render.vertex_start));
@@ -54,6 +54,18 @@
 #define GEN9_3DSTATE_SCISSOR_STATE_POINTERS	GEN9_3D(3, 0, 0x0f)
 
 #define GEN9_3DSTATE_VS				GEN9_3D(3, 0, 0x10)
+/* DW6 */
+# define VS_DISPATCH_START_GRF_SHIFT		20
+# define VS_URB_READ_LENGTH_SHIFT		11
+# define VS_URB_ENTRY_READ_OFFSET_SHIFT		4
+/* DW7 */
+# define VS_MAX_THREADS_SHIFT			23
+# define VS_STATISTICS_ENABLE			(1 << 10)
+# define VS_SIMD8_DISPATCH_ENABLE		(1 << 2)
+# define VS_ENABLE				(1 << 0)
+/* DW8 */
+# define VS_URB_OUTPUT_READ_OFFSET_SHIFT	21
+# define VS_URB_OUTPUT_LENGTH_SHIFT		16
 #define GEN9_3DSTATE_GS				GEN9_3D(3, 0, 0x11)
 #define GEN9_3DSTATE_CLIP			GEN9_3D(3, 0, 0x12)
 #define GEN9_3DSTATE_SF				GEN9_3D(3, 0, 0x13)
@@ -201,6 +213,7 @@
 #define GEN9_3DSTATE_BINDING_TABLE_EDIT_PS       GEN9_3D(3, 0, 0x47)
 
 #define GEN9_3DSTATE_VF_INSTANCING		GEN9_3D(3, 0, 0x49)
+# define VF_INSTANCING_ENABLE			(1 << 8)
 #define GEN9_3DSTATE_VF_SGVS			GEN9_3D(3, 0, 0x4a)
 # define SGVS_ENABLE_INSTANCE_ID			(1 << 31)
 # define SGVS_INSTANCE_ID_COMPONENT_SHIFT		29
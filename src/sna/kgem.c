@@ -87,6 +87,7 @@ search_snoop_cache(struct kgem *kgem, unsigned int num_pages, unsigned flags);
 #define DBG_NO_BLT_Y 0
 #define DBG_NO_SCANOUT_Y 0
 #define DBG_NO_DIRTYFB 0
+#define DBG_NO_HW_CONTEXT 0
 #define DBG_NO_DETILING 0
 #define DBG_DUMP 0
 #define DBG_NO_MALLOC_CACHE 0
@@ -1516,6 +1517,49 @@ static bool test_can_scanout_y(struct kgem *kgem)
 	return ret;
 }
 
+struct local_i915_reset_stats {
+	uint32_t ctx_id;
+	uint32_t flags;
+	uint32_t reset_count;
+	uint32_t batch_active;
+	uint32_t batch_pending;
+	uint32_t pad;
+};
+#define LOCAL_I915_GET_RESET_STATS 0x32
+#define LOCAL_IOCTL_I915_GET_RESET_STATS DRM_IOWR(DRM_COMMAND_BASE + LOCAL_I915_GET_RESET_STATS, struct local_i915_reset_stats)
+
+static bool test_has_hw_context(struct kgem *kgem)
+{
+	struct local_i915_gem_context_create {
+		uint32_t ctx_id;
+		uint32_t pad;
+	} create;
+	struct local_i915_reset_stats stats;
+#define LOCAL_I915_GEM_CONTEXT_CREATE	0x2d
+#define LOCAL_I915_GEM_CONTEXT_DESTROY	0x2e
+#define LOCAL_IOCTL_I915_GEM_CONTEXT_CREATE DRM_IOWR(DRM_COMMAND_BASE + LOCAL_I915_GEM_CONTEXT_CREATE, struct local_i915_gem_context_create)
+#define LOCAL_IOCTL_I915_GEM_CONTEXT_DESTROY DRM_IOW(DRM_COMMAND_BASE + LOCAL_I915_GEM_CONTEXT_DESTROY, struct local_i915_gem_context_create)
+
+	if (DBG_NO_HW_CONTEXT)
+		return false;
+
+	if (kgem->gen < 060)
+		return false;
+
+	/* The render ring only preserves its state between our batches if
+	 * the kernel switches a logical context in for us; and we can only
+	 * rely upon that state if we can also tell when a GPU reset has
+	 * thrown it away.
+	 */
+	memset(&create, 0, sizeof(create));
+	if (drmIoctl(kgem->fd, LOCAL_IOCTL_I915_GEM_CONTEXT_CREATE, &create))
+		return false;
+	(void)drmIoctl(kgem->fd, LOCAL_IOCTL_I915_GEM_CONTEXT_DESTROY, &create);
+
+	memset(&stats, 0, sizeof(stats));
+	return drmIoctl(kgem->fd, LOCAL_IOCTL_I915_GET_RESET_STATS, &stats) == 0;
+}
+
 static bool test_has_dirtyfb(struct kgem *kgem)
 {
 	struct drm_mode_fb_cmd create;
@@ -2044,6 +2088,9 @@ void kgem_init(struct kgem *kgem, int fd, struct pci_device *dev, unsigned gen)
 	kgem->has_dirtyfb = test_has_dirtyfb(kgem);
 	DBG(("%s: has dirty fb? %d\n", __FUNCTION__, kgem->has_dirtyfb));
 
+	kgem->has_hw_context = test_has_hw_context(kgem);
+	DBG(("%s: has hw context? %d\n", __FUNCTION__, kgem->has_hw_context));
+
 	kgem->has_secure_batches = test_has_secure_batches(kgem);
 	DBG(("%s: can use privileged batchbuffers? %d\n", __FUNCTION__,
 	     kgem->has_secure_batches));
@@ -2902,6 +2949,7 @@ void kgem_bo_undo(struct kgem *kgem, struct kgem_bo *bo)
 	assert(RQ(bo->rq) == kgem->next_request);
 
 	bo->refcnt++;
+	kgem->context_valid = false;
 	kgem_reset(kgem);
 	bo->refcnt--;
 
@@ -2947,6 +2995,7 @@ void kgem_bo_pair_undo(struct kgem *kgem, struct kgem_bo *a, struct kgem_bo *b)
 
 	a->refcnt++;
 	b->refcnt++;
+	kgem->context_valid = false;
 	kgem_reset(kgem);
 	b->refcnt--;
 	a->refcnt--;
@@ -4182,6 +4231,7 @@ void _kgem_submit(struct kgem *kgem)
 		ret = -ENOMEM;
 
 	if (ret < 0) {
+		kgem->context_valid = false;
 		kgem_throttle(kgem);
 		if (!kgem->wedged) {
 			xf86DrvMsg(kgem_get_screen_index(kgem), X_ERROR,
@@ -4295,6 +4345,40 @@ int kgem_is_wedged(struct kgem *kgem)
 	return __kgem_throttle(kgem, true);
 }
 
+/* Report whether the state we programmed into the render context by our
+ * earlier batches may no longer be there for the next one: either we
+ * have no logical context, a batch was discarded without reaching the
+ * GPU, or a GPU reset has caught one of our batches since we last looked.
+ * Called as the next render batch is being built.
+ */
+bool kgem_context_lost(struct kgem *kgem)
+{
+	struct local_i915_reset_stats stats;
+	uint32_t resets;
+	bool lost;
+
+	if (!kgem->has_hw_context || kgem->wedged)
+		return true;
+
+	memset(&stats, 0, sizeof(stats));
+	if (drmIoctl(kgem->fd, LOCAL_IOCTL_I915_GET_RESET_STATS, &stats)) {
+		kgem->context_valid = false;
+		return true;
+	}
+
+	/* reset_count is only reported to privileged clients, but the
+	 * per-context counts of batches caught by a reset are ours.
+	 */
+	resets = stats.batch_active + stats.batch_pending;
+	lost = !kgem->context_valid || resets != kgem->context_resets;
+	DBG(("%s: resets=%d (was %d), valid? %d -> lost? %d\n", __FUNCTION__,
+	     resets, kgem->context_resets, kgem->context_valid, lost));
+
+	kgem->context_resets = resets;
+	kgem->context_valid = true;
+	return lost;
+}
+
 static void kgem_purge_cache(struct kgem *kgem)
 {
 	struct kgem_bo *bo, *next;
@@ -196,6 +196,8 @@ struct kgem {
 	uint32_t has_handle_lut :1;
 	uint32_t has_wc_mmap :1;
 	uint32_t has_dirtyfb :1;
+	uint32_t has_hw_context :1;
+	uint32_t context_valid :1;
 
 	uint32_t can_fence :1;
 	uint32_t can_blt_cpu :1;
@@ -206,6 +208,7 @@ struct kgem {
 	uint32_t needs_dirtyfb :1;
 
 	uint16_t fence_max;
+	uint32_t context_resets;
 	uint16_t half_cpu_cache_pages;
 	uint32_t aperture_total, aperture_high, aperture_low, aperture_mappable, aperture_fenceable;
 	uint32_t aperture, aperture_fenced, aperture_max_fence;
@@ -832,6 +835,7 @@ bool kgem_buffer_is_inplace(struct kgem_bo *bo);
 void kgem_buffer_read_sync(struct kgem *kgem, struct kgem_bo *bo);
 
 int kgem_is_wedged(struct kgem *kgem);
+bool kgem_context_lost(struct kgem *kgem);
 void kgem_throttle(struct kgem *kgem);
 #define MAX_INACTIVE_TIME 10
 bool kgem_expire_cache(struct kgem *kgem);
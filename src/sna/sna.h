@@ -168,7 +168,7 @@ struct sna_pixmap {
 struct sna_glyph {
 	PicturePtr atlas;
 	struct sna_coordinate coordinate;
-	uint16_t size, pos;
+	uint16_t page, pos;
 	pixman_image_t *image;
 };
 
@@ -265,6 +265,7 @@ struct sna {
 #define SNA_PERFORMANCE		0x1000
 #define SNA_POWERSAVE		0x2000
 #define SNA_NO_DPMS		0x4000
+#define SNA_ANALYTIC_COVERAGE	0x8000
 #define SNA_HAS_FLIP		0x10000
 #define SNA_HAS_ASYNC_FLIP	0x20000
 #define SNA_LINEAR_FB		0x40000
@@ -441,6 +442,8 @@ struct sna {
 	} acpi;
 
 	struct sna_render render;
+	/* glyph atlas pages kept across server regeneration */
+	struct sna_glyph_cache glyph_snapshot[2];
 
 #if DEBUG_MEMORY
 	struct {
@@ -1127,6 +1130,7 @@ void sna_composite_trapezoids(CARD8 op,
 			      INT16 xSrc, INT16 ySrc,
 			      int ntrap, xTrapezoid *traps);
 void sna_add_traps(PicturePtr picture, INT16 x, INT16 y, int n, xTrap *t);
+void sna_trapezoids_close(struct sna *sna);
 
 void sna_composite_triangles(CARD8 op,
 			     PicturePtr src,
@@ -1169,6 +1173,7 @@ void sna_glyphs__shared(CARD8 op,
 			int nlist, GlyphListPtr list, GlyphPtr *glyphs);
 void sna_glyph_unrealize(ScreenPtr screen, GlyphPtr glyph);
 void sna_glyphs_close(struct sna *sna);
+void sna_glyphs_free(struct sna *sna);
 
 void sna_read_boxes(struct sna *sna, PixmapPtr dst, struct kgem_bo *src_bo,
 		    const BoxRec *box, int n);
@@ -1212,6 +1217,13 @@ memcpy_blt(const void *src, void *dst, int bpp,
 	   int16_t dst_x, int16_t dst_y,
 	   uint16_t width, uint16_t height);
 
+void
+memcpy_blt__stream(const void *src, void *dst, int bpp,
+		   int32_t src_stride, int32_t dst_stride,
+		   int16_t src_x, int16_t src_y,
+		   int16_t dst_x, int16_t dst_y,
+		   uint16_t width, uint16_t height);
+
 void
 affine_blt(const void *src, void *dst, int bpp,
 	   int16_t src_x, int16_t src_y,
@@ -110,6 +110,8 @@
 
 #define NO_TILE_8x8 0
 #define NO_STIPPLE_8x8 0
+#define NO_FONT_ATLAS 0
+#define NO_POLYGON_SCAN 0
 
 #define IS_COW_OWNER(ptr) ((uintptr_t)(ptr) & 1)
 #define MAKE_COW_OWNER(ptr) ((void*)((uintptr_t)(ptr) | 1))
@@ -4736,6 +4738,7 @@ try_upload__tiled_x(PixmapPtr pixmap, RegionRec *region,
 {
 	struct sna *sna = to_sna_from_pixmap(pixmap);
 	struct sna_pixmap *priv = sna_pixmap(pixmap);
+	memcpy_box_func copy = memcpy_blt;
 	const BoxRec *box;
 	uint8_t *dst;
 	int n;
@@ -4765,6 +4768,7 @@ try_upload__tiled_x(PixmapPtr pixmap, RegionRec *region,
 			return false;
 
 		kgem_bo_sync__gtt(&sna->kgem, priv->gpu_bo);
+		copy = memcpy_blt__stream;
 	}
 
 	box = region_rects(region);
@@ -4825,12 +4829,12 @@ try_upload__tiled_x(PixmapPtr pixmap, RegionRec *region,
 			assert(box->x2 - x <= w);
 			assert(box->y2 - y <= h);
 
-			memcpy_blt(bits, dst,
-				   pixmap->drawable.bitsPerPixel,
-				   stride, priv->gpu_bo->pitch,
-				   box->x1 - x, box->y1 - y,
-				   box->x1, box->y1,
-				   box->x2 - box->x1, box->y2 - box->y1);
+			copy(bits, dst,
+			     pixmap->drawable.bitsPerPixel,
+			     stride, priv->gpu_bo->pitch,
+			     box->x1 - x, box->y1 - y,
+			     box->x1, box->y1,
+			     box->x2 - box->x1, box->y2 - box->y1);
 			box++;
 		} while (--n);
 
@@ -4858,6 +4862,7 @@ try_upload__inplace(PixmapPtr pixmap, RegionRec *region,
 	struct sna_pixmap *priv = sna_pixmap(pixmap);
 	bool ignore_cpu = false;
 	bool replaces;
+	memcpy_box_func copy;
 	const BoxRec *box;
 	uint8_t *dst;
 	int n;
@@ -4971,6 +4976,12 @@ try_upload__inplace(PixmapPtr pixmap, RegionRec *region,
 	priv->cpu &= priv->mapped == MAPPED_CPU;
 	assert(has_coherent_ptr(sna, priv, MOVE_WRITE));
 
+	/* The mapping stays attached as devPrivate.ptr, so later fallbacks
+	 * may read back through it. A GTT/WC mapping is uncached for them
+	 * regardless, so stream the upload past the CPU cache.
+	 */
+	copy = priv->mapped == MAPPED_CPU ? memcpy_blt : memcpy_blt__stream;
+
 	box = region_rects(region);
 	n = region_num_rects(region);
 
@@ -4999,12 +5010,12 @@ try_upload__inplace(PixmapPtr pixmap, RegionRec *region,
 		assert(box->x2 - x <= w);
 		assert(box->y2 - y <= h);
 
-		memcpy_blt(bits, dst,
-			   pixmap->drawable.bitsPerPixel,
-			   stride, priv->gpu_bo->pitch,
-			   box->x1 - x, box->y1 - y,
-			   box->x1, box->y1,
-			   box->x2 - box->x1, box->y2 - box->y1);
+		copy(bits, dst,
+		     pixmap->drawable.bitsPerPixel,
+		     stride, priv->gpu_bo->pitch,
+		     box->x1 - x, box->y1 - y,
+		     box->x1, box->y1,
+		     box->x2 - box->x1, box->y2 - box->y1);
 		box++;
 	} while (--n);
 
@@ -5141,6 +5152,12 @@ static bool ignore_cpu_damage(struct sna *sna, struct sna_pixmap *priv, const Re
 
 }
 
+static bool upload_is_large(struct sna *sna, const RegionRec *region, int stride)
+{
+	int h = region->extents.y2 - region->extents.y1;
+	return (h * stride) >> 12 >= sna->kgem.half_cpu_cache_pages;
+}
+
 static bool
 try_upload__fast(PixmapPtr pixmap, RegionRec *region,
 		 int x, int y, int w, int  h, char *bits, int stride)
@@ -5161,7 +5178,18 @@ try_upload__fast(PixmapPtr pixmap, RegionRec *region,
 			return true;
 	}
 
-	if (DAMAGE_IS_ALL(priv->cpu_damage) || priv->gpu_damage == NULL || priv->cpu) {
+	if (DAMAGE_IS_ALL(priv->cpu_damage) || priv->cpu) {
+		DBG(("%s: no, cpu damage\n", __FUNCTION__));
+		return false;
+	}
+
+	/* With nothing yet on the GPU the upload would normally go
+	 * into the shadow, costing us a full copy of the image. Once
+	 * the image is large enough to flush the cache anyway, blitting
+	 * straight from the request is the cheaper route.
+	 */
+	if (priv->gpu_damage == NULL &&
+	    (priv->gpu_bo == NULL || !upload_is_large(sna, region, stride))) {
 		DBG(("%s: no, no gpu damage\n", __FUNCTION__));
 		return false;
 	}
@@ -7740,6 +7768,143 @@ sna_fill_spans__dash_clip_boxes(DrawablePtr drawable,
 		sna_fill_spans__fill_clip_boxes(drawable, gc, n, pt, width, sorted);
 }
 
+static void
+sna_poly_fill_rect__fill(DrawablePtr drawable, GCPtr gc,
+			 int n, xRectangle *r)
+{
+	struct sna_fill_spans *data = sna_gc(gc)->priv;
+	struct sna_fill_op *op = data->op;
+	BoxRec box[512], *b = box, *const last_box = box + ARRAY_SIZE(box);
+
+	DBG(("%s: alu=%d, fg=%08lx, count=%d, clipped?=%d\n",
+	     __FUNCTION__, gc->alu, gc->fgPixel, n,
+	     !!(data->flags & IS_CLIPPED)));
+
+	/* The wide line routines emit their rectilinear pieces (and
+	 * caps) as rectangles relative to the drawable, so bring them
+	 * into the same space as the spans before clipping.
+	 */
+	while (n--) {
+		BoxRec rect;
+
+		rect.x1 = r->x + drawable->x;
+		rect.y1 = r->y + drawable->y;
+		rect.x2 = bound(rect.x1, r->width);
+		rect.y2 = bound(rect.y1, r->height);
+		r++;
+
+		if (data->flags & IS_CLIPPED) {
+			if (!box_intersect(&rect, &data->region.extents))
+				continue;
+
+			if (data->region.data) {
+				const BoxRec * const clip_start = RegionBoxptr(&data->region);
+				const BoxRec * const clip_end = clip_start + data->region.data->numRects;
+				const BoxRec *c;
+
+				c = find_clip_box_for_y(clip_start, clip_end, rect.y1);
+				while (c != clip_end) {
+					if (rect.y2 <= c->y1)
+						break;
+
+					*b = rect;
+					if (box_intersect(b, c++)) {
+						b->x1 += data->dx;
+						b->x2 += data->dx;
+						b->y1 += data->dy;
+						b->y2 += data->dy;
+						if (++b == last_box) {
+							op->boxes(data->sna, op, box, last_box - box);
+							b = box;
+						}
+					}
+				}
+				continue;
+			}
+		}
+
+		b->x1 = rect.x1 + data->dx;
+		b->x2 = rect.x2 + data->dx;
+		b->y1 = rect.y1 + data->dy;
+		b->y2 = rect.y2 + data->dy;
+		if (b->x2 > b->x1 && b->y2 > b->y1 && ++b == last_box) {
+			op->boxes(data->sna, op, box, last_box - box);
+			b = box;
+		}
+	}
+	if (b != box)
+		op->boxes(data->sna, op, box, b - box);
+}
+
+static void
+sna_poly_fill_rect__dash(DrawablePtr drawable, GCPtr gc,
+			 int n, xRectangle *r)
+{
+	struct sna_fill_spans *data = sna_gc(gc)->priv;
+	if (data->phase == gc->fgPixel)
+		sna_poly_fill_rect__fill(drawable, gc, n, r);
+}
+
+/* Only a solid DoubleDash needs to be split into a foreground and a
+ * background pass: the mi line routines switch gc->fgPixel between the
+ * dashes and we filter the spans for each pass by comparing against it.
+ * Any other solid fill uses the same colour for both dash phases.
+ */
+static inline bool
+gc_needs_dash_passes(GCPtr gc)
+{
+	return (gc->lineStyle == LineDoubleDash &&
+		gc->fillStyle == FillSolid &&
+		gc->alu != GXclear && gc->alu != GXset &&
+		gc->fgPixel != gc->bgPixel);
+}
+
+static bool
+sna_fill_spans_ops_init(struct sna_fill_spans *data, GCPtr gc, bool dash)
+{
+	if ((data->flags & IS_CLIPPED) == 0) {
+		if (dash) {
+			if (data->dx | data->dy)
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_offset;
+			else
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash;
+			sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash;
+		} else {
+			if (data->dx | data->dy)
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
+			else
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
+			sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill;
+		}
+	} else {
+		if (!region_maybe_clip(&data->region, gc->pCompositeClip))
+			return false;
+
+		if (region_is_singular(&data->region)) {
+			if (dash) {
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_clip_extents;
+				sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash_clip_extents;
+			} else {
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
+				sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_extents;
+			}
+		} else {
+			if (dash) {
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_clip_boxes;
+				sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash_clip_boxes;
+			} else {
+				sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
+				sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_boxes;
+			}
+		}
+	}
+	sna_gc_ops__tmp.PolyFillRect =
+		dash ? sna_poly_fill_rect__dash : sna_poly_fill_rect__fill;
+
+	assert(gc->miTranslate);
+	return true;
+}
+
 static bool
 sna_fill_spans_blt(DrawablePtr drawable,
 		   struct kgem_bo *bo, struct sna_damage **damage,
@@ -9814,12 +9979,15 @@ _use_line_spans(DrawablePtr drawable, GCPtr gc, const BoxRec *extents, unsigned
 	if (flags & RECTILINEAR)
 		return PREFER_GPU;
 
-	if (gc->lineStyle != LineSolid && gc->lineWidth == 0)
-		return 0;
-
+	/* Solid lines of any width or dash pattern are fed into a single
+	 * fill op, so keep them on the GPU.
+	 */
 	if (gc_is_solid(gc, &ignored))
 		return PREFER_GPU;
 
+	if (gc->lineStyle != LineSolid && gc->lineWidth == 0)
+		return 0;
+
 	return !drawable_gc_inplace_hint(drawable, gc);
 }
 
@@ -9831,6 +9999,34 @@ use_line_spans(DrawablePtr drawable, GCPtr gc, const BoxRec *extents, unsigned f
 	return ret;
 }
 
+typedef void (*sna_line_func_t)(DrawablePtr, GCPtr, int, int, DDXPointPtr);
+
+static sna_line_func_t
+sna_line_func(GCPtr gc)
+{
+	switch (gc->lineStyle) {
+	default:
+		assert(0);
+	case LineSolid:
+		if (gc->lineWidth == 0) {
+			DBG(("%s: miZeroLine\n", __FUNCTION__));
+			return miZeroLine;
+		} else {
+			DBG(("%s: miWideLine\n", __FUNCTION__));
+			return miWideLine;
+		}
+	case LineOnOffDash:
+	case LineDoubleDash:
+		if (gc->lineWidth == 0) {
+			DBG(("%s: miZeroDashLine\n", __FUNCTION__));
+			return miZeroDashLine;
+		} else {
+			DBG(("%s: miWideDash\n", __FUNCTION__));
+			return miWideDash;
+		}
+	}
+}
+
 static void
 sna_poly_line(DrawablePtr drawable, GCPtr gc,
 	      int mode, int n, DDXPointPtr pt)
@@ -9999,86 +10195,36 @@ spans_fallback:
 		get_drawable_deltas(drawable, data.pixmap, &data.dx, &data.dy);
 		sna_gc(gc)->priv = &data;
 
-		if (gc->lineWidth == 0 && gc_is_solid(gc, &color)) {
+		if (gc_is_solid(gc, &color)) {
+			sna_line_func_t line;
 			struct sna_fill_op fill;
+			bool dash = gc_needs_dash_passes(gc);
 
-			if (gc->lineStyle == LineSolid) {
-				if (!sna_fill_init_blt(&fill,
-						       data.sna, data.pixmap,
-						       data.bo, gc->alu, color,
-						       FILL_POINTS | FILL_SPANS))
-					goto fallback;
-
-				data.op = &fill;
-
-				if ((data.flags & IS_CLIPPED) == 0) {
-					if (data.dx | data.dy)
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
-					else
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
-					sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill;
-				} else {
-					if (!region_maybe_clip(&data.region,
-							       gc->pCompositeClip))
-						return;
-
-					if (region_is_singular(&data.region)) {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_extents;
-					} else {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_boxes;
-					}
-				}
-				assert(gc->miTranslate);
-
-				gc->ops = &sna_gc_ops__tmp;
-				DBG(("%s: miZeroLine (solid fill)\n", __FUNCTION__));
-				miZeroLine(drawable, gc, mode, n, pt);
-				fill.done(data.sna, &fill);
-			} else {
-				data.op = &fill;
-
-				if ((data.flags & IS_CLIPPED) == 0) {
-					if (data.dx | data.dy)
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_offset;
-					else
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash;
-					sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash;
-				} else {
-					if (!region_maybe_clip(&data.region,
-							       gc->pCompositeClip))
-						return;
+			line = sna_line_func(gc);
 
-					if (region_is_singular(&data.region)) {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_clip_extents;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash_clip_extents;
-					} else {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__dash_clip_boxes;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__dash_clip_boxes;
-					}
-				}
-				assert(gc->miTranslate);
+			if (!sna_fill_spans_ops_init(&data, gc, dash))
+				return;
 
-				DBG(("%s: miZeroLine (solid dash, clipped? %d (complex? %d)), fg pass [%08x]\n",
-				     __FUNCTION__,
-				     !!(data.flags & IS_CLIPPED), data.flags & IS_CLIPPED && !region_is_singular(&data.region),
-				     gc->fgPixel));
+			if (!sna_fill_init_blt(&fill,
+					       data.sna, data.pixmap,
+					       data.bo, gc->alu, color,
+					       FILL_POINTS | FILL_SPANS))
+				goto fallback;
 
-				if (!sna_fill_init_blt(&fill,
-						       data.sna, data.pixmap,
-						       data.bo, gc->alu, color,
-						       FILL_POINTS | FILL_SPANS))
-					goto fallback;
+			DBG(("%s: solid line (width=%d, style=%d, clipped? %d (complex? %d)), fg pass [%08x]\n",
+			     __FUNCTION__, gc->lineWidth, gc->lineStyle,
+			     !!(data.flags & IS_CLIPPED), data.flags & IS_CLIPPED && !region_is_singular(&data.region),
+			     color));
 
-				gc->ops = &sna_gc_ops__tmp;
-				data.phase = gc->fgPixel;
-				miZeroDashLine(drawable, gc, mode, n, pt);
-				fill.done(data.sna, &fill);
+			data.op = &fill;
+			data.phase = gc->fgPixel;
+			gc->ops = &sna_gc_ops__tmp;
+			line(drawable, gc, mode, n, pt);
+			fill.done(data.sna, &fill);
 
-				DBG(("%s: miZeroLine (solid dash, clipped? %d (complex? %d)), bg pass [%08x]\n",
-				     __FUNCTION__,
-				     !!(data.flags & IS_CLIPPED), data.flags & IS_CLIPPED && !region_is_singular(&data.region),
+			if (dash) {
+				DBG(("%s: solid line (width=%d, style=%d), bg pass [%08lx]\n",
+				     __FUNCTION__, gc->lineWidth, gc->lineStyle,
 				     gc->bgPixel));
 
 				if (sna_fill_init_blt(&fill,
@@ -10087,7 +10233,7 @@ spans_fallback:
 						      gc->bgPixel,
 						      FILL_POINTS | FILL_SPANS)) {
 					data.phase = gc->bgPixel;
-					miZeroDashLine(drawable, gc, mode, n, pt);
+					line(drawable, gc, mode, n, pt);
 					fill.done(data.sna, &fill);
 				}
 			}
@@ -10102,29 +10248,7 @@ spans_fallback:
 			sna_gc_ops__tmp.PolyPoint = sna_poly_point__gpu;
 			gc->ops = &sna_gc_ops__tmp;
 
-			switch (gc->lineStyle) {
-			default:
-				assert(0);
-			case LineSolid:
-				if (gc->lineWidth == 0) {
-					DBG(("%s: miZeroLine\n", __FUNCTION__));
-					miZeroLine(drawable, gc, mode, n, pt);
-				} else {
-					DBG(("%s: miWideLine\n", __FUNCTION__));
-					miWideLine(drawable, gc, mode, n, pt);
-				}
-				break;
-			case LineOnOffDash:
-			case LineDoubleDash:
-				if (gc->lineWidth == 0) {
-					DBG(("%s: miZeroDashLine\n", __FUNCTION__));
-					miZeroDashLine(drawable, gc, mode, n, pt);
-				} else {
-					DBG(("%s: miWideDash\n", __FUNCTION__));
-					miWideDash(drawable, gc, mode, n, pt);
-				}
-				break;
-			}
+			sna_line_func(gc)(drawable, gc, mode, n, pt);
 		}
 
 		gc->ops = (GCOps *)&sna_gc_ops;
@@ -10894,35 +11018,22 @@ spans_fallback:
 					   use_line_spans(drawable, gc, &data.region.extents, data.flags),
 					   &data.region.extents,
 					   &data.damage))) {
-		void (*line)(DrawablePtr, GCPtr, int, int, DDXPointPtr);
+		sna_line_func_t line;
 		int i;
 
 		DBG(("%s: converting segments into spans\n", __FUNCTION__));
 
-		switch (gc->lineStyle) {
-		default:
-		case LineSolid:
-			if (gc->lineWidth == 0)
-				line = miZeroLine;
-			else
-				line = miWideLine;
-			break;
-		case LineOnOffDash:
-		case LineDoubleDash:
-			if (gc->lineWidth == 0)
-				line = miZeroDashLine;
-			else
-				line = miWideDash;
-			break;
-		}
+		line = sna_line_func(gc);
 
 		get_drawable_deltas(drawable, data.pixmap, &data.dx, &data.dy);
 		sna_gc(gc)->priv = &data;
 
-		if (gc->lineWidth == 0 &&
-		    gc->lineStyle == LineSolid &&
-		    gc_is_solid(gc, &color)) {
+		if (gc_is_solid(gc, &color)) {
 			struct sna_fill_op fill;
+			bool dash = gc_needs_dash_passes(gc);
+
+			if (!sna_fill_spans_ops_init(&data, gc, dash))
+				return;
 
 			if (!sna_fill_init_blt(&fill,
 					       data.sna, data.pixmap,
@@ -10931,33 +11042,24 @@ spans_fallback:
 				goto fallback;
 
 			data.op = &fill;
-
-			if ((data.flags & IS_CLIPPED) == 0) {
-				if (data.dx | data.dy)
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
-				else
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
-				sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill;
-			} else {
-				if (!region_maybe_clip(&data.region,
-						       gc->pCompositeClip))
-					return;
-
-				if (region_is_singular(&data.region)) {
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
-					sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_extents;
-				} else {
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
-					sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_boxes;
-				}
-			}
-			assert(gc->miTranslate);
+			data.phase = gc->fgPixel;
 			gc->ops = &sna_gc_ops__tmp;
 			for (i = 0; i < n; i++)
 				line(drawable, gc, CoordModeOrigin, 2,
 				     (DDXPointPtr)&seg[i]);
-
 			fill.done(data.sna, &fill);
+
+			if (dash &&
+			    sna_fill_init_blt(&fill,
+					      data.sna, data.pixmap,
+					      data.bo, gc->alu, gc->bgPixel,
+					      FILL_POINTS | FILL_SPANS)) {
+				data.phase = gc->bgPixel;
+				for (i = 0; i < n; i++)
+					line(drawable, gc, CoordModeOrigin, 2,
+					     (DDXPointPtr)&seg[i]);
+				fill.done(data.sna, &fill);
+			}
 		} else {
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
 			sna_gc_ops__tmp.PolyFillRect = sna_poly_fill_rect__gpu;
@@ -11729,34 +11831,22 @@ sna_poly_arc(DrawablePtr drawable, GCPtr gc, int n, xArc *arc)
 			if (gc->lineStyle == LineSolid) {
 				struct sna_fill_op fill;
 
+				if (!sna_fill_spans_ops_init(&data, gc, false))
+					return;
+
 				if (!sna_fill_init_blt(&fill,
 						       data.sna, data.pixmap,
 						       data.bo, gc->alu, color,
 						       FILL_POINTS | FILL_SPANS))
 					goto fallback;
 
-				if ((data.flags & IS_CLIPPED) == 0) {
-					if (data.dx | data.dy)
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
-					else
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
-					sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill;
-				} else {
-					if (!region_maybe_clip(&data.region,
-							       gc->pCompositeClip))
-						return;
-
-					if (region_is_singular(&data.region)) {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_extents;
-					} else {
-						sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
-						sna_gc_ops__tmp.PolyPoint = sna_poly_point__fill_clip_boxes;
-					}
-				}
-
 				data.op = &fill;
 				gc->ops = &sna_gc_ops__tmp;
+				/* Wide arcs stay with miPolyArc() on purpose:
+				 * duplicating its geometry pixel for pixel is
+				 * not worth it when its spans already land in
+				 * the fill op through sna_gc_ops__tmp.
+				 */
 				if (gc->lineWidth == 0)
 					miZeroPolyArc(drawable, gc, n, arc);
 				else
@@ -11770,6 +11860,7 @@ sna_poly_arc(DrawablePtr drawable, GCPtr gc, int n, xArc *arc)
 					return;
 
 				sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
+				sna_gc_ops__tmp.PolyFillRect = sna_poly_fill_rect__gpu;
 				sna_gc_ops__tmp.PolyPoint = sna_poly_point__gpu;
 
 				gc->ops = &sna_gc_ops__tmp;
@@ -12086,65 +12177,353 @@ use_fill_spans(DrawablePtr drawable, GCPtr gc, const BoxRec *extents, unsigned f
 	return ret;
 }
 
-static void
-sna_poly_fill_polygon(DrawablePtr draw, GCPtr gc,
-		      int shape, int mode,
-		      int n, DDXPointPtr pt)
-{
-	struct sna_fill_spans data;
-	struct sna_pixmap *priv;
+/* Core polygons are sampled at the integer pixel coordinates: an edge
+ * from (x0, y0) down to (x1, y1) covers the rows [y0, y1) and on row
+ * y0 + k sits at x0 + ceil(k * (x1 - x0) / (y1 - y0)), which is exactly
+ * where the Bresenham stepping in mipolyutil lands. Each span then runs
+ * from its left edge up to, but excluding, its right edge. This is the
+ * same active edge walk as the mono trapezoid rasteriser, just without
+ * the fixed point subsampling, so the spans (or whole bands of them when
+ * every active edge is vertical) go straight into the fill op as boxes.
+ */
+struct sna_poly_edge {
+	struct sna_poly_edge *next;
+	int height_left;
+	int dir;
+	int x, e;
+	int dxdy, rem, dy;
+};
 
-	DBG(("%s(n=%d, PlaneMask: %lx (solid %d), solid fill: %d [style=%d, tileIsPixel=%d], alu=%d)\n", __FUNCTION__,
-	     n, gc->planemask, !!PM_IS_SOLID(draw, gc->planemask),
-	     (gc->fillStyle == FillSolid ||
-	      (gc->fillStyle == FillTiled && gc->tileIsPixel)),
-	     gc->fillStyle, gc->tileIsPixel,
-	     gc->alu));
-	DBG(("%s: draw=%ld, offset=(%d, %d), size=%dx%d\n",
-	     __FUNCTION__, draw->serialNumber,
-	     draw->x, draw->y, draw->width, draw->height));
+struct sna_poly_scan {
+	struct sna_poly_edge *edges;
+	struct sna_poly_edge **y_buckets;
+	struct sna_poly_edge *active;
+	int num_edges;
+	int ymin, ymax;
+	int mask;
 
-	data.flags = sna_poly_point_extents(draw, gc, mode, n, pt,
-					    &data.region.extents);
-	if (data.flags == 0) {
-		DBG(("%s, nothing to do\n", __FUNCTION__));
-		return;
-	}
+	DrawablePtr draw;
+	GCPtr gc;
+	xRectangle *r;
 
-	DBG(("%s: extents(%d, %d), (%d, %d), flags=%x\n", __FUNCTION__,
-	     data.region.extents.x1, data.region.extents.y1,
-	     data.region.extents.x2, data.region.extents.y2,
-	     data.flags));
+	xRectangle rects[256];
+	struct sna_poly_edge edges_embedded[64];
+	struct sna_poly_edge *y_buckets_embedded[256];
+};
 
-	data.region.data = NULL;
+static inline int
+floor_divrem(int64_t num, int den, int *rem)
+{
+	int64_t quo = num / den;
 
-	if (FORCE_FALLBACK)
-		goto fallback;
+	assert(den > 0);
+	num -= quo * den;
+	if (num < 0) {
+		quo--;
+		num += den;
+	}
+	*rem = num;
+	return quo;
+}
 
-	if (!ACCEL_POLY_FILL_POLYGON)
-		goto fallback;
+static void
+sna_poly_scan_add_edge(struct sna_poly_scan *scan,
+		       const DDXPointRec *p0, const DDXPointRec *p1)
+{
+	const DDXPointRec *top, *bot;
+	struct sna_poly_edge *e;
+	int ytop, ybot, dx, dy, dir;
 
-	data.pixmap = get_drawable_pixmap(draw);
-	data.sna = to_sna_from_pixmap(data.pixmap);
-	priv = sna_pixmap(data.pixmap);
-	if (priv == NULL) {
-		DBG(("%s: fallback -- unattached\n", __FUNCTION__));
-		goto fallback;
-	}
+	if (p0->y == p1->y)
+		return;
 
-	if (wedged(data.sna)) {
-		DBG(("%s: fallback -- wedged\n", __FUNCTION__));
-		goto fallback;
+	if (p0->y < p1->y) {
+		top = p0, bot = p1;
+		dir = 1;
+	} else {
+		top = p1, bot = p0;
+		dir = -1;
 	}
 
-	if (!PM_IS_SOLID(draw, gc->planemask))
-		goto fallback;
+	ytop = top->y;
+	ybot = bot->y;
+	if (ytop >= scan->ymax || ybot <= scan->ymin)
+		return;
 
-	if ((data.bo = sna_drawable_use_bo(draw,
-					   use_fill_spans(draw, gc, &data.region.extents, data.flags),
-					   &data.region.extents,
-					   &data.damage))) {
-		uint32_t color;
+	dx = bot->x - top->x;
+	dy = ybot - ytop;
+
+	e = &scan->edges[scan->num_edges++];
+	e->dir = dir;
+	e->dy = dy;
+	e->dxdy = floor_divrem(dx, dy, &e->rem);
+	if (ytop < scan->ymin) {
+		e->x = top->x + floor_divrem((int64_t)dx * (scan->ymin - ytop) + dy - 1,
+					     dy, &e->e);
+		ytop = scan->ymin;
+	} else {
+		e->x = top->x;
+		e->e = dy - 1;
+	}
+	if (ybot > scan->ymax)
+		ybot = scan->ymax;
+	e->height_left = ybot - ytop;
+
+	e->next = scan->y_buckets[ytop - scan->ymin];
+	scan->y_buckets[ytop - scan->ymin] = e;
+}
+
+static inline void
+sna_poly_scan_insert(struct sna_poly_edge **head, struct sna_poly_edge *e)
+{
+	while (*head && (*head)->x < e->x)
+		head = &(*head)->next;
+	e->next = *head;
+	*head = e;
+}
+
+static void
+sna_poly_scan_flush(struct sna_poly_scan *scan)
+{
+	if (scan->r != scan->rects)
+		sna_poly_fill_rect__fill(scan->draw, scan->gc,
+					 scan->r - scan->rects, scan->rects);
+	scan->r = scan->rects;
+}
+
+static void
+sna_poly_scan_row(struct sna_poly_scan *scan, int y, int h)
+{
+	struct sna_poly_edge *e = scan->active;
+
+	while (e) {
+		int x1 = e->x, x2, winding = 0;
+
+		/* Merge abutting spans as we go */
+		do {
+			do {
+				winding += e->dir;
+				x2 = e->x;
+				e = e->next;
+			} while (e && (winding & scan->mask));
+		} while (e && e->x == x2);
+
+		if (x2 > x1) {
+			scan->r->x = x1;
+			scan->r->y = y;
+			scan->r->width = x2 - x1;
+			scan->r->height = h;
+			if (++scan->r == scan->rects + ARRAY_SIZE(scan->rects))
+				sna_poly_scan_flush(scan);
+		}
+	}
+}
+
+static void
+sna_poly_scan_step(struct sna_poly_scan *scan, int h)
+{
+	struct sna_poly_edge **p = &scan->active, *prev = NULL, *e;
+
+	while ((e = *p)) {
+		e->height_left -= h;
+		if (e->height_left == 0) {
+			*p = e->next;
+			continue;
+		}
+
+		if (h == 1) {
+			e->x += e->dxdy;
+			e->e += e->rem;
+			if (e->e >= e->dy) {
+				e->x++;
+				e->e -= e->dy;
+			}
+		} else
+			assert((e->dxdy | e->rem) == 0);
+
+		/* Edges only cross occasionally, so keep the list sorted
+		 * by bubbling the odd one back into place.
+		 */
+		if (prev && e->x < prev->x) {
+			*p = e->next;
+			sna_poly_scan_insert(&scan->active, e);
+			continue;
+		}
+
+		prev = e;
+		p = &e->next;
+	}
+}
+
+static void
+sna_poly_scan_render(struct sna_poly_scan *scan)
+{
+	int y = scan->ymin;
+
+	while (y < scan->ymax) {
+		struct sna_poly_edge *e, *next;
+		int h, i;
+
+		for (e = scan->y_buckets[y - scan->ymin]; e; e = next) {
+			next = e->next;
+			sna_poly_scan_insert(&scan->active, e);
+		}
+
+		if (scan->active == NULL) {
+			y++;
+			continue;
+		}
+
+		/* Emit whole bands whilst nothing changes */
+		h = scan->ymax - y;
+		for (e = scan->active; e; e = e->next) {
+			if (e->dxdy | e->rem) {
+				h = 1;
+				break;
+			}
+			if (e->height_left < h)
+				h = e->height_left;
+		}
+		for (i = 1; i < h; i++) {
+			if (scan->y_buckets[y + i - scan->ymin]) {
+				h = i;
+				break;
+			}
+		}
+
+		__DBG(("%s: y=%d, h=%d\n", __FUNCTION__, y, h));
+		sna_poly_scan_row(scan, y, h);
+		sna_poly_scan_step(scan, h);
+		y += h;
+	}
+}
+
+static bool
+sna_poly_fill_polygon__fill(DrawablePtr draw, GCPtr gc,
+			    int mode, int n, DDXPointPtr pt,
+			    const BoxRec *extents)
+{
+	struct sna_poly_scan scan;
+	DDXPointRec first, last, cur;
+	int i;
+
+	scan.ymin = extents->y1 - draw->y;
+	scan.ymax = extents->y2 - draw->y;
+	DBG(("%s: n=%d, mode=%d, rule=%d, rows [%d, %d)\n",
+	     __FUNCTION__, n, mode, gc->fillRule, scan.ymin, scan.ymax));
+	if (scan.ymin >= scan.ymax)
+		return true;
+
+	scan.edges = scan.edges_embedded;
+	if (n > ARRAY_SIZE(scan.edges_embedded)) {
+		scan.edges = malloc(sizeof(struct sna_poly_edge) * n);
+		if (scan.edges == NULL)
+			return false;
+	}
+
+	scan.y_buckets = scan.y_buckets_embedded;
+	if (scan.ymax - scan.ymin > ARRAY_SIZE(scan.y_buckets_embedded)) {
+		scan.y_buckets = malloc(sizeof(struct sna_poly_edge *) *
+					(scan.ymax - scan.ymin));
+		if (scan.y_buckets == NULL) {
+			if (scan.edges != scan.edges_embedded)
+				free(scan.edges);
+			return false;
+		}
+	}
+	memset(scan.y_buckets, 0,
+	       sizeof(struct sna_poly_edge *) * (scan.ymax - scan.ymin));
+
+	scan.num_edges = 0;
+	scan.active = NULL;
+	scan.mask = gc->fillRule == WindingRule ? ~0 : 1;
+	scan.draw = draw;
+	scan.gc = gc;
+	scan.r = scan.rects;
+
+	/* As with mi, relative coordinates accumulate (and wrap) as int16 */
+	first = last = *pt++;
+	for (i = 1; i < n; i++) {
+		cur = *pt++;
+		if (mode == CoordModePrevious) {
+			cur.x += last.x;
+			cur.y += last.y;
+		}
+		sna_poly_scan_add_edge(&scan, &last, &cur);
+		last = cur;
+	}
+	sna_poly_scan_add_edge(&scan, &last, &first);
+
+	if (scan.num_edges)
+		sna_poly_scan_render(&scan);
+	sna_poly_scan_flush(&scan);
+
+	if (scan.y_buckets != scan.y_buckets_embedded)
+		free(scan.y_buckets);
+	if (scan.edges != scan.edges_embedded)
+		free(scan.edges);
+	return true;
+}
+
+static void
+sna_poly_fill_polygon(DrawablePtr draw, GCPtr gc,
+		      int shape, int mode,
+		      int n, DDXPointPtr pt)
+{
+	struct sna_fill_spans data;
+	struct sna_pixmap *priv;
+
+	DBG(("%s(n=%d, PlaneMask: %lx (solid %d), solid fill: %d [style=%d, tileIsPixel=%d], alu=%d)\n", __FUNCTION__,
+	     n, gc->planemask, !!PM_IS_SOLID(draw, gc->planemask),
+	     (gc->fillStyle == FillSolid ||
+	      (gc->fillStyle == FillTiled && gc->tileIsPixel)),
+	     gc->fillStyle, gc->tileIsPixel,
+	     gc->alu));
+	DBG(("%s: draw=%ld, offset=(%d, %d), size=%dx%d\n",
+	     __FUNCTION__, draw->serialNumber,
+	     draw->x, draw->y, draw->width, draw->height));
+
+	data.flags = sna_poly_point_extents(draw, gc, mode, n, pt,
+					    &data.region.extents);
+	if (data.flags == 0) {
+		DBG(("%s, nothing to do\n", __FUNCTION__));
+		return;
+	}
+
+	DBG(("%s: extents(%d, %d), (%d, %d), flags=%x\n", __FUNCTION__,
+	     data.region.extents.x1, data.region.extents.y1,
+	     data.region.extents.x2, data.region.extents.y2,
+	     data.flags));
+
+	data.region.data = NULL;
+
+	if (FORCE_FALLBACK)
+		goto fallback;
+
+	if (!ACCEL_POLY_FILL_POLYGON)
+		goto fallback;
+
+	data.pixmap = get_drawable_pixmap(draw);
+	data.sna = to_sna_from_pixmap(data.pixmap);
+	priv = sna_pixmap(data.pixmap);
+	if (priv == NULL) {
+		DBG(("%s: fallback -- unattached\n", __FUNCTION__));
+		goto fallback;
+	}
+
+	if (wedged(data.sna)) {
+		DBG(("%s: fallback -- wedged\n", __FUNCTION__));
+		goto fallback;
+	}
+
+	if (!PM_IS_SOLID(draw, gc->planemask))
+		goto fallback;
+
+	if ((data.bo = sna_drawable_use_bo(draw,
+					   use_fill_spans(draw, gc, &data.region.extents, data.flags),
+					   &data.region.extents,
+					   &data.damage))) {
+		uint32_t color;
 
 		sna_gc(gc)->priv = &data;
 		get_drawable_deltas(draw, data.pixmap, &data.dx, &data.dy);
@@ -12152,33 +12531,22 @@ sna_poly_fill_polygon(DrawablePtr draw, GCPtr gc,
 		if (gc_is_solid(gc, &color)) {
 			struct sna_fill_op fill;
 
+			if (!sna_fill_spans_ops_init(&data, gc, false))
+				return;
+
 			if (!sna_fill_init_blt(&fill,
 					       data.sna, data.pixmap,
 					       data.bo, gc->alu, color,
-					       FILL_SPANS))
+					       FILL_BOXES))
 				goto fallback;
 
 			data.op = &fill;
-
-			if ((data.flags & IS_CLIPPED) == 0) {
-				if (data.dx | data.dy)
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
-				else
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
-			} else {
-				if (!region_maybe_clip(&data.region,
-						       gc->pCompositeClip))
-					return;
-
-				if (region_is_singular(&data.region))
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
-				else
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
-			}
-			assert(gc->miTranslate);
 			gc->ops = &sna_gc_ops__tmp;
 
-			miFillPolygon(draw, gc, shape, mode, n, pt);
+			if (NO_POLYGON_SCAN ||
+			    !sna_poly_fill_polygon__fill(draw, gc, mode, n, pt,
+							 &data.region.extents))
+				miFillPolygon(draw, gc, shape, mode, n, pt);
 			fill.done(data.sna, &fill);
 		} else {
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
@@ -15185,6 +15553,144 @@ sna_poly_fill_rect__gpu(DrawablePtr draw, GCPtr gc, int n, xRectangle *r)
 	}
 }
 
+#define FULL_CIRCLE (360 * 64)
+
+static inline bool
+arc_is_empty(const xArc *arc)
+{
+	return (arc->angle2 == 0 ||
+		arc->width == 0 || arc->height == 0 ||
+		(arc->width == 1 && arc->height & 1));
+}
+
+/* Complete ellipses that miFillEllipseI() would have scan converted with
+ * integer arithmetic (i.e. circles or anything small enough not to
+ * overflow its error terms).
+ */
+static inline bool
+arc_is_filled_ellipse(const xArc *arc)
+{
+	if (arc->angle2 < FULL_CIRCLE && arc->angle2 > -FULL_CIRCLE)
+		return false;
+
+	return (arc->width == arc->height ||
+		(arc->width <= 800 && arc->height <= 800));
+}
+
+/* Walk the ellipse using the same error terms as miFillEllipseI() so that
+ * we hit exactly the same pixels, but coalesce the runs of identical spans
+ * along the flanks of the ellipse into rectangles and feed those straight
+ * into the fill op, skipping the FillSpans callback per scanline.
+ */
+static void
+sna_poly_fill_ellipse__fill(DrawablePtr drawable, GCPtr gc, const xArc *arc)
+{
+	xRectangle rect[256], *r = rect, upper, lower;
+	int x, y, e, xk, xm, yk, ym, dx, dy, xorg, yorg;
+
+	DBG(("%s: (%d, %d)x(%d, %d)\n", __FUNCTION__,
+	     arc->x, arc->y, arc->width, arc->height));
+
+	y = arc->height >> 1;
+	dy = arc->height & 1;
+	yorg = arc->y + y;
+	dx = arc->width & 1;
+	xorg = arc->x + (arc->width >> 1) + dx;
+	dx = 1 - dx;
+	if (arc->width == arc->height) {
+		ym = 8;
+		xm = 8;
+		yk = y << 3;
+		if (!dx) {
+			xk = 0;
+			e = -1;
+		} else {
+			y++;
+			yk += 4;
+			xk = -4;
+			e = -(y << 3);
+		}
+	} else {
+		ym = (arc->width * arc->width) << 3;
+		xm = (arc->height * arc->height) << 3;
+		yk = y * ym;
+		if (!dy)
+			yk -= ym >> 1;
+		if (!dx) {
+			xk = 0;
+			e = -(xm >> 3);
+		} else {
+			y++;
+			yk += ym;
+			xk = -(xm >> 1);
+			e = xk - yk;
+		}
+	}
+	x = 0;
+
+#define ADD_RECT(R) do { \
+	if ((R).height) { \
+		*r++ = (R); \
+		if (r == rect + ARRAY_SIZE(rect)) { \
+			sna_poly_fill_rect__fill(drawable, gc, r - rect, rect); \
+			r = rect; \
+		} \
+	} \
+} while (0)
+
+	upper.height = lower.height = 0;
+	while (y > 0) {
+		int slw;
+
+		e += yk;
+		while (e >= 0) {
+			x++;
+			xk -= xm;
+			e += xk;
+		}
+		y--;
+		yk -= ym;
+		slw = (x << 1) + dx;
+		if (e == xk && slw > 1)
+			slw--;
+		if (slw <= 0)
+			continue;
+
+		if (upper.height &&
+		    upper.x == xorg - x && upper.width == slw &&
+		    upper.y + upper.height == yorg - y) {
+			upper.height++;
+		} else {
+			ADD_RECT(upper);
+			upper.x = xorg - x;
+			upper.y = yorg - y;
+			upper.width = slw;
+			upper.height = 1;
+		}
+
+		if (y + dy != 0 && (slw > 1 || e != xk)) {
+			if (lower.height &&
+			    lower.x == xorg - x && lower.width == slw &&
+			    lower.y == yorg + y + dy + 1) {
+				lower.y--;
+				lower.height++;
+			} else {
+				ADD_RECT(lower);
+				lower.x = xorg - x;
+				lower.y = yorg + y + dy;
+				lower.width = slw;
+				lower.height = 1;
+			}
+		}
+	}
+	ADD_RECT(upper);
+	ADD_RECT(lower);
+#undef ADD_RECT
+
+	if (r != rect)
+		sna_poly_fill_rect__fill(drawable, gc, r - rect, rect);
+}
+
 static void
 sna_poly_fill_arc(DrawablePtr draw, GCPtr gc, int n, xArc *arc)
 {
@@ -15243,6 +15749,10 @@ sna_poly_fill_arc(DrawablePtr draw, GCPtr gc, int n, xArc *arc)
 
 		if (gc_is_solid(gc, &color)) {
 			struct sna_fill_op fill;
+			int i, j;
+
+			if (!sna_fill_spans_ops_init(&data, gc, false))
+				return;
 
 			if (!sna_fill_init_blt(&fill,
 					       data.sna, data.pixmap,
@@ -15251,26 +15761,32 @@ sna_poly_fill_arc(DrawablePtr draw, GCPtr gc, int n, xArc *arc)
 				goto fallback;
 
 			data.op = &fill;
-
-			if ((data.flags & IS_CLIPPED) == 0) {
-				if (data.dx | data.dy)
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_offset;
-				else
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill;
-			} else {
-				if (!region_maybe_clip(&data.region,
-						       gc->pCompositeClip))
-					return;
-
-				if (region_is_singular(&data.region))
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_extents;
-				else
-					sna_gc_ops__tmp.FillSpans = sna_fill_spans__fill_clip_boxes;
-			}
-			assert(gc->miTranslate);
 			gc->ops = &sna_gc_ops__tmp;
 
-			miPolyFillArc(draw, gc, n, arc);
+			/* Complete ellipses are converted directly into
+			 * boxes. Pie slices and chords are deliberately
+			 * left to miPolyFillArc(), as matching its slice
+			 * edges would mean duplicating miFillArcSliceI()
+			 * and its floating point variant; their spans still
+			 * go straight into the same fill op.
+			 */
+			for (i = 0; i < n; i = j) {
+				for (j = i; j < n; j++) {
+					if (arc_is_empty(&arc[j]) ||
+					    arc_is_filled_ellipse(&arc[j]))
+						break;
+				}
+				if (j > i) {
+					DBG(("%s: miPolyFillArc x %d\n",
+					     __FUNCTION__, j - i));
+					miPolyFillArc(draw, gc, j - i, arc + i);
+				}
+				if (j < n) {
+					if (!arc_is_empty(&arc[j]))
+						sna_poly_fill_ellipse__fill(draw, gc, &arc[j]);
+					j++;
+				}
+			}
 			fill.done(data.sna, &fill);
 		} else {
 			sna_gc_ops__tmp.FillSpans = sna_fill_spans__gpu;
@@ -15317,13 +15833,50 @@ out:
 	RegionUninit(&data.region);
 }
 
+/* Glyphs too large to be sent inline with XY_TEXT_IMMEDIATE, or large
+ * enough that a copy from the GPU is cheaper than the inline bitmap, are
+ * kept in a per-font atlas. Each page of the atlas is a linear bo
+ * shadowed by a CPU copy; new glyphs are appended to the shadow and the
+ * bo is rewritten (or replaced, if it is still busy) before its next use.
+ */
+#define FONT_ATLAS_PAGE_SIZE (64 * 1024)
+#define FONT_ATLAS_MAX_PAGES 16
+
+struct sna_font_atlas {
+	struct kgem_bo *bo;
+	uint8_t *data;
+	uint32_t used;
+	bool dirty;
+};
+
 struct sna_font {
 	CharInfoRec glyphs8[256];
 	CharInfoRec *glyphs16[256];
+	struct sna_font_atlas atlas[FONT_ATLAS_MAX_PAGES];
+	int num_atlas;
 };
 #define GLYPH_INVALID (void *)1
 #define GLYPH_EMPTY (void *)2
 
+/* Hidden header in front of the reversed glyph bits */
+struct sna_glyph_bits {
+	uint16_t page; /* 1 + index into sna_font.atlas, 0 if not cached */
+	uint16_t pad;
+	uint32_t offset;
+};
+
+static inline struct sna_glyph_bits *sna_glyph_bits(CharInfoPtr c)
+{
+	assert((uintptr_t)c->bits & ~3);
+	return (struct sna_glyph_bits *)c->bits - 1;
+}
+
+static inline void sna_glyph_free_bits(CharInfoPtr c)
+{
+	if ((uintptr_t)c->bits & ~3)
+		free(sna_glyph_bits(c));
+}
+
 static Bool
 sna_realize_font(ScreenPtr screen, FontPtr font)
 {
@@ -15347,6 +15900,7 @@ static Bool
 sna_unrealize_font(ScreenPtr screen, FontPtr font)
 {
 	struct sna_font *priv = FontGetPrivate(font, sna_font_key);
+	struct sna *sna = to_sna_from_screen(screen);
 	int i, j;
 
 	DBG(("%s (key=%d)\n", __FUNCTION__, sna_font_key));
@@ -15354,30 +15908,233 @@ sna_unrealize_font(ScreenPtr screen, FontPtr font)
 	if (priv == NULL)
 		return TRUE;
 
-	for (i = 0; i < 256; i++) {
-		if ((uintptr_t)priv->glyphs8[i].bits & ~3)
-			free(priv->glyphs8[i].bits);
-	}
+	for (i = 0; i < 256; i++)
+		sna_glyph_free_bits(&priv->glyphs8[i]);
 	for (j = 0; j < 256; j++) {
 		if (priv->glyphs16[j] == NULL)
 			continue;
 
-		for (i = 0; i < 256; i++) {
-			if ((uintptr_t)priv->glyphs16[j][i].bits & ~3)
-				free(priv->glyphs16[j][i].bits);
-		}
+		for (i = 0; i < 256; i++)
+			sna_glyph_free_bits(&priv->glyphs16[j][i]);
 		free(priv->glyphs16[j]);
 	}
+	for (i = 0; i < priv->num_atlas; i++) {
+		if (priv->atlas[i].bo)
+			kgem_bo_destroy(&sna->kgem, priv->atlas[i].bo);
+		free(priv->atlas[i].data);
+	}
 	free(priv);
 
 	FontSetPrivate(font, sna_font_key, NULL);
 	return TRUE;
 }
 
+static inline int glyph_atlas_stride(CharInfoPtr c)
+{
+	/* XY_MONO_SRC_COPY expects each row to be word aligned */
+	return ALIGN((GLYPHWIDTHPIXELS(c) + 7) >> 3, 2);
+}
+
+static bool
+sna_font_atlas_add(struct sna_font *priv, CharInfoPtr c)
+{
+	struct sna_glyph_bits *g = sna_glyph_bits(c);
+	struct sna_font_atlas *atlas;
+	int w8 = (GLYPHWIDTHPIXELS(c) + 7) >> 3;
+	int h = GLYPHHEIGHTPIXELS(c);
+	int stride = glyph_atlas_stride(c);
+	int size = ALIGN(stride * h, 8);
+	const uint8_t *src;
+	uint8_t *dst;
+
+	if (g->page)
+		return true;
+
+	if (NO_FONT_ATLAS || size > FONT_ATLAS_PAGE_SIZE)
+		return false;
+
+	atlas = NULL;
+	if (priv->num_atlas)
+		atlas = &priv->atlas[priv->num_atlas - 1];
+	if (atlas == NULL || atlas->used + size > FONT_ATLAS_PAGE_SIZE) {
+		if (priv->num_atlas == FONT_ATLAS_MAX_PAGES) {
+			DBG(("%s: font atlas full\n", __FUNCTION__));
+			return false;
+		}
+
+		atlas = &priv->atlas[priv->num_atlas];
+		atlas->data = malloc(FONT_ATLAS_PAGE_SIZE);
+		if (atlas->data == NULL)
+			return false;
+
+		atlas->bo = NULL;
+		atlas->used = 0;
+		atlas->dirty = false;
+		priv->num_atlas++;
+	}
+
+	DBG(("%s: glyph %dx%d -> page %d, offset %d\n", __FUNCTION__,
+	     GLYPHWIDTHPIXELS(c), h, (int)(atlas - priv->atlas), atlas->used));
+
+	src = (const uint8_t *)c->bits;
+	dst = atlas->data + atlas->used;
+	do {
+		memcpy(dst, src, w8);
+		if (stride > w8)
+			dst[w8] = 0;
+		src += w8;
+		dst += stride;
+	} while (--h);
+
+	g->page = atlas - priv->atlas + 1;
+	g->offset = atlas->used;
+	atlas->used += size;
+	atlas->dirty = true;
+	return true;
+}
+
+static struct kgem_bo *
+sna_font_atlas_get_bo(struct sna *sna, struct sna_font_atlas *atlas)
+{
+	if (!atlas->dirty)
+		return atlas->bo;
+
+	if (atlas->bo && __kgem_bo_is_busy(&sna->kgem, atlas->bo)) {
+		DBG(("%s: replacing busy atlas handle=%d\n",
+		     __FUNCTION__, atlas->bo->handle));
+		kgem_bo_destroy(&sna->kgem, atlas->bo);
+		atlas->bo = NULL;
+	}
+
+	if (atlas->bo == NULL) {
+		atlas->bo = kgem_create_linear(&sna->kgem,
+					       FONT_ATLAS_PAGE_SIZE, 0);
+		if (atlas->bo == NULL)
+			return NULL;
+	}
+
+	if (!kgem_bo_write(&sna->kgem, atlas->bo, atlas->data, atlas->used)) {
+		kgem_bo_destroy(&sna->kgem, atlas->bo);
+		atlas->bo = NULL;
+		return NULL;
+	}
+
+	atlas->dirty = false;
+	return atlas->bo;
+}
+
+static inline bool glyph_fits_immediate(CharInfoPtr c)
+{
+	return ((GLYPHWIDTHPIXELS(c) + 7) >> 3) * GLYPHHEIGHTPIXELS(c) <= 124;
+}
+
+static inline bool glyph_prefers_atlas(struct sna *sna, CharInfoPtr c)
+{
+	int w8 = (GLYPHWIDTHPIXELS(c) + 7) >> 3;
+	int len = (w8 * GLYPHHEIGHTPIXELS(c) + 7) >> 3 << 1;
+
+	/* Compare the inline bitmap against the cost of a mono blit */
+	return 3 + len > (sna->kgem.gen >= 0100 ? 10 : 8);
+}
+
+/* Make sure every glyph we need from the atlas is resident, before we
+ * commit anything to the batch. Returns false if a glyph cannot be sent
+ * inline and could not be placed into the atlas.
+ */
+static bool
+sna_font_atlas_prepare(struct sna *sna, struct sna_font *priv,
+		       CharInfoPtr *info, unsigned int n,
+		       bool *use_atlas)
+{
+	int i;
+
+	*use_atlas = false;
+	do {
+		CharInfoPtr c = *info++;
+
+		if (c->bits == GLYPH_EMPTY)
+			continue;
+
+		if (!glyph_prefers_atlas(sna, c))
+			continue;
+
+		if (priv == NULL || !sna_font_atlas_add(priv, c)) {
+			if (!glyph_fits_immediate(c))
+				return false;
+			continue;
+		}
+
+		*use_atlas = true;
+	} while (--n);
+
+	if (!*use_atlas)
+		return true;
+
+	for (i = 0; i < priv->num_atlas; i++) {
+		if (sna_font_atlas_get_bo(sna, &priv->atlas[i]) == NULL)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+sna_glyph_blt_setup(struct sna *sna, DrawablePtr drawable,
+		    struct kgem_bo *bo, const BoxRec *extents,
+		    uint32_t fg, uint32_t bg, uint8_t rop, bool transparent)
+{
+	uint32_t *b;
+
+	assert(sna->kgem.mode == KGEM_BLT);
+	b = sna->kgem.batch + sna->kgem.nbatch;
+	if (sna->kgem.gen >= 0100) {
+		b[0] = XY_SETUP_BLT | 3 << 20 | 8;
+		b[1] = bo->pitch;
+		if (bo->tiling) {
+			b[0] |= BLT_DST_TILED;
+			b[1] >>= 2;
+		}
+		b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
+		b[2] = extents->y1 << 16 | extents->x1;
+		b[3] = extents->y2 << 16 | extents->x2;
+		*(uint64_t *)(b+4) =
+			kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, bo,
+					 I915_GEM_DOMAIN_RENDER << 16 |
+					 I915_GEM_DOMAIN_RENDER |
+					 KGEM_RELOC_FENCED,
+					 0);
+		b[6] = bg;
+		b[7] = fg;
+		b[8] = 0;
+		b[9] = 0;
+		sna->kgem.nbatch += 10;
+	} else {
+		b[0] = XY_SETUP_BLT | 3 << 20 | 6;
+		b[1] = bo->pitch;
+		if (sna->kgem.gen >= 040 && bo->tiling) {
+			b[0] |= BLT_DST_TILED;
+			b[1] >>= 2;
+		}
+		b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
+		b[2] = extents->y1 << 16 | extents->x1;
+		b[3] = extents->y2 << 16 | extents->x2;
+		b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, bo,
+				      I915_GEM_DOMAIN_RENDER << 16 |
+				      I915_GEM_DOMAIN_RENDER |
+				      KGEM_RELOC_FENCED,
+				      0);
+		b[5] = bg;
+		b[6] = fg;
+		b[7] = 0;
+		sna->kgem.nbatch += 8;
+	}
+}
+
 static bool
 sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 	      int _x, int _y, unsigned int _n,
 	      CharInfoPtr *_info,
+	      struct sna_font *priv,
 	      RegionRec *clip,
 	      uint32_t fg, uint32_t bg,
 	      bool transparent)
@@ -15389,9 +16146,10 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 	const BoxRec *extents, *last_extents;
 	uint32_t *b;
 	int16_t dx, dy;
-	uint32_t br00;
+	uint32_t br00, br13;
 	uint16_t unwind_batch, unwind_reloc;
 	unsigned hint;
+	bool use_atlas;
 
 	uint8_t rop = transparent ? copy_ROP[gc->alu] : ROP_S;
 
@@ -15403,6 +16161,12 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 		return false;
 	}
 
+	if (!sna_font_atlas_prepare(sna, priv, _info, _n, &use_atlas)) {
+		DBG(("%s: fallback -- unable to cache large glyphs\n",
+		     __FUNCTION__));
+		return false;
+	}
+
 	if (!transparent && clip->data == NULL)
 		hint = PREFER_GPU | IGNORE_DAMAGE;
 	else
@@ -15465,54 +16229,20 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 	unwind_batch = sna->kgem.nbatch;
 	unwind_reloc = sna->kgem.nreloc;
 
-	assert(sna->kgem.mode == KGEM_BLT);
-	b = sna->kgem.batch + sna->kgem.nbatch;
-	if (sna->kgem.gen >= 0100) {
-		b[0] = XY_SETUP_BLT | 3 << 20 | 8;
-		b[1] = bo->pitch;
-		if (sna->kgem.gen >= 040 && bo->tiling) {
-			b[0] |= BLT_DST_TILED;
-			b[1] >>= 2;
-		}
-		b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
-		b[2] = extents->y1 << 16 | extents->x1;
-		b[3] = extents->y2 << 16 | extents->x2;
-		*(uint64_t *)(b+4) =
-			kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, bo,
-					 I915_GEM_DOMAIN_RENDER << 16 |
-					 I915_GEM_DOMAIN_RENDER |
-					 KGEM_RELOC_FENCED,
-					 0);
-		b[6] = bg;
-		b[7] = fg;
-		b[8] = 0;
-		b[9] = 0;
-		sna->kgem.nbatch += 10;
-	} else {
-		b[0] = XY_SETUP_BLT | 3 << 20 | 6;
-		b[1] = bo->pitch;
-		if (sna->kgem.gen >= 040 && bo->tiling) {
-			b[0] |= BLT_DST_TILED;
-			b[1] >>= 2;
-		}
-		b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
-		b[2] = extents->y1 << 16 | extents->x1;
-		b[3] = extents->y2 << 16 | extents->x2;
-		b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, bo,
-				      I915_GEM_DOMAIN_RENDER << 16 |
-				      I915_GEM_DOMAIN_RENDER |
-				      KGEM_RELOC_FENCED,
-				      0);
-		b[5] = bg;
-		b[6] = fg;
-		b[7] = 0;
-		sna->kgem.nbatch += 8;
-	}
+	sna_glyph_blt_setup(sna, drawable, bo, extents, fg, bg, rop, transparent);
 
 	br00 = XY_TEXT_IMMEDIATE_BLT;
 	if (bo->tiling && sna->kgem.gen >= 040)
 		br00 |= BLT_DST_TILED;
 
+	/* Glyphs copied from the atlas are clipped against the same
+	 * clip rectangle as set up for XY_TEXT_IMMEDIATE_BLT.
+	 */
+	br13 = bo->pitch;
+	if (bo->tiling && sna->kgem.gen >= 040)
+		br13 >>= 2;
+	br13 |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
+
 	do {
 		CharInfoPtr *info = _info;
 		int x = _x, y = _y, n = _n;
@@ -15539,81 +16269,113 @@ sna_glyph_blt(DrawablePtr drawable, GCPtr gc,
 			if (x1 + w <= extents->x1 || y1 + h <= extents->y1)
 				goto skip;
 
+			if (use_atlas && sna_glyph_bits(c)->page) {
+				const struct sna_glyph_bits *g = sna_glyph_bits(c);
+				struct kgem_bo *src = priv->atlas[g->page - 1].bo;
+
+				assert(src && !priv->atlas[g->page - 1].dirty);
+				if (!kgem_check_batch(&sna->kgem, 10) ||
+				    !kgem_check_bo_fenced(&sna->kgem, src) ||
+				    !kgem_check_reloc_and_exec(&sna->kgem, 2))
+					goto new_batch;
+
+				goto emit_atlas;
+			}
+
 			assert(len > 0);
-			if (!kgem_check_batch(&sna->kgem, 3+len)) {
-				_kgem_submit(&sna->kgem);
-				_kgem_set_mode(&sna->kgem, KGEM_BLT);
-				kgem_bcs_set_tiling(&sna->kgem, NULL, bo);
+			if (!kgem_check_batch(&sna->kgem, 3+len))
+				goto new_batch;
 
-				DBG(("%s: new batch, glyph clip box (%d, %d), (%d, %d)\n",
-				     __FUNCTION__,
-				     extents->x1, extents->y1,
-				     extents->x2, extents->y2));
+			goto emit_immediate;
 
-				unwind_batch = sna->kgem.nbatch;
-				unwind_reloc = sna->kgem.nreloc;
+new_batch:
+			_kgem_submit(&sna->kgem);
+			_kgem_set_mode(&sna->kgem, KGEM_BLT);
+			kgem_bcs_set_tiling(&sna->kgem, NULL, bo);
+
+			DBG(("%s: new batch, glyph clip box (%d, %d), (%d, %d)\n",
+			     __FUNCTION__,
+			     extents->x1, extents->y1,
+			     extents->x2, extents->y2));
+
+			unwind_batch = sna->kgem.nbatch;
+			unwind_reloc = sna->kgem.nreloc;
+
+			sna_glyph_blt_setup(sna, drawable, bo, extents,
+					    fg, bg, rop, transparent);
+
+			if (use_atlas && sna_glyph_bits(c)->page)
+				goto emit_atlas;
+
+emit_immediate:
+			assert(sna->kgem.mode == KGEM_BLT);
+			b = sna->kgem.batch + sna->kgem.nbatch;
+			sna->kgem.nbatch += 3 + len;
+
+			b[0] = br00 | (1 + len);
+			b[1] = (uint16_t)y1 << 16 | (uint16_t)x1;
+			b[2] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
+			{
+				uint64_t *src = (uint64_t *)c->bits;
+				uint64_t *dst = (uint64_t *)(b + 3);
+				do  {
+					*dst++ = *src++;
+					len -= 2;
+				} while (len);
+			}
+			goto damage;
+
+emit_atlas:
+			{
+				const struct sna_glyph_bits *g = sna_glyph_bits(c);
+				struct kgem_bo *src = priv->atlas[g->page - 1].bo;
 
 				assert(sna->kgem.mode == KGEM_BLT);
 				b = sna->kgem.batch + sna->kgem.nbatch;
 				if (sna->kgem.gen >= 0100) {
-					b[0] = XY_SETUP_BLT | 3 << 20 | 8;
-					b[1] = bo->pitch;
-					if (bo->tiling) {
+					b[0] = XY_MONO_SRC_COPY | 3 << 20 | 8;
+					if (bo->tiling)
 						b[0] |= BLT_DST_TILED;
-						b[1] >>= 2;
-					}
-					b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
-					b[2] = extents->y1 << 16 | extents->x1;
-					b[3] = extents->y2 << 16 | extents->x2;
+					b[1] = br13;
+					b[2] = (uint16_t)y1 << 16 | (uint16_t)x1;
+					b[3] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
 					*(uint64_t *)(b+4) =
 						kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 4, bo,
 								 I915_GEM_DOMAIN_RENDER << 16 |
 								 I915_GEM_DOMAIN_RENDER |
 								 KGEM_RELOC_FENCED,
 								 0);
-					b[6] = bg;
-					b[7] = fg;
-					b[8] = 0;
-					b[9] = 0;
+					*(uint64_t *)(b+6) =
+						kgem_add_reloc64(&sna->kgem, sna->kgem.nbatch + 6, src,
+								 I915_GEM_DOMAIN_RENDER << 16 |
+								 KGEM_RELOC_FENCED,
+								 g->offset);
+					b[8] = bg;
+					b[9] = fg;
 					sna->kgem.nbatch += 10;
 				} else {
-					b[0] = XY_SETUP_BLT | 3 << 20 | 6;
-					b[1] = bo->pitch;
-					if (sna->kgem.gen >= 040 && bo->tiling) {
+					b[0] = XY_MONO_SRC_COPY | 3 << 20 | 6;
+					if (sna->kgem.gen >= 040 && bo->tiling)
 						b[0] |= BLT_DST_TILED;
-						b[1] >>= 2;
-					}
-					b[1] |= 1 << 30 | transparent << 29 | blt_depth(drawable->depth) << 24 | rop << 16;
-					b[2] = extents->y1 << 16 | extents->x1;
-					b[3] = extents->y2 << 16 | extents->x2;
+					b[1] = br13;
+					b[2] = (uint16_t)y1 << 16 | (uint16_t)x1;
+					b[3] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
 					b[4] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 4, bo,
 							      I915_GEM_DOMAIN_RENDER << 16 |
 							      I915_GEM_DOMAIN_RENDER |
 							      KGEM_RELOC_FENCED,
 							      0);
-					b[5] = bg;
-					b[6] = fg;
-					b[7] = 0;
+					b[5] = kgem_add_reloc(&sna->kgem, sna->kgem.nbatch + 5, src,
+							      I915_GEM_DOMAIN_RENDER << 16 |
+							      KGEM_RELOC_FENCED,
+							      g->offset);
+					b[6] = bg;
+					b[7] = fg;
 					sna->kgem.nbatch += 8;
 				}
 			}
 
-			assert(sna->kgem.mode == KGEM_BLT);
-			b = sna->kgem.batch + sna->kgem.nbatch;
-			sna->kgem.nbatch += 3 + len;
-
-			b[0] = br00 | (1 + len);
-			b[1] = (uint16_t)y1 << 16 | (uint16_t)x1;
-			b[2] = (uint16_t)(y1+h) << 16 | (uint16_t)(x1+w);
-			{
-				uint64_t *src = (uint64_t *)c->bits;
-				uint64_t *dst = (uint64_t *)(b + 3);
-				do  {
-					*dst++ = *src++;
-					len -= 2;
-				} while (len);
-			}
-
+damage:
 			if (damage) {
 				BoxRec r;
 
@@ -15701,6 +16463,7 @@ static bool sna_set_glyph(CharInfoPtr in, CharInfoPtr out)
 	int w = GLYPHWIDTHPIXELS(in);
 	int h = GLYPHHEIGHTPIXELS(in);
 	int stride = GLYPHWIDTHBYTESPADDED(in);
+	struct sna_glyph_bits *g;
 	uint8_t *dst, *src;
 	int clear = 1;
 
@@ -15714,10 +16477,13 @@ static bool sna_set_glyph(CharInfoPtr in, CharInfoPtr out)
 
 	w = (w + 7) >> 3;
 
-	out->bits = malloc((w*h + 7) & ~7);
-	if (out->bits == NULL)
+	g = malloc(sizeof(*g) + ((w*h + 7) & ~7));
+	if (g == NULL)
 		return false;
 
+	g->page = 0;
+	out->bits = (char *)(g + 1);
+
 	VG(memset(out->bits, 0, (w*h + 7) & ~7));
 	src = (uint8_t *)in->bits;
 	dst = (uint8_t *)out->bits;
@@ -15732,7 +16498,7 @@ static bool sna_set_glyph(CharInfoPtr in, CharInfoPtr out)
 	} while (--h);
 
 	if (clear) {
-		free(out->bits);
+		free(g);
 		out->bits = GLYPH_EMPTY;
 	}
 
@@ -15837,7 +16603,8 @@ sna_poly_text8(DrawablePtr drawable, GCPtr gc,
 	if (!ACCEL_POLY_TEXT8)
 		goto fallback;
 
-	if (sna_font_too_large(gc->font))
+	/* Glyphs too large for an inline blit are sent via the font atlas */
+	if (NO_FONT_ATLAS && sna_font_too_large(gc->font))
 		goto fallback;
 
 	if (!PM_IS_SOLID(drawable, gc->planemask))
@@ -15846,7 +16613,7 @@ sna_poly_text8(DrawablePtr drawable, GCPtr gc,
 	if (!gc_is_solid(gc, &fg))
 		goto fallback;
 
-	if (!sna_glyph_blt(drawable, gc, x, y, n, info, &region, fg, -1, true)) {
+	if (!sna_glyph_blt(drawable, gc, x, y, n, info, priv, &region, fg, -1, true)) {
 fallback:
 		DBG(("%s: fallback\n", __FUNCTION__));
 		gc->font->get_glyphs(gc->font, count, (unsigned char *)chars,
@@ -15912,7 +16679,8 @@ sna_poly_text16(DrawablePtr drawable, GCPtr gc,
 	if (!ACCEL_POLY_TEXT16)
 		goto fallback;
 
-	if (sna_font_too_large(gc->font))
+	/* Glyphs too large for an inline blit are sent via the font atlas */
+	if (NO_FONT_ATLAS && sna_font_too_large(gc->font))
 		goto fallback;
 
 	if (!PM_IS_SOLID(drawable, gc->planemask))
@@ -15921,7 +16689,7 @@ sna_poly_text16(DrawablePtr drawable, GCPtr gc,
 	if (!gc_is_solid(gc, &fg))
 		goto fallback;
 
-	if (!sna_glyph_blt(drawable, gc, x, y, n, info, &region, fg, -1, true)) {
+	if (!sna_glyph_blt(drawable, gc, x, y, n, info, priv, &region, fg, -1, true)) {
 fallback:
 		DBG(("%s: fallback\n", __FUNCTION__));
 		gc->font->get_glyphs(gc->font, count, (unsigned char *)chars,
@@ -15999,13 +16767,14 @@ sna_image_text8(DrawablePtr drawable, GCPtr gc,
 	if (!ACCEL_IMAGE_TEXT8)
 		goto fallback;
 
-	if (sna_font_too_large(gc->font))
+	/* Glyphs too large for an inline blit are sent via the font atlas */
+	if (NO_FONT_ATLAS && sna_font_too_large(gc->font))
 		goto fallback;
 
 	if (!PM_IS_SOLID(drawable, gc->planemask))
 		goto fallback;
 
-	if (!sna_glyph_blt(drawable, gc, x, y, n, info, &region,
+	if (!sna_glyph_blt(drawable, gc, x, y, n, info, priv, &region,
 			   gc->fgPixel, gc->bgPixel, false)) {
 fallback:
 		DBG(("%s: fallback\n", __FUNCTION__));
@@ -16081,13 +16850,14 @@ sna_image_text16(DrawablePtr drawable, GCPtr gc,
 	if (!ACCEL_IMAGE_TEXT16)
 		goto fallback;
 
-	if (sna_font_too_large(gc->font))
+	/* Glyphs too large for an inline blit are sent via the font atlas */
+	if (NO_FONT_ATLAS && sna_font_too_large(gc->font))
 		goto fallback;
 
 	if (!PM_IS_SOLID(drawable, gc->planemask))
 		goto fallback;
 
-	if (!sna_glyph_blt(drawable, gc, x, y, n, info, &region,
+	if (!sna_glyph_blt(drawable, gc, x, y, n, info, priv, &region,
 			   gc->fgPixel, gc->bgPixel, false)) {
 fallback:
 		DBG(("%s: fallback\n", __FUNCTION__));
@@ -18292,6 +19062,8 @@ void sna_accel_enter(struct sna *sna)
 {
 	DBG(("%s\n", __FUNCTION__));
 	sna->kgem.wedged &= kgem_is_wedged(&sna->kgem);
+	/* Suspend/resume may have reinitialised the logical contexts */
+	sna->kgem.context_valid = false;
 	kgem_throttle(&sna->kgem);
 }
 
@@ -18300,6 +19072,7 @@ void sna_accel_close(struct sna *sna)
 	DBG(("%s\n", __FUNCTION__));
 
 	sna_composite_close(sna);
+	sna_trapezoids_close(sna);
 	sna_gradients_close(sna);
 	sna_glyphs_close(sna);
 
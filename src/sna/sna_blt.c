@@ -1295,15 +1295,14 @@ static void blt_composite_fill_boxes_no_offset__thread(struct sna *sna,
 			b[0] = cmd; *(uint64_t *)(b+1) = *(const uint64_t *)box++;
 		}
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 		if (!nbox)
 			break;
 
+		sna_vertex_lock(&sna->render);
 		sna_vertex_wait__locked(&sna->render);
 		sna_blt_fill_begin(sna, blt);
 	} while (1);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall static void blt_composite_fill_box(struct sna *sna,
@@ -1410,15 +1409,14 @@ static void blt_composite_fill_boxes__thread(struct sna *sna,
 			b[0] = cmd; *(uint64_t *)(b+1) = add4(box++, dx, dy);
 		}
 
-		sna_vertex_lock(&sna->render);
-		sna_vertex_release__locked(&sna->render);
+		sna_vertex_release(&sna->render);
 		if (!nbox)
 			break;
 
+		sna_vertex_lock(&sna->render);
 		sna_vertex_wait__locked(&sna->render);
 		sna_blt_fill_begin(sna, blt);
 	} while (1);
-	sna_vertex_unlock(&sna->render);
 }
 
 fastcall
@@ -647,6 +647,10 @@ static Bool sna_pre_init(ScrnInfoPtr scrn, int probe)
 		sna->flags |= SNA_FORCE_SHADOW;
 	}
 
+	if (xf86ReturnOptValBool(sna->Options, OPTION_ANALYTIC_COVERAGE, FALSE))
+		sna->flags |= SNA_ANALYTIC_COVERAGE;
+	DBG(("%s: analytic coverage? %s\n", __FUNCTION__, sna->flags & SNA_ANALYTIC_COVERAGE ? "enabled" : "disabled"));
+
 	if (!sna_mode_pre_init(scrn, sna)) {
 		xf86DrvMsg(scrn->scrnIndex, X_ERROR,
 			   "No outputs and no modes.\n");
@@ -1252,6 +1256,8 @@ static void sna_free_screen(FREE_SCREEN_ARGS_DECL)
 	sna_mode_fini(sna);
 	sna_acpi_fini(sna);
 
+	sna_glyphs_free(sna);
+
 	intel_put_device(sna->dev);
 	free(sna);
 }
@@ -67,8 +67,13 @@
 #include "sna_render_inline.h"
 #include "fb/fbpict.h"
 
+#include "intel_options.h"
+
 #define FALLBACK 0
 #define NO_GLYPH_CACHE 0
+#define NO_GLYPH_UPLOAD_BATCH 0
+#define NO_GLYPH_CACHE_LOOKUP 0
+#define NO_GLYPH_CACHE_PERSIST 0
 #define NO_GLYPHS_TO_DST 0
 #define FORCE_GLYPHS_TO_DST 0
 #define NO_GLYPHS_VIA_MASK 0
@@ -77,9 +82,9 @@
 #define DISCARD_MASK 0 /* -1 = never, 1 = always */
 
 #define CACHE_PICTURE_SIZE 1024
-#define GLYPH_MIN_SIZE 8
-#define GLYPH_MAX_SIZE 64
-#define GLYPH_CACHE_SIZE (CACHE_PICTURE_SIZE * CACHE_PICTURE_SIZE / (GLYPH_MIN_SIZE * GLYPH_MIN_SIZE))
+#define CACHE_BYTES (16 << 20) /* per format */
+#define GLYPH_MAX_SIZE 256
+#define GLYPH_SHELF_ALIGN 4
 
 #define N_STACK_GLYPHS 512
 #define NO_ATLAS ((PicturePtr)-1)
@@ -147,20 +152,155 @@ static bool op_is_bounded(uint8_t op)
 	}
 }
 
+static inline struct sna_glyph_page *
+glyph_page(struct sna_render *render, const struct sna_glyph *p)
+{
+	int page = p->page - 1;
+	return &render->glyph[page / SNA_GLYPH_PAGES].page[page % SNA_GLYPH_PAGES];
+}
+
+static inline void
+glyph_touch(struct sna_render *render, const struct sna_glyph *p)
+{
+	struct sna_glyph_cache *cache;
+
+	if (p->page == 0)
+		return;
+
+	cache = &render->glyph[(p->page - 1) / SNA_GLYPH_PAGES];
+	cache->page[(p->page - 1) % SNA_GLYPH_PAGES].age = ++cache->serial;
+	cache->stats.lookups++;
+}
+
+static inline bool
+glyph_in_alpha_atlas(const struct sna_glyph *p)
+{
+	return p->page && p->page <= SNA_GLYPH_PAGES;
+}
+
+static void
+glyph_uncache(struct sna_render *render, struct sna_glyph *p)
+{
+	struct sna_glyph_page *page = glyph_page(render, p);
+
+	DBG(("%s: releasing glyph pos %d from page %d\n",
+	     __FUNCTION__, p->pos, p->page - 1));
+	assert(page->glyphs[p->pos] == p);
+	page->glyphs[p->pos] = NULL;
+	p->atlas = NULL;
+	p->page = 0;
+}
+
+/* If the request mixes alpha-only and colour glyphs, we keep all of its
+ * glyphs in the ARGB atlas so that they can be drawn in a single run
+ * rather than bouncing between the two atlases (and their composite
+ * setups). Alpha glyphs are expanded to (a, a, a, a) which, being
+ * component-alpha, renders identically to the original a8 mask.
+ */
+static bool
+glyphs_mixed(int nlist, GlyphListPtr list)
+{
+	bool alpha = false, colour = false;
+
+	while (nlist--) {
+		if (PICT_FORMAT_RGB(list->format->format))
+			colour = true;
+		else
+			alpha = true;
+		list++;
+	}
+
+	return alpha && colour;
+}
+
+static inline int glyph_hash(const unsigned char *sha1)
+{
+	return (sha1[0] | sha1[1] << 8) & (SNA_GLYPH_HASH - 1);
+}
+
+/* Hand the atlas page over to the snapshot, keeping its bo and the
+ * record of which glyph images it holds, so that the next server
+ * generation can start with the glyphs of the last.
+ */
+static bool
+glyph_page_retain(struct sna_glyph_cache *snapshot,
+		  struct sna_glyph_page *page)
+{
+	struct sna_glyph_page *keep;
+	struct sna_pixmap *priv;
+
+	if (page->picture == NULL || page->count == 0)
+		return false;
+
+	if (snapshot->npages == SNA_GLYPH_PAGES)
+		return false;
+
+	priv = sna_pixmap((PixmapPtr)page->picture->pDrawable);
+	if (priv == NULL || priv->gpu_bo == NULL || priv->cpu_damage)
+		return false;
+
+	DBG(("%s: keeping page of %d glyphs, handle=%d\n",
+	     __FUNCTION__, page->count, priv->gpu_bo->handle));
+
+	keep = &snapshot->page[snapshot->npages++];
+	*keep = *page;
+	keep->picture = NULL;
+	keep->bo = kgem_bo_reference(priv->gpu_bo);
+	keep->age = 0;
+	memset(keep->glyphs, 0, keep->count * sizeof(*keep->glyphs));
+	return true;
+}
+
 void sna_glyphs_close(struct sna *sna)
 {
 	struct sna_render *render = &sna->render;
 	unsigned int i;
+	bool retain;
+	int n;
 
 	DBG(("%s\n", __FUNCTION__));
 
+	/* Only carry the atlas over a regeneration; on termination
+	 * there is no next generation to hand the pages to.
+	 */
+	retain = !NO_GLYPH_CACHE_PERSIST && !sna->kgem.wedged &&
+		!xf86ServerIsExiting();
+	if (retain && sna->Options)
+		retain = xf86ReturnOptValBool(sna->Options,
+					      OPTION_GLYPH_CACHE_PERSIST,
+					      TRUE);
+
 	for (i = 0; i < ARRAY_SIZE(render->glyph); i++) {
 		struct sna_glyph_cache *cache = &render->glyph[i];
 
-		if (cache->picture)
-			FreePicture(cache->picture, 0);
+		if (cache->stats.misses)
+			xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+				       "Glyph cache (%s): %u hits, %u misses, %u restored, %u evictions, %u pages\n",
+				       i ? "ARGB" : "A8",
+				       cache->stats.lookups - cache->stats.misses - cache->stats.restores,
+				       cache->stats.misses,
+				       cache->stats.restores,
+				       cache->stats.evictions, cache->stats.pages);
+
+		for (n = 0; n < cache->npages; n++) {
+			struct sna_glyph_page *page = &cache->page[n];
+			int j;
+
+			for (j = 0; j < page->count; j++) {
+				struct sna_glyph *p = page->glyphs[j];
+				if (p) {
+					p->atlas = NULL;
+					p->page = 0;
+				}
+			}
 
-		free(cache->glyphs);
+			if (!(retain && glyph_page_retain(&sna->glyph_snapshot[i], page))) {
+				free(page->glyphs);
+				free(page->slots);
+			}
+			if (page->picture)
+				FreePicture(page->picture, 0);
+		}
 	}
 	memset(render->glyph, 0, sizeof(render->glyph));
 
@@ -174,14 +314,174 @@ void sna_glyphs_close(struct sna *sna)
 	}
 }
 
-/* All caches for a single format share a single pixmap for glyph storage,
- * allowing mixing glyphs of different sizes without paying a penalty
- * for switching between source pixmaps. (Note that for a size of font
- * right at the border between two sizes, we might be switching for almost
- * every glyph.)
+static PixmapPtr
+glyph_page_pixmap(ScreenPtr screen, int depth, int bpp, struct kgem_bo *bo)
+{
+	PixmapPtr pixmap;
+
+	if (bo == NULL)
+		return screen->CreatePixmap(screen,
+					    CACHE_PICTURE_SIZE,
+					    CACHE_PICTURE_SIZE,
+					    depth,
+					    SNA_CREATE_SCRATCH);
+
+	pixmap = sna_pixmap_create_unattached(screen, 0, 0, depth);
+	if (pixmap == NullPixmap)
+		return NullPixmap;
+
+	if (!screen->ModifyPixmapHeader(pixmap,
+					CACHE_PICTURE_SIZE,
+					CACHE_PICTURE_SIZE,
+					depth, bpp,
+					bo->pitch, NULL))
+		goto err;
+
+	if (!sna_pixmap_attach_to_bo(pixmap, kgem_bo_reference(bo))) {
+		kgem_bo_destroy(&to_sna_from_screen(screen)->kgem, bo);
+		goto err;
+	}
+
+	return pixmap;
+
+err:
+	screen->DestroyPixmap(pixmap);
+	return NullPixmap;
+}
+
+static bool
+glyph_page_create(ScreenPtr screen, struct sna_glyph_cache *cache,
+		  int format, struct kgem_bo *bo)
+{
+	struct sna_glyph_page *page = &cache->page[cache->npages];
+	struct sna_pixmap *priv;
+	PixmapPtr pixmap;
+	PicturePtr picture = NULL;
+	PictFormatPtr pPictFormat;
+	CARD32 component_alpha;
+	int depth = PIXMAN_FORMAT_DEPTH(format);
+	int error;
+
+	assert(cache->npages < cache->max_pages);
+
+	pPictFormat = PictureMatchFormat(screen, depth, format);
+	if (!pPictFormat)
+		return false;
+
+	/* Now allocate the pixmap and picture */
+	pixmap = glyph_page_pixmap(screen, depth,
+				   PIXMAN_FORMAT_BPP(format), bo);
+	if (!pixmap) {
+		DBG(("%s: failed to allocate pixmap for Glyph cache\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	priv = sna_pixmap(pixmap);
+	if (priv != NULL) {
+		/* Prevent the cache from ever being paged out */
+		assert(priv->gpu_bo);
+		priv->pinned = PIN_SCANOUT;
+
+		component_alpha = NeedsComponent(pPictFormat->format);
+		picture = CreatePicture(0, &pixmap->drawable, pPictFormat,
+					CPComponentAlpha, &component_alpha,
+					serverClient, &error);
+	}
+
+	screen->DestroyPixmap(pixmap);
+	if (!picture)
+		return false;
+
+	ValidatePicture(picture);
+	assert(picture->pDrawable == &pixmap->drawable);
+
+	memset(page, 0, sizeof(*page));
+	page->picture = picture;
+	page->age = ++cache->serial;
+	cache->current = cache->npages++;
+	cache->stats.pages++;
+
+	DBG(("%s: added page %d (of %d) for format %08x\n",
+	     __FUNCTION__, cache->npages, cache->max_pages, format));
+	return true;
+}
+
+/* Adopt the atlas pages kept from the previous server generation. The
+ * glyphs themselves are long gone, but their images are still in the
+ * pages, ready to be claimed by glyph_cache_lookup() as the new clients
+ * recreate them.
+ */
+static void
+glyph_cache_restore(struct sna *sna, ScreenPtr screen,
+		    struct sna_glyph_cache *cache,
+		    struct sna_glyph_cache *snapshot,
+		    int format)
+{
+	int n;
+
+	for (n = 0; n < snapshot->npages; n++) {
+		struct sna_glyph_page *keep = &snapshot->page[n];
+
+		if (cache->npages < cache->max_pages &&
+		    glyph_page_create(screen, cache, format, keep->bo)) {
+			struct sna_glyph_page *page = &cache->page[cache->current];
+			PicturePtr picture = page->picture;
+
+			DBG(("%s: restored page %d with %d glyphs\n",
+			     __FUNCTION__, cache->current, keep->count));
+
+			*page = *keep;
+			page->picture = picture;
+			page->bo = NULL;
+			page->age = ++cache->serial;
+		} else {
+			free(keep->glyphs);
+			free(keep->slots);
+		}
+
+		kgem_bo_destroy(&sna->kgem, keep->bo);
+	}
+
+	memset(snapshot, 0, sizeof(*snapshot));
+}
+
+/* Release any atlas pages still held over from the last generation,
+ * i.e. when the screen is freed without a further sna_glyphs_create().
+ */
+void sna_glyphs_free(struct sna *sna)
+{
+	bool released = false;
+	unsigned int i;
+	int n;
+
+	DBG(("%s\n", __FUNCTION__));
+
+	for (i = 0; i < ARRAY_SIZE(sna->glyph_snapshot); i++) {
+		struct sna_glyph_cache *snapshot = &sna->glyph_snapshot[i];
+
+		for (n = 0; n < snapshot->npages; n++) {
+			struct sna_glyph_page *keep = &snapshot->page[n];
+
+			free(keep->glyphs);
+			free(keep->slots);
+			kgem_bo_destroy(&sna->kgem, keep->bo);
+			released = true;
+		}
+
+		memset(snapshot, 0, sizeof(*snapshot));
+	}
+
+	if (released)
+		kgem_cleanup_cache(&sna->kgem);
+}
+
+/* All glyphs for a single format share a small set of atlas pages for
+ * glyph storage, allowing mixing glyphs of different sizes without paying
+ * a penalty for switching between source pixmaps.
  *
- * This function allocates the storage pixmap, and then fills in the
- * rest of the allocated structures for all caches with the given format.
+ * This function allocates the first page for each format and sizes the
+ * caches; further pages are only created as the working set grows.
  */
 bool sna_glyphs_create(struct sna *sna)
 {
@@ -222,56 +522,19 @@ bool sna_glyphs_create(struct sna *sna)
 
 	for (i = 0; i < ARRAY_SIZE(formats); i++) {
 		struct sna_glyph_cache *cache = &sna->render.glyph[i];
-		struct sna_pixmap *priv;
-		PixmapPtr pixmap;
-		PicturePtr picture = NULL;
-		PictFormatPtr pPictFormat;
-		CARD32 component_alpha;
-		int depth = PIXMAN_FORMAT_DEPTH(formats[i]);
-
-		pPictFormat = PictureMatchFormat(screen, depth, formats[i]);
-		if (!pPictFormat)
-			goto bail;
-
-		/* Now allocate the pixmap and picture */
-		pixmap = screen->CreatePixmap(screen,
-					      CACHE_PICTURE_SIZE,
-					      CACHE_PICTURE_SIZE,
-					      depth,
-					      SNA_CREATE_SCRATCH);
-		if (!pixmap) {
-			DBG(("%s: failed to allocate pixmap for Glyph cache\n",
-			     __FUNCTION__));
-			goto bail;
-		}
-
-		priv = sna_pixmap(pixmap);
-		if (priv != NULL) {
-			/* Prevent the cache from ever being paged out */
-			assert(priv->gpu_bo);
-			priv->pinned = PIN_SCANOUT;
 
-			component_alpha = NeedsComponent(pPictFormat->format);
-			picture = CreatePicture(0, &pixmap->drawable, pPictFormat,
-						CPComponentAlpha, &component_alpha,
-						serverClient, &error);
-		}
-
-		screen->DestroyPixmap(pixmap);
-		if (!picture)
+		cache->max_pages = CACHE_BYTES /
+			(CACHE_PICTURE_SIZE * CACHE_PICTURE_SIZE * PIXMAN_FORMAT_BPP(formats[i]) / 8);
+		if (cache->max_pages > SNA_GLYPH_PAGES)
+			cache->max_pages = SNA_GLYPH_PAGES;
+		if (cache->max_pages < 1)
+			cache->max_pages = 1;
+
+		glyph_cache_restore(sna, screen, cache,
+				    &sna->glyph_snapshot[i], formats[i]);
+		if (cache->npages == 0 &&
+		    !glyph_page_create(screen, cache, formats[i], NULL))
 			goto bail;
-
-		ValidatePicture(picture);
-		assert(picture->pDrawable == &pixmap->drawable);
-
-		cache->count = cache->evict = 0;
-		cache->picture = picture;
-		cache->glyphs = calloc(sizeof(struct sna_glyph *),
-				       GLYPH_CACHE_SIZE);
-		if (!cache->glyphs)
-			goto bail;
-
-		cache->evict = rand() % GLYPH_CACHE_SIZE;
 	}
 
 	sna->render.white_picture =
@@ -287,22 +550,32 @@ bail:
 }
 
 static void
-glyph_cache_upload(struct sna_glyph_cache *cache,
+glyph_cache_upload(PicturePtr atlas, PicturePtr white,
 		   GlyphPtr glyph, PicturePtr glyph_picture,
 		   int16_t x, int16_t y)
 {
-	DBG(("%s: upload glyph %p to cache (%d, %d)x(%d, %d)\n",
+	DBG(("%s: upload glyph %p to cache (%d, %d)x(%d, %d), expand? %d\n",
 	     __FUNCTION__,
 	     glyph, x, y,
 	     glyph_picture->pDrawable->width,
-	     glyph_picture->pDrawable->height));
-	sna_composite(PictOpSrc,
-		      glyph_picture, 0, cache->picture,
-		      0, 0,
-		      0, 0,
-		      x, y,
-		      glyph_picture->pDrawable->width,
-		      glyph_picture->pDrawable->height);
+	     glyph_picture->pDrawable->height,
+	     white != NULL));
+	if (white)
+		sna_composite(PictOpSrc,
+			      white, glyph_picture, atlas,
+			      0, 0,
+			      0, 0,
+			      x, y,
+			      glyph_picture->pDrawable->width,
+			      glyph_picture->pDrawable->height);
+	else
+		sna_composite(PictOpSrc,
+			      glyph_picture, 0, atlas,
+			      0, 0,
+			      0, 0,
+			      x, y,
+			      glyph_picture->pDrawable->width,
+			      glyph_picture->pDrawable->height);
 }
 
 static void
@@ -368,34 +641,282 @@ glyph_count(int nlist,
 }
 #endif
 
-static inline unsigned int
-glyph_size_to_count(int size)
+/* Find room for a w x h glyph on the page, preferring the shelf that
+ * wastes the least height and opening a new shelf only if none fits.
+ */
+static bool
+glyph_page_alloc(struct sna_glyph_page *page, int w, int h,
+		 struct sna_coordinate *xy)
 {
-	size /= GLYPH_MIN_SIZE;
-	return size * size;
+	struct sna_glyph_shelf *shelf, *best = NULL;
+	int n;
+
+	for (n = 0; n < page->nshelf; n++) {
+		shelf = &page->shelf[n];
+		if (shelf->height < h || shelf->height > h + h / 2 + GLYPH_SHELF_ALIGN)
+			continue;
+		if (shelf->x + w > CACHE_PICTURE_SIZE)
+			continue;
+		if (best == NULL || shelf->height < best->height)
+			best = shelf;
+	}
+
+	if (best == NULL) {
+		h = ALIGN(h, GLYPH_SHELF_ALIGN);
+		if (page->top + h > CACHE_PICTURE_SIZE ||
+		    page->nshelf == SNA_GLYPH_SHELVES)
+			return false;
+
+		best = &page->shelf[page->nshelf++];
+		best->y = page->top;
+		best->height = h;
+		best->x = 0;
+		page->top += h;
+	}
+
+	xy->x = best->x;
+	xy->y = best->y;
+	best->x += w;
+	return true;
+}
+
+static void
+glyph_page_evict(struct sna_glyph_cache *cache, struct sna_glyph_page *page)
+{
+	int n;
+
+	DBG(("%s: evicting page %d, %d glyphs, %d shelves\n",
+	     __FUNCTION__, (int)(page - cache->page), page->count, page->nshelf));
+
+	for (n = 0; n < page->count; n++) {
+		struct sna_glyph *p = page->glyphs[n];
+		if (p) {
+			p->atlas = NULL;
+			p->page = 0;
+		}
+	}
+
+	page->count = 0;
+	page->top = 0;
+	page->nshelf = 0;
+	memset(page->hash, 0, sizeof(page->hash));
+	cache->stats.evictions++;
 }
 
-static inline unsigned int
-glyph_count_to_mask(int count)
+static struct sna_glyph_page *
+glyph_cache_alloc(ScreenPtr screen,
+		  struct sna_glyph_cache *cache, int format,
+		  int w, int h, struct sna_coordinate *xy)
 {
-	return ~(count - 1);
+	struct sna_glyph_page *page;
+	int n;
+
+	page = &cache->page[cache->current];
+	if (glyph_page_alloc(page, w, h, xy))
+		return page;
+
+	for (n = 0; n < cache->npages; n++) {
+		if (n == cache->current)
+			continue;
+
+		page = &cache->page[n];
+		if (glyph_page_alloc(page, w, h, xy)) {
+			cache->current = n;
+			return page;
+		}
+	}
+
+	if (cache->npages < cache->max_pages &&
+	    glyph_page_create(screen, cache, format, NULL)) {
+		page = &cache->page[cache->current];
+		if (glyph_page_alloc(page, w, h, xy))
+			return page;
+	}
+
+	page = &cache->page[0];
+	for (n = 1; n < cache->npages; n++)
+		if ((int32_t)(cache->page[n].age - page->age) < 0)
+			page = &cache->page[n];
+
+	glyph_page_evict(cache, page);
+	page->age = ++cache->serial;
+	cache->current = page - cache->page;
+
+	if (!glyph_page_alloc(page, w, h, xy))
+		return NULL;
+
+	return page;
 }
 
-static inline unsigned int
-glyph_size_to_mask(int size)
+/* Each slot remembers the image stored there by its sha1, so that it
+ * can be found again after its glyph has been freed. The page is marked
+ * as used now, so that it is not the next to be evicted while the glyph
+ * is still waiting to be drawn.
+ */
+static bool
+glyph_page_add(struct sna_glyph_cache *cache,
+	       struct sna_glyph_page *page, struct sna_glyph *p,
+	       GlyphPtr glyph, uint32_t format)
 {
-	return glyph_count_to_mask(glyph_size_to_count(size));
+	struct sna_glyph_slot *slot;
+	int h;
+
+	if (page->count == 0xffff)
+		return false;
+
+	if (page->count == page->size) {
+		struct sna_glyph **glyphs;
+		struct sna_glyph_slot *slots;
+		int size = page->size ? 2 * page->size : 64;
+
+		glyphs = realloc(page->glyphs, size * sizeof(*glyphs));
+		if (glyphs == NULL)
+			return false;
+		page->glyphs = glyphs;
+
+		slots = realloc(page->slots, size * sizeof(*slots));
+		if (slots == NULL)
+			return false;
+		page->slots = slots;
+
+		page->size = size;
+	}
+
+	slot = &page->slots[page->count];
+	memcpy(slot->sha1, glyph->sha1, sizeof(slot->sha1));
+	slot->format = format;
+	slot->x = p->coordinate.x;
+	slot->y = p->coordinate.y;
+	slot->width = glyph->info.width;
+	slot->height = glyph->info.height;
+
+	h = glyph_hash(glyph->sha1);
+	slot->next = page->hash[h];
+	page->hash[h] = page->count + 1;
+
+	p->pos = page->count;
+	page->glyphs[page->count++] = p;
+	page->age = ++cache->serial;
+	return true;
+}
+
+/* Glyphs come and go with their clients, and are all recreated after a
+ * server regeneration, yet their images stay in the atlas until the
+ * page is evicted. So look for an identical image, by the sha1 the
+ * server uses to share glyphs, before uploading it all over again.
+ */
+static bool
+glyph_cache_lookup(struct sna_render *render,
+		   GlyphPtr glyph, PicturePtr glyph_picture,
+		   bool mixed)
+{
+	struct sna_glyph_cache *cache;
+	int i, n, h;
+
+	if (NO_GLYPH_CACHE_LOOKUP)
+		return false;
+
+	i = mixed || PICT_FORMAT_RGB(glyph_picture->format) != 0;
+	cache = &render->glyph[i];
+	h = glyph_hash(glyph->sha1);
+
+	for (n = 0; n < cache->npages; n++) {
+		struct sna_glyph_page *page = &cache->page[n];
+		unsigned pos;
+
+		for (pos = page->hash[h]; pos; pos = page->slots[pos - 1].next) {
+			struct sna_glyph_slot *slot = &page->slots[pos - 1];
+			struct sna_glyph *p;
+
+			if (page->glyphs[pos - 1] ||
+			    slot->format != glyph_picture->format ||
+			    slot->width != glyph->info.width ||
+			    slot->height != glyph->info.height ||
+			    memcmp(slot->sha1, glyph->sha1, sizeof(slot->sha1)))
+				continue;
+
+			DBG(("%s: found glyph %p in cache %d, page %d, pos %d, (%d, %d)\n",
+			     __FUNCTION__, glyph, i, n, pos - 1, slot->x, slot->y));
+
+			p = sna_glyph(glyph);
+			p->atlas = page->picture;
+			p->page = i * SNA_GLYPH_PAGES + n + 1;
+			p->pos = pos - 1;
+			p->coordinate.x = slot->x;
+			p->coordinate.y = slot->y;
+			page->glyphs[pos - 1] = p;
+			page->age = ++cache->serial;
+			cache->stats.restores++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static struct sna_glyph_page *
+glyph_cache_reserve(ScreenPtr screen,
+		    struct sna_render *render,
+		    GlyphPtr glyph, PicturePtr glyph_picture,
+		    bool mixed)
+{
+	struct sna_glyph_cache *cache;
+	struct sna_glyph_page *page;
+	struct sna_glyph *p;
+	int i;
+
+	if (NO_GLYPH_CACHE ||
+	    glyph->info.width > GLYPH_MAX_SIZE ||
+	    glyph->info.height > GLYPH_MAX_SIZE)
+		return NULL;
+
+	i = mixed || PICT_FORMAT_RGB(glyph_picture->format) != 0;
+	cache = &render->glyph[i];
+	if (cache->npages == 0)
+		return NULL;
+
+	p = sna_glyph(glyph);
+	page = glyph_cache_alloc(screen, cache,
+				 i ? PIXMAN_a8r8g8b8 : PIXMAN_a8,
+				 glyph->info.width,
+				 glyph->info.height,
+				 &p->coordinate);
+	if (page == NULL ||
+	    !glyph_page_add(cache, page, p, glyph, glyph_picture->format))
+		return NULL;
+
+	DBG(("%s(%d): adding glyph to cache %d, page %d, pos %d, (%d, %d)\n",
+	     __FUNCTION__, screen->myNum, i, (int)(page - cache->page),
+	     p->pos, p->coordinate.x, p->coordinate.y));
+	p->atlas = page->picture;
+	p->page = i * SNA_GLYPH_PAGES + (page - cache->page) + 1;
+	cache->stats.misses++;
+	return page;
+}
+
+static inline PicturePtr
+glyph_upload_source(struct sna_render *render,
+		    const struct sna_glyph_page *page,
+		    PicturePtr glyph_picture)
+{
+	/* Alpha glyphs promoted into the ARGB atlas are expanded through
+	 * the white source.
+	 */
+	if (PICT_FORMAT_RGB(page->picture->format) &&
+	    PICT_FORMAT_RGB(glyph_picture->format) == 0)
+		return render->white_picture;
+
+	return NULL;
 }
 
 static int
 glyph_cache(ScreenPtr screen,
 	    struct sna_render *render,
-	    GlyphPtr glyph)
+	    GlyphPtr glyph, bool mixed)
 {
 	PicturePtr glyph_picture;
-	struct sna_glyph_cache *cache;
+	struct sna_glyph_page *page;
 	struct sna_glyph *p;
-	int size, mask, pos, s;
 
 	assert(glyph_valid(glyph));
 
@@ -405,9 +926,11 @@ glyph_cache(ScreenPtr screen,
 		return false;
 	}
 
-	if (NO_GLYPH_CACHE ||
-	    glyph->info.width > GLYPH_MAX_SIZE ||
-	    glyph->info.height > GLYPH_MAX_SIZE) {
+	if (glyph_cache_lookup(render, glyph, glyph_picture, mixed))
+		return true;
+
+	page = glyph_cache_reserve(screen, render, glyph, glyph_picture, mixed);
+	if (page == NULL) {
 		PixmapPtr pixmap = (PixmapPtr)glyph_picture->pDrawable;
 		assert(glyph_picture->pDrawable->type == DRAWABLE_PIXMAP);
 		if (pixmap->drawable.depth >= 8) {
@@ -418,76 +941,311 @@ glyph_cache(ScreenPtr screen,
 		/* no cache for this glyph */
 		p = sna_glyph(glyph);
 		p->atlas = glyph_picture;
+		p->page = 0;
 		p->coordinate.x = p->coordinate.y = 0;
 		return true;
 	}
 
-	for (size = GLYPH_MIN_SIZE; size <= GLYPH_MAX_SIZE; size *= 2)
-		if (glyph->info.width <= size && glyph->info.height <= size)
-			break;
+	p = sna_glyph(glyph);
+	glyph_cache_upload(page->picture,
+			   glyph_upload_source(render, page, glyph_picture),
+			   glyph, glyph_picture,
+			   p->coordinate.x, p->coordinate.y);
 
-	cache = &render->glyph[PICT_FORMAT_RGB(glyph_picture->format) != 0];
-	s = glyph_size_to_count(size);
-	mask = glyph_count_to_mask(s);
-	pos = (cache->count + s - 1) & mask;
-	if (pos < GLYPH_CACHE_SIZE) {
-		cache->count = pos + s;
-	} else {
-		p = NULL;
-		for (s = size; s <= GLYPH_MAX_SIZE; s *= 2) {
-			int i = cache->evict & glyph_size_to_mask(s);
-			p = cache->glyphs[i];
-			if (p == NULL)
-				continue;
+	return true;
+}
+
+static pixman_image_t *
+__sna_glyph_get_image(GlyphPtr g, ScreenPtr s)
+{
+	pixman_image_t *image;
+	PicturePtr p;
+	int dx, dy;
+
+	DBG(("%s: creating image cache for glyph %p (on screen %d)\n", __FUNCTION__, g, s->myNum));
+
+	p = GetGlyphPicture(g, s);
+	if (unlikely(p == NULL))
+		return NULL;
+
+	image = image_from_pict(p, FALSE, &dx, &dy);
+	if (!image)
+		return NULL;
+
+	assert(dx == 0 && dy == 0);
+	return sna_glyph(g)->image = image;
+}
+
+static inline pixman_image_t *
+sna_glyph_get_image(GlyphPtr g, ScreenPtr s)
+{
+	pixman_image_t *image;
+
+	image = sna_glyph(g)->image;
+	if (image == NULL)
+		image = __sna_glyph_get_image(g, s);
+
+	return image;
+}
+
+/* Glyphs missing from the atlas are gathered up front for the whole
+ * request, rendered on the CPU into a single staging buffer per atlas
+ * page and then copied into place with one multi-box copy, rather than
+ * being uploaded one tiny composite at a time.
+ */
+struct glyph_upload {
+	GlyphPtr glyph;
+	struct sna_glyph *p;
+	pixman_image_t *image;
+	PicturePtr picture;
+	uint16_t page;
+	BoxRec box;
+};
+
+static bool
+glyph_upload_valid(const struct glyph_upload *u)
+{
+	/* An eviction whilst gathering may have taken the slot away */
+	return (u->p->page == u->page &&
+		u->p->coordinate.x == u->box.x1 &&
+		u->p->coordinate.y == u->box.y1);
+}
+
+static bool
+glyphs_upload_page(struct sna *sna, struct sna_glyph_page *page,
+		   struct glyph_upload *u, int count)
+{
+	PixmapPtr pixmap = (PixmapPtr)page->picture->pDrawable;
+	struct sna_pixmap *priv;
+	struct kgem_bo *src_bo;
+	pixman_image_t *image;
+	DrawableRec tmp;
+	BoxRec stack_boxes[64], *boxes = stack_boxes;
+	BoxRec extents;
+	void *ptr;
+	int n;
+	bool ok;
+
+	if (count > ARRAY_SIZE(stack_boxes)) {
+		boxes = malloc(count * sizeof(BoxRec));
+		if (boxes == NULL)
+			return false;
+	}
 
-			if (p->size >= s) {
-				cache->glyphs[i] = NULL;
-				p->atlas = NULL;
-				pos = i;
+	extents = u[0].box;
+	for (n = 0; n < count; n++) {
+		boxes[n] = u[n].box;
+		if (boxes[n].x1 < extents.x1)
+			extents.x1 = boxes[n].x1;
+		if (boxes[n].x2 > extents.x2)
+			extents.x2 = boxes[n].x2;
+		if (boxes[n].y1 < extents.y1)
+			extents.y1 = boxes[n].y1;
+		if (boxes[n].y2 > extents.y2)
+			extents.y2 = boxes[n].y2;
+	}
+
+	DBG(("%s: uploading %d glyphs to page %d, extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, count, u[0].page - 1,
+	     extents.x1, extents.y1, extents.x2, extents.y2));
+
+	ok = false;
+	priv = sna_pixmap_move_to_gpu(pixmap, MOVE_READ | MOVE_WRITE);
+	if (priv == NULL)
+		goto out;
+
+	tmp.width  = extents.x2 - extents.x1;
+	tmp.height = extents.y2 - extents.y1;
+	tmp.depth  = pixmap->drawable.depth;
+	tmp.bitsPerPixel = pixmap->drawable.bitsPerPixel;
+
+	src_bo = kgem_create_buffer_2d(&sna->kgem,
+				       tmp.width, tmp.height,
+				       tmp.bitsPerPixel,
+				       KGEM_BUFFER_WRITE_INPLACE,
+				       &ptr);
+	if (src_bo == NULL)
+		goto out;
+
+	image = pixman_image_create_bits(page->picture->format,
+					 tmp.width, tmp.height,
+					 ptr, src_bo->pitch);
+	if (image == NULL) {
+		kgem_bo_destroy(&sna->kgem, src_bo);
+		goto out;
+	}
+
+	if (sigtrap_get() == 0) {
+		for (n = 0; n < count; n++) {
+			if (glyph_upload_source(&sna->render, page, u[n].picture))
+				pixman_image_composite(PIXMAN_OP_SRC,
+						       sna->render.white_image,
+						       u[n].image,
+						       image,
+						       0, 0,
+						       0, 0,
+						       boxes[n].x1 - extents.x1,
+						       boxes[n].y1 - extents.y1,
+						       boxes[n].x2 - boxes[n].x1,
+						       boxes[n].y2 - boxes[n].y1);
+			else
+				pixman_image_composite(PIXMAN_OP_SRC,
+						       u[n].image,
+						       NULL,
+						       image,
+						       0, 0,
+						       0, 0,
+						       boxes[n].x1 - extents.x1,
+						       boxes[n].y1 - extents.y1,
+						       boxes[n].x2 - boxes[n].x1,
+						       boxes[n].y2 - boxes[n].y1);
+		}
+
+		ok = sna->render.copy_boxes(sna, GXcopy,
+					    &tmp, src_bo, -extents.x1, -extents.y1,
+					    &pixmap->drawable, priv->gpu_bo, 0, 0,
+					    boxes, count, 0);
+		sigtrap_put();
+	}
+	pixman_image_unref(image);
+	kgem_bo_destroy(&sna->kgem, src_bo);
+
+	if (ok && !DAMAGE_IS_ALL(priv->gpu_damage))
+		sna_damage_add_boxes(&priv->gpu_damage, boxes, count, 0, 0);
+
+out:
+	if (boxes != stack_boxes)
+		free(boxes);
+	return ok;
+}
+
+static void
+glyphs_upload_flush(struct sna *sna, struct glyph_upload *u, int count)
+{
+	int i, j, n;
+
+	for (i = 0; i < count; i++) {
+		struct sna_glyph_page *page;
+		uint16_t id;
+
+		if (u[i].p == NULL || !glyph_upload_valid(&u[i]))
+			continue;
+
+		/* Gather the remaining uploads for this page at i */
+		id = u[i].page;
+		for (j = n = i; j < count; j++) {
+			if (u[j].p == NULL || u[j].page != id)
+				continue;
+			if (glyph_upload_valid(&u[j])) {
+				struct glyph_upload t = u[n];
+				u[n++] = u[j];
+				u[j] = t;
 			} else
-				p = NULL;
-			break;
+				u[j].p = NULL;
+		}
+
+		page = glyph_page(&sna->render, u[i].p);
+		if (!glyphs_upload_page(sna, page, &u[i], n - i)) {
+			for (j = i; j < n; j++)
+				glyph_cache_upload(page->picture,
+						   glyph_upload_source(&sna->render, page, u[j].picture),
+						   u[j].glyph, u[j].picture,
+						   u[j].box.x1, u[j].box.y1);
 		}
-		if (p == NULL) {
-			int count = glyph_size_to_count(size);
-			pos = cache->evict & glyph_count_to_mask(count);
-			for (s = 0; s < count; s++) {
-				p = cache->glyphs[pos + s];
-				if (p != NULL) {
-					p->atlas =NULL;
-					cache->glyphs[pos + s] = NULL;
+		for (j = i; j < n; j++)
+			u[j].p = NULL;
+	}
+}
+
+static void
+glyphs_upload(struct sna *sna, ScreenPtr screen,
+	      int nlist, GlyphListPtr list, GlyphPtr *glyphs,
+	      bool mixed)
+{
+	struct glyph_upload stack[64], *u = stack;
+	int count, size, n;
+
+	if (NO_GLYPH_UPLOAD_BATCH)
+		return;
+
+	size = ARRAY_SIZE(stack);
+	count = 0;
+	while (nlist--) {
+		n = list->len;
+		list++;
+		while (n--) {
+			GlyphPtr glyph = *glyphs++;
+			struct sna_glyph *p = sna_glyph(glyph);
+			struct sna_glyph_page *page;
+			struct sna_pixmap *priv;
+			PicturePtr picture;
+			pixman_image_t *image;
+
+			if (!glyph_valid(glyph))
+				continue;
+
+			if (unlikely(mixed) && glyph_in_alpha_atlas(p))
+				glyph_uncache(&sna->render, p);
+			if (p->atlas)
+				continue;
+
+			picture = GetGlyphPicture(glyph, screen);
+			if (picture == NULL)
+				continue;
+
+			if (glyph_cache_lookup(&sna->render, glyph, picture, mixed))
+				continue;
+
+			/* Only glyphs still living in system memory */
+			priv = sna_pixmap((PixmapPtr)picture->pDrawable);
+			if (priv && priv->gpu_damage)
+				continue;
+
+			image = sna_glyph_get_image(glyph, screen);
+			if (image == NULL)
+				continue;
+
+			if (count == size) {
+				struct glyph_upload *new_u;
+
+				if (u == stack) {
+					new_u = malloc(2 * size * sizeof(*u));
+					if (new_u)
+						memcpy(new_u, u, count * sizeof(*u));
+				} else
+					new_u = realloc(u, 2 * size * sizeof(*u));
+				if (new_u == NULL) {
+					glyphs_upload_flush(sna, u, count);
+					count = 0;
+				} else {
+					u = new_u;
+					size *= 2;
 				}
 			}
-		}
 
-		/* And pick a new eviction position */
-		cache->evict = rand() % GLYPH_CACHE_SIZE;
+			page = glyph_cache_reserve(screen, &sna->render,
+						   glyph, picture, mixed);
+			if (page == NULL)
+				continue;
+
+			u[count].glyph = glyph;
+			u[count].p = p;
+			u[count].image = image;
+			u[count].picture = picture;
+			u[count].page = p->page;
+			u[count].box.x1 = p->coordinate.x;
+			u[count].box.y1 = p->coordinate.y;
+			u[count].box.x2 = p->coordinate.x + glyph->info.width;
+			u[count].box.y2 = p->coordinate.y + glyph->info.height;
+			count++;
+		}
 	}
-	assert(cache->glyphs[pos] == NULL);
 
-	p = sna_glyph(glyph);
-	DBG(("%s(%d): adding glyph to cache %d, pos %d\n",
-	     __FUNCTION__, screen->myNum,
-	     PICT_FORMAT_RGB(glyph_picture->format) != 0, pos));
-	cache->glyphs[pos] = p;
-	p->atlas = cache->picture;
-	p->size = size;
-	p->pos = pos << 1 | (PICT_FORMAT_RGB(glyph_picture->format) != 0);
-	s = pos / ((GLYPH_MAX_SIZE / GLYPH_MIN_SIZE) * (GLYPH_MAX_SIZE / GLYPH_MIN_SIZE));
-	p->coordinate.x = s % (CACHE_PICTURE_SIZE / GLYPH_MAX_SIZE) * GLYPH_MAX_SIZE;
-	p->coordinate.y = (s / (CACHE_PICTURE_SIZE / GLYPH_MAX_SIZE)) * GLYPH_MAX_SIZE;
-	for (s = GLYPH_MIN_SIZE; s < GLYPH_MAX_SIZE; s *= 2) {
-		if (pos & 1)
-			p->coordinate.x += s;
-		if (pos & 2)
-			p->coordinate.y += s;
-		pos >>= 2;
-	}
-
-	glyph_cache_upload(cache, glyph, glyph_picture,
-			   p->coordinate.x, p->coordinate.y);
+	if (count)
+		glyphs_upload_flush(sna, u, count);
 
-	return true;
+	if (u != stack)
+		free(u);
 }
 
 static void apply_damage(struct sna_composite_op *op,
@@ -594,6 +1352,7 @@ glyphs_to_dst(struct sna *sna,
 	const BoxRec *rects;
 	int nrect;
 	int16_t x, y;
+	bool mixed;
 
 	if (NO_GLYPHS_TO_DST)
 		return false;
@@ -615,6 +1374,9 @@ glyphs_to_dst(struct sna *sna,
 	src_x -= list->xOff + x;
 	src_y -= list->yOff + y;
 
+	mixed = glyphs_mixed(nlist, list);
+	glyphs_upload(sna, dst->pDrawable->pScreen, nlist, list, glyphs, mixed);
+
 	glyph_atlas = NO_ATLAS;
 	while (nlist--) {
 		int n = list->len;
@@ -626,6 +1388,8 @@ glyphs_to_dst(struct sna *sna,
 			int i;
 
 			p = sna_glyph(glyph);
+			if (unlikely(mixed) && glyph_in_alpha_atlas(p))
+				glyph_uncache(&sna->render, p);
 			if (unlikely(p->atlas != glyph_atlas)) {
 				if (unlikely(!glyph_valid(glyph)))
 					goto next_glyph;
@@ -636,7 +1400,7 @@ glyphs_to_dst(struct sna *sna,
 				}
 
 				if (p->atlas == NULL &&
-				    !glyph_cache(screen, &sna->render, glyph))
+				    !glyph_cache(screen, &sna->render, glyph, mixed))
 					goto next_glyph;
 
 				if (!sna->render.composite(sna,
@@ -648,6 +1412,7 @@ glyphs_to_dst(struct sna *sna,
 
 				glyph_atlas = p->atlas;
 			}
+			glyph_touch(&sna->render, p);
 
 			if (nrect) {
 				int xi = x - glyph->info.x;
@@ -744,6 +1509,7 @@ glyphs0_to_dst(struct sna *sna,
 	struct sna_composite_op tmp;
 	ScreenPtr screen = dst->pDrawable->pScreen;
 	PicturePtr glyph_atlas = NO_ATLAS;
+	bool mixed;
 	int x, y;
 
 	if (NO_GLYPHS_TO_DST)
@@ -755,6 +1521,9 @@ glyphs0_to_dst(struct sna *sna,
 	     __FUNCTION__, op, src_x, src_y, nlist,
 	     list->xOff, list->yOff, dst->pDrawable->x, dst->pDrawable->y));
 
+	mixed = glyphs_mixed(nlist, list);
+	glyphs_upload(sna, screen, nlist, list, glyphs, mixed);
+
 	x = dst->pDrawable->x;
 	y = dst->pDrawable->y;
 	src_x -= list->xOff + x;
@@ -775,6 +1544,8 @@ glyphs0_to_dst(struct sna *sna,
 				struct sna_glyph *p = sna_glyph0(glyph);
 				int i, xi, yi;
 
+				if (unlikely(mixed) && glyph_in_alpha_atlas(p))
+					glyph_uncache(&sna->render, p);
 				if (unlikely(p->atlas != glyph_atlas)) {
 					if (unlikely(!glyph_valid(glyph)))
 						goto next_glyph_N;
@@ -785,7 +1556,7 @@ glyphs0_to_dst(struct sna *sna,
 					}
 
 					if (unlikely(p->atlas == NULL)) {
-						if (!glyph_cache(screen, &sna->render, glyph))
+						if (!glyph_cache(screen, &sna->render, glyph, mixed))
 							goto next_glyph_N;
 					}
 
@@ -798,6 +1569,7 @@ glyphs0_to_dst(struct sna *sna,
 
 					glyph_atlas = p->atlas;
 				}
+				glyph_touch(&sna->render, p);
 
 				xi = x - glyph->info.x;
 				yi = y - glyph->info.y;
@@ -867,6 +1639,8 @@ next_glyph_N:
 			struct sna_glyph *p = sna_glyph0(glyph);
 			struct sna_composite_rectangles r;
 
+			if (unlikely(mixed) && glyph_in_alpha_atlas(p))
+				glyph_uncache(&sna->render, p);
 			if (unlikely(p->atlas != glyph_atlas)) {
 				if (unlikely(!glyph_valid(glyph)))
 					goto next_glyph_0;
@@ -877,7 +1651,7 @@ next_glyph_N:
 				}
 
 				if (unlikely(p->atlas == NULL)) {
-					if (!glyph_cache(screen, &sna->render, glyph))
+					if (!glyph_cache(screen, &sna->render, glyph, mixed))
 						goto next_glyph_0;
 				}
 
@@ -890,6 +1664,7 @@ next_glyph_N:
 
 				glyph_atlas = p->atlas;
 			}
+			glyph_touch(&sna->render, p);
 
 			r.dst.x = x - glyph->info.x;
 			r.dst.y = y - glyph->info.y;
@@ -967,9 +1742,10 @@ glyphs_slow(struct sna *sna,
 				if (unlikely(!glyph_valid(glyph)))
 					goto next_glyph;
 
-				if (!glyph_cache(screen, &sna->render, glyph))
+				if (!glyph_cache(screen, &sna->render, glyph, false))
 					goto next_glyph;
 			}
+			glyph_touch(&sna->render, p);
 
 			DBG(("%s: glyph=(%d, %d)x(%d, %d), src=(%d, %d), mask=(%d, %d)\n",
 			     __FUNCTION__,
@@ -1059,39 +1835,204 @@ too_large(struct sna *sna, int width, int height)
 		height > sna->render.max_3d_size);
 }
 
-static pixman_image_t *
-__sna_glyph_get_image(GlyphPtr g, ScreenPtr s)
-{
+/* Accumulating glyphs into a mask on the CPU is split into horizontal
+ * bands, one per thread. Each band is a separate image over the rows of
+ * the mask it owns, so pixman clips the glyphs straddling a boundary for
+ * us, and every band only composites the glyphs binned into its rows.
+ */
+struct glyph_image {
 	pixman_image_t *image;
-	PicturePtr p;
-	int dx, dy;
+	int16_t x, y;
+	uint16_t width, height;
+	bool expand;
+};
+
+struct glyph_band {
+	pixman_image_t *white;
+	pixman_image_t *mask;
+	int y, height;
+	const struct glyph_image *glyphs;
+#if HAS_PIXMAN_GLYPHS
+	const pixman_glyph_t *pglyphs;
+#endif
+	int count;
+};
 
-	DBG(("%s: creating image cache for glyph %p (on screen %d)\n", __FUNCTION__, g, s->myNum));
+static void glyph_band_composite(void *arg)
+{
+	const struct glyph_band *band = arg;
+	const struct glyph_image *g;
+	int n;
 
-	p = GetGlyphPicture(g, s);
-	if (unlikely(p == NULL))
-		return NULL;
+#if HAS_PIXMAN_GLYPHS
+	if (band->pglyphs) {
+		pixman_composite_glyphs_no_mask(PIXMAN_OP_ADD,
+						band->white,
+						band->mask,
+						0, 0,
+						0, -band->y,
+						__global_glyph_cache,
+						band->count, band->pglyphs);
+		return;
+	}
+#endif
 
-	image = image_from_pict(p, FALSE, &dx, &dy);
-	if (!image)
-		return NULL;
+	for (n = 0, g = band->glyphs; n < band->count; n++, g++) {
+		if (g->y >= band->y + band->height ||
+		    g->y + g->height <= band->y)
+			continue;
 
-	assert(dx == 0 && dy == 0);
-	return sna_glyph(g)->image = image;
+		if (g->expand)
+			pixman_image_composite(PictOpAdd,
+					       band->white,
+					       g->image,
+					       band->mask,
+					       0, 0,
+					       0, 0,
+					       g->x, g->y - band->y,
+					       g->width, g->height);
+		else
+			pixman_image_composite(PictOpAdd,
+					       g->image,
+					       NULL,
+					       band->mask,
+					       0, 0,
+					       0, 0,
+					       g->x, g->y - band->y,
+					       g->width, g->height);
+	}
 }
 
-static inline pixman_image_t *
-sna_glyph_get_image(GlyphPtr g, ScreenPtr s)
+static void
+glyphs_composite_bands(pixman_image_t *mask, const struct glyph_band *proto)
 {
-	pixman_image_t *image;
+	int width = pixman_image_get_width(mask);
+	int height = pixman_image_get_height(mask);
+	int num_threads;
+
+	num_threads = sna_use_threads(width, height, 32);
+	if (num_threads > 1) {
+		struct glyph_band band[num_threads];
+		pixman_format_code_t format = pixman_image_get_format(mask);
+		uint8_t *bits = (uint8_t *)pixman_image_get_data(mask);
+		int stride = pixman_image_get_stride(mask);
+		int y, dy, n;
+
+		DBG(("%s: using %d threads for %d glyphs into %dx%d\n",
+		     __FUNCTION__, num_threads, proto->count, width, height));
+
+		dy = (height + num_threads - 1) / num_threads;
+		num_threads -= (num_threads-1) * dy >= height;
+
+		for (n = y = 0; n < num_threads; n++, y += dy) {
+			band[n] = *proto;
+			band[n].y = y;
+			band[n].height = y + dy > height ? height - y : dy;
+			band[n].mask = pixman_image_create_bits(format,
+								width, band[n].height,
+								(uint32_t *)(bits + y * stride),
+								stride);
+			if (band[n].mask == NULL)
+				break;
+		}
 
-	image = sna_glyph(g)->image;
-	if (image == NULL)
-		image = __sna_glyph_get_image(g, s);
+		if (n == num_threads) {
+			if (sigtrap_get() == 0) {
+				for (n = 1; n < num_threads; n++)
+					sna_threads_run(n, glyph_band_composite, &band[n]);
+				glyph_band_composite(&band[0]);
+				sna_threads_wait();
+				sigtrap_put();
+			} else
+				sna_threads_kill();
 
-	return image;
+			for (n = 0; n < num_threads; n++)
+				pixman_image_unref(band[n].mask);
+			return;
+		}
+
+		while (n--)
+			pixman_image_unref(band[n].mask);
+	}
+
+	{
+		struct glyph_band band = *proto;
+
+		band.mask = mask;
+		band.y = 0;
+		band.height = height;
+		glyph_band_composite(&band);
+	}
 }
 
+#if HAS_PIXMAN_GLYPHS
+/* pixman_composite_glyphs() renders into a private mask the size of the
+ * composite rectangle, so disjoint strips of the destination can each be
+ * handed to a thread of their own.
+ */
+struct glyph_strip {
+	pixman_op_t op;
+	pixman_image_t *src, *dst;
+	pixman_format_code_t format;
+	int src_x, src_y;
+	int mask_x, mask_y;
+	int dst_x, dst_y;
+	int width, height;
+	const pixman_glyph_t *pglyphs;
+	int count;
+};
+
+static void glyph_strip_composite(void *arg)
+{
+	const struct glyph_strip *t = arg;
+
+	pixman_composite_glyphs(t->op, t->src, t->dst, t->format,
+				t->src_x, t->src_y,
+				t->mask_x, t->mask_y,
+				t->dst_x, t->dst_y,
+				t->width, t->height,
+				__global_glyph_cache, t->count, t->pglyphs);
+}
+
+static void
+glyphs_composite_strips(const struct glyph_strip *proto)
+{
+	int num_threads;
+
+	num_threads = sna_use_threads(proto->width, proto->height, 32);
+	if (num_threads <= 1) {
+		glyph_strip_composite((void *)proto);
+	} else {
+		struct glyph_strip data[num_threads];
+		int y, dy, n;
+
+		DBG(("%s: using %d threads for %d glyphs into %dx%d\n",
+		     __FUNCTION__, num_threads, proto->count,
+		     proto->width, proto->height));
+
+		dy = (proto->height + num_threads - 1) / num_threads;
+		num_threads -= (num_threads-1) * dy >= proto->height;
+
+		for (n = y = 0; n < num_threads; n++, y += dy) {
+			data[n] = *proto;
+			data[n].src_y += y;
+			data[n].mask_y += y;
+			data[n].dst_y += y;
+			data[n].height = y + dy > proto->height ? proto->height - y : dy;
+		}
+
+		if (sigtrap_get() == 0) {
+			for (n = 1; n < num_threads; n++)
+				sna_threads_run(n, glyph_strip_composite, &data[n]);
+			glyph_strip_composite(&data[0]);
+			sna_threads_wait();
+			sigtrap_put();
+		} else
+			sna_threads_kill();
+	}
+}
+#endif
+
 static inline bool use_small_mask(struct sna *sna, int16_t width, int16_t height, int depth)
 {
 	if (depth < 8)
@@ -1122,6 +2063,7 @@ glyphs_via_mask(struct sna *sna,
 	int16_t x, y, width, height;
 	int error;
 	bool ret = false;
+	bool mixed;
 	BoxRec box;
 
 	if (NO_GLYPHS_VIA_MASK)
@@ -1131,6 +2073,8 @@ glyphs_via_mask(struct sna *sna,
 	     __FUNCTION__, op, src_x, src_y, nlist,
 	     list->xOff, list->yOff, dst->pDrawable->x, dst->pDrawable->y));
 
+	mixed = glyphs_mixed(nlist, list);
+
 	glyph_extents(nlist, list, glyphs, &box);
 	if (box.x2 <= box.x1 || box.y2 <= box.y1)
 		return true;
@@ -1355,6 +2299,8 @@ next_image:
 		if (!clear_pixmap(sna, pixmap))
 			goto err_mask;
 
+		glyphs_upload(sna, screen, nlist, list, glyphs, mixed);
+
 		do {
 			int n = list->len;
 			x += list->xOff;
@@ -1364,6 +2310,8 @@ next_image:
 				struct sna_glyph *p = sna_glyph(glyph);
 				struct sna_composite_rectangles r;
 
+				if (unlikely(mixed) && glyph_in_alpha_atlas(p))
+					glyph_uncache(&sna->render, p);
 				if (unlikely(p->atlas != glyph_atlas)) {
 					bool ok;
 
@@ -1376,7 +2324,7 @@ next_image:
 					}
 
 					if (unlikely(p->atlas == NULL)) {
-						if (!glyph_cache(screen, &sna->render, glyph))
+						if (!glyph_cache(screen, &sna->render, glyph, mixed))
 							goto next_glyph;
 					}
 
@@ -1408,6 +2356,7 @@ next_image:
 
 					glyph_atlas = p->atlas;
 				}
+				glyph_touch(&sna->render, p);
 
 				DBG(("%s: blt glyph origin (%d, %d), offset (%d, %d), src (%d, %d), size (%d, %d)\n",
 				     __FUNCTION__,
@@ -1789,15 +2738,23 @@ next:
 
 		if (sigtrap_get() == 0) {
 			if (mask_format) {
-				pixman_composite_glyphs(op, src_image, dst_image,
-							pixman_format(mask_format),
-							src_x + src_dx + region.extents.x1 - dst_x,
-							src_y + src_dy + region.extents.y1 - dst_y,
-							region.extents.x1, region.extents.y1,
-							region.extents.x1 + dst_dx, region.extents.y1 + dst_dy,
-							region.extents.x2 - region.extents.x1,
-							region.extents.y2 - region.extents.y1,
-							__global_glyph_cache, count, pglyphs);
+				struct glyph_strip strip;
+
+				strip.op = op;
+				strip.src = src_image;
+				strip.dst = dst_image;
+				strip.format = pixman_format(mask_format);
+				strip.src_x = src_x + src_dx + region.extents.x1 - dst_x;
+				strip.src_y = src_y + src_dy + region.extents.y1 - dst_y;
+				strip.mask_x = region.extents.x1;
+				strip.mask_y = region.extents.y1;
+				strip.dst_x = region.extents.x1 + dst_dx;
+				strip.dst_y = region.extents.y1 + dst_dy;
+				strip.width = region.extents.x2 - region.extents.x1;
+				strip.height = region.extents.y2 - region.extents.y1;
+				strip.pglyphs = pglyphs;
+				strip.count = count;
+				glyphs_composite_strips(&strip);
 			} else {
 				pixman_composite_glyphs_no_mask(op, src_image, dst_image,
 								src_x + src_dx - dst_x, src_y + src_dy - dst_y,
@@ -1819,7 +2776,10 @@ out:
 	} else
 #endif
 	{
+		struct glyph_image stack_images[N_STACK_GLYPHS];
+		struct glyph_image *images = stack_images;
 		pixman_image_t *mask_image;
+		int count;
 
 		dst_image = image_from_pict(dst, TRUE, &x, &y);
 		if (dst_image == NULL)
@@ -1869,6 +2829,20 @@ out:
 			src_y -= y - dst->pDrawable->y;
 		}
 
+		count = 0;
+		if (mask_format) {
+			for (n = 0; n < nlist; ++n)
+				count += list[n].len;
+			if (count > N_STACK_GLYPHS) {
+				images = malloc(count * sizeof(*images));
+				if (images == NULL) {
+					pixman_image_unref(mask_image);
+					goto cleanup_src;
+				}
+			}
+			count = 0;
+		}
+
 		if (sigtrap_get() == 0) {
 			do {
 				n = list->len;
@@ -1893,30 +2867,15 @@ out:
 						     g->info.width,
 						     g->info.height));
 
-						if (list->format == mask_format) {
-							assert(pixman_image_get_format(glyph_image) == pixman_image_get_format(mask_image));
-							pixman_image_composite(PictOpAdd,
-									       glyph_image,
-									       NULL,
-									       mask_image,
-									       0, 0,
-									       0, 0,
-									       x - g->info.x,
-									       y - g->info.y,
-									       g->info.width,
-									       g->info.height);
-						} else {
-							pixman_image_composite(PictOpAdd,
-									       sna->render.white_image,
-									       glyph_image,
-									       mask_image,
-									       0, 0,
-									       0, 0,
-									       x - g->info.x,
-									       y - g->info.y,
-									       g->info.width,
-									       g->info.height);
-						}
+						assert(list->format != mask_format ||
+						       pixman_image_get_format(glyph_image) == pixman_image_get_format(mask_image));
+						images[count].image = glyph_image;
+						images[count].x = x - g->info.x;
+						images[count].y = y - g->info.y;
+						images[count].width = g->info.width;
+						images[count].height = g->info.height;
+						images[count].expand = list->format != mask_format;
+						count++;
 					} else {
 						int xi = x - g->info.x;
 						int yi = y - g->info.y;
@@ -1950,8 +2909,20 @@ next_glyph:
 				}
 				list++;
 			} while (--nlist);
+
+			if (mask_format) {
+				struct glyph_band band;
+
+				memset(&band, 0, sizeof(band));
+				band.white = sna->render.white_image;
+				band.glyphs = images;
+				band.count = count;
+				glyphs_composite_bands(mask_image, &band);
+			}
 			sigtrap_put();
 		}
+		if (images != stack_images)
+			free(images);
 
 		if (mask_format) {
 			DBG(("%s: glyph mask composite src=(%d+%d,%d+%d) dst=(%d, %d)x(%d, %d)\n",
@@ -1960,12 +2931,12 @@ next_glyph:
 			     region.extents.x1, region.extents.y1,
 			     region.extents.x2 - region.extents.x1,
 			     region.extents.y2 - region.extents.y1));
-			pixman_image_composite(op, src_image, mask_image, dst_image,
-					       src_x, src_y,
-					       0, 0,
-					       region.extents.x1, region.extents.y1,
-					       region.extents.x2 - region.extents.x1,
-					       region.extents.y2 - region.extents.y1);
+			sna_image_composite(op, src_image, mask_image, dst_image,
+					    src_x, src_y,
+					    0, 0,
+					    region.extents.x1, region.extents.y1,
+					    region.extents.x2 - region.extents.x1,
+					    region.extents.y2 - region.extents.y1);
 			pixman_image_unref(mask_image);
 		}
 
@@ -2081,6 +3052,7 @@ glyphs_via_image(struct sna *sna,
 	PicturePtr mask;
 	int16_t x, y, width, height;
 	pixman_image_t *mask_image;
+	struct glyph_band band;
 	int error;
 	bool ret = false;
 	BoxRec box;
@@ -2204,19 +3176,36 @@ next_pglyph:
 			list++;
 		} while (--nlist);
 
-		pixman_composite_glyphs_no_mask(PIXMAN_OP_ADD,
-						sna->render.white_image,
-						mask_image,
-						0, 0,
-						0, 0,
-						__global_glyph_cache, count, pglyphs);
+		memset(&band, 0, sizeof(band));
+		band.white = sna->render.white_image;
+		band.pglyphs = pglyphs;
+		band.count = count;
+		glyphs_composite_bands(mask_image, &band);
 		pixman_glyph_cache_thaw(__global_glyph_cache);
 		if (pglyphs != stack_glyphs)
 			free(pglyphs);
 	} else
 #endif
+	{
+		struct glyph_image stack_images[N_STACK_GLYPHS];
+		struct glyph_image *images = stack_images;
+		int count, n;
+
+		count = 0;
+		for (n = 0; n < nlist; ++n)
+			count += list[n].len;
+		if (count > N_STACK_GLYPHS) {
+			images = malloc(count * sizeof(*images));
+			if (images == NULL) {
+				pixman_image_unref(mask_image);
+				sigtrap_put();
+				goto err_pixmap;
+			}
+		}
+
+		count = 0;
 		do {
-			int n = list->len;
+			n = list->len;
 			x += list->xOff;
 			y += list->yOff;
 			while (n--) {
@@ -2248,28 +3237,15 @@ next_pglyph:
 				     g->info.width,
 				     g->info.height));
 
-				if (list->format == format) {
-					assert(pixman_image_get_format(glyph_image) == pixman_image_get_format(mask_image));
-					pixman_image_composite(PictOpAdd,
-							       glyph_image,
-							       NULL,
-							       mask_image,
-							       0, 0,
-							       0, 0,
-							       xi, yi,
-							       g->info.width,
-							       g->info.height);
-				} else {
-					pixman_image_composite(PictOpAdd,
-							       sna->render.white_image,
-							       glyph_image,
-							       mask_image,
-							       0, 0,
-							       0, 0,
-							       xi, yi,
-							       g->info.width,
-							       g->info.height);
-				}
+				assert(list->format != format ||
+				       pixman_image_get_format(glyph_image) == pixman_image_get_format(mask_image));
+				images[count].image = glyph_image;
+				images[count].x = xi;
+				images[count].y = yi;
+				images[count].width = g->info.width;
+				images[count].height = g->info.height;
+				images[count].expand = list->format != format;
+				count++;
 
 next_image:
 				x += g->info.xOff;
@@ -2277,6 +3253,16 @@ next_image:
 			}
 			list++;
 		} while (--nlist);
+
+		memset(&band, 0, sizeof(band));
+		band.white = sna->render.white_image;
+		band.glyphs = images;
+		band.count = count;
+		glyphs_composite_bands(mask_image, &band);
+
+		if (images != stack_images)
+			free(images);
+	}
 	pixman_image_unref(mask_image);
 	sigtrap_put();
 
@@ -2384,15 +3370,9 @@ sna_glyph_unrealize(ScreenPtr screen, GlyphPtr glyph)
 		p->image = NULL;
 	}
 
-	if (p->atlas && p->atlas != GetGlyphPicture(glyph, screen)) {
-		struct sna *sna = to_sna_from_screen(screen);
-		struct sna_glyph_cache *cache = &sna->render.glyph[p->pos&1];
-		DBG(("%s: releasing glyph pos %d from cache %d\n",
-		     __FUNCTION__, p->pos >> 1, p->pos & 1));
-		assert(cache->glyphs[p->pos >> 1] == p);
-		cache->glyphs[p->pos >> 1] = NULL;
-		p->atlas = NULL;
-	}
+	if (p->atlas && p->page)
+		glyph_uncache(&to_sna_from_screen(screen)->render, p);
+	p->atlas = NULL;
 
 #if HAS_PIXMAN_GLYPHS
 	assert(__global_glyph_cache == NULL ||
@@ -32,6 +32,8 @@
 #include "sna.h"
 #include "sna_render.h"
 
+#include "intel_options.h"
+
 #define xFixedToDouble(f) pixman_fixed_to_double(f)
 
 bool
@@ -98,60 +100,136 @@ sna_gradient_sample_width(PictGradient *gradient)
 	return min(width, 1024);
 }
 
+static uint32_t
+gradient_hash(const PictGradient *pattern)
+{
+	return sna_hash(SNA_HASH_INIT, pattern->stops,
+			sizeof(PictGradientStop) * pattern->nstops);
+}
+
 static bool
 _gradient_color_stops_equal(PictGradient *pattern,
-			    struct sna_gradient_cache *cache)
+			    struct sna_gradient_ramp *ramp)
 {
-    if (cache->nstops != pattern->nstops)
+    if (ramp->nstops != pattern->nstops)
 	    return false;
 
-    return memcmp(cache->stops,
+    return memcmp(ramp->stops,
 		  pattern->stops,
-		  sizeof(PictGradientStop)*cache->nstops) == 0;
+		  sizeof(PictGradientStop)*ramp->nstops) == 0;
 }
 
-struct kgem_bo *
-sna_render_get_gradient(struct sna *sna,
-			PictGradient *pattern)
+static void
+gradient_ramp_release(struct sna *sna, struct sna_gradient_ramp *ramp)
 {
-	struct sna_render *render = &sna->render;
-	struct sna_gradient_cache *cache;
-	pixman_image_t *gradient, *image;
-	pixman_point_fixed_t p1, p2;
-	int i, width;
-	struct kgem_bo *bo;
+	struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+	struct sna_gradient_ramp **p;
+
+	DBG(("%s: row=%d, refcnt=%d, busy? %d\n", __FUNCTION__,
+	     ramp->row, ramp->bo->refcnt, ramp->bo->rq != NULL));
+
+	p = &cache->hash[ramp->hash & cache->mask];
+	while (*p != ramp)
+		p = &(*p)->next;
+	*p = ramp->next;
+
+	/* We can only overwrite the row once nobody else holds a reference
+	 * to it, and not until the GPU has finished with the atlas.
+	 */
+	if (ramp->row >= 0 &&
+	    ramp->bo->proxy == cache->atlas &&
+	    ramp->bo->refcnt == 1 &&
+	    !kgem_bo_is_busy(ramp->bo))
+		cache->stale |= (uint64_t)1 << ramp->row;
+
+	kgem_bo_destroy(&sna->kgem, ramp->bo);
+	ramp->bo = NULL;
+
+	list_move(&ramp->link, &cache->free);
+	cache->count--;
+}
 
-	DBG(("%s: %dx[%f:%x ... %f:%x ... %f:%x]\n", __FUNCTION__,
-	     pattern->nstops,
-	     pattern->stops[0].x / 65536.,
-	     pattern->stops[0].color.alpha >> 8 << 24 |
-	     pattern->stops[0].color.red   >> 8 << 16 |
-	     pattern->stops[0].color.green >> 8 << 8 |
-	     pattern->stops[0].color.blue  >> 8 << 0,
-	     pattern->stops[pattern->nstops/2].x / 65536.,
-	     pattern->stops[pattern->nstops/2].color.alpha >> 8 << 24 |
-	     pattern->stops[pattern->nstops/2].color.red   >> 8 << 16 |
-	     pattern->stops[pattern->nstops/2].color.green >> 8 << 8 |
-	     pattern->stops[pattern->nstops/2].color.blue  >> 8 << 0,
-	     pattern->stops[pattern->nstops-1].x / 65536.,
-	     pattern->stops[pattern->nstops-1].color.alpha >> 8 << 24 |
-	     pattern->stops[pattern->nstops-1].color.red   >> 8 << 16 |
-	     pattern->stops[pattern->nstops-1].color.green >> 8 << 8 |
-	     pattern->stops[pattern->nstops-1].color.blue  >> 8 << 0));
+static int
+gradient_atlas_row(struct sna *sna)
+{
+	struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+	int row;
 
-	for (i = 0; i < render->gradient_cache.size; i++) {
-		cache = &render->gradient_cache.cache[i];
-		if (_gradient_color_stops_equal(pattern, cache)) {
-			DBG(("%s: old --> %d\n", __FUNCTION__, i));
-			return kgem_bo_reference(cache->bo);
-		}
+	if (cache->atlas && cache->rows < GRADIENT_ATLAS_ROWS)
+		return cache->rows++;
+
+	if (cache->stale && !__kgem_bo_is_busy(&sna->kgem, cache->atlas)) {
+		row = __builtin_ffsll(cache->stale) - 1;
+		cache->stale &= ~((uint64_t)1 << row);
+		DBG(("%s: reusing row %d\n", __FUNCTION__, row));
+		return row;
+	}
+
+	/* Start a new atlas rather than wait; the old one lives on for as
+	 * long as any of its rows remain in the cache.
+	 */
+	if (cache->atlas) {
+		kgem_bo_destroy(&sna->kgem, cache->atlas);
+		cache->atlas = NULL;
+		cache->map = NULL;
 	}
+	cache->stale = 0;
+	cache->rows = 0;
+
+	cache->atlas = kgem_create_linear(&sna->kgem,
+					  GRADIENT_ATLAS_ROWS * 4 * GRADIENT_ATLAS_WIDTH, 0);
+	if (cache->atlas == NULL)
+		return -1;
+
+	/* Rows are only ever written whilst idle, so write unsynchronized */
+	if (sna->kgem.has_llc)
+		cache->map = kgem_bo_map__cpu(&sna->kgem, cache->atlas);
+	else
+		cache->map = kgem_bo_map__wc(&sna->kgem, cache->atlas);
+	if (cache->map == NULL)
+		cache->map = kgem_bo_map__gtt(&sna->kgem, cache->atlas);
+	if (cache->map == NULL) {
+		kgem_bo_destroy(&sna->kgem, cache->atlas);
+		cache->atlas = NULL;
+		return -1;
+	}
+
+	cache->atlas->pitch = 4 * GRADIENT_ATLAS_WIDTH;
+
+	DBG(("%s: new atlas handle=%d\n", __FUNCTION__, cache->atlas->handle));
+	cache->stats.atlases++;
+	return cache->rows++;
+}
+
+static struct kgem_bo *
+gradient_render_ramp(struct sna *sna, PictGradient *pattern, int *row)
+{
+	struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+	pixman_image_t *gradient, *image;
+	pixman_point_fixed_t p1, p2;
+	struct kgem_bo *bo;
+	uint32_t *dst;
+	int width;
 
 	width = sna_gradient_sample_width(pattern);
 	DBG(("%s: sample width = %d\n", __FUNCTION__, width));
 	if (width == 0)
 		return NULL;
 
+	/* Render straight into a row of the atlas if we can. Rows span the
+	 * full width of the atlas so that it can be sampled as one surface.
+	 */
+	dst = NULL;
+	if (row) {
+		*row = gradient_atlas_row(sna);
+		if (*row < 0) {
+			row = NULL;
+		} else {
+			dst = (uint32_t *)(cache->map + *row * 4 * GRADIENT_ATLAS_WIDTH);
+			width = GRADIENT_ATLAS_WIDTH;
+		}
+	}
+
 	p1.x = 0;
 	p1.y = 0;
 	p2.x = width << 16;
@@ -160,15 +238,21 @@ sna_render_get_gradient(struct sna *sna,
 	gradient = pixman_image_create_linear_gradient(&p1, &p2,
 						       (pixman_gradient_stop_t *)pattern->stops,
 						       pattern->nstops);
-	if (gradient == NULL)
+	if (gradient == NULL) {
+		if (row)
+			cache->stale |= (uint64_t)1 << *row;
 		return NULL;
+	}
 
 	pixman_image_set_filter(gradient, PIXMAN_FILTER_BILINEAR, NULL, 0);
 	pixman_image_set_repeat(gradient, PIXMAN_REPEAT_PAD);
 
-	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, 1, NULL, 0);
+	image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, 1, dst,
+					 4 * GRADIENT_ATLAS_WIDTH);
 	if (image == NULL) {
 		pixman_image_unref(gradient);
+		if (row)
+			cache->stale |= (uint64_t)1 << *row;
 		return NULL;
 	}
 
@@ -185,43 +269,155 @@ sna_render_get_gradient(struct sna *sna,
 	     width/2, pixman_image_get_data(image)[width/2],
 	     width-1, pixman_image_get_data(image)[width-1]));
 
-	bo = kgem_create_linear(&sna->kgem, width*4, 0);
-	if (!bo) {
-		pixman_image_unref(image);
-		return NULL;
+	if (row) {
+		bo = kgem_create_proxy(&sna->kgem, cache->atlas,
+				       *row * 4 * GRADIENT_ATLAS_WIDTH, 4*width);
+		if (bo == NULL)
+			cache->stale |= (uint64_t)1 << *row;
+	} else {
+		bo = kgem_create_linear(&sna->kgem, width*4, 0);
+		if (bo)
+			kgem_bo_write(&sna->kgem, bo,
+				      pixman_image_get_data(image), 4*width);
 	}
+	pixman_image_unref(image);
 
-	bo->pitch = 4*width;
-	kgem_bo_write(&sna->kgem, bo, pixman_image_get_data(image), 4*width);
+	if (bo)
+		bo->pitch = 4*width;
+	return bo;
+}
 
-	pixman_image_unref(image);
+static struct sna_gradient_ramp *
+gradient_cache_lookup(struct sna *sna, PictGradient *pattern)
+{
+	struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+	struct sna_gradient_ramp *ramp;
+	struct kgem_bo *bo;
+	uint32_t hash;
+	int row;
+
+	hash = gradient_hash(pattern);
+	for (ramp = cache->hash[hash & cache->mask]; ramp; ramp = ramp->next) {
+		if (ramp->hash == hash &&
+		    _gradient_color_stops_equal(pattern, ramp)) {
+			DBG(("%s: old --> %d\n", __FUNCTION__,
+			     (int)(ramp - cache->ramps)));
+			cache->stats.hits++;
+			list_move(&ramp->link, &cache->lru);
+			return ramp;
+		}
+	}
+	cache->stats.misses++;
 
-	if (render->gradient_cache.size < GRADIENT_CACHE_SIZE)
-		i = render->gradient_cache.size++;
-	else
-		i = rand () % GRADIENT_CACHE_SIZE;
+	if (list_is_empty(&cache->free)) {
+		ramp = list_last_entry(&cache->lru, struct sna_gradient_ramp, link);
+		gradient_ramp_release(sna, ramp);
+		cache->stats.evictions++;
+	}
+	ramp = list_first_entry(&cache->free, struct sna_gradient_ramp, link);
+	assert(ramp->bo == NULL);
 
-	cache = &render->gradient_cache.cache[i];
-	if (cache->nstops < pattern->nstops) {
+	/* Make room for the stops before claiming an atlas row, so that
+	 * we never hand out a row that the cache cannot later reclaim.
+	 */
+	if (ramp->nstops < pattern->nstops) {
 		PictGradientStop *newstops;
 
 		newstops = malloc(sizeof(PictGradientStop) * pattern->nstops);
 		if (newstops == NULL)
-			return bo;
+			return NULL;
 
-		free(cache->stops);
-		cache->stops = newstops;
+		free(ramp->stops);
+		ramp->stops = newstops;
 	}
 
-	memcpy(cache->stops, pattern->stops,
+	row = -1;
+	bo = gradient_render_ramp(sna, pattern, &row);
+	if (bo == NULL)
+		return NULL;
+
+	memcpy(ramp->stops, pattern->stops,
 	       sizeof(PictGradientStop) * pattern->nstops);
-	cache->nstops = pattern->nstops;
+	ramp->nstops = pattern->nstops;
+	ramp->hash = hash;
+	ramp->row = row;
+	ramp->bo = bo;
 
-	if (cache->bo)
-		kgem_bo_destroy(&sna->kgem, cache->bo);
-	cache->bo = kgem_bo_reference(bo);
+	ramp->next = cache->hash[hash & cache->mask];
+	cache->hash[hash & cache->mask] = ramp;
+	list_move(&ramp->link, &cache->lru);
+	cache->count++;
 
-	return bo;
+	return ramp;
+}
+
+struct kgem_bo *
+sna_render_get_gradient(struct sna *sna,
+			PictGradient *pattern)
+{
+	struct sna_gradient_ramp *ramp;
+
+	DBG(("%s: %dx[%f:%x ... %f:%x ... %f:%x]\n", __FUNCTION__,
+	     pattern->nstops,
+	     pattern->stops[0].x / 65536.,
+	     pattern->stops[0].color.alpha >> 8 << 24 |
+	     pattern->stops[0].color.red   >> 8 << 16 |
+	     pattern->stops[0].color.green >> 8 << 8 |
+	     pattern->stops[0].color.blue  >> 8 << 0,
+	     pattern->stops[pattern->nstops/2].x / 65536.,
+	     pattern->stops[pattern->nstops/2].color.alpha >> 8 << 24 |
+	     pattern->stops[pattern->nstops/2].color.red   >> 8 << 16 |
+	     pattern->stops[pattern->nstops/2].color.green >> 8 << 8 |
+	     pattern->stops[pattern->nstops/2].color.blue  >> 8 << 0,
+	     pattern->stops[pattern->nstops-1].x / 65536.,
+	     pattern->stops[pattern->nstops-1].color.alpha >> 8 << 24 |
+	     pattern->stops[pattern->nstops-1].color.red   >> 8 << 16 |
+	     pattern->stops[pattern->nstops-1].color.green >> 8 << 8 |
+	     pattern->stops[pattern->nstops-1].color.blue  >> 8 << 0));
+
+	if (sna->render.gradient_cache.ramps == NULL)
+		return gradient_render_ramp(sna, pattern, NULL);
+
+	ramp = gradient_cache_lookup(sna, pattern);
+	if (ramp == NULL)
+		return gradient_render_ramp(sna, pattern, NULL);
+
+	return kgem_bo_reference(ramp->bo);
+}
+
+/* As sna_render_get_gradient(), but returns the whole atlas holding the
+ * ramp together with its row, so that every gradient drawn from the
+ * atlas shares a single surface. A ramp that could not be placed in the
+ * atlas is returned on its own, with a row of -1.
+ *
+ * The caller holds the atlas rather than the ramp, so the ramp may be
+ * evicted whilst the caller still samples from its row. Only a source
+ * and a mask are looked up before the operation is emitted, and so a
+ * cache that can keep two ramps never reuses a row still wanted.
+ */
+struct kgem_bo *
+sna_render_get_gradient_row(struct sna *sna,
+			    PictGradient *pattern,
+			    int *row)
+{
+	struct sna_gradient_ramp *ramp;
+
+	DBG(("%s: nstops=%d\n", __FUNCTION__, pattern->nstops));
+
+	*row = -1;
+	if (sna->render.gradient_cache.size < 2)
+		return sna_render_get_gradient(sna, pattern);
+
+	ramp = gradient_cache_lookup(sna, pattern);
+	if (ramp == NULL)
+		return gradient_render_ramp(sna, pattern, NULL);
+
+	if (ramp->row < 0)
+		return kgem_bo_reference(ramp->bo);
+
+	assert(ramp->bo->proxy);
+	*row = ramp->row;
+	return kgem_bo_reference(ramp->bo->proxy);
 }
 
 void
@@ -240,17 +436,34 @@ sna_render_flush_solid(struct sna *sna)
 }
 
 static void
-sna_render_finish_solid(struct sna *sna, bool force)
+sna_solid_cache_map(struct sna *sna)
+{
+	struct sna_solid_cache *cache = &sna->render.solid_cache;
+
+	/* New colours are only ever written into unused slots, so we can
+	 * write them straight into the bo without waiting for the GPU.
+	 */
+	if (sna->kgem.has_llc)
+		cache->map = kgem_bo_map__cpu(&sna->kgem, cache->cache_bo);
+	else
+		cache->map = kgem_bo_map__wc(&sna->kgem, cache->cache_bo);
+	if (cache->map == NULL)
+		cache->map = kgem_bo_map__gtt(&sna->kgem, cache->cache_bo);
+}
+
+/* Every slot is in use, so start a new generation of the cache in a fresh
+ * bo. The old bo is kept alive by the proxies already handed out, and the
+ * hash table is emptied simply by advancing the generation.
+ */
+static void
+sna_render_finish_solid(struct sna *sna)
 {
 	struct sna_solid_cache *cache = &sna->render.solid_cache;
 	struct kgem_bo *old;
 	int i;
 
-	DBG(("sna_render_finish_solid(force=%d, domain=%d, busy=%d, dirty=%d, size=%d)\n",
-	     force, cache->cache_bo->domain, cache->cache_bo->rq != NULL, cache->dirty, cache->size));
-
-	if (!force && cache->cache_bo->domain != DOMAIN_GPU)
-		return;
+	DBG(("sna_render_finish_solid(gen=%d, domain=%d, busy=%d, dirty=%d, size=%d)\n",
+	     cache->gen, cache->cache_bo->domain, cache->cache_bo->rq != NULL, cache->dirty, cache->size));
 
 	if (cache->dirty)
 		sna_render_flush_solid(sna);
@@ -267,29 +480,37 @@ sna_render_finish_solid(struct sna *sna, bool force)
 	old = cache->cache_bo;
 	cache->cache_bo = kgem_create_linear(&sna->kgem, sizeof(cache->color), 0);
 	if (cache->cache_bo == NULL) {
+		/* Only reuse the old slots once the GPU is done with them */
 		cache->cache_bo = old;
+		if (sna->kgem.has_llc)
+			kgem_bo_sync__cpu(&sna->kgem, old);
+		else
+			kgem_bo_sync__gtt(&sna->kgem, old);
 		old = NULL;
-	}
+	} else
+		sna_solid_cache_map(sna);
 
-	if (force)
-		cache->size = 0;
-	if (cache->last < cache->size) {
-		cache->bo[cache->last] = kgem_create_proxy(&sna->kgem, cache->cache_bo,
-							   cache->last*sizeof(uint32_t), sizeof(uint32_t));
-		if (cache->bo[cache->last])
-			cache->bo[cache->last]->pitch = 4;
-		else
-			cache->last = 1024;
+	if (++cache->gen == 0) {
+		memset(cache->hash, 0, sizeof(cache->hash));
+		cache->gen = 1;
 	}
+	cache->size = 0;
+	cache->last = 0;
 
 	if (old)
 		kgem_bo_destroy(&sna->kgem, old);
 }
 
+static inline unsigned solid_hash(uint32_t color)
+{
+	return (color * 0x9e3779b1) >> 21;
+}
+
 struct kgem_bo *
 sna_render_get_solid(struct sna *sna, uint32_t color)
 {
 	struct sna_solid_cache *cache = &sna->render.solid_cache;
+	unsigned h;
 	int i;
 
 	DBG(("%s: %08x\n", __FUNCTION__, color));
@@ -333,35 +554,39 @@ sna_render_get_solid(struct sna *sna, uint32_t color)
 		}
 	}
 
-	if (cache->color[cache->last] == color) {
+	if (cache->last < cache->size && cache->color[cache->last] == color) {
 		DBG(("sna_render_get_solid(%d) = %x (last)\n",
 		     cache->last, color));
 		return kgem_bo_reference(cache->bo[cache->last]);
 	}
 
-	for (i = 0; i < cache->size; i++) {
+	h = solid_hash(color);
+	while (cache->hash[h].gen == cache->gen) {
+		i = cache->hash[h].slot;
 		if (cache->color[i] == color) {
-			if (cache->bo[i] == NULL) {
-				DBG(("sna_render_get_solid(%d) = %x (recreate)\n",
-				     i, color));
-				goto create;
-			} else {
-				DBG(("sna_render_get_solid(%d) = %x (old)\n",
-				     i, color));
-				goto done;
-			}
+			DBG(("sna_render_get_solid(%d) = %x (old)\n",
+			     i, color));
+			goto done;
 		}
+		h = (h + 1) & (ARRAY_SIZE(cache->hash) - 1);
 	}
 
-	sna_render_finish_solid(sna, i == ARRAY_SIZE(cache->color));
+	if (cache->size == ARRAY_SIZE(cache->color)) {
+		sna_render_finish_solid(sna);
+		h = solid_hash(color);
+	}
 
 	i = cache->size++;
 	assert(i < ARRAY_SIZE(cache->color));
 	cache->color[i] = color;
-	cache->dirty = 1;
+	if (cache->map)
+		cache->map[i] = color;
+	else
+		cache->dirty = 1;
+	cache->hash[h].slot = i;
+	cache->hash[h].gen = cache->gen;
 	DBG(("sna_render_get_solid(%d) = %x (new)\n", i, color));
 
-create:
 	cache->bo[i] = kgem_create_proxy(&sna->kgem, cache->cache_bo,
 					 i*sizeof(uint32_t), sizeof(uint32_t));
 	cache->bo[i]->pitch = 4;
@@ -430,14 +655,56 @@ static bool sna_solid_cache_init(struct sna *sna)
 	if (!cache->cache_bo)
 		return false;
 
+	sna_solid_cache_map(sna);
+
+	memset(cache->hash, 0, sizeof(cache->hash));
+	cache->gen = 1;
 	cache->last = 0;
-	cache->color[cache->last] = 0;
 	cache->dirty = 0;
 	cache->size = 0;
 
 	return true;
 }
 
+static void sna_gradient_cache_init(struct sna *sna)
+{
+	struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+	int size, n;
+
+	list_init(&cache->lru);
+	list_init(&cache->free);
+
+	size = GRADIENT_CACHE_SIZE;
+	if (sna->Options &&
+	    xf86GetOptValInteger(sna->Options, OPTION_GRADIENT_CACHE, &size)) {
+		if (size < 0)
+			size = 0;
+		if (size > 4096)
+			size = 4096;
+	}
+	DBG(("%s: size=%d\n", __FUNCTION__, size));
+	if (size == 0)
+		return;
+
+	for (n = 1; n < size; n <<= 1)
+		;
+
+	cache->ramps = calloc(size, sizeof(*cache->ramps));
+	cache->hash = calloc(n, sizeof(*cache->hash));
+	if (cache->ramps == NULL || cache->hash == NULL) {
+		free(cache->ramps);
+		free(cache->hash);
+		cache->ramps = NULL;
+		cache->hash = NULL;
+		return;
+	}
+
+	cache->size = size;
+	cache->mask = n - 1;
+	while (size--)
+		list_add(&cache->ramps[size].link, &cache->free);
+}
+
 bool sna_gradients_create(struct sna *sna)
 {
 	DBG(("%s\n", __FUNCTION__));
@@ -451,6 +718,7 @@ bool sna_gradients_create(struct sna *sna)
 	if (!sna_solid_cache_init(sna))
 		return false;
 
+	sna_gradient_cache_init(sna);
 	return true;
 }
 
@@ -478,19 +746,31 @@ void sna_gradients_close(struct sna *sna)
 			kgem_bo_destroy(&sna->kgem, sna->render.solid_cache.bo[i]);
 	}
 	sna->render.solid_cache.cache_bo = 0;
+	sna->render.solid_cache.map = NULL;
 	sna->render.solid_cache.size = 0;
 	sna->render.solid_cache.dirty = 0;
 
-	for (i = 0; i < sna->render.gradient_cache.size; i++) {
-		struct sna_gradient_cache *cache =
-			&sna->render.gradient_cache.cache[i];
+	if (sna->render.gradient_cache.ramps) {
+		struct sna_gradient_cache *cache = &sna->render.gradient_cache;
+
+		if (cache->stats.misses)
+			xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+				       "Gradient cache: %u hits, %u misses, %u evictions, %u atlases\n",
+				       cache->stats.hits, cache->stats.misses,
+				       cache->stats.evictions, cache->stats.atlases);
 
-		if (cache->bo)
-			kgem_bo_destroy(&sna->kgem, cache->bo);
+		for (i = 0; i < cache->size; i++) {
+			struct sna_gradient_ramp *ramp = &cache->ramps[i];
+
+			if (ramp->bo)
+				kgem_bo_destroy(&sna->kgem, ramp->bo);
+			free(ramp->stops);
+		}
+		if (cache->atlas)
+			kgem_bo_destroy(&sna->kgem, cache->atlas);
 
-		free(cache->stops);
-		cache->stops = NULL;
-		cache->nstops = 0;
+		free(cache->ramps);
+		free(cache->hash);
+		memset(cache, 0, sizeof(*cache));
 	}
-	sna->render.gradient_cache.size = 0;
 }
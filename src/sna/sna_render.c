@@ -1296,6 +1296,228 @@ sna_render_picture_extract(struct sna *sna,
 	return 1;
 }
 
+static PicturePtr
+convolve_scratch(struct sna *sna, ScreenPtr screen,
+		 int w, int h, int depth, uint32_t format,
+		 struct kgem_bo **bo)
+{
+	PixmapPtr pixmap;
+	PicturePtr tmp;
+	int error;
+
+	pixmap = screen->CreatePixmap(screen, w, h, depth, SNA_CREATE_SCRATCH);
+	if (pixmap == NullPixmap) {
+		DBG(("%s: pixmap allocation failed\n", __FUNCTION__));
+		return NULL;
+	}
+
+	tmp = NULL;
+	*bo = __sna_pixmap_get_bo(pixmap);
+	assert(*bo);
+	if (sna->render.clear(sna, pixmap, *bo))
+		tmp = CreatePicture(0, &pixmap->drawable,
+				PictureMatchFormat(screen, depth, format),
+				0, NULL, serverClient, &error);
+	screen->DestroyPixmap(pixmap);
+	if (tmp == NULL)
+		return NULL;
+
+	ValidatePicture(tmp);
+	return tmp;
+}
+
+/* Can the kernel be expressed as the outer product of a row and a
+ * column? Only non-negative kernels are split, as the intermediate is
+ * clamped when stored. The row is normalised to unit sum so that the
+ * intermediate uses its full range, with the column taking up the
+ * scale.
+ */
+bool
+sna_convolve_is_separable(const pixman_fixed_t *k, int cw, int ch,
+			  pixman_fixed_t *row, pixman_fixed_t *col)
+{
+	int i, j, pi = 0, pj = 0;
+	double pivot, sum;
+
+	for (j = 0; j < ch; j++) {
+		for (i = 0; i < cw; i++) {
+			if (k[j*cw + i] < 0)
+				return false;
+			if (k[j*cw + i] > k[pj*cw + pi])
+				pi = i, pj = j;
+		}
+	}
+
+	pivot = pixman_fixed_to_double(k[pj*cw + pi]);
+	if (pivot == 0.)
+		return false;
+
+	for (i = 0; i < cw; i++)
+		row[i] = k[pj*cw + i];
+	for (j = 0; j < ch; j++)
+		col[j] = pixman_double_to_fixed(pixman_fixed_to_double(k[j*cw + pi]) / pivot);
+
+	for (j = 0; j < ch; j++) {
+		for (i = 0; i < cw; i++) {
+			double v = pixman_fixed_to_double(row[i]) * pixman_fixed_to_double(col[j]);
+			v -= pixman_fixed_to_double(k[j*cw + i]);
+			if (v > pivot / 1024 || v < -pivot / 1024)
+				return false;
+		}
+	}
+
+	sum = 0;
+	for (i = 0; i < cw; i++)
+		sum += pixman_fixed_to_double(row[i]);
+	for (i = 0; i < cw; i++)
+		row[i] = pixman_double_to_fixed(pixman_fixed_to_double(row[i]) / sum);
+	for (j = 0; j < ch; j++)
+		col[j] = pixman_double_to_fixed(pixman_fixed_to_double(col[j]) * sum);
+
+	return true;
+}
+
+/* A private picture onto the same source with its own filter, so that
+ * a pass can resample the source without touching the client's Picture.
+ * The transform and filter parameters are borrowed, not copied.
+ */
+PicturePtr
+sna_render_picture_private(PicturePtr picture, int filter,
+			   pixman_fixed_t *params, int nparams)
+{
+	PicturePtr tmp;
+	int error;
+
+	assert(picture->pDrawable);
+	assert(picture->alphaMap == NULL);
+
+	tmp = CreatePicture(0, picture->pDrawable, picture->pFormat,
+			    0, NULL, serverClient, &error);
+	if (tmp == NULL)
+		return NULL;
+
+	tmp->repeat = picture->repeat;
+	tmp->repeatType = picture->repeatType;
+	tmp->transform = picture->transform;
+	tmp->filter = filter;
+	tmp->filter_params = params;
+	tmp->filter_nparams = nparams;
+
+	return tmp;
+}
+
+void
+sna_render_picture_private_free(PicturePtr tmp)
+{
+	tmp->transform = NULL;
+	tmp->filter_params = NULL;
+	tmp->filter_nparams = 0;
+	FreePicture(tmp, 0);
+}
+
+/* Apply a separable kernel as a horizontal pass into an intermediate
+ * followed by a vertical pass, i.e. cw+ch taps rather than cw*ch. Each
+ * pass is a regular composite of a one-dimensional convolution and so
+ * is itself handled natively by the backend where possible.
+ */
+static int
+sna_render_picture_convolve__separable(struct sna *sna,
+				       PicturePtr picture,
+				       struct sna_composite_channel *channel,
+				       int16_t x, int16_t y,
+				       int16_t w, int16_t h,
+				       int16_t dst_x, int16_t dst_y)
+{
+	ScreenPtr screen = picture->pDrawable->pScreen;
+	pixman_fixed_t *params = picture->filter_params;
+	int cw = pixman_fixed_to_int(params[0]);
+	int ch = pixman_fixed_to_int(params[1]);
+	pixman_fixed_t row[2 + 32], col[2 + 32];
+	PicturePtr src, tmp[2];
+	struct kgem_bo *bo;
+	int y0, depth;
+	uint32_t format;
+
+	if (cw <= 1 || ch <= 1 || cw > 32 || ch > 32)
+		return -1;
+
+	if (h + ch - 1 > sna->render.max_3d_size)
+		return -1;
+
+	if (!sna_convolve_is_separable(params + 2, cw, ch, row + 2, col + 2))
+		return -1;
+
+	/* first row of the kernel relative to the sample, as per pixman */
+	y0 = pixman_fixed_to_int(pixman_fixed_1/2 - pixman_fixed_e - ((params[1] - pixman_fixed_1) >> 1));
+
+	DBG(("%s: kernel=%dx%d, size=%dx%d\n", __FUNCTION__, cw, ch, w, h));
+
+	if (PICT_FORMAT_RGB(picture->format) == 0) {
+		format = PIXMAN_a8;
+		depth = 8;
+	} else {
+		format = PIXMAN_a8r8g8b8;
+		depth = 32;
+	}
+
+	tmp[0] = convolve_scratch(sna, screen, w, h + ch - 1, depth, format, &bo);
+	if (tmp[0] == NULL)
+		return -1;
+
+	tmp[1] = convolve_scratch(sna, screen, w, h, depth, format, &bo);
+	if (tmp[1] == NULL) {
+		FreePicture(tmp[0], 0);
+		return -1;
+	}
+
+	row[0] = params[0];
+	row[1] = pixman_fixed_1;
+	src = sna_render_picture_private(picture, PictFilterConvolution,
+					 row, 2 + cw);
+	if (src == NULL) {
+		FreePicture(tmp[1], 0);
+		FreePicture(tmp[0], 0);
+		return -1;
+	}
+	sna_composite(PictOpSrc, src, NULL, tmp[0],
+		      x, y + y0,
+		      0, 0,
+		      0, 0,
+		      w, h + ch - 1);
+	sna_render_picture_private_free(src);
+
+	col[0] = pixman_fixed_1;
+	col[1] = params[1];
+	tmp[0]->filter = PictFilterConvolution;
+	tmp[0]->filter_params = col;
+	tmp[0]->filter_nparams = 2 + ch;
+	sna_composite(PictOpSrc, tmp[0], NULL, tmp[1],
+		      0, -y0,
+		      0, 0,
+		      0, 0,
+		      w, h);
+	tmp[0]->filter = PictFilterNearest;
+	tmp[0]->filter_params = NULL;
+	tmp[0]->filter_nparams = 0;
+	FreePicture(tmp[0], 0);
+
+	channel->pict_format = format;
+	channel->height = h;
+	channel->width  = w;
+	channel->filter = PictFilterNearest;
+	channel->repeat = RepeatNone;
+	channel->is_affine = true;
+	channel->transform = NULL;
+	channel->scale[0] = 1.f / w;
+	channel->scale[1] = 1.f / h;
+	channel->offset[0] = -dst_x;
+	channel->offset[1] = -dst_y;
+	channel->bo = kgem_bo_reference(bo); /* transfer ownership */
+	FreePicture(tmp[1], 0);
+
+	return 1;
+}
+
 static int
 sna_render_picture_convolve(struct sna *sna,
 			    PicturePtr picture,
@@ -1305,7 +1527,6 @@ sna_render_picture_convolve(struct sna *sna,
 			    int16_t dst_x, int16_t dst_y)
 {
 	ScreenPtr screen = picture->pDrawable->pScreen;
-	PixmapPtr pixmap;
 	PicturePtr tmp;
 	pixman_fixed_t *params = picture->filter_params;
 	int x_off = -pixman_fixed_to_int((params[0] - pixman_fixed_1) >> 1);
@@ -1315,6 +1536,15 @@ sna_render_picture_convolve(struct sna *sna,
 	int i, j, error, depth;
 	struct kgem_bo *bo;
 
+	assert(picture->pDrawable);
+	assert(picture->filter == PictFilterConvolution);
+	assert(w <= sna->render.max_3d_size && h <= sna->render.max_3d_size);
+
+	if (sna_render_picture_convolve__separable(sna, picture, channel,
+						   x, y, w, h,
+						   dst_x, dst_y) == 1)
+		return 1;
+
 	/* Lame multi-pass accumulation implementation of a general convolution
 	 * that works everywhere.
 	 */
@@ -1323,10 +1553,6 @@ sna_render_picture_convolve(struct sna *sna,
 	if (cw*ch > 32) /* too much loss of precision from quantization! */
 		return -1;
 
-	assert(picture->pDrawable);
-	assert(picture->filter == PictFilterConvolution);
-	assert(w <= sna->render.max_3d_size && h <= sna->render.max_3d_size);
-
 	if (PICT_FORMAT_RGB(picture->format) == 0) {
 		channel->pict_format = PIXMAN_a8;
 		depth = 8;
@@ -1335,25 +1561,11 @@ sna_render_picture_convolve(struct sna *sna,
 		depth = 32;
 	}
 
-	pixmap = screen->CreatePixmap(screen, w, h, depth, SNA_CREATE_SCRATCH);
-	if (pixmap == NullPixmap) {
-		DBG(("%s: pixmap allocation failed\n", __FUNCTION__));
-		return -1;
-	}
-
-	tmp = NULL;
-	bo = __sna_pixmap_get_bo(pixmap);
-	assert(bo);
-	if (sna->render.clear(sna, pixmap, bo))
-		tmp = CreatePicture(0, &pixmap->drawable,
-				PictureMatchFormat(screen, depth, channel->pict_format),
-				0, NULL, serverClient, &error);
-	screen->DestroyPixmap(pixmap);
+	tmp = convolve_scratch(sna, screen, w, h, depth,
+			       channel->pict_format, &bo);
 	if (tmp == NULL)
 		return -1;
 
-	ValidatePicture(tmp);
-
 	picture->filter = PictFilterBilinear;
 	params += 2;
 	for (j = 0; j < ch; j++) {
@@ -1361,7 +1573,9 @@ sna_render_picture_convolve(struct sna *sna,
 			xRenderColor color;
 			PicturePtr alpha;
 
-			color.alpha = *params++;
+			/* a weight of 1 does not fit into the colour */
+			color.alpha = MIN(*params, 0xffff);
+			params++;
 			color.red = color.green = color.blue = 0;
 			DBG(("%s: (%d, %d), alpha=%x\n",
 			     __FUNCTION__, i,j, color.alpha));
@@ -10,7 +10,9 @@
 #include <pthread.h>
 #include "atomic.h"
 
-#define GRADIENT_CACHE_SIZE 16
+#define GRADIENT_CACHE_SIZE 256 /* default, see Option "GradientCacheSize" */
+#define GRADIENT_ATLAS_ROWS 64
+#define GRADIENT_ATLAS_WIDTH 1024 /* texels in each row, i.e. each ramp */
 
 #define GXinvalid 0xff
 
@@ -143,6 +145,7 @@ struct sna_composite_op {
 
 		struct {
 			uint32_t flags;
+			const struct sna_shader *shader;
 		} gen7;
 
 		struct {
@@ -221,10 +224,25 @@ struct sna_copy_op {
 	void (*done)(struct sna *sna, const struct sna_copy_op *op);
 };
 
+/* Glyphs are packed onto shelves within a set of atlas pages per format,
+ * allocated on demand. Once all pages are in use, the least recently
+ * used page is emptied wholesale to make room.
+ */
+#define SNA_GLYPH_PAGES 16
+#define SNA_GLYPH_SHELVES 256
+#define SNA_GLYPH_HASH 256
+
+#define SNA_TRAPEZOID_CACHE_SIZE 16
+#define SNA_TRAPEZOID_CACHE_MAX 256 /* largest mask dimension retained */
+#define SNA_TRAPEZOID_CACHE_HITS 3 /* insertions a busy mask survives idle */
+
 struct sna_render {
 	pthread_mutex_t lock;
 	pthread_cond_t wait;
+	const void *reserve_op;
+	int reserve_step;
 	int active;
+#define VERTEX_SHARED (1 << 30)
 
 	int max_3d_size;
 	int max_3d_pitch;
@@ -312,36 +330,94 @@ struct sna_render {
 		struct kgem_bo *cache_bo;
 		struct kgem_bo *bo[1024];
 		uint32_t color[1024];
+		uint32_t *map;
+		struct {
+			uint16_t slot;
+			uint16_t gen;
+		} hash[2048];
+		uint16_t gen;
 		int last;
 		int size;
 		int dirty;
 	} solid_cache;
 
-	struct {
-		struct sna_gradient_cache {
+	struct sna_gradient_cache {
+		struct sna_gradient_ramp {
+			struct list link;
+			struct sna_gradient_ramp *next;
 			struct kgem_bo *bo;
+			uint32_t hash;
+			int row;
 			int nstops;
 			PictGradientStop *stops;
-		} cache[GRADIENT_CACHE_SIZE];
-		int size;
+		} *ramps, **hash;
+		struct list lru, free;
+		struct kgem_bo *atlas;
+		uint8_t *map;
+		uint64_t stale;
+		int size, count, rows, mask;
+		struct {
+			unsigned hits, misses, evictions, atlases;
+		} stats;
 	} gradient_cache;
 
-	struct sna_glyph_cache{
-		PicturePtr picture;
-		struct sna_glyph **glyphs;
-		uint16_t count;
-		uint16_t evict;
+	struct sna_glyph_cache {
+		struct sna_glyph_page {
+			PicturePtr picture;
+			struct kgem_bo *bo;
+			struct sna_glyph **glyphs;
+			struct sna_glyph_slot {
+				unsigned char sha1[20];
+				uint32_t format;
+				int16_t x, y;
+				uint16_t width, height;
+				uint16_t next;
+			} *slots;
+			uint16_t hash[SNA_GLYPH_HASH];
+			int count, size;
+			uint32_t age;
+			int16_t top;
+			int16_t nshelf;
+			struct sna_glyph_shelf {
+				int16_t y, height, x;
+			} shelf[SNA_GLYPH_SHELVES];
+		} page[SNA_GLYPH_PAGES];
+		int npages, max_pages;
+		int current;
+		uint32_t serial;
+		struct {
+			unsigned lookups, misses, restores, evictions, pages;
+		} stats;
 	} glyph[2];
+
+	struct sna_trapezoid_cache {
+		struct sna_trapezoid_mask {
+			xTrapezoid *traps;
+			PicturePtr picture;
+			uint32_t hash;
+			uint32_t age;
+			int ntrap, size;
+			int16_t width, height;
+			uint8_t mode;
+			uint8_t hits;
+		} entry[SNA_TRAPEZOID_CACHE_SIZE];
+		uint32_t serial;
+		bool busy;
+		struct {
+			unsigned hits, misses, masks, evictions;
+		} stats;
+	} trapezoid_cache;
+
 	pixman_image_t *white_image;
 	PicturePtr white_picture;
 
-	uint16_t vb_id;
+	uint32_t vb_id;
 	uint16_t vertex_offset;
 	uint16_t vertex_start;
 	uint16_t vertex_index;
 	uint16_t vertex_used;
 	uint16_t vertex_size;
-	uint16_t vertex_reloc[16];
+	uint16_t vertex_reloc[18];
 	int nvertex_reloc;
 
 	struct kgem_bo *vbo;
@@ -381,6 +457,60 @@ struct gen3_render_state {
 	uint32_t tex_delta[2];
 };
 
+/* Binding tables already written into the current batch, keyed by the
+ * surface state offsets they point to. As each surface state is itself
+ * cached per bo and format (kgem_bo_get_binding), identical offsets mean
+ * an identical table that we can simply point at again.
+ */
+#define SNA_BINDING_CACHE_SIZE 64
+struct sna_binding_cache {
+	struct sna_binding_table {
+		uint32_t surface[3];
+		uint16_t offset;
+	} entry[SNA_BINDING_CACHE_SIZE];
+};
+
+/* Kernels assembled on demand for composite variants outside of the
+ * precompiled set. They live in a reserved arena at the tail of the
+ * general state bo, are looked up by an opaque key describing the
+ * variant and are evicted least-recently-used once either the table
+ * or the arena fills up. A full arena is compacted into a copy of the
+ * general state bo, which the backend adopts at its next batch.
+ */
+#define SNA_SHADER_CACHE_SIZE 32
+#define SNA_SHADER_KEY_MAX 256
+#define SNA_SHADER_ARENA_SIZE (64*1024)
+
+typedef bool (*sna_shader_compile_func)(struct brw_compile *p,
+					int dispatch_width,
+					const void *key);
+
+struct sna_shader {
+	uint32_t hash;
+	uint32_t len;
+	uint32_t serial;
+	uint32_t last_used;
+	uint32_t offset, size;
+	uint32_t kernel[3];
+	int num_surfaces;
+	uint8_t key[SNA_SHADER_KEY_MAX];
+};
+
+struct sna_shader_cache {
+	struct kgem_bo *bo;
+	uint8_t *map;
+	uint32_t base, size, used;
+	uint32_t serial;
+	int count;
+	struct sna_shader entry[SNA_SHADER_CACHE_SIZE];
+	struct {
+		unsigned hits;
+		unsigned misses;
+		unsigned evictions;
+		unsigned compactions;
+	} stats;
+};
+
 struct gen4_render_state {
 	struct kgem_bo *general_bo;
 
@@ -396,6 +526,7 @@ struct gen4_render_state {
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 
 	bool needs_invariant;
 	bool needs_urb;
@@ -416,6 +547,7 @@ struct gen5_render_state {
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 
 	bool needs_invariant;
 };
@@ -465,6 +597,7 @@ struct gen6_render_state {
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 
 	bool needs_invariant;
 	bool first_state_packet;
@@ -502,6 +635,10 @@ struct gen7_render_state {
 	uint32_t sf_mask_state;
 	uint32_t wm_state;
 	uint32_t wm_kernel[GEN7_WM_KERNEL_COUNT][3];
+	struct sna_shader_cache shaders;
+	uint32_t vs_kernel[2];
+	uint32_t vs_corners;
+	uint32_t vs_scratch;
 
 	uint32_t cc_blend;
 
@@ -513,11 +650,14 @@ struct gen7_render_state {
 
 	uint16_t num_sf_outputs;
 	uint16_t ve_id;
+	uint16_t vs;
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 	uint16_t pipe_controls_since_stall;
 
+	bool needs_context;
 	bool needs_invariant;
 	bool emit_flush;
 };
@@ -555,6 +695,8 @@ struct gen8_render_state {
 	uint32_t sf_mask_state;
 	uint32_t wm_state;
 	uint32_t wm_kernel[GEN8_WM_KERNEL_COUNT][3];
+	uint32_t vs_kernel[2];
+	uint32_t vs_corners;
 
 	uint32_t cc_blend;
 
@@ -566,9 +708,11 @@ struct gen8_render_state {
 
 	uint16_t num_sf_outputs;
 	uint16_t ve_id;
+	uint16_t vs;
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 
 	bool needs_invariant;
 	bool emit_flush;
@@ -606,6 +750,8 @@ struct gen9_render_state {
 	uint32_t sf_mask_state;
 	uint32_t wm_state;
 	uint32_t wm_kernel[GEN9_WM_KERNEL_COUNT][3];
+	uint32_t vs_kernel[2];
+	uint32_t vs_corners;
 
 	uint32_t cc_blend;
 
@@ -617,9 +763,11 @@ struct gen9_render_state {
 
 	uint16_t num_sf_outputs;
 	uint16_t ve_id;
+	uint16_t vs;
 	uint16_t last_primitive;
 	int16_t floats_per_vertex;
 	uint16_t surface_table;
+	struct sna_binding_cache binding_cache;
 
 	bool needs_invariant;
 	bool emit_flush;
@@ -641,6 +789,10 @@ unsigned sna_static_stream_compile_sf(struct sna *sna,
 				      struct sna_static_stream *stream,
 				      bool (*compile)(struct brw_compile *));
 
+unsigned sna_static_stream_compile_vs(struct sna *sna,
+				      struct sna_static_stream *stream,
+				      bool (*compile)(struct brw_compile *));
+
 unsigned sna_static_stream_compile_wm(struct sna *sna,
 				      struct sna_static_stream *stream,
 				      bool (*compile)(struct brw_compile *, int),
@@ -648,6 +800,35 @@ unsigned sna_static_stream_compile_wm(struct sna *sna,
 struct kgem_bo *sna_static_stream_fini(struct sna *sna,
 				       struct sna_static_stream *stream);
 
+/* FNV-1a, for keying the shader, gradient and trapezoid caches.
+ * Start from SNA_HASH_INIT and feed successive blocks through sna_hash().
+ */
+#define SNA_HASH_INIT 2166136261u
+static inline uint32_t sna_hash(uint32_t hash, const void *data, int len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+bool sna_shader_cache_init(struct sna *sna,
+			   struct sna_shader_cache *cache,
+			   struct kgem_bo *bo,
+			   uint32_t offset, uint32_t size);
+void sna_shader_cache_fini(struct sna *sna,
+			   struct sna_shader_cache *cache);
+const struct sna_shader *
+sna_shader_cache_get(struct sna *sna,
+		     struct sna_shader_cache *cache,
+		     const void *key, int len,
+		     int num_surfaces, unsigned dispatch,
+		     sna_shader_compile_func compile);
+
 struct kgem_bo *
 sna_render_get_solid(struct sna *sna,
 		     uint32_t color);
@@ -658,6 +839,10 @@ sna_render_flush_solid(struct sna *sna);
 struct kgem_bo *
 sna_render_get_gradient(struct sna *sna,
 			PictGradient *pattern);
+struct kgem_bo *
+sna_render_get_gradient_row(struct sna *sna,
+			    PictGradient *pattern,
+			    int *row);
 
 bool
 sna_gradient_is_opaque(const PictGradient *gradient);
@@ -855,6 +1040,16 @@ sna_render_picture_fixup(struct sna *sna,
 			 int16_t w, int16_t h,
 			 int16_t dst_x, int16_t dst_y);
 
+bool
+sna_convolve_is_separable(const pixman_fixed_t *k, int cw, int ch,
+			  pixman_fixed_t *row, pixman_fixed_t *col);
+
+PicturePtr
+sna_render_picture_private(PicturePtr picture, int filter,
+			   pixman_fixed_t *params, int nparams);
+void
+sna_render_picture_private_free(PicturePtr tmp);
+
 int
 sna_render_picture_convert(struct sna *sna,
 			   PicturePtr picture,
@@ -899,31 +1094,137 @@ static inline void sna_vertex_lock(struct sna_render *r)
 	pthread_mutex_lock(&r->lock);
 }
 
-static inline void sna_vertex_acquire__locked(struct sna_render *r)
+static inline void sna_vertex_unlock(struct sna_render *r)
 {
-	r->active++;
+	pthread_mutex_unlock(&r->lock);
 }
 
-static inline void sna_vertex_unlock(struct sna_render *r)
+static inline void sna_vertex_acquire__locked(struct sna_render *r)
 {
-	pthread_mutex_unlock(&r->lock);
+	__sync_fetch_and_add(&r->active, 1);
 }
 
-static inline void sna_vertex_release__locked(struct sna_render *r)
+static inline void sna_vertex_release(struct sna_render *r)
 {
-	assert(r->active > 0);
-	if (--r->active == 0)
+	assert(r->active & ~VERTEX_SHARED);
+	if (__sync_sub_and_fetch(&r->active, 1) == 0) {
+		/* Only reachable once the primitive is closed (or private);
+		 * take the lock so the wakeup cannot slip in between the
+		 * waiter's check and its sleep.
+		 */
+		pthread_mutex_lock(&r->lock);
 		pthread_cond_signal(&r->wait);
+		pthread_mutex_unlock(&r->lock);
+	}
 }
 
+/* Reserve space for up to *want rectangles of @op in the current vertex
+ * buffer without taking the lock. Whilst the primitive is shared, writers
+ * simply bump vertex_used and count themselves in r->active; once the
+ * buffer is full (or the primitive is closed) the caller must take the
+ * lock and fall back to its get_rectangles(). The caller keeps its active
+ * reference until sna_vertex_release().
+ */
+static inline float *sna_vertex_reserve(struct sna_render *r,
+					const void *op,
+					int floats_per_rect,
+					int *want)
+{
+	uint16_t used;
+	int active, n;
+
+	do {
+		active = *(volatile int *)&r->active;
+		if ((active & VERTEX_SHARED) == 0)
+			return NULL;
+	} while (!__sync_bool_compare_and_swap(&r->active, active, active + 1));
+
+	if (r->reserve_op != op)
+		goto fail;
+
+	do {
+		used = *(volatile uint16_t *)&r->vertex_used;
+		n = (r->vertex_size - used) / floats_per_rect;
+		if (n <= 0)
+			goto fail;
+		if (n > *want)
+			n = *want;
+	} while (!__sync_bool_compare_and_swap(&r->vertex_used, used,
+					       used + n * floats_per_rect));
+
+	__sync_fetch_and_add(&r->vertex_index, n * r->reserve_step);
+	*want = n;
+	return r->vertices + used;
+
+fail:
+	sna_vertex_release(r);
+	return NULL;
+}
+
+/* Close the primitive to further lock-free reservations and wait for the
+ * outstanding writers to complete.
+ */
 static inline bool sna_vertex_wait__locked(struct sna_render *r)
 {
-	bool was_active = r->active;
-	while (r->active)
+	bool was_active;
+
+	was_active = __sync_fetch_and_and(&r->active, ~VERTEX_SHARED) & ~VERTEX_SHARED;
+	while (*(volatile int *)&r->active)
 		pthread_cond_wait(&r->wait, &r->lock);
 	return was_active;
 }
 
+static inline float *sna_vertex_reserve__locked(struct sna_render *r,
+						const void *op,
+						int floats_per_rect,
+						int *want)
+{
+	float *v;
+
+	/* Another thread may have refilled the vertex buffer whilst we
+	 * waited for the lock, otherwise drain the writers before the
+	 * caller touches the vertex state.
+	 */
+	v = sna_vertex_reserve(r, op, floats_per_rect, want);
+	if (v == NULL)
+		sna_vertex_wait__locked(r);
+	return v;
+}
+
+/* Claim the @nrect rectangles just allocated by get_rectangles() and then
+ * share the primitive so that other threads can reserve the remaining
+ * space using sna_vertex_reserve(). A NULL @op keeps the primitive private.
+ */
+static inline float *sna_vertex_share__locked(struct sna_render *r,
+					      const void *op,
+					      int floats_per_rect,
+					      int nrect,
+					      int vertices_per_rect)
+{
+	float *v;
+
+	assert(r->active == 0);
+
+	v = r->vertices + r->vertex_used;
+	r->vertex_used += nrect * floats_per_rect;
+	assert(r->vertex_used <= r->vertex_size);
+
+	r->reserve_op = op;
+	r->reserve_step = vertices_per_rect;
+	__sync_fetch_and_add(&r->active, op ? 1 | VERTEX_SHARED : 1);
+	return v;
+}
+
+float *sna_vertex_reserve__thread(struct sna *sna,
+				  const struct sna_composite_op *op,
+				  int floats_per_rect,
+				  int vertices_per_rect,
+				  bool share,
+				  int *nbox,
+				  int (*get_rectangles)(struct sna *sna,
+							const struct sna_composite_op *op,
+							int want));
+
 #define alphaless(format) PICT_FORMAT(PICT_FORMAT_BPP(format),		\
 				      PICT_FORMAT_TYPE(format),		\
 				      0,				\
@@ -393,4 +393,48 @@ static inline long get_picture_id(PicturePtr picture)
 	return picture && picture->pDrawable ? get_drawable_pixmap(picture->pDrawable)->drawable.serialNumber : 0;
 }
 
+static inline void
+sna_binding_cache_reset(struct sna_binding_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+}
+
+/* Having just filled in the binding table at offset, look for an
+ * identical table earlier in this batch. On a hit, the new table is
+ * discarded (if nothing has been allocated after it) and the old
+ * one is returned in its place.
+ */
+static inline uint16_t
+sna_binding_cache_lookup(struct sna *sna,
+			 struct sna_binding_cache *cache,
+			 uint16_t offset, int size)
+{
+	const uint32_t *table = sna->kgem.batch + offset;
+	struct sna_binding_table *e;
+	uint32_t hash;
+
+	hash = table[0] >> 5;
+	hash = hash * 31 + (table[1] >> 5);
+	hash = hash * 31 + (table[2] >> 5);
+	e = &cache->entry[hash % SNA_BINDING_CACHE_SIZE];
+
+	if (e->offset &&
+	    e->surface[0] == table[0] &&
+	    e->surface[1] == table[1] &&
+	    e->surface[2] == table[2]) {
+		DBG(("%s: reusing binding table %x for %x\n",
+		     __FUNCTION__, 4*e->offset, 4*offset));
+		assert(e->offset != offset);
+		if (sna->kgem.surface == offset)
+			sna->kgem.surface += size;
+		return e->offset;
+	}
+
+	e->surface[0] = table[0];
+	e->surface[1] = table[1];
+	e->surface[2] = table[2];
+	e->offset = offset;
+	return offset;
+}
+
 #endif /* SNA_RENDER_INLINE_H */
@@ -0,0 +1,343 @@
+/*
+ * Copyright © 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "sna_render.h"
+#include "brw/brw.h"
+
+/* Scratch space for assembling a single kernel before it is copied into
+ * the arena; generated kernels may unroll far beyond the 256 dwords we
+ * reserve for each of the fixed kernels.
+ */
+#define MAX_KERNEL_SIZE (16*1024)
+
+/* We only ever append to space the GPU is not using, so write
+ * through an unsynchronized mapping.
+ */
+static uint8_t *
+sna_shader_cache_map(struct sna *sna, struct kgem_bo *bo)
+{
+	uint8_t *map;
+
+	if (sna->kgem.has_llc)
+		map = kgem_bo_map__cpu(&sna->kgem, bo);
+	else
+		map = kgem_bo_map__wc(&sna->kgem, bo);
+	if (map == NULL)
+		map = kgem_bo_map__gtt(&sna->kgem, bo);
+
+	return map;
+}
+
+bool sna_shader_cache_init(struct sna *sna,
+			   struct sna_shader_cache *cache,
+			   struct kgem_bo *bo,
+			   uint32_t offset, uint32_t size)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	cache->map = sna_shader_cache_map(sna, bo);
+	if (cache->map == NULL) {
+		DBG(("%s: unable to map the kernel arena\n", __FUNCTION__));
+		return false;
+	}
+
+	cache->bo = kgem_bo_reference(bo);
+	cache->base = offset;
+	cache->size = size;
+
+	DBG(("%s: arena [%x, %x)\n", __FUNCTION__, offset, offset + size));
+	return true;
+}
+
+void sna_shader_cache_fini(struct sna *sna,
+			   struct sna_shader_cache *cache)
+{
+	if (cache->map == NULL)
+		return;
+
+	if (cache->stats.misses)
+		xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+			       "Shader cache: %u hits, %u misses, %u evictions, %u compactions\n",
+			       cache->stats.hits, cache->stats.misses,
+			       cache->stats.evictions, cache->stats.compactions);
+
+	kgem_bo_destroy(&sna->kgem, cache->bo);
+	cache->map = NULL;
+	cache->bo = NULL;
+}
+
+static struct sna_shader *
+sna_shader_cache_find(struct sna_shader_cache *cache,
+		      uint32_t hash, const void *key, int len)
+{
+	int n;
+
+	for (n = 0; n < SNA_SHADER_CACHE_SIZE; n++) {
+		struct sna_shader *s = &cache->entry[n];
+
+		if (s->len == len && s->hash == hash &&
+		    memcmp(s->key, key, len) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+static uint32_t
+sna_shader_cache_evict(struct sna_shader_cache *cache)
+{
+	struct sna_shader *lru = NULL;
+	int n;
+
+	for (n = 0; n < SNA_SHADER_CACHE_SIZE; n++) {
+		struct sna_shader *s = &cache->entry[n];
+
+		if (s->len == 0)
+			continue;
+
+		if (lru == NULL || (int32_t)(s->last_used - lru->last_used) < 0)
+			lru = s;
+	}
+	assert(lru);
+
+	DBG(("%s: evicting shader serial=%d, [%x, %x)\n",
+	     __FUNCTION__, lru->serial, lru->offset, lru->offset + lru->size));
+
+	lru->len = 0;
+	cache->count--;
+	cache->stats.evictions++;
+	return lru->size;
+}
+
+static int cmp_offset(const void *A, const void *B)
+{
+	const struct sna_shader *a = *(const struct sna_shader * const *)A;
+	const struct sna_shader *b = *(const struct sna_shader * const *)B;
+
+	return (int)a->offset - (int)b->offset;
+}
+
+/* Pack the surviving kernels into a fresh bo, behind a copy of the
+ * static state that precedes the arena. Moving them in place would have
+ * to wait for the GPU to finish with the old kernels; instead the old bo
+ * stays untouched until its batches retire, and the backend switches to
+ * the new one at the start of its next batch.
+ */
+static bool
+sna_shader_cache_compact(struct sna *sna, struct sna_shader_cache *cache)
+{
+	struct sna_shader *live[SNA_SHADER_CACHE_SIZE];
+	struct kgem_bo *bo;
+	uint8_t *map;
+	uint32_t offset;
+	int n, count;
+
+	DBG(("%s: used=%d, count=%d\n", __FUNCTION__, cache->used, cache->count));
+
+	bo = kgem_create_linear(&sna->kgem, cache->base + cache->size, 0);
+	if (bo == NULL)
+		return false;
+
+	map = sna_shader_cache_map(sna, bo);
+	if (map == NULL) {
+		kgem_bo_destroy(&sna->kgem, bo);
+		return false;
+	}
+
+	memcpy(map, cache->map, cache->base);
+	cache->stats.compactions++;
+
+	count = 0;
+	for (n = 0; n < SNA_SHADER_CACHE_SIZE; n++)
+		if (cache->entry[n].len)
+			live[count++] = &cache->entry[n];
+	assert(count == cache->count);
+	qsort(live, count, sizeof(live[0]), cmp_offset);
+
+	offset = cache->base;
+	for (n = 0; n < count; n++) {
+		struct sna_shader *s = live[n];
+		int32_t delta = offset - s->offset;
+		int i;
+
+		memcpy(map + offset, cache->map + s->offset, s->size);
+		if (delta) {
+			for (i = 0; i < 3; i++)
+				if (s->kernel[i])
+					s->kernel[i] += delta;
+			s->offset = offset;
+			/* The render state may still remember the old
+			 * kernels across batches, so make it look anew.
+			 */
+			s->serial = ++cache->serial;
+		}
+		offset += s->size;
+	}
+	cache->used = offset - cache->base;
+
+	kgem_bo_destroy(&sna->kgem, cache->bo);
+	cache->bo = bo;
+	cache->map = map;
+	return true;
+}
+
+static struct sna_shader *
+sna_shader_cache_alloc(struct sna *sna,
+		       struct sna_shader_cache *cache,
+		       uint32_t size)
+{
+	int n;
+
+	if (size > cache->size)
+		return NULL;
+
+	if (cache->count == SNA_SHADER_CACHE_SIZE)
+		sna_shader_cache_evict(cache);
+
+	if (cache->used + size > cache->size) {
+		uint32_t live = 0;
+
+		for (n = 0; n < SNA_SHADER_CACHE_SIZE; n++)
+			if (cache->entry[n].len)
+				live += cache->entry[n].size;
+
+		while (live + size > cache->size)
+			live -= sna_shader_cache_evict(cache);
+
+		if (!sna_shader_cache_compact(sna, cache))
+			return NULL;
+		assert(cache->used == live);
+	}
+
+	for (n = 0; n < SNA_SHADER_CACHE_SIZE; n++) {
+		if (cache->entry[n].len == 0) {
+			struct sna_shader *s = &cache->entry[n];
+
+			s->offset = cache->base + cache->used;
+			s->size = size;
+			cache->used += size;
+			cache->count++;
+			return s;
+		}
+	}
+
+	assert(0);
+	return NULL;
+}
+
+const struct sna_shader *
+sna_shader_cache_get(struct sna *sna,
+		     struct sna_shader_cache *cache,
+		     const void *key, int len,
+		     int num_surfaces, unsigned dispatch,
+		     sna_shader_compile_func compile)
+{
+	struct sna_shader *s;
+	uint32_t hash, size, kernel[3], length[3];
+	uint8_t *store;
+	int i;
+
+	assert(len > 0 && len <= SNA_SHADER_KEY_MAX);
+	assert(dispatch);
+
+	if (cache->map == NULL)
+		return NULL;
+
+	hash = sna_hash(SNA_HASH_INIT, key, len);
+	s = sna_shader_cache_find(cache, hash, key, len);
+	if (s) {
+		cache->stats.hits++;
+		s->last_used = ++cache->serial;
+		return s;
+	}
+
+	cache->stats.misses++;
+
+	store = malloc(3 * MAX_KERNEL_SIZE);
+	if (store == NULL)
+		return NULL;
+
+	size = 0;
+	for (i = 0; i < 3; i++) {
+		struct brw_compile p;
+
+		kernel[i] = length[i] = 0;
+		if ((dispatch & (1 << i)) == 0)
+			continue;
+
+		brw_compile_init(&p, sna->kgem.gen, store + i * MAX_KERNEL_SIZE);
+		if (!compile(&p, 8 << i, key)) {
+			DBG(("%s: failed to compile SIMD%d kernel\n",
+			     __FUNCTION__, 8 << i));
+			continue;
+		}
+
+		length[i] = p.nr_insn * sizeof(struct brw_instruction);
+		assert(length[i] <= MAX_KERNEL_SIZE);
+
+		kernel[i] = size;
+		size += ALIGN(length[i], 64);
+	}
+	if (size == 0) {
+		free(store);
+		return NULL;
+	}
+
+	s = sna_shader_cache_alloc(sna, cache, size);
+	if (s == NULL) {
+		free(store);
+		return NULL;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (length[i] == 0) {
+			s->kernel[i] = 0;
+			continue;
+		}
+
+		memcpy(cache->map + s->offset + kernel[i],
+		       store + i * MAX_KERNEL_SIZE,
+		       length[i]);
+		s->kernel[i] = s->offset + kernel[i];
+	}
+	free(store);
+
+	s->hash = hash;
+	s->len = len;
+	memcpy(s->key, key, len);
+	s->num_surfaces = num_surfaces;
+	s->serial = ++cache->serial;
+	s->last_used = s->serial;
+
+	DBG(("%s: compiled shader serial=%d, size=%d, kernels=(%x, %x, %x), arena %d/%d used\n",
+	     __FUNCTION__, s->serial, size,
+	     s->kernel[0], s->kernel[1], s->kernel[2],
+	     cache->used, cache->size));
+	return s;
+}
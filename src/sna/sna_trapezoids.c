@@ -140,6 +140,86 @@ bool trapezoids_bounds(int n, const xTrapezoid *t, BoxPtr box)
 	return box->x2 > box->x1 && box->y2 > box->y1;
 }
 
+static bool
+trapezoid_tile_range(const struct trapezoid_tiles *tiles,
+		     const xTrapezoid *t, int dy,
+		     int *first, int *last)
+{
+	int y1, y2;
+
+	if (!xTrapezoidValid(t))
+		return false;
+
+	y1 = pixman_fixed_integer_floor(t->top) + dy;
+	y2 = pixman_fixed_integer_ceil(t->bottom) + dy;
+	if (y1 < tiles->y1)
+		y1 = tiles->y1;
+	if (y2 > tiles->y2)
+		y2 = tiles->y2;
+	if (y1 >= y2)
+		return false;
+
+	*first = (y1 - tiles->y1) / TRAPEZOID_TILE_HEIGHT;
+	*last = (y2 - 1 - tiles->y1) / TRAPEZOID_TILE_HEIGHT + 1;
+	return true;
+}
+
+bool trapezoid_tiles_init(struct trapezoid_tiles *tiles,
+			  const BoxRec *extents, int dy,
+			  const xTrapezoid *traps, int ntrap)
+{
+	int *cursor;
+	int n, t0, t1, total;
+
+	tiles->traps = traps;
+	tiles->y1 = extents->y1;
+	tiles->y2 = extents->y2;
+	tiles->count = (extents->y2 - extents->y1 + TRAPEZOID_TILE_HEIGHT - 1) / TRAPEZOID_TILE_HEIGHT;
+	tiles->next = 0;
+
+	tiles->offset = calloc(2 * (tiles->count + 1), sizeof(int));
+	if (tiles->offset == NULL)
+		return false;
+	cursor = tiles->offset + tiles->count + 1;
+
+	/* Count the trapezoids crossing each tile, then bin them */
+	for (n = 0; n < ntrap; n++) {
+		if (!trapezoid_tile_range(tiles, &traps[n], dy, &t0, &t1))
+			continue;
+
+		while (t0 < t1)
+			tiles->offset[++t0]++;
+	}
+	for (n = 0; n < tiles->count; n++)
+		tiles->offset[n+1] += tiles->offset[n];
+	total = tiles->offset[tiles->count];
+
+	tiles->index = malloc((total + 1) * sizeof(int));
+	if (tiles->index == NULL) {
+		free(tiles->offset);
+		return false;
+	}
+
+	memcpy(cursor, tiles->offset, tiles->count * sizeof(int));
+	for (n = 0; n < ntrap; n++) {
+		if (!trapezoid_tile_range(tiles, &traps[n], dy, &t0, &t1))
+			continue;
+
+		while (t0 < t1)
+			tiles->index[cursor[t0++]++] = n;
+	}
+
+	DBG(("%s: %d tiles of height %d, %d trapezoids binned %d times\n",
+	     __FUNCTION__, tiles->count, TRAPEZOID_TILE_HEIGHT, ntrap, total));
+	return true;
+}
+
+void trapezoid_tiles_fini(struct trapezoid_tiles *tiles)
+{
+	free(tiles->index);
+	free(tiles->offset);
+}
+
 static bool
 trapezoids_inplace_fallback(struct sna *sna,
 			    CARD8 op,
@@ -556,6 +636,306 @@ out:
 	return dst->pDrawable->width <= TOR_INPLACE_SIZE;
 }
 
+/* Clients often redraw exactly the same antialiased shapes every frame,
+ * spinners, rounded buttons and icons, only perhaps moved by whole pixels.
+ * Remember the last few trapezoid lists, translated to the origin, and
+ * once one is seen again keep its coverage in an a8 picture so that
+ * subsequent repeats become a single composite through that mask.
+ */
+static uint8_t trapezoid_mode(PicturePtr dst, PictFormatPtr maskFormat)
+{
+	if (is_analytic(dst, maskFormat))
+		return 2;
+	return is_precise(dst, maskFormat);
+}
+
+static void
+trapezoid_translate(xTrapezoid *out, const xTrapezoid *t, xFixed dx, xFixed dy)
+{
+	out->top = t->top - dy;
+	out->bottom = t->bottom - dy;
+	out->left.p1.x = t->left.p1.x - dx;
+	out->left.p1.y = t->left.p1.y - dy;
+	out->left.p2.x = t->left.p2.x - dx;
+	out->left.p2.y = t->left.p2.y - dy;
+	out->right.p1.x = t->right.p1.x - dx;
+	out->right.p1.y = t->right.p1.y - dy;
+	out->right.p2.x = t->right.p2.x - dx;
+	out->right.p2.y = t->right.p2.y - dy;
+}
+
+static uint32_t
+trapezoids_hash(const xTrapezoid *traps, int ntrap, xFixed dx, xFixed dy)
+{
+	uint32_t hash = SNA_HASH_INIT;
+
+	while (ntrap--) {
+		xTrapezoid t;
+
+		trapezoid_translate(&t, traps++, dx, dy);
+		hash = sna_hash(hash, &t, sizeof(t));
+	}
+
+	return hash;
+}
+
+static bool
+trapezoids_equal(const xTrapezoid *cached, const xTrapezoid *traps, int ntrap,
+		 xFixed dx, xFixed dy)
+{
+	while (ntrap--) {
+		xTrapezoid t;
+
+		trapezoid_translate(&t, traps++, dx, dy);
+		if (memcmp(&t, cached++, sizeof(t)))
+			return false;
+	}
+
+	return true;
+}
+
+static void
+trapezoid_mask_release(struct sna_trapezoid_mask *m)
+{
+	if (m->picture) {
+		FreePicture(m->picture, 0);
+		m->picture = NULL;
+	}
+	free(m->traps);
+	m->traps = NULL;
+	m->ntrap = m->size = 0;
+}
+
+static struct sna_trapezoid_mask *
+trapezoid_mask_find(struct sna_trapezoid_cache *cache,
+		    uint32_t hash, uint8_t mode,
+		    const xTrapezoid *traps, int ntrap,
+		    xFixed dx, xFixed dy)
+{
+	int n;
+
+	for (n = 0; n < SNA_TRAPEZOID_CACHE_SIZE; n++) {
+		struct sna_trapezoid_mask *m = &cache->entry[n];
+
+		if (m->ntrap == ntrap && m->hash == hash && m->mode == mode &&
+		    trapezoids_equal(m->traps, traps, ntrap, dx, dy))
+			return m;
+	}
+
+	return NULL;
+}
+
+static void
+trapezoid_mask_insert(struct sna_trapezoid_cache *cache,
+		      uint32_t hash, uint8_t mode, int width, int height,
+		      const xTrapezoid *traps, int ntrap,
+		      xFixed dx, xFixed dy)
+{
+	struct sna_trapezoid_mask *m = NULL;
+	int n;
+
+	for (n = 0; n < SNA_TRAPEZOID_CACHE_SIZE; n++) {
+		struct sna_trapezoid_mask *e = &cache->entry[n];
+
+		if (e->ntrap == 0) {
+			m = e;
+			break;
+		}
+
+		if (m == NULL) {
+			m = e;
+			continue;
+		}
+
+		/* Replace the entry with the fewest recent hits, and the
+		 * oldest of those. Every hit buys a mask protection from
+		 * one-off shapes for a few more insertions, so a stream of
+		 * them does not flush out the shapes being redrawn, yet a
+		 * mask that has stopped being used still ages out.
+		 */
+		if (e->hits != m->hits) {
+			if (e->hits < m->hits)
+				m = e;
+			continue;
+		}
+
+		if ((int32_t)(e->age - m->age) < 0)
+			m = e;
+	}
+	assert(m);
+
+	for (n = 0; n < SNA_TRAPEZOID_CACHE_SIZE; n++) {
+		if (cache->entry[n].hits)
+			cache->entry[n].hits--;
+	}
+
+	if (m->ntrap) {
+		DBG(("%s: evicting %d trapezoids, mask? %d\n",
+		     __FUNCTION__, m->ntrap, m->picture != NULL));
+		if (m->picture) {
+			FreePicture(m->picture, 0);
+			m->picture = NULL;
+		}
+		m->ntrap = 0;
+		cache->stats.evictions++;
+	}
+
+	if (ntrap > m->size) {
+		free(m->traps);
+		m->traps = malloc(sizeof(xTrapezoid)*ntrap);
+		if (m->traps == NULL) {
+			m->size = 0;
+			return;
+		}
+		m->size = ntrap;
+	}
+
+	for (n = 0; n < ntrap; n++)
+		trapezoid_translate(&m->traps[n], &traps[n], dx, dy);
+	m->ntrap = ntrap;
+	m->hash = hash;
+	m->mode = mode;
+	m->width = width;
+	m->height = height;
+	m->age = ++cache->serial;
+	m->hits = 0;
+}
+
+/* Render the coverage of the cached trapezoids into a fresh a8 picture,
+ * using the same converters (and so the same antialiasing) as the
+ * original destination would have.
+ */
+static bool
+trapezoid_mask_create(struct sna *sna, PicturePtr dst,
+		      PictFormatPtr maskFormat,
+		      struct sna_trapezoid_mask *m)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	struct sna_trapezoid_cache *cache = &sna->render.trapezoid_cache;
+	PixmapPtr pixmap;
+	PicturePtr picture;
+	int error;
+
+	pixmap = screen->CreatePixmap(screen, m->width, m->height, 8,
+				      SNA_CREATE_SCRATCH);
+	if (pixmap == NULL)
+		return false;
+
+	picture = CreatePicture(0, &pixmap->drawable, maskFormat,
+				0, 0, serverClient, &error);
+	screen->DestroyPixmap(pixmap);
+	if (picture == NULL)
+		return false;
+
+	picture->polyMode = dst->polyMode;
+	picture->polyEdge = dst->polyEdge;
+	ValidatePicture(picture);
+
+	cache->busy = true;
+	sna_composite_trapezoids(PictOpSrc,
+				 sna->render.white_picture, picture,
+				 maskFormat, 0, 0,
+				 m->ntrap, m->traps);
+	cache->busy = false;
+
+	DBG(("%s: created %dx%d mask for %d trapezoids\n",
+	     __FUNCTION__, m->width, m->height, m->ntrap));
+	m->picture = picture;
+	cache->stats.masks++;
+	return true;
+}
+
+static bool
+trapezoids_cached(struct sna *sna,
+		  CARD8 op, PicturePtr src, PicturePtr dst,
+		  PictFormatPtr maskFormat,
+		  INT16 xSrc, INT16 ySrc,
+		  int ntrap, xTrapezoid *traps)
+{
+	struct sna_trapezoid_cache *cache = &sna->render.trapezoid_cache;
+	struct sna_trapezoid_mask *m;
+	BoxRec bounds;
+	xFixed dx, dy;
+	int16_t x0, y0;
+	uint32_t hash;
+	uint8_t mode;
+
+	if (NO_TRAPEZOID_CACHE || cache->busy)
+		return false;
+
+	/* Without a mask each trapezoid is composited on its own */
+	if (maskFormat == NULL || maskFormat->format != PICT_a8)
+		return false;
+
+	if (sna->render.white_picture == NULL)
+		return false;
+
+	if (!trapezoids_bounds(ntrap, traps, &bounds))
+		return false;
+
+	if (bounds.x2 - bounds.x1 > SNA_TRAPEZOID_CACHE_MAX ||
+	    bounds.y2 - bounds.y1 > SNA_TRAPEZOID_CACHE_MAX) {
+		DBG(("%s: too large to cache, %dx%d\n", __FUNCTION__,
+		     bounds.x2 - bounds.x1, bounds.y2 - bounds.y1));
+		return false;
+	}
+
+	dx = pixman_int_to_fixed(bounds.x1);
+	dy = pixman_int_to_fixed(bounds.y1);
+	mode = trapezoid_mode(dst, maskFormat);
+	hash = trapezoids_hash(traps, ntrap, dx, dy);
+
+	m = trapezoid_mask_find(cache, hash, mode, traps, ntrap, dx, dy);
+	if (m == NULL) {
+		DBG(("%s: miss, remembering %d trapezoids, hash=%08x\n",
+		     __FUNCTION__, ntrap, hash));
+		cache->stats.misses++;
+		trapezoid_mask_insert(cache, hash, mode,
+				      bounds.x2 - bounds.x1,
+				      bounds.y2 - bounds.y1,
+				      traps, ntrap, dx, dy);
+		return false;
+	}
+
+	m->age = ++cache->serial;
+	if (m->hits < SNA_TRAPEZOID_CACHE_HITS)
+		m->hits++;
+	if (m->picture == NULL &&
+	    !trapezoid_mask_create(sna, dst, maskFormat, m))
+		return false;
+
+	DBG(("%s: hit, %d trapezoids at (%d, %d), mask %dx%d\n",
+	     __FUNCTION__, ntrap, bounds.x1, bounds.y1, m->width, m->height));
+	cache->stats.hits++;
+
+	trapezoid_origin(&traps[0].left, &x0, &y0);
+	CompositePicture(op, src, m->picture, dst,
+			 xSrc + bounds.x1 - x0,
+			 ySrc + bounds.y1 - y0,
+			 0, 0,
+			 bounds.x1, bounds.y1,
+			 m->width, m->height);
+	return true;
+}
+
+void sna_trapezoids_close(struct sna *sna)
+{
+	struct sna_trapezoid_cache *cache = &sna->render.trapezoid_cache;
+	int n;
+
+	DBG(("%s\n", __FUNCTION__));
+
+	if (cache->stats.misses)
+		xf86DrvMsgVerb(sna->scrn->scrnIndex, X_INFO, 3,
+			       "Trapezoid cache: %u hits, %u misses, %u masks, %u evictions\n",
+			       cache->stats.hits, cache->stats.misses,
+			       cache->stats.masks, cache->stats.evictions);
+
+	for (n = 0; n < SNA_TRAPEZOID_CACHE_SIZE; n++)
+		trapezoid_mask_release(&cache->entry[n]);
+	memset(cache, 0, sizeof(*cache));
+}
+
 void
 sna_composite_trapezoids(CARD8 op,
 			 PicturePtr src,
@@ -674,6 +1054,11 @@ force_fallback:
 	if (force_fallback)
 		goto fallback;
 
+	if (!is_mono(dst, maskFormat) &&
+	    trapezoids_cached(sna, op, src, dst, maskFormat,
+			      xSrc, ySrc, ntrap, traps))
+		return;
+
 	if (is_mono(dst, maskFormat) &&
 	    mono_trapezoids_span_converter(sna, op, src, dst,
 					   xSrc, ySrc,
@@ -1106,10 +1491,42 @@ sna_composite_tristrip(CARD8 op,
 		       int n, xPointFixed *points)
 {
 	struct sna *sna = to_sna_from_drawable(dst->pDrawable);
+	xTriangle stack[64], *tri;
+	int i;
 
 	if (tristrip_span_converter(sna, op, src, dst, maskFormat, xSrc, ySrc, n, points))
 		return;
 
+	if (n < 3)
+		goto fallback;
+
+	/* Without spans, build the mask from the strip's triangles so that
+	 * it is still rasterised on the sample grid.
+	 */
+	tri = stack;
+	if (n - 2 > (int)ARRAY_SIZE(stack)) {
+		tri = malloc(sizeof(xTriangle)*(n - 2));
+		if (tri == NULL)
+			goto fallback;
+	}
+
+	for (i = 2; i < n; i++) {
+		tri[i-2].p1 = points[i-2];
+		tri[i-2].p2 = points[i-1];
+		tri[i-2].p3 = points[i];
+	}
+
+	if (triangles_mask_converter(op, src, dst, maskFormat,
+				     xSrc, ySrc,
+				     n - 2, tri)) {
+		if (tri != stack)
+			free(tri);
+		return;
+	}
+
+	if (tri != stack)
+		free(tri);
+fallback:
 	tristrip_fallback(op, src, dst, maskFormat, xSrc, ySrc, n, points);
 }
 
@@ -1241,6 +1658,44 @@ sna_composite_trifan(CARD8 op,
 		     INT16 xSrc, INT16 ySrc,
 		     int n, xPointFixed *points)
 {
+	struct sna *sna = to_sna_from_drawable(dst->pDrawable);
+	xTriangle stack[64], *tri;
+	int i;
+
+	if (n < 3)
+		return;
+
+	/* Every triangle of the fan shares the first vertex, so feed them
+	 * to the triangle converters as a list rather than rasterising
+	 * each one in software.
+	 */
+	tri = stack;
+	if (n - 2 > (int)ARRAY_SIZE(stack)) {
+		tri = malloc(sizeof(xTriangle)*(n - 2));
+		if (tri == NULL)
+			goto fallback;
+	}
+
+	for (i = 2; i < n; i++) {
+		tri[i-2].p1 = points[0];
+		tri[i-2].p2 = points[i-1];
+		tri[i-2].p3 = points[i];
+	}
+
+	if (triangles_span_converter(sna, op, src, dst, maskFormat,
+				     xSrc, ySrc,
+				     n - 2, tri) ||
+	    triangles_mask_converter(op, src, dst, maskFormat,
+				     xSrc, ySrc,
+				     n - 2, tri)) {
+		if (tri != stack)
+			free(tri);
+		return;
+	}
+
+	if (tri != stack)
+		free(tri);
+fallback:
 	trifan_fallback(op, src, dst, maskFormat, xSrc, ySrc, n, points);
 }
 #endif
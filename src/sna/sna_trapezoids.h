@@ -9,9 +9,11 @@
 #define NO_UNALIGNED_BOXES 0
 #define NO_SCAN_CONVERTER 0
 #define NO_GPU_THREADS 0
+#define NO_TRAPEZOID_CACHE 0
 
 #define NO_IMPRECISE 0
 #define NO_PRECISE 0
+#define NO_ANALYTIC 0
 
 #if 0
 #define __DBG DBG
@@ -113,6 +115,25 @@ precise_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 				INT16 src_x, INT16 src_y,
 				int ntrap, xTrapezoid *traps);
 
+bool
+analytic_trapezoid_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned int flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps);
+
+bool
+analytic_trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps);
+
+bool
+analytic_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, unsigned flags,
+				 INT16 src_x, INT16 src_y,
+				 int ntrap, xTrapezoid *traps);
+
 static inline bool is_mono(PicturePtr dst, PictFormatPtr mask)
 {
 	return mask ? mask->depth < 8 : dst->polyEdge==PolyEdgeSharp;
@@ -123,6 +144,13 @@ static inline bool is_precise(PicturePtr dst, PictFormatPtr mask)
 	return dst->polyMode == PolyModePrecise && !is_mono(dst, mask);
 }
 
+/* Smooth edges in precise mode may instead be given exact area coverage. */
+static inline bool is_analytic(PicturePtr dst, PictFormatPtr mask)
+{
+	return (to_sna_from_drawable(dst->pDrawable)->flags & SNA_ANALYTIC_COVERAGE &&
+		is_precise(dst, mask));
+}
+
 static inline bool
 trapezoid_span_inplace(struct sna *sna,
 		       CARD8 op, PicturePtr src, PicturePtr dst,
@@ -149,6 +177,8 @@ trapezoid_span_inplace(struct sna *sna,
 
 	if (is_mono(dst, maskFormat))
 		return mono_trapezoid_span_inplace(sna, op, src, dst, src_x, src_y, ntrap, traps);
+	else if (is_analytic(dst, maskFormat))
+		return false;
 	else if (is_precise(dst, maskFormat))
 		return precise_trapezoid_span_inplace(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps, fallback);
 	else
@@ -167,6 +197,8 @@ trapezoid_span_converter(struct sna *sna,
 
 	if (is_mono(dst, maskFormat))
 		return mono_trapezoids_span_converter(sna, op, src, dst, src_x, src_y, ntrap, traps);
+	else if (is_analytic(dst, maskFormat))
+		return analytic_trapezoid_span_converter(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 	else if (is_precise(dst, maskFormat))
 		return precise_trapezoid_span_converter(sna, op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 	else
@@ -182,7 +214,9 @@ trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 	if (NO_SCAN_CONVERTER)
 		return false;
 
-	if (is_precise(dst, maskFormat))
+	if (is_analytic(dst, maskFormat))
+		return analytic_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
+	else if (is_precise(dst, maskFormat))
 		return precise_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 	else
 		return imprecise_trapezoid_mask_converter(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
@@ -197,7 +231,9 @@ trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 	if (NO_SCAN_CONVERTER)
 		return false;
 
-	if (is_precise(dst, maskFormat))
+	if (is_analytic(dst, maskFormat))
+		return analytic_trapezoid_span_fallback(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
+	else if (is_precise(dst, maskFormat))
 		return precise_trapezoid_span_fallback(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
 	else
 		return imprecise_trapezoid_span_fallback(op, src, dst, maskFormat, flags, src_x, src_y, ntrap, traps);
@@ -255,6 +291,28 @@ triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 			 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
 			 int count, xTriangle *tri);
 
+bool
+precise_triangles_span_converter(struct sna *sna,
+				 CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri);
+
+bool
+precise_triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri);
+
+bool
+analytic_triangles_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				  int count, xTriangle *tri);
+
+bool
+analytic_triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				  int count, xTriangle *tri);
+
 bool
 mono_tristrip_span_converter(struct sna *sna,
 			     CARD8 op, PicturePtr src, PicturePtr dst,
@@ -393,6 +451,335 @@ static inline int pixman_fixed_to_fast(pixman_fixed_t v)
 
 bool trapezoids_bounds(int n, const xTrapezoid *t, BoxPtr box);
 
+/* The threaded span converters cut the extents into tiles of a fixed
+ * height, each with the list of trapezoids that cross it, and the
+ * workers take the next tile from the shared queue as they finish the
+ * last. So a few tiles crowded with edges no longer hold up the threads
+ * given the empty ones.
+ */
+#define TRAPEZOID_TILE_HEIGHT 32
+
+struct trapezoid_tiles {
+	const xTrapezoid *traps;
+	int *index, *offset;
+	int y1, y2, count;
+	int next;
+};
+
+bool trapezoid_tiles_init(struct trapezoid_tiles *tiles,
+			  const BoxRec *extents, int dy,
+			  const xTrapezoid *traps, int ntrap);
+void trapezoid_tiles_fini(struct trapezoid_tiles *tiles);
+
+static inline bool
+trapezoid_tiles_next(struct trapezoid_tiles *tiles,
+		     BoxRec *box, const int **index, int *count)
+{
+	int n = __sync_fetch_and_add(&tiles->next, 1);
+	if (n >= tiles->count)
+		return false;
+
+	box->y1 = tiles->y1 + n * TRAPEZOID_TILE_HEIGHT;
+	box->y2 = box->y1 + TRAPEZOID_TILE_HEIGHT;
+	if (box->y2 > tiles->y2)
+		box->y2 = tiles->y2;
+
+	*index = tiles->index + tiles->offset[n];
+	*count = tiles->offset[n+1] - tiles->offset[n];
+	return true;
+}
+
 #define TOR_INPLACE_SIZE 128
 
+typedef void (*span_func_t)(struct sna *sna,
+			    struct sna_composite_spans_op *op,
+			    pixman_region16_t *clip,
+			    const BoxRec *box,
+			    int coverage);
+
+#if HAS_DEBUG_FULL
+static inline void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
+{
+	if (box->x1 < 0 || box->y1 < 0 ||
+	    box->x2 > pixmap->drawable.width ||
+	    box->y2 > pixmap->drawable.height)
+	{
+		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
+			   function,
+			   box->x1, box->y1, box->x2, box->y2,
+			   pixmap->drawable.width,
+			   pixmap->drawable.height);
+	}
+}
+#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
+#else
+#define assert_pixmap_contains_box(p, b)
+#endif
+
+static inline void apply_damage(struct sna_composite_op *op, RegionPtr region)
+{
+	DBG(("%s: damage=%p, region=%dx[(%d, %d), (%d, %d)]\n",
+	     __FUNCTION__, op->damage,
+	     region_num_rects(region),
+	     region->extents.x1, region->extents.y1,
+	     region->extents.x2, region->extents.y2));
+
+	if (op->damage == NULL)
+		return;
+
+	RegionTranslate(region, op->dst.x, op->dst.y);
+
+	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
+	if (sna_damage_add_to_pixmap(op->damage, region, op->dst.pixmap))
+		op->damage = NULL;
+}
+
+static inline void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
+{
+	BoxRec r;
+
+	r.x1 = box->x1 + op->dst.x;
+	r.x2 = box->x2 + op->dst.x;
+	r.y1 = box->y1 + op->dst.y;
+	r.y2 = box->y2 + op->dst.y;
+
+	assert_pixmap_contains_box(op->dst.pixmap, &r);
+	sna_damage_add_box(op->damage, &r);
+}
+
+inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
+{
+	if (op->damage)
+		_apply_damage_box(op, box);
+}
+
+static inline int operator_is_bounded(uint8_t op)
+{
+	switch (op) {
+	case PictOpOver:
+	case PictOpOutReverse:
+	case PictOpAdd:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* The precise and analytic converters both hand their spans an area on
+ * the precise sample grid, GRID_AREA being full coverage, and so share
+ * the span functions that emit those directly through the composite op.
+ */
+#define GRID_AREA (2*SAMPLES_X*SAMPLES_Y)
+#define AREA_TO_FLOAT(c)  ((c) / (float)GRID_AREA)
+
+static inline void
+span_blt(struct sna *sna,
+	 struct sna_composite_spans_op *op,
+	 pixman_region16_t *clip,
+	 const BoxRec *box,
+	 int coverage)
+{
+	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
+
+	op->box(sna, op, box, AREA_TO_FLOAT(coverage));
+	apply_damage_box(&op->base, box);
+}
+
+static inline void
+span_blt__no_damage(struct sna *sna,
+		    struct sna_composite_spans_op *op,
+		    pixman_region16_t *clip,
+		    const BoxRec *box,
+		    int coverage)
+{
+	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
+
+	op->box(sna, op, box, AREA_TO_FLOAT(coverage));
+}
+
+static inline void
+span_blt_clipped(struct sna *sna,
+		 struct sna_composite_spans_op *op,
+		 pixman_region16_t *clip,
+		 const BoxRec *box,
+		 int coverage)
+{
+	pixman_region16_t region;
+	float opacity;
+
+	opacity = AREA_TO_FLOAT(coverage);
+	__DBG(("%s: %d -> %d @ %f\n", __FUNCTION__, box->x1, box->x2, opacity));
+
+	pixman_region_init_rects(&region, box, 1);
+	RegionIntersect(&region, &region, clip);
+	if (region_num_rects(&region)) {
+		op->boxes(sna, op,
+			  region_rects(&region),
+			  region_num_rects(&region),
+			  opacity);
+		apply_damage(&op->base, &region);
+	}
+	pixman_region_fini(&region);
+}
+
+static inline span_func_t
+choose_span(struct sna_composite_spans_op *tmp,
+	    PicturePtr dst,
+	    PictFormatPtr maskFormat,
+	    RegionPtr clip)
+{
+	span_func_t span;
+
+	assert(!is_mono(dst, maskFormat));
+	if (clip->data)
+		span = span_blt_clipped;
+	else if (tmp->base.damage == NULL)
+		span = span_blt__no_damage;
+	else
+		span = span_blt;
+
+	return span;
+}
+
+/* The threaded span converters collect their spans into a local array
+ * of opacity boxes, flushed through op->thread_boxes() as it fills.
+ * The coverage is converted to opacity by dividing by the area of the
+ * converter's sample grid, set by span_thread_boxes_init().
+ */
+struct span_thread {
+	struct sna *sna;
+	const struct sna_composite_spans_op *op;
+	struct trapezoid_tiles *tiles;
+	RegionPtr clip;
+	span_func_t span;
+	BoxRec extents;
+	int dx, dy;
+	bool unbounded;
+};
+
+#define SPAN_THREAD_MAX_BOXES (8192/sizeof(struct sna_opacity_box))
+struct span_thread_boxes {
+	const struct sna_composite_spans_op *op;
+	const BoxRec *clip_start, *clip_end;
+	float area;
+	int num_boxes;
+	struct sna_opacity_box boxes[SPAN_THREAD_MAX_BOXES];
+};
+
+static inline void span_thread_add_box(struct sna *sna, void *data,
+				       const BoxRec *box, float alpha)
+{
+	struct span_thread_boxes *b = data;
+
+	__DBG(("%s: adding box with alpha=%f\n", __FUNCTION__, alpha));
+
+	if (unlikely(b->num_boxes == SPAN_THREAD_MAX_BOXES)) {
+		DBG(("%s: flushing %d boxes\n", __FUNCTION__, b->num_boxes));
+		b->op->thread_boxes(sna, b->op, b->boxes, b->num_boxes);
+		b->num_boxes = 0;
+	}
+
+	b->boxes[b->num_boxes].box = *box++;
+	b->boxes[b->num_boxes].alpha = alpha;
+	b->num_boxes++;
+	assert(b->num_boxes <= SPAN_THREAD_MAX_BOXES);
+}
+
+static inline void
+span_thread_box(struct sna *sna,
+		struct sna_composite_spans_op *op,
+		pixman_region16_t *clip,
+		const BoxRec *box,
+		int coverage)
+{
+	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
+	float alpha = coverage / b->area;
+
+	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
+	if (b->num_boxes) {
+		struct sna_opacity_box *bb = &b->boxes[b->num_boxes-1];
+		if (bb->box.x1 == box->x1 &&
+		    bb->box.x2 == box->x2 &&
+		    bb->box.y2 == box->y1 &&
+		    bb->alpha == alpha) {
+			bb->box.y2 = box->y2;
+			__DBG(("%s: contracted double row: %d -> %d\n", __func__, bb->box.y1, bb->box.y2));
+			return;
+		}
+	}
+
+	span_thread_add_box(sna, op, box, alpha);
+}
+
+static inline void
+span_thread_clipped_box(struct sna *sna,
+			struct sna_composite_spans_op *op,
+			pixman_region16_t *clip,
+			const BoxRec *box,
+			int coverage)
+{
+	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
+	float alpha = coverage / b->area;
+	const BoxRec *c;
+
+	__DBG(("%s: %d -> %d @ %f\n", __FUNCTION__, box->x1, box->x2, alpha));
+
+	b->clip_start =
+		find_clip_box_for_y(b->clip_start, b->clip_end, box->y1);
+
+	c = b->clip_start;
+	while (c != b->clip_end) {
+		BoxRec clipped;
+
+		if (box->y2 <= c->y1)
+			break;
+
+		clipped = *box;
+		if (!box_intersect(&clipped, c++))
+			continue;
+
+		span_thread_add_box(sna, op, &clipped, alpha);
+	}
+}
+
+static inline span_func_t
+thread_choose_span(struct sna_composite_spans_op *tmp,
+		   PicturePtr dst,
+		   PictFormatPtr maskFormat,
+		   RegionPtr clip)
+{
+	span_func_t span;
+
+	if (tmp->base.damage) {
+		DBG(("%s: damaged -> no thread support\n", __FUNCTION__));
+		return NULL;
+	}
+
+	if (is_mono(dst, maskFormat)) {
+		DBG(("%s: mono rendering -> no thread support\n", __FUNCTION__));
+		return NULL;
+	}
+
+	assert(tmp->thread_boxes);
+	DBG(("%s: clipped? %d x %d\n", __FUNCTION__, clip->data != NULL, region_num_rects(clip)));
+	if (clip->data)
+		span = span_thread_clipped_box;
+	else
+		span = span_thread_box;
+
+	return span;
+}
+
+inline static void
+span_thread_boxes_init(struct span_thread_boxes *boxes,
+		       const struct sna_composite_spans_op *op,
+		       const RegionRec *clip,
+		       float area)
+{
+	boxes->op = op;
+	region_get_boxes(clip, &boxes->clip_start, &boxes->clip_end);
+	boxes->area = area;
+	boxes->num_boxes = 0;
+}
+
 #endif /* SNA_TRAPEZOIDS_H */
@@ -0,0 +1,1254 @@
+/*
+ * Copyright (c) 2015 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sna.h"
+#include "sna_render.h"
+#include "sna_render_inline.h"
+#include "sna_trapezoids.h"
+#include "fb/fbpict.h"
+
+#include <mipict.h>
+
+/* Exact area coverage, in the manner of the font rasterisers.
+ *
+ * Rather than counting which of a grid of sample points lie inside the
+ * trapezoids, every edge deposits the signed area it sweeps within each
+ * pixel of a row into an accumulation buffer. A prefix sum along the row
+ * then yields the fraction of each pixel that is covered, so a row costs
+ * one pass over the edges plus one pass over the pixels they touch,
+ * instead of one pass per sample row.
+ *
+ * Coverage of overlapping trapezoids is summed and then clamped, i.e. the
+ * trapezoids are added together as required by Render.
+ */
+
+#ifndef MAX
+#define MAX(x,y) ((x) >= (y) ? (x) : (y))
+#endif
+
+#ifndef MIN
+#define MIN(x,y) ((x) <= (y) ? (x) : (y))
+#endif
+
+struct edge {
+	struct edge *next;
+
+	/* Vertical extent and the intercept at the top, in pixels
+	 * relative to the origin of the converter.
+	 */
+	double top, bottom;
+	double x, dxdy;
+
+	/* +1 for a left edge, -1 for a right edge */
+	float dir;
+};
+
+struct acov {
+	BoxRec extents;
+	int width, height;
+
+	/* Signed area accumulated for each pixel of the current row,
+	 * with room for the carry out of the last pixel.
+	 */
+	float *cells;
+	int xmin, xmax;
+
+	uint8_t *row;
+
+	struct edge *edges;
+	int num_edges;
+
+	struct edge **buckets;
+	struct edge *active;
+
+	struct edge edges_embedded[32];
+	struct edge *buckets_embedded[64];
+	float cells_embedded[256 + 2];
+	uint8_t row_embedded[256];
+};
+
+static void
+acov_fini(struct acov *c)
+{
+	if (c->edges != c->edges_embedded)
+		free(c->edges);
+	if (c->buckets != c->buckets_embedded)
+		free(c->buckets);
+	if (c->cells != c->cells_embedded)
+		free(c->cells);
+	if (c->row != c->row_embedded)
+		free(c->row);
+}
+
+static bool
+acov_init(struct acov *c, const BoxRec *box, int num_edges)
+{
+	__DBG(("%s: (%d, %d),(%d, %d) x (%d, %d), num_edges=%d\n",
+	       __FUNCTION__,
+	       box->x1, box->y1, box->x2, box->y2,
+	       box->x2 - box->x1, box->y2 - box->y1,
+	       num_edges));
+
+	c->extents = *box;
+	c->width = box->x2 - box->x1;
+	c->height = box->y2 - box->y1;
+	assert(c->width > 0 && c->height > 0);
+
+	c->edges = c->edges_embedded;
+	c->buckets = c->buckets_embedded;
+	c->cells = c->cells_embedded;
+	c->row = c->row_embedded;
+	c->num_edges = 0;
+	c->active = NULL;
+
+	if (num_edges > (int)ARRAY_SIZE(c->edges_embedded)) {
+		c->edges = malloc(sizeof(struct edge)*num_edges);
+		if (unlikely(c->edges == NULL))
+			goto bail;
+	}
+
+	if (c->height > (int)ARRAY_SIZE(c->buckets_embedded)) {
+		c->buckets = malloc(sizeof(struct edge *)*c->height);
+		if (unlikely(c->buckets == NULL))
+			goto bail;
+	}
+	memset(c->buckets, 0, sizeof(struct edge *)*c->height);
+
+	if (c->width + 2 > (int)ARRAY_SIZE(c->cells_embedded)) {
+		c->cells = malloc(sizeof(float)*(c->width + 2));
+		if (unlikely(c->cells == NULL))
+			goto bail;
+	}
+	memset(c->cells, 0, sizeof(float)*(c->width + 2));
+
+	if (c->width > (int)ARRAY_SIZE(c->row_embedded)) {
+		c->row = malloc(c->width);
+		if (unlikely(c->row == NULL))
+			goto bail;
+	}
+
+	return true;
+
+bail:
+	acov_fini(c);
+	return false;
+}
+
+static void
+acov_add_edge(struct acov *c, const xLineFixed *line,
+	      xFixed top, xFixed bottom,
+	      int dx, int dy, float dir)
+{
+	struct edge *e;
+	double y1, y2;
+	int row;
+
+	if (line->p1.y == line->p2.y)
+		return;
+
+	y1 = pixman_fixed_to_double(top) + dy - c->extents.y1;
+	y2 = pixman_fixed_to_double(bottom) + dy - c->extents.y1;
+	if (y1 >= c->height || y2 <= 0 || y1 >= y2)
+		return;
+
+	e = &c->edges[c->num_edges++];
+	e->top = y1;
+	e->bottom = y2;
+	e->dxdy = (double)(line->p2.x - line->p1.x) / (line->p2.y - line->p1.y);
+	e->x = pixman_fixed_to_double(line->p1.x) +
+		pixman_fixed_to_double(top - line->p1.y) * e->dxdy +
+		dx - c->extents.x1;
+	e->dir = dir;
+
+	row = y1 > 0 ? (int)y1 : 0;
+	e->next = c->buckets[row];
+	c->buckets[row] = e;
+}
+
+static double
+acov_line_x(const xLineFixed *l, xFixed y)
+{
+	return pixman_fixed_to_double(l->p1.x) +
+		pixman_fixed_to_double(l->p2.x - l->p1.x) *
+		(double)(y - l->p1.y) / (l->p2.y - l->p1.y);
+}
+
+static void
+acov_add_trapezoid(struct acov *c, const xTrapezoid *t, int dx, int dy)
+{
+	xFixed top, bottom;
+	double wt, wb;
+
+	if (!xTrapezoidValid(t)) {
+		__DBG(("%s: skipping invalid trapezoid: top=%d, bottom=%d, left=(%d, %d), (%d, %d), right=(%d, %d), (%d, %d)\n",
+		       __FUNCTION__,
+		       t->top, t->bottom,
+		       t->left.p1.x, t->left.p1.y,
+		       t->left.p2.x, t->left.p2.y,
+		       t->right.p1.x, t->right.p1.y,
+		       t->right.p2.x, t->right.p2.y));
+		return;
+	}
+
+	/* Render only fills where the left edge lies to the left of the
+	 * right. As every trapezoid is accumulated into the same cells, an
+	 * inverted span would subtract from any other trapezoid it
+	 * overlapped, so drop the inverted part (up to where the edges
+	 * cross) before adding the edges.
+	 */
+	top = t->top;
+	bottom = t->bottom;
+	wt = acov_line_x(&t->right, top) - acov_line_x(&t->left, top);
+	wb = acov_line_x(&t->right, bottom) - acov_line_x(&t->left, bottom);
+	if (wt < 0 || wb < 0) {
+		xFixed y;
+
+		if (wt <= 0 && wb <= 0) {
+			__DBG(("%s: skipping inverted trapezoid\n", __FUNCTION__));
+			return;
+		}
+
+		y = top + (xFixed)((bottom - top) * (wt / (wt - wb)));
+		if (wt < 0)
+			top = y;
+		else
+			bottom = y;
+		__DBG(("%s: twisted trapezoid, clipped to [%d, %d]\n",
+		       __FUNCTION__, top, bottom));
+	}
+
+	acov_add_edge(c, &t->left, top, bottom, dx, dy, 1.f);
+	acov_add_edge(c, &t->right, top, bottom, dx, dy, -1.f);
+}
+
+static void
+acov_add_line(struct acov *c,
+	      const xPointFixed *p1, const xPointFixed *p2,
+	      int dx, int dy, float dir)
+{
+	xLineFixed line;
+
+	if (p1->y < p2->y) {
+		line.p1 = *p1;
+		line.p2 = *p2;
+	} else {
+		line.p1 = *p2;
+		line.p2 = *p1;
+		dir = -dir;
+	}
+
+	acov_add_edge(c, &line, line.p1.y, line.p2.y, dx, dy, dir);
+}
+
+/* Each triangle is wound so that it adds to the coverage regardless of
+ * the order of its vertices, so overlapping triangles accumulate just as
+ * if they had been drawn one at a time into the mask.
+ */
+static void
+acov_add_triangle(struct acov *c, const xTriangle *t, int dx, int dy)
+{
+	int64_t cross;
+	float dir;
+
+	cross = (int64_t)(t->p2.x - t->p1.x) * (t->p3.y - t->p1.y) -
+		(int64_t)(t->p2.y - t->p1.y) * (t->p3.x - t->p1.x);
+	if (cross == 0)
+		return;
+
+	dir = cross < 0 ? 1.f : -1.f;
+	acov_add_line(c, &t->p1, &t->p2, dx, dy, dir);
+	acov_add_line(c, &t->p2, &t->p3, dx, dy, dir);
+	acov_add_line(c, &t->p3, &t->p1, dx, dy, dir);
+}
+
+/* Deposit the area to the right of the segment running from x0 to x1
+ * (in either order) across a strip of height |d| into the row.
+ */
+static void
+acov_line(struct acov *c, double x0, double x1, float d)
+{
+	float *a = c->cells;
+	double s, f0, f1, a0, a1, am;
+	int first, i0, i1, i;
+
+	if (x0 > x1) {
+		double t = x0;
+		x0 = x1;
+		x1 = t;
+	}
+
+	if (x0 >= c->width)
+		return;
+
+	if (x1 <= 0) {
+		a[0] += d;
+		c->xmin = 0;
+		c->xmax = MAX(c->xmax, 0);
+		return;
+	}
+
+	/* The portion of the edge left of the row covers the first pixel
+	 * entirely; the portion right of the row is never seen.
+	 */
+	first = c->width;
+	if (x0 < 0) {
+		float left = d * (-x0 / (x1 - x0));
+		a[0] += left;
+		d -= left;
+		x0 = 0;
+		first = 0;
+	}
+	if (x1 > c->width) {
+		d *= (c->width - x0) / (x1 - x0);
+		x1 = c->width;
+	}
+
+	i0 = (int)x0;
+	first = MIN(first, i0);
+	if (x1 - i0 <= 1) {
+		double xm = .5 * (x0 + x1) - i0;
+
+		a[i0] += d * (1 - xm);
+		a[i0 + 1] += d * xm;
+		i1 = i0 + 1;
+	} else {
+		i1 = (int)x1;
+		if (i1 < x1)
+			i1++;
+		s = 1 / (x1 - x0);
+		f0 = x0 - i0;
+		f1 = x1 - i1 + 1;
+		a0 = .5 * s * (1 - f0) * (1 - f0);
+		am = .5 * s * f1 * f1;
+
+		a[i0] += d * a0;
+		if (i1 == i0 + 2) {
+			a[i0 + 1] += d * (1 - a0 - am);
+		} else {
+			a1 = s * (1.5 - f0);
+			a[i0 + 1] += d * (a1 - a0);
+			for (i = i0 + 2; i < i1 - 1; i++)
+				a[i] += d * s;
+			a[i1 - 1] += d * (1 - (a1 + (i1 - i0 - 3) * s) - am);
+		}
+		a[i1] += d * am;
+	}
+
+	c->xmin = MIN(c->xmin, first);
+	c->xmax = MAX(c->xmax, i1);
+}
+
+static void
+acov_step(struct acov *c, int y)
+{
+	struct edge *e, *next;
+
+	for (e = c->buckets[y]; e; e = next) {
+		next = e->next;
+		e->next = c->active;
+		c->active = e;
+	}
+
+	c->xmin = c->width;
+	c->xmax = -1;
+	for (e = c->active; e; e = e->next) {
+		double y0 = MAX(e->top, y);
+		double y1 = MIN(e->bottom, y + 1);
+
+		acov_line(c,
+			  e->x + (y0 - e->top) * e->dxdy,
+			  e->x + (y1 - e->top) * e->dxdy,
+			  (y1 - y0) * e->dir);
+	}
+}
+
+/* After rendering row y, count how many rows share its coverage: every
+ * active edge must be vertical and already cross the whole of row y, and
+ * nothing may start or stop in between.
+ */
+static int
+acov_repeat(struct acov *c, int y)
+{
+	struct edge *e;
+	int limit = c->height;
+	int j;
+
+	for (e = c->active; e; e = e->next) {
+		if (e->dxdy != 0 || e->top > y)
+			return 1;
+		if (e->bottom < limit)
+			limit = (int)e->bottom;
+	}
+
+	for (j = y + 1; j < limit && c->buckets[j] == NULL; j++)
+		;
+	return MAX(j - y, 1);
+}
+
+static void
+acov_retire(struct acov *c, int y)
+{
+	struct edge **ptr, *e;
+
+	for (ptr = &c->active; (e = *ptr); ) {
+		if (e->bottom <= y)
+			*ptr = e->next;
+		else
+			ptr = &e->next;
+	}
+}
+
+static force_inline uint8_t acov_alpha(float sum)
+{
+	if (sum <= 0.5f / 255)
+		return 0;
+	if (sum >= 1 - 0.5f / 255)
+		return 255;
+	return (int)(sum * 255 + .5f);
+}
+
+/* Resolve the accumulated areas into coverage for the row. */
+static void
+acov_coverage(struct acov *c, uint8_t *row)
+{
+	float sum = 0;
+	int x, end;
+
+	if (c->xmax < c->xmin) {
+		memset(row, 0, c->width);
+		return;
+	}
+
+	memset(row, 0, c->xmin);
+	end = MIN(c->xmax, c->width - 1);
+	for (x = c->xmin; x <= end; x++) {
+		sum += c->cells[x];
+		row[x] = acov_alpha(sum);
+	}
+	if (x < c->width)
+		memset(row + x, acov_alpha(sum), c->width - x);
+
+	memset(c->cells + c->xmin, 0, sizeof(float)*(c->xmax - c->xmin + 1));
+}
+
+/* The spans are shared with the precise converter, and so take their
+ * coverage as an area of the sample grid; GRID_AREA is twice 255.
+ */
+static void
+acov_blt(struct sna *sna,
+	 struct acov *c,
+	 struct sna_composite_spans_op *op,
+	 pixman_region16_t *clip,
+	 span_func_t span,
+	 int y, int height,
+	 int unbounded)
+{
+	const uint8_t *row = c->row;
+	BoxRec box;
+	int x, v;
+
+	assert(GRID_AREA == 2*255);
+	box.y1 = c->extents.y1 + y;
+	box.y2 = box.y1 + height;
+	assert(box.y2 <= c->extents.y2);
+
+	for (x = 0; x < c->width; ) {
+		v = row[x];
+		box.x1 = c->extents.x1 + x;
+		while (++x < c->width && row[x] == v)
+			;
+		box.x2 = c->extents.x1 + x;
+
+		if (v || unbounded) {
+			__DBG(("%s: span (%d, %d)x(%d, %d) @ %d\n", __FUNCTION__,
+			       box.x1, box.y1,
+			       box.x2 - box.x1,
+			       box.y2 - box.y1,
+			       v));
+			span(sna, op, clip, &box, 2*v);
+		}
+	}
+}
+
+static int
+acov_skip(struct acov *c, int y)
+{
+	int j;
+
+	for (j = y + 1; j < c->height && c->buckets[j] == NULL; j++)
+		;
+	return j - y;
+}
+
+flatten static void
+acov_render(struct sna *sna,
+	    struct acov *c,
+	    struct sna_composite_spans_op *op,
+	    pixman_region16_t *clip,
+	    span_func_t span,
+	    int unbounded)
+{
+	int y, h;
+
+	__DBG(("%s: unbounded=%d\n", __FUNCTION__, unbounded));
+
+	for (y = 0; y < c->height; y += h) {
+		if (c->active == NULL && c->buckets[y] == NULL) {
+			h = acov_skip(c, y);
+			__DBG(("%s: no edges, skipping %d -> %d\n",
+			       __FUNCTION__, y, y + h));
+			if (unbounded) {
+				BoxRec box;
+
+				box = c->extents;
+				box.y1 += y;
+				box.y2 = box.y1 + h;
+
+				span(sna, op, clip, &box, 0);
+			}
+			continue;
+		}
+
+		acov_step(c, y);
+		h = acov_repeat(c, y);
+		acov_coverage(c, c->row);
+		acov_blt(sna, c, op, clip, span, y, h, unbounded);
+		acov_retire(c, y + h);
+	}
+}
+
+/* Write coverage straight into an a8 mask. */
+flatten static void
+acov_render_mask(struct acov *c, uint8_t *ptr, int stride)
+{
+	int y, h;
+
+	ptr += c->extents.y1 * stride + c->extents.x1;
+	for (y = 0; y < c->height; y += h) {
+		uint8_t *row = ptr + y * stride;
+		int n;
+
+		if (c->active == NULL && c->buckets[y] == NULL) {
+			h = acov_skip(c, y);
+			for (n = 0; n < h; n++)
+				memset(row + n * stride, 0, c->width);
+			continue;
+		}
+
+		acov_step(c, y);
+		h = acov_repeat(c, y);
+		acov_coverage(c, row);
+		acov_retire(c, y + h);
+		for (n = 1; n < h; n++)
+			memcpy(row + n * stride, row, c->width);
+	}
+}
+
+static void
+span_thread(void *arg)
+{
+	struct span_thread *thread = arg;
+	struct trapezoid_tiles *tiles = thread->tiles;
+	struct span_thread_boxes boxes;
+	BoxRec extents;
+	const int *index;
+	int count;
+
+	span_thread_boxes_init(&boxes, thread->op, thread->clip, GRID_AREA);
+
+	extents = thread->extents;
+	while (trapezoid_tiles_next(tiles, &extents, &index, &count)) {
+		struct acov c;
+
+		if (count == 0 && !thread->unbounded)
+			continue;
+
+		if (!acov_init(&c, &extents, 2*count))
+			continue;
+
+		while (count--)
+			acov_add_trapezoid(&c, &tiles->traps[*index++],
+					   thread->dx, thread->dy);
+
+		acov_render(thread->sna, &c,
+			    (struct sna_composite_spans_op *)&boxes, thread->clip,
+			    thread->span, thread->unbounded);
+
+		acov_fini(&c);
+	}
+
+	if (boxes.num_boxes) {
+		DBG(("%s: flushing %d boxes\n", __FUNCTION__, boxes.num_boxes));
+		assert(boxes.num_boxes <= SPAN_THREAD_MAX_BOXES);
+		thread->op->thread_boxes(thread->sna, thread->op,
+					 boxes.boxes, boxes.num_boxes);
+	}
+}
+
+bool
+analytic_trapezoid_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned int flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps)
+{
+	struct sna_composite_spans_op tmp;
+	pixman_region16_t clip;
+	int16_t dst_x, dst_y;
+	bool was_clear;
+	int dx, dy, n;
+	struct trapezoid_tiles tiles;
+	int num_threads;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, flags)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	if (!trapezoids_bounds(ntrap, traps, &clip.extents))
+		return true;
+
+	if (((clip.extents.y2 - clip.extents.y1) | (clip.extents.x2 - clip.extents.x1)) < 32) {
+		DBG(("%s: fallback -- traps extents too small %dx%d\n", __FUNCTION__,
+		     clip.extents.y2 - clip.extents.y1,
+		     clip.extents.x2 - clip.extents.x1));
+		return false;
+	}
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__,
+	     clip.extents.x1, clip.extents.y1,
+	     clip.extents.x2, clip.extents.y2));
+
+	trapezoid_origin(&traps[0].left, &dst_x, &dst_y);
+
+	if (!sna_compute_composite_region(&clip,
+					  src, NULL, dst,
+					  src_x + clip.extents.x1 - dst_x,
+					  src_y + clip.extents.y1 - dst_y,
+					  0, 0,
+					  clip.extents.x1, clip.extents.y1,
+					  clip.extents.x2 - clip.extents.x1,
+					  clip.extents.y2 - clip.extents.y1)) {
+		DBG(("%s: trapezoids do not intersect drawable clips\n",
+		     __FUNCTION__)) ;
+		return true;
+	}
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst,
+					       clip.extents.x2 - clip.extents.x1,
+					       clip.extents.y2 - clip.extents.y1,
+					       flags)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	dx = dst->pDrawable->x;
+	dy = dst->pDrawable->y;
+
+	DBG(("%s: after clip -- extents (%d, %d), (%d, %d), delta=(%d, %d) src -> (%d, %d)\n",
+	     __FUNCTION__,
+	     clip.extents.x1, clip.extents.y1,
+	     clip.extents.x2, clip.extents.y2,
+	     dx, dy,
+	     src_x + clip.extents.x1 - dst_x - dx,
+	     src_y + clip.extents.y1 - dst_y - dy));
+
+	was_clear = sna_drawable_is_clear(dst->pDrawable);
+	switch (op) {
+	case PictOpAdd:
+	case PictOpOver:
+		if (was_clear)
+			op = PictOpSrc;
+		break;
+	case PictOpIn:
+		if (was_clear)
+			return true;
+		break;
+	}
+
+	if (!sna->render.composite_spans(sna, op, src, dst,
+					 src_x + clip.extents.x1 - dst_x - dx,
+					 src_y + clip.extents.y1 - dst_y - dy,
+					 clip.extents.x1,  clip.extents.y1,
+					 clip.extents.x2 - clip.extents.x1,
+					 clip.extents.y2 - clip.extents.y1,
+					 flags, memset(&tmp, 0, sizeof(tmp)))) {
+		DBG(("%s: fallback -- composite spans render op not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	num_threads = 1;
+	if (!NO_GPU_THREADS &&
+	    (flags & COMPOSITE_SPANS_RECTILINEAR) == 0 &&
+	    tmp.thread_boxes &&
+	    thread_choose_span(&tmp, dst, maskFormat, &clip))
+		num_threads = sna_use_threads(clip.extents.x2-clip.extents.x1,
+					      clip.extents.y2-clip.extents.y1,
+					      8);
+	if (num_threads > 1 &&
+	    !trapezoid_tiles_init(&tiles, &clip.extents, dy, traps, ntrap))
+		num_threads = 1;
+	DBG(("%s: using %d threads\n", __FUNCTION__, num_threads));
+	if (num_threads == 1) {
+		struct acov c;
+
+		if (!acov_init(&c, &clip.extents, 2*ntrap))
+			goto skip;
+
+		for (n = 0; n < ntrap; n++)
+			acov_add_trapezoid(&c, &traps[n], dx, dy);
+
+		acov_render(sna, &c, &tmp, &clip,
+			    choose_span(&tmp, dst, maskFormat, &clip),
+			    !was_clear && maskFormat && !operator_is_bounded(op));
+
+		acov_fini(&c);
+	} else {
+		struct span_thread threads[num_threads];
+
+		DBG(("%s: using %d threads for span compositing %dx%d, %d tiles\n",
+		     __FUNCTION__, num_threads,
+		     clip.extents.x2 - clip.extents.x1,
+		     clip.extents.y2 - clip.extents.y1,
+		     tiles.count));
+
+		threads[0].sna = sna;
+		threads[0].op = &tmp;
+		threads[0].tiles = &tiles;
+		threads[0].extents = clip.extents;
+		threads[0].clip = &clip;
+		threads[0].dx = dx;
+		threads[0].dy = dy;
+		threads[0].unbounded = !was_clear && maskFormat && !operator_is_bounded(op);
+		threads[0].span = thread_choose_span(&tmp, dst, maskFormat, &clip);
+
+		if (num_threads > tiles.count)
+			num_threads = tiles.count;
+		for (n = 1; n < num_threads; n++) {
+			threads[n] = threads[0];
+			sna_threads_run(n, span_thread, &threads[n]);
+		}
+
+		span_thread(&threads[0]);
+
+		sna_threads_wait();
+		trapezoid_tiles_fini(&tiles);
+	}
+skip:
+	tmp.done(sna, &tmp);
+
+	REGION_UNINIT(NULL, &clip);
+	return true;
+}
+
+struct mask_thread {
+	PixmapPtr scratch;
+	struct trapezoid_tiles *tiles;
+	int dx, dy;
+	bool failed;
+};
+
+static void
+mask_thread(void *arg)
+{
+	struct mask_thread *thread = arg;
+	struct trapezoid_tiles *tiles = thread->tiles;
+	BoxRec extents;
+	const int *index;
+	int count;
+
+	extents.x1 = 0;
+	extents.x2 = thread->scratch->drawable.width;
+	while (trapezoid_tiles_next(tiles, &extents, &index, &count)) {
+		struct acov c;
+
+		if (!acov_init(&c, &extents, 2*count)) {
+			thread->failed = true;
+			continue;
+		}
+
+		while (count--)
+			acov_add_trapezoid(&c, &tiles->traps[*index++],
+					   thread->dx, thread->dy);
+
+		acov_render_mask(&c,
+				 thread->scratch->devPrivate.ptr,
+				 thread->scratch->devKind);
+		acov_fini(&c);
+	}
+}
+
+/* Rasterise the trapezoids, offset by (dx, dy), into the a8 scratch.
+ * Returns false if any part of the mask could not be rendered.
+ */
+static bool
+acov_mask(PixmapPtr scratch, unsigned flags,
+	  const xTrapezoid *traps, int ntrap,
+	  int dx, int dy)
+{
+	struct trapezoid_tiles tiles;
+	BoxRec extents;
+	bool ret = true;
+	int num_threads, n;
+
+	extents.x1 = extents.y1 = 0;
+	extents.x2 = scratch->drawable.width;
+	extents.y2 = scratch->drawable.height;
+
+	num_threads = 1;
+	if (!NO_GPU_THREADS &&
+	    (flags & COMPOSITE_SPANS_RECTILINEAR) == 0)
+		num_threads = sna_use_threads(extents.x2, extents.y2, 4);
+	if (num_threads > 1 &&
+	    !trapezoid_tiles_init(&tiles, &extents, dy, traps, ntrap))
+		num_threads = 1;
+	if (num_threads == 1) {
+		struct acov c;
+
+		if (!acov_init(&c, &extents, 2*ntrap))
+			return false;
+
+		for (n = 0; n < ntrap; n++)
+			acov_add_trapezoid(&c, &traps[n], dx, dy);
+
+		acov_render_mask(&c, scratch->devPrivate.ptr, scratch->devKind);
+		acov_fini(&c);
+	} else {
+		struct mask_thread threads[num_threads];
+
+		DBG(("%s: using %d threads for mask compositing %dx%d, %d tiles\n",
+		     __FUNCTION__, num_threads,
+		     extents.x2, extents.y2, tiles.count));
+
+		threads[0].scratch = scratch;
+		threads[0].tiles = &tiles;
+		threads[0].dx = dx;
+		threads[0].dy = dy;
+		threads[0].failed = false;
+
+		if (num_threads > tiles.count)
+			num_threads = tiles.count;
+		for (n = 1; n < num_threads; n++) {
+			threads[n] = threads[0];
+			sna_threads_run(n, mask_thread, &threads[n]);
+		}
+
+		mask_thread(&threads[0]);
+
+		sna_threads_wait();
+		trapezoid_tiles_fini(&tiles);
+
+		for (n = 0; n < num_threads; n++)
+			ret &= !threads[n].failed;
+	}
+
+	return ret;
+}
+
+bool
+analytic_trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, unsigned flags,
+				  INT16 src_x, INT16 src_y,
+				  int ntrap, xTrapezoid *traps)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	PixmapPtr scratch;
+	PicturePtr mask;
+	BoxRec extents;
+	int16_t dst_x, dst_y;
+	int error;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (maskFormat == NULL && ntrap > 1) {
+		DBG(("%s: individual rasterisation requested\n",
+		     __FUNCTION__));
+		do {
+			/* XXX unwind errors? */
+			if (!analytic_trapezoid_mask_converter(op, src, dst, NULL, flags,
+							       src_x, src_y, 1, traps++))
+				return false;
+		} while (--ntrap);
+		return true;
+	}
+
+	if (!trapezoids_bounds(ntrap, traps, &extents))
+		return true;
+
+	DBG(("%s: ntraps=%d, extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, ntrap, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (!sna_compute_composite_extents(&extents,
+					   src, NULL, dst,
+					   src_x, src_y,
+					   0, 0,
+					   extents.x1, extents.y1,
+					   extents.x2 - extents.x1,
+					   extents.y2 - extents.y1))
+		return true;
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	extents.y2 -= extents.y1;
+	extents.x2 -= extents.x1;
+	extents.x1 -= dst->pDrawable->x;
+	extents.y1 -= dst->pDrawable->y;
+	dst_x = extents.x1;
+	dst_y = extents.y1;
+
+	DBG(("%s: mask (%dx%d) at (%d, %d)\n",
+	     __FUNCTION__, extents.x2, extents.y2, dst_x, dst_y));
+	scratch = sna_pixmap_create_upload(screen,
+					   extents.x2, extents.y2, 8,
+					   KGEM_BUFFER_WRITE_INPLACE);
+	if (!scratch)
+		return true;
+
+	DBG(("%s: created buffer %p, stride %d\n",
+	     __FUNCTION__, scratch->devPrivate.ptr, scratch->devKind));
+
+	if (!acov_mask(scratch, flags, traps, ntrap, -dst_x, -dst_y)) {
+		sna_pixmap_destroy(scratch);
+		return true;
+	}
+
+	mask = CreatePicture(0, &scratch->drawable,
+			     PictureMatchFormat(screen, 8, PICT_a8),
+			     0, 0, serverClient, &error);
+	if (mask) {
+		int16_t x0, y0;
+
+		trapezoid_origin(&traps[0].left, &x0, &y0);
+
+		CompositePicture(op, src, mask, dst,
+				 src_x + dst_x - x0,
+				 src_y + dst_y - y0,
+				 0, 0,
+				 dst_x, dst_y,
+				 extents.x2, extents.y2);
+		FreePicture(mask, 0);
+	}
+	sna_pixmap_destroy(scratch);
+
+	return true;
+}
+
+bool
+analytic_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, unsigned flags,
+				 INT16 src_x, INT16 src_y,
+				 int ntrap, xTrapezoid *traps)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	PixmapPtr scratch;
+	PicturePtr mask;
+	BoxRec extents;
+	int16_t dst_x, dst_y;
+	int error;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (maskFormat == NULL && ntrap > 1) {
+		DBG(("%s: individual rasterisation requested\n",
+		     __FUNCTION__));
+		do {
+			/* XXX unwind errors? */
+			if (!analytic_trapezoid_span_fallback(op, src, dst, NULL, flags,
+							      src_x, src_y, 1, traps++))
+				return false;
+		} while (--ntrap);
+		return true;
+	}
+
+	if (!trapezoids_bounds(ntrap, traps, &extents))
+		return true;
+
+	DBG(("%s: ntraps=%d, extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, ntrap, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (!sna_compute_composite_extents(&extents,
+					   src, NULL, dst,
+					   src_x, src_y,
+					   0, 0,
+					   extents.x1, extents.y1,
+					   extents.x2 - extents.x1,
+					   extents.y2 - extents.y1))
+		return true;
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	extents.y2 -= extents.y1;
+	extents.x2 -= extents.x1;
+	extents.x1 -= dst->pDrawable->x;
+	extents.y1 -= dst->pDrawable->y;
+	dst_x = extents.x1;
+	dst_y = extents.y1;
+
+	DBG(("%s: mask (%dx%d) at (%d, %d)\n",
+	     __FUNCTION__, extents.x2, extents.y2, dst_x, dst_y));
+	scratch = sna_pixmap_create_unattached(screen,
+					       extents.x2, extents.y2, 8);
+	if (!scratch)
+		return true;
+
+	DBG(("%s: created buffer %p, stride %d\n",
+	     __FUNCTION__, scratch->devPrivate.ptr, scratch->devKind));
+
+	if (!acov_mask(scratch, flags, traps, ntrap, -dst_x, -dst_y)) {
+		sna_pixmap_destroy(scratch);
+		return true;
+	}
+
+	mask = CreatePicture(0, &scratch->drawable,
+			     PictureMatchFormat(screen, 8, PICT_a8),
+			     0, 0, serverClient, &error);
+	if (mask) {
+		RegionRec region;
+		int16_t x0, y0;
+
+		region.extents.x1 = dst_x + dst->pDrawable->x;
+		region.extents.y1 = dst_y + dst->pDrawable->y;
+		region.extents.x2 = region.extents.x1 + extents.x2;
+		region.extents.y2 = region.extents.y1 + extents.y2;
+		region.data = NULL;
+
+		trapezoid_origin(&traps[0].left, &x0, &y0);
+
+		DBG(("%s: fbComposite()\n", __FUNCTION__));
+		sna_composite_fb(op, src, mask, dst, &region,
+				 src_x + dst_x - x0, src_y + dst_y - y0,
+				 0, 0,
+				 dst_x, dst_y,
+				 extents.x2, extents.y2);
+
+		FreePicture(mask, 0);
+	}
+	sna_pixmap_destroy(scratch);
+
+	return true;
+}
+
+bool
+analytic_triangles_span_converter(struct sna *sna,
+				  CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				  int count, xTriangle *tri)
+{
+	struct sna_composite_spans_op tmp;
+	struct acov c;
+	BoxRec extents;
+	pixman_region16_t clip;
+	int16_t dst_x, dst_y;
+	int dx, dy, n;
+	bool was_clear;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, 0)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	dst_x = pixman_fixed_to_int(tri[0].p1.x);
+	dst_y = pixman_fixed_to_int(tri[0].p1.y);
+
+	miTriangleBounds(count, tri, &extents);
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
+		return true;
+
+	if (!sna_compute_composite_region(&clip,
+					  src, NULL, dst,
+					  src_x + extents.x1 - dst_x,
+					  src_y + extents.y1 - dst_y,
+					  0, 0,
+					  extents.x1, extents.y1,
+					  extents.x2 - extents.x1,
+					  extents.y2 - extents.y1)) {
+		DBG(("%s: triangles do not intersect drawable clips\n",
+		     __FUNCTION__)) ;
+		return true;
+	}
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst,
+					       clip.extents.x2 - clip.extents.x1,
+					       clip.extents.y2 - clip.extents.y1,
+					       0)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	extents = *RegionExtents(&clip);
+	dx = dst->pDrawable->x;
+	dy = dst->pDrawable->y;
+
+	DBG(("%s: after clip -- extents (%d, %d), (%d, %d), delta=(%d, %d) src -> (%d, %d)\n",
+	     __FUNCTION__,
+	     extents.x1, extents.y1,
+	     extents.x2, extents.y2,
+	     dx, dy,
+	     src_x + extents.x1 - dst_x - dx,
+	     src_y + extents.y1 - dst_y - dy));
+
+	was_clear = sna_drawable_is_clear(dst->pDrawable);
+
+	memset(&tmp, 0, sizeof(tmp));
+	if (!sna->render.composite_spans(sna, op, src, dst,
+					 src_x + extents.x1 - dst_x - dx,
+					 src_y + extents.y1 - dst_y - dy,
+					 extents.x1,  extents.y1,
+					 extents.x2 - extents.x1,
+					 extents.y2 - extents.y1,
+					 0,
+					 &tmp)) {
+		DBG(("%s: fallback -- composite spans render op not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	if (!acov_init(&c, &extents, 3*count))
+		goto skip;
+
+	for (n = 0; n < count; n++)
+		acov_add_triangle(&c, &tri[n], dx, dy);
+
+	acov_render(sna, &c, &tmp, &clip,
+		    choose_span(&tmp, dst, maskFormat, &clip),
+		    !was_clear && maskFormat && !operator_is_bounded(op));
+
+	acov_fini(&c);
+skip:
+	tmp.done(sna, &tmp);
+
+	REGION_UNINIT(NULL, &clip);
+	return true;
+}
+
+bool
+analytic_triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				  PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				  int count, xTriangle *tri)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	PixmapPtr scratch;
+	PicturePtr mask;
+	struct acov c;
+	BoxRec extents;
+	int16_t dst_x, dst_y;
+	int error, n;
+
+	if (NO_ANALYTIC)
+		return false;
+
+	if (maskFormat == NULL && count > 1) {
+		DBG(("%s: fallback -- individual rasterisation requested\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	miTriangleBounds(count, tri, &extents);
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
+		return true;
+
+	if (!sna_compute_composite_extents(&extents,
+					   src, NULL, dst,
+					   src_x, src_y,
+					   0, 0,
+					   extents.x1, extents.y1,
+					   extents.x2 - extents.x1,
+					   extents.y2 - extents.y1))
+		return true;
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	extents.y2 -= extents.y1;
+	extents.x2 -= extents.x1;
+	extents.x1 -= dst->pDrawable->x;
+	extents.y1 -= dst->pDrawable->y;
+	dst_x = extents.x1;
+	dst_y = extents.y1;
+	extents.x1 = extents.y1 = 0;
+
+	DBG(("%s: mask (%dx%d)\n",
+	     __FUNCTION__, extents.x2, extents.y2));
+	scratch = sna_pixmap_create_upload(screen,
+					   extents.x2, extents.y2, 8,
+					   KGEM_BUFFER_WRITE_INPLACE);
+	if (!scratch)
+		return true;
+
+	DBG(("%s: created buffer %p, stride %d\n",
+	     __FUNCTION__, scratch->devPrivate.ptr, scratch->devKind));
+
+	if (!acov_init(&c, &extents, 3*count)) {
+		sna_pixmap_destroy(scratch);
+		return true;
+	}
+
+	for (n = 0; n < count; n++)
+		acov_add_triangle(&c, &tri[n], -dst_x, -dst_y);
+
+	acov_render_mask(&c, scratch->devPrivate.ptr, scratch->devKind);
+	acov_fini(&c);
+
+	mask = CreatePicture(0, &scratch->drawable,
+			     PictureMatchFormat(screen, 8, PICT_a8),
+			     0, 0, serverClient, &error);
+	if (mask) {
+		CompositePicture(op, src, mask, dst,
+				 src_x + dst_x - pixman_fixed_to_int(tri[0].p1.x),
+				 src_y + dst_y - pixman_fixed_to_int(tri[0].p1.y),
+				 0, 0,
+				 dst_x, dst_y,
+				 extents.x2, extents.y2);
+		FreePicture(mask, 0);
+	}
+	sna_pixmap_destroy(scratch);
+
+	return true;
+}
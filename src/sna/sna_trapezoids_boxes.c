@@ -52,62 +52,6 @@
 #define region_count(r) ((r)->data ? (r)->data->numRects : 1)
 #define region_boxes(r) ((r)->data ? (BoxPtr)((r)->data + 1) : &(r)->extents)
 
-#if HAS_DEBUG_FULL
-static void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
-{
-	if (box->x1 < 0 || box->y1 < 0 ||
-	    box->x2 > pixmap->drawable.width ||
-	    box->y2 > pixmap->drawable.height)
-	{
-		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
-			   function,
-			   box->x1, box->y1, box->x2, box->y2,
-			   pixmap->drawable.width,
-			   pixmap->drawable.height);
-	}
-}
-#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
-#else
-#define assert_pixmap_contains_box(p, b)
-#endif
-
-static void apply_damage(struct sna_composite_op *op, RegionPtr region)
-{
-	DBG(("%s: damage=%p, region=%dx[(%d, %d), (%d, %d)]\n",
-	     __FUNCTION__, op->damage,
-	     region_num_rects(region),
-	     region->extents.x1, region->extents.y1,
-	     region->extents.x2, region->extents.y2));
-
-	if (op->damage == NULL)
-		return;
-
-	RegionTranslate(region, op->dst.x, op->dst.y);
-
-	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
-	if (sna_damage_add_to_pixmap(op->damage, region, op->dst.pixmap))
-		op->damage = NULL;
-}
-
-static void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	BoxRec r;
-
-	r.x1 = box->x1 + op->dst.x;
-	r.x2 = box->x2 + op->dst.x;
-	r.y1 = box->y1 + op->dst.y;
-	r.y2 = box->y2 + op->dst.y;
-
-	assert_pixmap_contains_box(op->dst.pixmap, &r);
-	sna_damage_add_box(op->damage, &r);
-}
-
-inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	if (op->damage)
-		_apply_damage_box(op, box);
-}
-
 bool
 composite_aligned_boxes(struct sna *sna,
 			CARD8 op,
@@ -52,67 +52,6 @@
 #define MIN(x,y) ((x) <= (y) ? (x) : (y))
 #endif
 
-typedef void (*span_func_t)(struct sna *sna,
-			    struct sna_composite_spans_op *op,
-			    pixman_region16_t *clip,
-			    const BoxRec *box,
-			    int coverage);
-
-#if HAS_DEBUG_FULL
-static void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
-{
-	if (box->x1 < 0 || box->y1 < 0 ||
-	    box->x2 > pixmap->drawable.width ||
-	    box->y2 > pixmap->drawable.height)
-	{
-		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
-			   function,
-			   box->x1, box->y1, box->x2, box->y2,
-			   pixmap->drawable.width,
-			   pixmap->drawable.height);
-	}
-}
-#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
-#else
-#define assert_pixmap_contains_box(p, b)
-#endif
-
-static void apply_damage(struct sna_composite_op *op, RegionPtr region)
-{
-	DBG(("%s: damage=%p, region=%dx[(%d, %d), (%d, %d)]\n",
-	     __FUNCTION__, op->damage,
-	     region_num_rects(region),
-	     region->extents.x1, region->extents.y1,
-	     region->extents.x2, region->extents.y2));
-
-	if (op->damage == NULL)
-		return;
-
-	RegionTranslate(region, op->dst.x, op->dst.y);
-
-	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
-	sna_damage_add(op->damage, region);
-}
-
-static void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	BoxRec r;
-
-	r.x1 = box->x1 + op->dst.x;
-	r.x2 = box->x2 + op->dst.x;
-	r.y1 = box->y1 + op->dst.y;
-	r.y2 = box->y2 + op->dst.y;
-
-	assert_pixmap_contains_box(op->dst.pixmap, &r);
-	sna_damage_add_box(op->damage, &r);
-}
-
-inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	if (op->damage)
-		_apply_damage_box(op, box);
-}
-
 #define FAST_SAMPLES_X_TO_INT_FRAC(x, i, f) \
 	_GRID_TO_INT_FRAC_shift(x, i, f, FAST_SAMPLES_shift)
 
@@ -1639,23 +1578,11 @@ tor_inplace(struct tor *converter, PixmapPtr scratch, int mono, uint8_t *buf)
 	}
 }
 
-static int operator_is_bounded(uint8_t op)
-{
-	switch (op) {
-	case PictOpOver:
-	case PictOpOutReverse:
-	case PictOpAdd:
-		return true;
-	default:
-		return false;
-	}
-}
-
 static span_func_t
-choose_span(struct sna_composite_spans_op *tmp,
-	    PicturePtr dst,
-	    PictFormatPtr maskFormat,
-	    RegionPtr clip)
+imprecise_choose_span(struct sna_composite_spans_op *tmp,
+		      PicturePtr dst,
+		      PictFormatPtr maskFormat,
+		      RegionPtr clip)
 {
 	span_func_t span;
 
@@ -1682,168 +1609,38 @@ choose_span(struct sna_composite_spans_op *tmp,
 	return span;
 }
 
-struct span_thread {
-	struct sna *sna;
-	const struct sna_composite_spans_op *op;
-	const xTrapezoid *traps;
-	RegionPtr clip;
-	span_func_t span;
-	BoxRec extents;
-	int dx, dy, draw_y;
-	int ntrap;
-	bool unbounded;
-};
-
-#define SPAN_THREAD_MAX_BOXES (8192/sizeof(struct sna_opacity_box))
-struct span_thread_boxes {
-	const struct sna_composite_spans_op *op;
-	const BoxRec *clip_start, *clip_end;
-	int num_boxes;
-	struct sna_opacity_box boxes[SPAN_THREAD_MAX_BOXES];
-};
-
-static void span_thread_add_box(struct sna *sna, void *data,
-				const BoxRec *box, float alpha)
-{
-	struct span_thread_boxes *b = data;
-
-	__DBG(("%s: adding box with alpha=%f\n", __FUNCTION__, alpha));
-
-	if (unlikely(b->num_boxes == SPAN_THREAD_MAX_BOXES)) {
-		DBG(("%s: flushing %d boxes\n", __FUNCTION__, b->num_boxes));
-		b->op->thread_boxes(sna, b->op, b->boxes, b->num_boxes);
-		b->num_boxes = 0;
-	}
-
-	b->boxes[b->num_boxes].box = *box++;
-	b->boxes[b->num_boxes].alpha = alpha;
-	b->num_boxes++;
-	assert(b->num_boxes <= SPAN_THREAD_MAX_BOXES);
-}
-
-static void
-span_thread_box(struct sna *sna,
-		struct sna_composite_spans_op *op,
-		pixman_region16_t *clip,
-		const BoxRec *box,
-		int coverage)
-{
-	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
-
-	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
-	if (b->num_boxes) {
-		struct sna_opacity_box *bb = &b->boxes[b->num_boxes-1];
-		if (bb->box.x1 == box->x1 &&
-		    bb->box.x2 == box->x2 &&
-		    bb->box.y2 == box->y1 &&
-		    bb->alpha == AREA_TO_ALPHA(coverage)) {
-			bb->box.y2 = box->y2;
-			__DBG(("%s: contracted double row: %d -> %d\n", __func__, bb->box.y1, bb->box.y2));
-			return;
-		}
-	}
-
-	span_thread_add_box(sna, op, box, AREA_TO_ALPHA(coverage));
-}
-
-static void
-span_thread_clipped_box(struct sna *sna,
-			struct sna_composite_spans_op *op,
-			pixman_region16_t *clip,
-			const BoxRec *box,
-			int coverage)
-{
-	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
-	const BoxRec *c;
-
-	__DBG(("%s: %d -> %d @ %f\n", __FUNCTION__, box->x1, box->x2,
-	       AREA_TO_ALPHA(coverage)));
-
-	b->clip_start =
-		find_clip_box_for_y(b->clip_start, b->clip_end, box->y1);
-
-	c = b->clip_start;
-	while (c != b->clip_end) {
-		BoxRec clipped;
-
-		if (box->y2 <= c->y1)
-			break;
-
-		clipped = *box;
-		if (!box_intersect(&clipped, c++))
-			continue;
-
-		span_thread_add_box(sna, op, &clipped, AREA_TO_ALPHA(coverage));
-	}
-}
-
-static span_func_t
-thread_choose_span(struct sna_composite_spans_op *tmp,
-		   PicturePtr dst,
-		   PictFormatPtr maskFormat,
-		   RegionPtr clip)
-{
-	span_func_t span;
-
-	if (tmp->base.damage) {
-		DBG(("%s: damaged -> no thread support\n", __FUNCTION__));
-		return NULL;
-	}
-
-	if (is_mono(dst, maskFormat)) {
-		DBG(("%s: mono rendering -> no thread support\n", __FUNCTION__));
-		return NULL;
-	} else {
-		assert(tmp->thread_boxes);
-		DBG(("%s: clipped? %d\n", __FUNCTION__, clip->data != NULL));
-		if (clip->data)
-			span = span_thread_clipped_box;
-		else
-			span = span_thread_box;
-	}
-
-	return span;
-}
-
-inline static void
-span_thread_boxes_init(struct span_thread_boxes *boxes,
-		       const struct sna_composite_spans_op *op,
-		       const RegionRec *clip)
-{
-	boxes->op = op;
-	region_get_boxes(clip, &boxes->clip_start, &boxes->clip_end);
-	boxes->num_boxes = 0;
-}
-
 static void
 span_thread(void *arg)
 {
 	struct span_thread *thread = arg;
+	struct trapezoid_tiles *tiles = thread->tiles;
 	struct span_thread_boxes boxes;
-	struct tor tor;
-	const xTrapezoid *t;
-	int n, y1, y2;
+	BoxRec extents;
+	const int *index;
+	int count;
 
-	if (!tor_init(&tor, &thread->extents, 2*thread->ntrap))
-		return;
+	span_thread_boxes_init(&boxes, thread->op, thread->clip, FAST_SAMPLES_XY);
 
-	span_thread_boxes_init(&boxes, thread->op, thread->clip);
+	extents = thread->extents;
+	while (trapezoid_tiles_next(tiles, &extents, &index, &count)) {
+		struct tor tor;
 
-	y1 = thread->extents.y1 - thread->draw_y;
-	y2 = thread->extents.y2 - thread->draw_y;
-	for (n = thread->ntrap, t = thread->traps; n--; t++) {
-		if (pixman_fixed_integer_floor(t->top) >= y2 ||
-		    pixman_fixed_integer_ceil(t->bottom) <= y1)
+		if (count == 0 && !thread->unbounded)
 			continue;
 
-		tor_add_trapezoid(&tor, t, thread->dx, thread->dy);
-	}
+		if (!tor_init(&tor, &extents, 2*count))
+			continue;
 
-	tor_render(thread->sna, &tor,
-		   (struct sna_composite_spans_op *)&boxes, thread->clip,
-		   thread->span, thread->unbounded);
+		while (count--)
+			tor_add_trapezoid(&tor, &tiles->traps[*index++],
+					  thread->dx, thread->dy);
 
-	tor_fini(&tor);
+		tor_render(thread->sna, &tor,
+			   (struct sna_composite_spans_op *)&boxes, thread->clip,
+			   thread->span, thread->unbounded);
+
+		tor_fini(&tor);
+	}
 
 	if (boxes.num_boxes) {
 		DBG(("%s: flushing %d boxes\n", __FUNCTION__, boxes.num_boxes));
@@ -1865,6 +1662,7 @@ imprecise_trapezoid_span_converter(struct sna *sna,
 	int16_t dst_x, dst_y;
 	bool was_clear;
 	int dx, dy, n;
+	struct trapezoid_tiles tiles;
 	int num_threads;
 
 	if (NO_IMPRECISE)
@@ -1964,6 +1762,10 @@ imprecise_trapezoid_span_converter(struct sna *sna,
 		num_threads = sna_use_threads(clip.extents.x2-clip.extents.x1,
 					      clip.extents.y2-clip.extents.y1,
 					      16);
+	if (num_threads > 1 &&
+	    !trapezoid_tiles_init(&tiles, &clip.extents, dst->pDrawable->y,
+				  traps, ntrap))
+		num_threads = 1;
 	DBG(("%s: using %d threads\n", __FUNCTION__, num_threads));
 	if (num_threads == 1) {
 		struct tor tor;
@@ -1980,49 +1782,40 @@ imprecise_trapezoid_span_converter(struct sna *sna,
 		}
 
 		tor_render(sna, &tor, &tmp, &clip,
-			   choose_span(&tmp, dst, maskFormat, &clip),
+			   imprecise_choose_span(&tmp, dst, maskFormat, &clip),
 			   !was_clear && maskFormat && !operator_is_bounded(op));
 
 		tor_fini(&tor);
 	} else {
 		struct span_thread threads[num_threads];
-		int y, h;
 
-		DBG(("%s: using %d threads for span compositing %dx%d\n",
+		DBG(("%s: using %d threads for span compositing %dx%d, %d tiles\n",
 		     __FUNCTION__, num_threads,
 		     clip.extents.x2 - clip.extents.x1,
-		     clip.extents.y2 - clip.extents.y1));
+		     clip.extents.y2 - clip.extents.y1,
+		     tiles.count));
 
 		threads[0].sna = sna;
 		threads[0].op = &tmp;
-		threads[0].traps = traps;
-		threads[0].ntrap = ntrap;
+		threads[0].tiles = &tiles;
 		threads[0].extents = clip.extents;
 		threads[0].clip = &clip;
 		threads[0].dx = dx;
 		threads[0].dy = dy;
-		threads[0].draw_y = dst->pDrawable->y;
 		threads[0].unbounded = !was_clear && maskFormat && !operator_is_bounded(op);
 		threads[0].span = thread_choose_span(&tmp, dst, maskFormat, &clip);
 
-		y = clip.extents.y1;
-		h = clip.extents.y2 - clip.extents.y1;
-		h = (h + num_threads - 1) / num_threads;
-		num_threads -= (num_threads-1) * h >= clip.extents.y2 - clip.extents.y1;
-
+		if (num_threads > tiles.count)
+			num_threads = tiles.count;
 		for (n = 1; n < num_threads; n++) {
 			threads[n] = threads[0];
-			threads[n].extents.y1 = y;
-			threads[n].extents.y2 = y += h;
-
 			sna_threads_run(n, span_thread, &threads[n]);
 		}
 
-		assert(y < threads[0].extents.y2);
-		threads[0].extents.y1 = y;
 		span_thread(&threads[0]);
 
 		sna_threads_wait();
+		trapezoid_tiles_fini(&tiles);
 	}
 skip:
 	tmp.done(sna, &tmp);
@@ -3265,7 +3058,7 @@ imprecise_trap_span_converter(struct sna *sna,
 	}
 
 	tor_render(sna, &tor, &tmp, clip,
-		   choose_span(&tmp, dst, NULL, clip), false);
+		   imprecise_choose_span(&tmp, dst, NULL, clip), false);
 
 	tor_fini(&tor);
 skip:
@@ -3428,9 +3221,16 @@ triangles_span_converter(struct sna *sna,
 
 	/* XXX strict adherence to the Render specification */
 	if (dst->polyMode == PolyModePrecise) {
-		DBG(("%s: fallback -- precise rasterisation requested\n",
-		     __FUNCTION__));
-		return false;
+		if (is_analytic(dst, maskFormat))
+			return analytic_triangles_span_converter(sna, op, src, dst,
+								 maskFormat,
+								 src_x, src_y,
+								 count, tri);
+
+		return precise_triangles_span_converter(sna, op, src, dst,
+							maskFormat,
+							src_x, src_y,
+							count, tri);
 	}
 
 	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, 0)) {
@@ -3519,7 +3319,7 @@ triangles_span_converter(struct sna *sna,
 	}
 
 	tor_render(sna, &tor, &tmp, &clip,
-		   choose_span(&tmp, dst, maskFormat, &clip),
+		   imprecise_choose_span(&tmp, dst, maskFormat, &clip),
 		   !was_clear && maskFormat && !operator_is_bounded(op));
 
 	tor_fini(&tor);
@@ -3553,9 +3353,16 @@ triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 		return false;
 
 	if (is_precise(dst, maskFormat)) {
-		DBG(("%s: fallback -- precise rasterisation requested\n",
-		     __FUNCTION__));
-		return false;
+		if (is_analytic(dst, maskFormat))
+			return analytic_triangles_mask_converter(op, src, dst,
+								 maskFormat,
+								 src_x, src_y,
+								 count, tri);
+
+		return precise_triangles_mask_converter(op, src, dst,
+							maskFormat,
+							src_x, src_y,
+							count, tri);
 	}
 
 	if (maskFormat == NULL && count > 1) {
@@ -3666,7 +3473,7 @@ tristrip_thread(void *arg)
 	if (!tor_init(&tor, &thread->extents, 2*thread->count))
 		return;
 
-	span_thread_boxes_init(&boxes, thread->op, thread->clip);
+	span_thread_boxes_init(&boxes, thread->op, thread->clip, FAST_SAMPLES_XY);
 
 	cw = 0; ccw = 1;
 	polygon_add_line(tor.polygon,
@@ -3837,7 +3644,7 @@ imprecise_tristrip_span_converter(struct sna *sna,
 		assert(tor.polygon->num_edges <= 2*count);
 
 		tor_render(sna, &tor, &tmp, &clip,
-			   choose_span(&tmp, dst, maskFormat, &clip),
+			   imprecise_choose_span(&tmp, dst, maskFormat, &clip),
 			   !was_clear && maskFormat && !operator_is_bounded(op));
 
 		tor_fini(&tor);
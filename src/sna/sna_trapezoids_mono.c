@@ -95,59 +95,6 @@ floored_muldivrem(int32_t x, int32_t a, int32_t b)
 	return qr;
 }
 
-#if HAS_DEBUG_FULL
-static void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
-{
-	if (box->x1 < 0 || box->y1 < 0 ||
-	    box->x2 > pixmap->drawable.width ||
-	    box->y2 > pixmap->drawable.height)
-		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
-			   __FUNCTION__,
-			   box->x1, box->y1, box->x2, box->y2,
-			   pixmap->drawable.width,
-			   pixmap->drawable.height);
-}
-#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
-#else
-#define assert_pixmap_contains_box(p, b)
-#endif
-
-static void apply_damage(struct sna_composite_op *op, RegionPtr region)
-{
-	DBG(("%s: damage=%p, region=%dx[(%d, %d), (%d, %d)]\n",
-	     __FUNCTION__, op->damage,
-	     region_num_rects(region),
-	     region->extents.x1, region->extents.y1,
-	     region->extents.x2, region->extents.y2));
-
-	if (op->damage == NULL)
-		return;
-
-	RegionTranslate(region, op->dst.x, op->dst.y);
-
-	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
-	sna_damage_add(op->damage, region);
-}
-
-static void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	BoxRec r;
-
-	r.x1 = box->x1 + op->dst.x;
-	r.x2 = box->x2 + op->dst.x;
-	r.y1 = box->y1 + op->dst.y;
-	r.y2 = box->y2 + op->dst.y;
-
-	assert_pixmap_contains_box(op->dst.pixmap, &r);
-	sna_damage_add_box(op->damage, &r);
-}
-
-inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	if (op->damage)
-		_apply_damage_box(op, box);
-}
-
 static bool
 mono_polygon_init(struct mono_polygon *polygon, BoxPtr box, int num_edges)
 {
@@ -735,24 +682,11 @@ mono_render(struct mono *mono)
 	}
 }
 
-static int operator_is_bounded(uint8_t op)
-{
-	switch (op) {
-	case PictOpOver:
-	case PictOpOutReverse:
-	case PictOpAdd:
-		return true;
-	default:
-		return false;
-	}
-}
-
 struct mono_span_thread {
 	struct sna *sna;
-	const xTrapezoid *traps;
+	struct trapezoid_tiles *tiles;
 	const struct sna_composite_op *op;
 	RegionPtr clip;
-	int ntrap;
 	BoxRec extents;
 	int dx, dy;
 };
@@ -761,59 +695,64 @@ static void
 mono_span_thread(void *arg)
 {
 	struct mono_span_thread *thread = arg;
-	struct mono mono;
+	struct trapezoid_tiles *tiles = thread->tiles;
 	struct mono_span_thread_boxes boxes;
-	const xTrapezoid *t;
-	int n;
+	struct mono mono;
+	BoxRec extents;
+	const int *index;
+	int count;
 
 	mono.sna = thread->sna;
 
-	mono.clip.extents = thread->extents;
-	mono.clip.data = NULL;
-	if (thread->clip->data) {
-		RegionIntersect(&mono.clip, &mono.clip, thread->clip);
-		if (RegionNil(&mono.clip))
-			return;
-	}
-	region_get_boxes(&mono.clip, &mono.clip_start, &mono.clip_end);
-
 	boxes.op = thread->op;
 	boxes.num_boxes = 0;
 	mono.op.priv = &boxes;
 
-	if (!mono_init(&mono, 2*thread->ntrap)) {
-		RegionUninit(&mono.clip);
-		return;
-	}
-
-	for (n = thread->ntrap, t = thread->traps; n--; t++) {
-		if (!xTrapezoidValid(t))
+	extents = thread->extents;
+	while (trapezoid_tiles_next(tiles, &extents, &index, &count)) {
+		if (count == 0)
 			continue;
 
-		if (pixman_fixed_to_int(t->top) + thread->dy >= thread->extents.y2 ||
-		    pixman_fixed_to_int(t->bottom) + thread->dy <= thread->extents.y1)
+		mono.clip.extents = extents;
+		mono.clip.data = NULL;
+		if (thread->clip->data) {
+			RegionIntersect(&mono.clip, &mono.clip, thread->clip);
+			if (RegionNil(&mono.clip)) {
+				RegionUninit(&mono.clip);
+				continue;
+			}
+		}
+		region_get_boxes(&mono.clip, &mono.clip_start, &mono.clip_end);
+
+		if (!mono_init(&mono, 2*count)) {
+			RegionUninit(&mono.clip);
 			continue;
+		}
 
-		mono_add_line(&mono, thread->dx, thread->dy,
-			      t->top, t->bottom,
-			      &t->left.p1, &t->left.p2, 1);
-		mono_add_line(&mono, thread->dx, thread->dy,
-			      t->top, t->bottom,
-			      &t->right.p1, &t->right.p2, -1);
-	}
+		while (count--) {
+			const xTrapezoid *t = &tiles->traps[*index++];
 
-	if (mono.clip.data == NULL)
-		mono.span = thread_mono_span;
-	else
-		mono.span = thread_mono_span_clipped;
+			mono_add_line(&mono, thread->dx, thread->dy,
+				      t->top, t->bottom,
+				      &t->left.p1, &t->left.p2, 1);
+			mono_add_line(&mono, thread->dx, thread->dy,
+				      t->top, t->bottom,
+				      &t->right.p1, &t->right.p2, -1);
+		}
 
-	mono_render(&mono);
-	mono_fini(&mono);
+		if (mono.clip.data == NULL)
+			mono.span = thread_mono_span;
+		else
+			mono.span = thread_mono_span_clipped;
+
+		mono_render(&mono);
+		mono_fini(&mono);
+		RegionUninit(&mono.clip);
+	}
 
 	if (boxes.num_boxes)
 		thread->op->thread_boxes(thread->sna, thread->op,
 					 boxes.boxes, boxes.num_boxes);
-	RegionUninit(&mono.clip);
 }
 
 bool
@@ -823,6 +762,7 @@ mono_trapezoids_span_converter(struct sna *sna,
 			       int ntrap, xTrapezoid *traps)
 {
 	struct mono mono;
+	struct trapezoid_tiles tiles;
 	BoxRec extents;
 	int16_t dst_x, dst_y;
 	int16_t dx, dy;
@@ -889,42 +829,37 @@ mono_trapezoids_span_converter(struct sna *sna,
 		num_threads = sna_use_threads(mono.clip.extents.x2 - mono.clip.extents.x1,
 					      mono.clip.extents.y2 - mono.clip.extents.y1,
 					      32);
+	if (num_threads > 1 &&
+	    !trapezoid_tiles_init(&tiles, &mono.clip.extents, dy, traps, ntrap))
+		num_threads = 1;
 	if (num_threads > 1) {
 		struct mono_span_thread threads[num_threads];
-		int y, h;
 
-		DBG(("%s: using %d threads for mono span compositing %dx%d\n",
+		DBG(("%s: using %d threads for mono span compositing %dx%d, %d tiles\n",
 		     __FUNCTION__, num_threads,
 		     mono.clip.extents.x2 - mono.clip.extents.x1,
-		     mono.clip.extents.y2 - mono.clip.extents.y1));
+		     mono.clip.extents.y2 - mono.clip.extents.y1,
+		     tiles.count));
 
 		threads[0].sna = mono.sna;
 		threads[0].op = &mono.op;
-		threads[0].traps = traps;
-		threads[0].ntrap = ntrap;
+		threads[0].tiles = &tiles;
 		threads[0].extents = mono.clip.extents;
 		threads[0].clip = &mono.clip;
 		threads[0].dx = dx;
 		threads[0].dy = dy;
 
-		y = extents.y1;
-		h = extents.y2 - extents.y1;
-		h = (h + num_threads - 1) / num_threads;
-		num_threads -= (num_threads-1) * h >= extents.y2 - extents.y1;
-
+		if (num_threads > tiles.count)
+			num_threads = tiles.count;
 		for (n = 1; n < num_threads; n++) {
 			threads[n] = threads[0];
-			threads[n].extents.y1 = y;
-			threads[n].extents.y2 = y += h;
-
 			sna_threads_run(n, mono_span_thread, &threads[n]);
 		}
 
-		threads[0].extents.y1 = y;
-		threads[0].extents.y2 = extents.y2;
 		mono_span_thread(&threads[0]);
 
 		sna_threads_wait();
+		trapezoid_tiles_fini(&tiles);
 		mono.op.done(mono.sna, &mono.op);
 		return true;
 	}
@@ -44,6 +44,14 @@
 
 /* TODO: Emit unantialiased and MSAA triangles. */
 
+#define NO_DENSE_COVERAGE 0
+
+/* Subrow spans wider than this many pixels are accumulated into the
+ * dense coverage row rather than added to each pixel in turn.
+ */
+#define DENSE_SPAN 16
+#define DENSE_STACK 1024
+
 #ifndef MAX
 #define MAX(x,y) ((x) >= (y) ? (x) : (y))
 #endif
@@ -61,8 +69,6 @@
 	}                                  \
 } while (0)
 
-#define GRID_AREA (2*SAMPLES_X*SAMPLES_Y)
-
 static inline int pixman_fixed_to_grid_x(pixman_fixed_t v)
 {
 	return ((int64_t)v * SAMPLES_X + (1<<15)) >> 16;
@@ -73,71 +79,9 @@ static inline int pixman_fixed_to_grid_y(pixman_fixed_t v)
 	return ((int64_t)v * SAMPLES_Y + (1<<15)) >> 16;
 }
 
-typedef void (*span_func_t)(struct sna *sna,
-			    struct sna_composite_spans_op *op,
-			    pixman_region16_t *clip,
-			    const BoxRec *box,
-			    int coverage);
-
-#if HAS_DEBUG_FULL
-static void _assert_pixmap_contains_box(PixmapPtr pixmap, BoxPtr box, const char *function)
-{
-	if (box->x1 < 0 || box->y1 < 0 ||
-	    box->x2 > pixmap->drawable.width ||
-	    box->y2 > pixmap->drawable.height)
-	{
-		FatalError("%s: damage box is beyond the pixmap: box=(%d, %d), (%d, %d), pixmap=(%d, %d)\n",
-			   function,
-			   box->x1, box->y1, box->x2, box->y2,
-			   pixmap->drawable.width,
-			   pixmap->drawable.height);
-	}
-}
-#define assert_pixmap_contains_box(p, b) _assert_pixmap_contains_box(p, b, __FUNCTION__)
-#else
-#define assert_pixmap_contains_box(p, b)
-#endif
-
-static void apply_damage(struct sna_composite_op *op, RegionPtr region)
-{
-	DBG(("%s: damage=%p, region=%dx[(%d, %d), (%d, %d)]\n",
-	     __FUNCTION__, op->damage,
-	     region_num_rects(region),
-	     region->extents.x1, region->extents.y1,
-	     region->extents.x2, region->extents.y2));
-
-	if (op->damage == NULL)
-		return;
-
-	RegionTranslate(region, op->dst.x, op->dst.y);
-
-	assert_pixmap_contains_box(op->dst.pixmap, RegionExtents(region));
-	sna_damage_add(op->damage, region);
-}
-
-static void _apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	BoxRec r;
-
-	r.x1 = box->x1 + op->dst.x;
-	r.x2 = box->x2 + op->dst.x;
-	r.y1 = box->y1 + op->dst.y;
-	r.y2 = box->y2 + op->dst.y;
-
-	assert_pixmap_contains_box(op->dst.pixmap, &r);
-	sna_damage_add_box(op->damage, &r);
-}
-
-inline static void apply_damage_box(struct sna_composite_op *op, const BoxRec *box)
-{
-	if (op->damage)
-		_apply_damage_box(op, box);
-}
-
 #define SAMPLES_X_TO_INT_FRAC(x, i, f) \
 	_GRID_TO_INT_FRAC(x, i, f, SAMPLES_X)
 
-#define AREA_TO_FLOAT(c)  ((c) / (float)GRID_AREA)
 #define TO_ALPHA(c) (((c)+1) >> 1)
 
 struct quorem {
@@ -1037,6 +981,33 @@ tor_add_trapezoid(struct tor *tor, const xTrapezoid *t, int dx, int dy)
 	polygon_add_edge(tor->polygon, t, &t->right, -1, dx, dy);
 }
 
+/* Walk every triangle the same way round so that overlapping triangles
+ * accumulate winding rather than cancelling under the nonzero rule.
+ */
+static void
+tor_add_triangle(struct tor *tor, const xTriangle *t, int dx, int dy)
+{
+	const xPointFixed *p2, *p3;
+	int64_t cross;
+
+	cross = (int64_t)(t->p2.x - t->p1.x) * (t->p3.y - t->p1.y) -
+		(int64_t)(t->p2.y - t->p1.y) * (t->p3.x - t->p1.x);
+	if (cross == 0)
+		return;
+
+	if (cross > 0) {
+		p2 = &t->p2;
+		p3 = &t->p3;
+	} else {
+		p2 = &t->p3;
+		p3 = &t->p2;
+	}
+
+	polygon_add_line(tor->polygon, &t->p1, p2, dx, dy);
+	polygon_add_line(tor->polygon, p2, p3, dx, dy);
+	polygon_add_line(tor->polygon, p3, &t->p1, dx, dy);
+}
+
 static void
 step_edges(struct active_list *active, int count)
 {
@@ -1053,56 +1024,6 @@ step_edges(struct active_list *active, int count)
 	}
 }
 
-static void
-tor_blt_span(struct sna *sna,
-	     struct sna_composite_spans_op *op,
-	     pixman_region16_t *clip,
-	     const BoxRec *box,
-	     int coverage)
-{
-	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
-
-	op->box(sna, op, box, AREA_TO_FLOAT(coverage));
-	apply_damage_box(&op->base, box);
-}
-
-static void
-tor_blt_span__no_damage(struct sna *sna,
-			struct sna_composite_spans_op *op,
-			pixman_region16_t *clip,
-			const BoxRec *box,
-			int coverage)
-{
-	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
-
-	op->box(sna, op, box, AREA_TO_FLOAT(coverage));
-}
-
-static void
-tor_blt_span_clipped(struct sna *sna,
-		     struct sna_composite_spans_op *op,
-		     pixman_region16_t *clip,
-		     const BoxRec *box,
-		     int coverage)
-{
-	pixman_region16_t region;
-	float opacity;
-
-	opacity = AREA_TO_FLOAT(coverage);
-	__DBG(("%s: %d -> %d @ %f\n", __FUNCTION__, box->x1, box->x2, opacity));
-
-	pixman_region_init_rects(&region, box, 1);
-	RegionIntersect(&region, &region, clip);
-	if (region_num_rects(&region)) {
-		op->boxes(sna, op,
-			  region_rects(&region),
-			  region_num_rects(&region),
-			  opacity);
-		apply_damage(&op->base, &region);
-	}
-	pixman_region_fini(&region);
-}
-
 static void
 tor_blt(struct sna *sna,
 	struct tor *converter,
@@ -1178,96 +1099,6 @@ tor_blt(struct sna *sna,
 	}
 }
 
-flatten static void
-tor_render(struct sna *sna,
-	   struct tor *converter,
-	   struct sna_composite_spans_op *op,
-	   pixman_region16_t *clip,
-	   void (*span)(struct sna *sna,
-			struct sna_composite_spans_op *op,
-			pixman_region16_t *clip,
-			const BoxRec *box,
-			int coverage),
-	   int unbounded)
-{
-	struct polygon *polygon = converter->polygon;
-	struct cell_list *coverages = converter->coverages;
-	struct active_list *active = converter->active;
-	struct edge *buckets[SAMPLES_Y] = { 0 };
-	int16_t i, j, h = converter->extents.y2 - converter->extents.y1;
-
-	__DBG(("%s: unbounded=%d\n", __FUNCTION__, unbounded));
-
-	/* Render each pixel row. */
-	for (i = 0; i < h; i = j) {
-		int do_full_step = 0;
-
-		j = i + 1;
-
-		/* Determine if we can ignore this row or use the full pixel
-		 * stepper. */
-		if (polygon->y_buckets[i] == NULL) {
-			if (active->head.next == &active->tail) {
-				for (; polygon->y_buckets[j] == NULL; j++)
-					;
-				__DBG(("%s: no new edges and no exisiting edges, skipping, %d -> %d\n",
-				       __FUNCTION__, i, j));
-
-				assert(j <= h);
-				if (unbounded) {
-					BoxRec box;
-
-					box = converter->extents;
-					box.y1 += i;
-					box.y2 = converter->extents.y1 + j;
-
-					span(sna, op, clip, &box, 0);
-				}
-				continue;
-			}
-
-			do_full_step = can_full_step(active);
-		}
-
-		__DBG(("%s: y=%d, do_full_step=%d, new edges=%d\n",
-		       __FUNCTION__, i, do_full_step,
-		       polygon->y_buckets[i] != NULL));
-		if (do_full_step) {
-			nonzero_row(active, coverages);
-
-			while (polygon->y_buckets[j] == NULL &&
-			       do_full_step >= 2*SAMPLES_Y) {
-				do_full_step -= SAMPLES_Y;
-				j++;
-			}
-			assert(j >= i + 1 && j <= h);
-			if (j != i + 1)
-				step_edges(active, j - (i + 1));
-
-			__DBG(("%s: vertical edges, full step (%d, %d)\n",
-			       __FUNCTION__,  i, j));
-		} else {
-			int suby;
-
-			fill_buckets(active, polygon->y_buckets[i], (i+converter->extents.y1)*SAMPLES_Y, buckets);
-
-			/* Subsample this row. */
-			for (suby = 0; suby < SAMPLES_Y; suby++) {
-				if (buckets[suby]) {
-					merge_edges(active, buckets[suby]);
-					buckets[suby] = NULL;
-				}
-
-				nonzero_subrow(active, coverages);
-			}
-		}
-
-		assert(j > i);
-		tor_blt(sna, converter, op, clip, span, i, j-i, unbounded);
-		cell_list_reset(coverages);
-	}
-}
-
 static void
 inplace_row(struct active_list *active, uint8_t *row, int width)
 {
@@ -1381,25 +1212,120 @@ inplace_row(struct active_list *active, uint8_t *row, int width)
 	}
 }
 
-inline static void
-inplace_subrow(struct active_list *active, int8_t *row, int width)
+/* For large shapes, most of the work of subsampling a row is in adding
+ * SAMPLES_X to every pixel of every span on each of the SAMPLES_Y
+ * subrows. Instead, we mark just the start and end of each wide span in
+ * a row of deltas, and convert the running sum of those into coverage
+ * once for the whole row. Narrow spans, the edges of thin shapes, are
+ * still added directly so that we only pay for the pass over the dense
+ * row when it saves work.
+ */
+static void
+dense_row__c(uint8_t *row, int16_t *dense, int width)
+{
+	int x, sum = 0;
+
+	for (x = 0; x < width; x++) {
+		sum += dense[x];
+		dense[x] = 0;
+		row[x] += sum;
+	}
+	dense[width] = 0;
+}
+
+#if defined(sse2)
+#pragma GCC push_options
+#pragma GCC target("sse2,fpmath=sse")
+#pragma GCC optimize("Ofast")
+#include <emmintrin.h>
+
+static force_inline __m128i
+dense_prefix_sum(__m128i x, __m128i carry)
+{
+	x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+	x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+	x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+	return _mm_add_epi16(x, carry);
+}
+
+static force_inline __m128i
+dense_carry(__m128i x)
+{
+	/* broadcast the last lane */
+	x = _mm_shufflehi_epi16(x, 0xff);
+	return _mm_unpackhi_epi64(x, x);
+}
+
+static void
+dense_row__sse2(uint8_t *row, int16_t *dense, int width)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i carry = zero;
+	int x, sum;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i lo, hi, v;
+
+		lo = _mm_loadu_si128((const __m128i *)(dense + x));
+		hi = _mm_loadu_si128((const __m128i *)(dense + x + 8));
+		_mm_storeu_si128((__m128i *)(dense + x), zero);
+		_mm_storeu_si128((__m128i *)(dense + x + 8), zero);
+
+		lo = dense_prefix_sum(lo, carry);
+		hi = dense_prefix_sum(hi, dense_carry(lo));
+		carry = dense_carry(hi);
+
+		/* The total coverage of a pixel never exceeds 255 */
+		v = _mm_loadu_si128((const __m128i *)(row + x));
+		v = _mm_add_epi8(v, _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(row + x), v);
+	}
+
+	sum = (int16_t)_mm_extract_epi16(carry, 0);
+	for (; x < width; x++) {
+		sum += dense[x];
+		dense[x] = 0;
+		row[x] += sum;
+	}
+	dense[width] = 0;
+}
+
+#pragma GCC pop_options
+#endif
+
+static void
+dense_row(struct sna *sna, uint8_t *row, int16_t *dense, int width)
+{
+#if defined(sse2)
+	if (sna->cpu_features & SSE2)
+		dense_row__sse2(row, dense, width);
+	else
+#endif
+		dense_row__c(row, dense, width);
+}
+
+inline static bool
+inplace_subrow(struct active_list *active, int8_t *row, int16_t *dense,
+	       int x0, int width)
 {
 	struct edge *edge = active->head.next;
 	int prev_x = INT_MIN;
+	bool used = false;
 
 	while (&active->tail != edge) {
 		struct edge *next = edge->next;
 		int winding = edge->dir;
-		int lfx, rfx;
+		int cell, lfx, rfx;
 		int lix, rix;
 
-		if (edge->cell < 0) {
+		cell = edge->cell - x0;
+		if (cell < 0) {
 			lix = lfx = 0;
-		} else if (edge->cell >= width * SAMPLES_X) {
+		} else if (cell >= width * SAMPLES_X) {
 			lix = width;
 			lfx = 0;
 		} else
-			SAMPLES_X_TO_INT_FRAC(edge->cell, lix, lfx);
+			SAMPLES_X_TO_INT_FRAC(cell, lix, lfx);
 
 		assert(edge->height_left > 0);
 		if (--edge->height_left) {
@@ -1457,13 +1383,14 @@ inplace_subrow(struct active_list *active, int8_t *row, int width)
 			edge = next;
 		} while (1);
 
-		if (edge->cell < 0) {
+		cell = edge->cell - x0;
+		if (cell < 0) {
 			rix = rfx = 0;
-		} else if (edge->cell >= width * SAMPLES_X) {
+		} else if (cell >= width * SAMPLES_X) {
 			rix = width;
 			rfx = 0;
 		} else
-			SAMPLES_X_TO_INT_FRAC(edge->cell, rix, rfx);
+			SAMPLES_X_TO_INT_FRAC(cell, rix, rfx);
 
 		assert(edge->height_left > 0);
 		if (--edge->height_left) {
@@ -1507,48 +1434,134 @@ inplace_subrow(struct active_list *active, int8_t *row, int width)
 				row[rix] += rfx;
 			}
 
-			while (++lix < rix)
+			if (dense && rix - lix > DENSE_SPAN) {
+				dense[lix + 1] += SAMPLES_X;
+				dense[rix] -= SAMPLES_X;
+				used = true;
+			} else while (++lix < rix)
 				row[lix] += SAMPLES_X;
 		}
 	}
+
+	return used;
 }
 
+/* Form the spans of a single subsampled row from the runs of equal
+ * coverage in its dense row; see tor_render(). Returns the number of
+ * spans emitted.
+ */
+static int
+tor_blt_dense(struct sna *sna,
+	      struct tor *converter,
+	      struct sna_composite_spans_op *op,
+	      pixman_region16_t *clip,
+	      void (*span)(struct sna *sna,
+			   struct sna_composite_spans_op *op,
+			   pixman_region16_t *clip,
+			   const BoxRec *box,
+			   int coverage),
+	      const uint8_t *row, int y, int width,
+	      int unbounded)
+{
+	BoxRec box;
+	int x, n, count = 0;
+
+	box.y1 = y + converter->extents.y1;
+	box.y2 = box.y1 + 1;
+	assert(box.y2 <= converter->extents.y2);
+
+	for (x = 0; x < width; x = n) {
+		uint8_t v = row[x];
+
+		for (n = x + 1; n < width && row[n] == v; n++)
+			;
+
+		if (unbounded || v) {
+			box.x1 = converter->extents.x1 + x;
+			box.x2 = converter->extents.x1 + n;
+			__DBG(("%s: span (%d, %d)x(%d, %d) @ %d\n", __FUNCTION__,
+			       box.x1, box.y1,
+			       box.x2 - box.x1,
+			       box.y2 - box.y1,
+			       2*v));
+			span(sna, op, clip, &box, 2*v); /* samples to area */
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* The sparse cells are walked from the start of the row for each
+ * subrow, so once a row holds more cells than it is wide (scaled by
+ * the number of subrows) we accumulate its subsamples into a dense
+ * coverage row instead, as tor_inplace() does, and form the spans from
+ * that. The choice for each row is made on the number of spans
+ * produced by the last.
+ *
+ * The dense row needs the CPU features, and so is only used when we
+ * have been given the device.
+ */
 flatten static void
-tor_inplace(struct tor *converter, PixmapPtr scratch)
+tor_render(struct sna *sna,
+	   struct tor *converter,
+	   struct sna_composite_spans_op *op,
+	   pixman_region16_t *clip,
+	   void (*span)(struct sna *sna,
+			struct sna_composite_spans_op *op,
+			pixman_region16_t *clip,
+			const BoxRec *box,
+			int coverage),
+	   int unbounded)
 {
-	uint8_t buf[TOR_INPLACE_SIZE];
-	int i, j, h = converter->extents.y2 - converter->extents.y1;
 	struct polygon *polygon = converter->polygon;
+	struct cell_list *coverages = converter->coverages;
 	struct active_list *active = converter->active;
 	struct edge *buckets[SAMPLES_Y] = { 0 };
-	uint8_t *row = scratch->devPrivate.ptr;
-	int stride = scratch->devKind;
-	int width = scratch->drawable.width;
+	int16_t i, j, h = converter->extents.y2 - converter->extents.y1;
+	int width = converter->extents.x2 - converter->extents.x1;
+	uint8_t row_stack[DENSE_STACK], *row = NULL;
+	int16_t dense_stack[DENSE_STACK + 1], *dense = NULL;
+	int count = 0;
 
-	__DBG(("%s: buf?=%d\n", __FUNCTION__, buf != NULL));
-	assert(converter->extents.x1 == 0);
-	assert(scratch->drawable.depth == 8);
+	__DBG(("%s: unbounded=%d\n", __FUNCTION__, unbounded));
 
-	row += converter->extents.y1 * stride;
+	if (!NO_DENSE_COVERAGE && sna && width > DENSE_SPAN) {
+		row = row_stack;
+		dense = dense_stack;
+		if (width > DENSE_STACK) {
+			dense = malloc((width + 1) * sizeof(*dense) + width);
+			row = dense ? (uint8_t *)(dense + width + 1) : NULL;
+		}
+		if (dense)
+			memset(dense, 0, (width + 1) * sizeof(*dense));
+	}
 
 	/* Render each pixel row. */
 	for (i = 0; i < h; i = j) {
 		int do_full_step = 0;
-		void *ptr = scratch->usage_hint ? buf : row;
 
 		j = i + 1;
 
 		/* Determine if we can ignore this row or use the full pixel
 		 * stepper. */
-		if (!polygon->y_buckets[i]) {
+		if (polygon->y_buckets[i] == NULL) {
 			if (active->head.next == &active->tail) {
-				for (; !polygon->y_buckets[j]; j++)
+				for (; polygon->y_buckets[j] == NULL; j++)
 					;
 				__DBG(("%s: no new edges and no exisiting edges, skipping, %d -> %d\n",
 				       __FUNCTION__, i, j));
 
-				memset(row, 0, stride*(j-i));
-				row += stride*(j-i);
+				assert(j <= h);
+				if (unbounded) {
+					BoxRec box;
+
+					box = converter->extents;
+					box.y1 += i;
+					box.y2 = converter->extents.y1 + j;
+
+					span(sna, op, clip, &box, 0);
+				}
 				continue;
 			}
 
@@ -1559,236 +1572,203 @@ tor_inplace(struct tor *converter, PixmapPtr scratch)
 		       __FUNCTION__, i, do_full_step,
 		       polygon->y_buckets[i] != NULL));
 		if (do_full_step) {
-			memset(ptr, 0, width);
-			inplace_row(active, ptr, width);
-			if (row != ptr)
-				memcpy(row, ptr, width);
+			nonzero_row(active, coverages);
 
 			while (polygon->y_buckets[j] == NULL &&
 			       do_full_step >= 2*SAMPLES_Y) {
 				do_full_step -= SAMPLES_Y;
-				row += stride;
-				memcpy(row, ptr, width);
 				j++;
 			}
+			assert(j >= i + 1 && j <= h);
 			if (j != i + 1)
 				step_edges(active, j - (i + 1));
 
 			__DBG(("%s: vertical edges, full step (%d, %d)\n",
 			       __FUNCTION__,  i, j));
+		} else if (row && count * SAMPLES_Y > 2 * width) {
+			bool used = false;
+			int suby;
+
+			fill_buckets(active, polygon->y_buckets[i], (i+converter->extents.y1)*SAMPLES_Y, buckets);
+
+			/* Subsample this row into the dense coverage row. */
+			memset(row, 0, width);
+			for (suby = 0; suby < SAMPLES_Y; suby++) {
+				if (buckets[suby]) {
+					merge_edges(active, buckets[suby]);
+					buckets[suby] = NULL;
+				}
+
+				used |= inplace_subrow(active, (int8_t *)row, dense,
+						       converter->extents.x1 * SAMPLES_X,
+						       width);
+			}
+			if (used)
+				dense_row(sna, row, dense, width);
+
+			count = tor_blt_dense(sna, converter, op, clip, span,
+					      row, i, width, unbounded);
+			continue;
 		} else {
 			int suby;
 
 			fill_buckets(active, polygon->y_buckets[i], (i+converter->extents.y1)*SAMPLES_Y, buckets);
 
 			/* Subsample this row. */
-			memset(ptr, 0, width);
 			for (suby = 0; suby < SAMPLES_Y; suby++) {
 				if (buckets[suby]) {
 					merge_edges(active, buckets[suby]);
 					buckets[suby] = NULL;
 				}
 
-				inplace_subrow(active, ptr, width);
+				nonzero_subrow(active, coverages);
 			}
-			if (row != ptr)
-				memcpy(row, ptr, width);
 		}
 
-		row += stride;
+		assert(j > i);
+		count = coverages->count;
+		tor_blt(sna, converter, op, clip, span, i, j-i, unbounded);
+		cell_list_reset(coverages);
 	}
-}
 
-static int operator_is_bounded(uint8_t op)
-{
-	switch (op) {
-	case PictOpOver:
-	case PictOpOutReverse:
-	case PictOpAdd:
-		return true;
-	default:
-		return false;
-	}
+	if (dense != dense_stack)
+		free(dense);
 }
 
-static span_func_t
-choose_span(struct sna_composite_spans_op *tmp,
-	    PicturePtr dst,
-	    PictFormatPtr maskFormat,
-	    RegionPtr clip)
+flatten static void
+tor_inplace(struct tor *converter, PixmapPtr scratch)
 {
-	span_func_t span;
-
-	assert(!is_mono(dst, maskFormat));
-	if (clip->data)
-		span = tor_blt_span_clipped;
-	else if (tmp->base.damage == NULL)
-		span = tor_blt_span__no_damage;
-	else
-		span = tor_blt_span;
-
-	return span;
-}
-
-struct span_thread {
-	struct sna *sna;
-	const struct sna_composite_spans_op *op;
-	const xTrapezoid *traps;
-	RegionPtr clip;
-	span_func_t span;
-	BoxRec extents;
-	int dx, dy, draw_y;
-	int ntrap;
-	bool unbounded;
-};
-
-#define SPAN_THREAD_MAX_BOXES (8192/sizeof(struct sna_opacity_box))
-struct span_thread_boxes {
-	const struct sna_composite_spans_op *op;
-	const BoxRec *clip_start, *clip_end;
-	int num_boxes;
-	struct sna_opacity_box boxes[SPAN_THREAD_MAX_BOXES];
-};
+	uint8_t buf[TOR_INPLACE_SIZE];
+	int16_t dense_stack[DENSE_STACK + 1], *dense = NULL;
+	int i, j, h = converter->extents.y2 - converter->extents.y1;
+	struct polygon *polygon = converter->polygon;
+	struct active_list *active = converter->active;
+	struct edge *buckets[SAMPLES_Y] = { 0 };
+	uint8_t *row = scratch->devPrivate.ptr;
+	int stride = scratch->devKind;
+	int width = scratch->drawable.width;
 
-static void span_thread_add_box(struct sna *sna, void *data,
-				const BoxRec *box, float alpha)
-{
-	struct span_thread_boxes *b = data;
+	__DBG(("%s: buf?=%d\n", __FUNCTION__, buf != NULL));
+	assert(converter->extents.x1 == 0);
+	assert(scratch->drawable.depth == 8);
 
-	__DBG(("%s: adding box with alpha=%f\n", __FUNCTION__, alpha));
+	row += converter->extents.y1 * stride;
 
-	if (unlikely(b->num_boxes == SPAN_THREAD_MAX_BOXES)) {
-		DBG(("%s: flushing %d boxes\n", __FUNCTION__, b->num_boxes));
-		b->op->thread_boxes(sna, b->op, b->boxes, b->num_boxes);
-		b->num_boxes = 0;
+	if (!NO_DENSE_COVERAGE && width > DENSE_SPAN) {
+		dense = dense_stack;
+		if (width > DENSE_STACK)
+			dense = malloc((width + 1) * sizeof(*dense));
+		if (dense)
+			memset(dense, 0, (width + 1) * sizeof(*dense));
 	}
 
-	b->boxes[b->num_boxes].box = *box++;
-	b->boxes[b->num_boxes].alpha = alpha;
-	b->num_boxes++;
-	assert(b->num_boxes <= SPAN_THREAD_MAX_BOXES);
-}
+	/* Render each pixel row. */
+	for (i = 0; i < h; i = j) {
+		int do_full_step = 0;
+		void *ptr = scratch->usage_hint ? buf : row;
 
-static void
-span_thread_box(struct sna *sna,
-		struct sna_composite_spans_op *op,
-		pixman_region16_t *clip,
-		const BoxRec *box,
-		int coverage)
-{
-	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
-
-	__DBG(("%s: %d -> %d @ %d\n", __FUNCTION__, box->x1, box->x2, coverage));
-	if (b->num_boxes) {
-		struct sna_opacity_box *bb = &b->boxes[b->num_boxes-1];
-		if (bb->box.x1 == box->x1 &&
-		    bb->box.x2 == box->x2 &&
-		    bb->box.y2 == box->y1 &&
-		    bb->alpha == AREA_TO_FLOAT(coverage)) {
-			bb->box.y2 = box->y2;
-			__DBG(("%s: contracted double row: %d -> %d\n", __func__, bb->box.y1, bb->box.y2));
-			return;
-		}
-	}
+		j = i + 1;
 
-	span_thread_add_box(sna, op, box, AREA_TO_FLOAT(coverage));
-}
+		/* Determine if we can ignore this row or use the full pixel
+		 * stepper. */
+		if (!polygon->y_buckets[i]) {
+			if (active->head.next == &active->tail) {
+				for (; !polygon->y_buckets[j]; j++)
+					;
+				__DBG(("%s: no new edges and no exisiting edges, skipping, %d -> %d\n",
+				       __FUNCTION__, i, j));
 
-static void
-span_thread_clipped_box(struct sna *sna,
-			struct sna_composite_spans_op *op,
-			pixman_region16_t *clip,
-			const BoxRec *box,
-			int coverage)
-{
-	struct span_thread_boxes *b = (struct span_thread_boxes *)op;
-	const BoxRec *c;
+				memset(row, 0, stride*(j-i));
+				row += stride*(j-i);
+				continue;
+			}
 
-	__DBG(("%s: %d -> %d @ %f\n", __FUNCTION__, box->x1, box->x2,
-	       AREA_TO_FLOAT(coverage)));
+			do_full_step = can_full_step(active);
+		}
 
-	b->clip_start =
-		find_clip_box_for_y(b->clip_start, b->clip_end, box->y1);
+		__DBG(("%s: y=%d, do_full_step=%d, new edges=%d\n",
+		       __FUNCTION__, i, do_full_step,
+		       polygon->y_buckets[i] != NULL));
+		if (do_full_step) {
+			memset(ptr, 0, width);
+			inplace_row(active, ptr, width);
+			if (row != ptr)
+				memcpy(row, ptr, width);
 
-	c = b->clip_start;
-	while (c != b->clip_end) {
-		BoxRec clipped;
+			while (polygon->y_buckets[j] == NULL &&
+			       do_full_step >= 2*SAMPLES_Y) {
+				do_full_step -= SAMPLES_Y;
+				row += stride;
+				memcpy(row, ptr, width);
+				j++;
+			}
+			if (j != i + 1)
+				step_edges(active, j - (i + 1));
 
-		if (box->y2 <= c->y1)
-			break;
+			__DBG(("%s: vertical edges, full step (%d, %d)\n",
+			       __FUNCTION__,  i, j));
+		} else {
+			bool used = false;
+			int suby;
 
-		clipped = *box;
-		if (!box_intersect(&clipped, c++))
-			continue;
+			fill_buckets(active, polygon->y_buckets[i], (i+converter->extents.y1)*SAMPLES_Y, buckets);
 
-		span_thread_add_box(sna, op, &clipped, AREA_TO_FLOAT(coverage));
-	}
-}
+			/* Subsample this row. */
+			memset(ptr, 0, width);
+			for (suby = 0; suby < SAMPLES_Y; suby++) {
+				if (buckets[suby]) {
+					merge_edges(active, buckets[suby]);
+					buckets[suby] = NULL;
+				}
 
-static span_func_t
-thread_choose_span(struct sna_composite_spans_op *tmp,
-		   PicturePtr dst,
-		   PictFormatPtr maskFormat,
-		   RegionPtr clip)
-{
-	span_func_t span;
+				used |= inplace_subrow(active, ptr, dense, 0, width);
+			}
+			if (used)
+				dense_row(to_sna_from_pixmap(scratch),
+					  ptr, dense, width);
+			if (row != ptr)
+				memcpy(row, ptr, width);
+		}
 
-	if (tmp->base.damage) {
-		DBG(("%s: damaged -> no thread support\n", __FUNCTION__));
-		return NULL;
+		row += stride;
 	}
 
-	assert(!is_mono(dst, maskFormat));
-	assert(tmp->thread_boxes);
-	DBG(("%s: clipped? %d x %d\n", __FUNCTION__, clip->data != NULL, region_num_rects(clip)));
-	if (clip->data)
-		span = span_thread_clipped_box;
-	else
-		span = span_thread_box;
-
-	return span;
-}
-
-inline static void
-span_thread_boxes_init(struct span_thread_boxes *boxes,
-		       const struct sna_composite_spans_op *op,
-		       const RegionRec *clip)
-{
-	boxes->op = op;
-	boxes->clip_start = region_rects(clip);
-	boxes->clip_end = boxes->clip_start + region_num_rects(clip);
-	boxes->num_boxes = 0;
+	if (dense != dense_stack)
+		free(dense);
 }
 
 static void
 span_thread(void *arg)
 {
 	struct span_thread *thread = arg;
+	struct trapezoid_tiles *tiles = thread->tiles;
 	struct span_thread_boxes boxes;
-	struct tor tor;
-	const xTrapezoid *t;
-	int n, y1, y2;
+	BoxRec extents;
+	const int *index;
+	int count;
 
-	if (!tor_init(&tor, &thread->extents, 2*thread->ntrap))
-		return;
+	span_thread_boxes_init(&boxes, thread->op, thread->clip, GRID_AREA);
 
-	span_thread_boxes_init(&boxes, thread->op, thread->clip);
+	extents = thread->extents;
+	while (trapezoid_tiles_next(tiles, &extents, &index, &count)) {
+		struct tor tor;
 
-	y1 = thread->extents.y1 - thread->draw_y;
-	y2 = thread->extents.y2 - thread->draw_y;
-	for (n = thread->ntrap, t = thread->traps; n--; t++) {
-		if (pixman_fixed_integer_floor(t->top) >= y2 ||
-		    pixman_fixed_integer_ceil(t->bottom) <= y1)
+		if (count == 0 && !thread->unbounded)
 			continue;
 
-		tor_add_trapezoid(&tor, t, thread->dx, thread->dy);
-	}
+		if (!tor_init(&tor, &extents, 2*count))
+			continue;
 
-	tor_render(thread->sna, &tor,
-		   (struct sna_composite_spans_op *)&boxes, thread->clip,
-		   thread->span, thread->unbounded);
+		while (count--)
+			tor_add_trapezoid(&tor, &tiles->traps[*index++],
+					  thread->dx, thread->dy);
 
-	tor_fini(&tor);
+		tor_render(thread->sna, &tor,
+			   (struct sna_composite_spans_op *)&boxes, thread->clip,
+			   thread->span, thread->unbounded);
+
+		tor_fini(&tor);
+	}
 
 	if (boxes.num_boxes) {
 		DBG(("%s: flushing %d boxes\n", __FUNCTION__, boxes.num_boxes));
@@ -1810,6 +1790,7 @@ precise_trapezoid_span_converter(struct sna *sna,
 	int16_t dst_x, dst_y;
 	bool was_clear;
 	int dx, dy, n;
+	struct trapezoid_tiles tiles;
 	int num_threads;
 
 	if (NO_PRECISE)
@@ -1909,6 +1890,10 @@ precise_trapezoid_span_converter(struct sna *sna,
 		num_threads = sna_use_threads(clip.extents.x2-clip.extents.x1,
 					      clip.extents.y2-clip.extents.y1,
 					      8);
+	if (num_threads > 1 &&
+	    !trapezoid_tiles_init(&tiles, &clip.extents, dst->pDrawable->y,
+				  traps, ntrap))
+		num_threads = 1;
 	DBG(("%s: using %d threads\n", __FUNCTION__, num_threads));
 	if (num_threads == 1) {
 		struct tor tor;
@@ -1931,43 +1916,34 @@ precise_trapezoid_span_converter(struct sna *sna,
 		tor_fini(&tor);
 	} else {
 		struct span_thread threads[num_threads];
-		int y, h;
 
-		DBG(("%s: using %d threads for span compositing %dx%d\n",
+		DBG(("%s: using %d threads for span compositing %dx%d, %d tiles\n",
 		     __FUNCTION__, num_threads,
 		     clip.extents.x2 - clip.extents.x1,
-		     clip.extents.y2 - clip.extents.y1));
+		     clip.extents.y2 - clip.extents.y1,
+		     tiles.count));
 
 		threads[0].sna = sna;
 		threads[0].op = &tmp;
-		threads[0].traps = traps;
-		threads[0].ntrap = ntrap;
+		threads[0].tiles = &tiles;
 		threads[0].extents = clip.extents;
 		threads[0].clip = &clip;
 		threads[0].dx = dx;
 		threads[0].dy = dy;
-		threads[0].draw_y = dst->pDrawable->y;
 		threads[0].unbounded = !was_clear && maskFormat && !operator_is_bounded(op);
 		threads[0].span = thread_choose_span(&tmp, dst, maskFormat, &clip);
 
-		y = clip.extents.y1;
-		h = clip.extents.y2 - clip.extents.y1;
-		h = (h + num_threads - 1) / num_threads;
-		num_threads -= (num_threads-1) * h >= clip.extents.y2 - clip.extents.y1;
-
+		if (num_threads > tiles.count)
+			num_threads = tiles.count;
 		for (n = 1; n < num_threads; n++) {
 			threads[n] = threads[0];
-			threads[n].extents.y1 = y;
-			threads[n].extents.y2 = y += h;
-
 			sna_threads_run(n, span_thread, &threads[n]);
 		}
 
-		assert(y < threads[0].extents.y2);
-		threads[0].extents.y1 = y;
 		span_thread(&threads[0]);
 
 		sna_threads_wait();
+		trapezoid_tiles_fini(&tiles);
 	}
 skip:
 	tmp.done(sna, &tmp);
@@ -2037,7 +2013,7 @@ mask_thread(void *arg)
 	if (thread->extents.x2 <= TOR_INPLACE_SIZE) {
 		tor_inplace(&tor, thread->scratch);
 	} else {
-		tor_render(NULL, &tor,
+		tor_render(to_sna_from_pixmap(thread->scratch), &tor,
 			   thread->scratch->devPrivate.ptr,
 			   (void *)(intptr_t)thread->scratch->devKind,
 			   tor_blt_mask,
@@ -2141,7 +2117,7 @@ precise_trapezoid_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
 		if (extents.x2 <= TOR_INPLACE_SIZE) {
 			tor_inplace(&tor, scratch);
 		} else {
-			tor_render(NULL, &tor,
+			tor_render(to_sna_from_pixmap(scratch), &tor,
 				   scratch->devPrivate.ptr,
 				   (void *)(intptr_t)scratch->devKind,
 				   tor_blt_mask,
@@ -3175,7 +3151,7 @@ precise_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 		if (extents.x2 <= TOR_INPLACE_SIZE) {
 			tor_inplace(&tor, scratch);
 		} else {
-			tor_render(NULL, &tor,
+			tor_render(to_sna_from_pixmap(scratch), &tor,
 				   scratch->devPrivate.ptr,
 				   (void *)(intptr_t)scratch->devKind,
 				   tor_blt_mask,
@@ -3248,6 +3224,214 @@ precise_trapezoid_span_fallback(CARD8 op, PicturePtr src, PicturePtr dst,
 	return true;
 }
 
+bool
+precise_triangles_span_converter(struct sna *sna,
+				 CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri)
+{
+	struct sna_composite_spans_op tmp;
+	struct tor tor;
+	BoxRec extents;
+	pixman_region16_t clip;
+	int16_t dst_x, dst_y;
+	int dx, dy, n;
+	bool was_clear;
+
+	if (NO_PRECISE)
+		return false;
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst, 0, 0, 0)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	dst_x = pixman_fixed_to_int(tri[0].p1.x);
+	dst_y = pixman_fixed_to_int(tri[0].p1.y);
+
+	miTriangleBounds(count, tri, &extents);
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
+		return true;
+
+	if (!sna_compute_composite_region(&clip,
+					  src, NULL, dst,
+					  src_x + extents.x1 - dst_x,
+					  src_y + extents.y1 - dst_y,
+					  0, 0,
+					  extents.x1, extents.y1,
+					  extents.x2 - extents.x1,
+					  extents.y2 - extents.y1)) {
+		DBG(("%s: triangles do not intersect drawable clips\n",
+		     __FUNCTION__)) ;
+		return true;
+	}
+
+	if (!sna->render.check_composite_spans(sna, op, src, dst,
+					       clip.extents.x2 - clip.extents.x1,
+					       clip.extents.y2 - clip.extents.y1,
+					       0)) {
+		DBG(("%s: fallback -- composite spans not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	extents = *RegionExtents(&clip);
+	dx = dst->pDrawable->x;
+	dy = dst->pDrawable->y;
+
+	DBG(("%s: after clip -- extents (%d, %d), (%d, %d), delta=(%d, %d) src -> (%d, %d)\n",
+	     __FUNCTION__,
+	     extents.x1, extents.y1,
+	     extents.x2, extents.y2,
+	     dx, dy,
+	     src_x + extents.x1 - dst_x - dx,
+	     src_y + extents.y1 - dst_y - dy));
+
+	was_clear = sna_drawable_is_clear(dst->pDrawable);
+
+	memset(&tmp, 0, sizeof(tmp));
+	if (!sna->render.composite_spans(sna, op, src, dst,
+					 src_x + extents.x1 - dst_x - dx,
+					 src_y + extents.y1 - dst_y - dy,
+					 extents.x1,  extents.y1,
+					 extents.x2 - extents.x1,
+					 extents.y2 - extents.y1,
+					 0,
+					 &tmp)) {
+		DBG(("%s: fallback -- composite spans render op not supported\n",
+		     __FUNCTION__));
+		return false;
+	}
+
+	dx *= SAMPLES_X;
+	dy *= SAMPLES_Y;
+	if (!tor_init(&tor, &extents, 3*count))
+		goto skip;
+
+	for (n = 0; n < count; n++)
+		tor_add_triangle(&tor, &tri[n], dx, dy);
+
+	tor_render(sna, &tor, &tmp, &clip,
+		   choose_span(&tmp, dst, maskFormat, &clip),
+		   !was_clear && maskFormat && !operator_is_bounded(op));
+
+	tor_fini(&tor);
+skip:
+	tmp.done(sna, &tmp);
+
+	REGION_UNINIT(NULL, &clip);
+	return true;
+}
+
+bool
+precise_triangles_mask_converter(CARD8 op, PicturePtr src, PicturePtr dst,
+				 PictFormatPtr maskFormat, INT16 src_x, INT16 src_y,
+				 int count, xTriangle *tri)
+{
+	ScreenPtr screen = dst->pDrawable->pScreen;
+	PixmapPtr scratch;
+	PicturePtr mask;
+	struct tor tor;
+	BoxRec extents;
+	int16_t dst_x, dst_y;
+	int dx, dy;
+	int error, n;
+
+	if (NO_PRECISE)
+		return false;
+
+	if (maskFormat == NULL && count > 1) {
+		DBG(("%s: individual rasterisation requested\n",
+		     __FUNCTION__));
+		do {
+			/* XXX unwind errors? */
+			if (!precise_triangles_mask_converter(op, src, dst, NULL,
+							      src_x, src_y, 1, tri++))
+				return false;
+		} while (--count);
+		return true;
+	}
+
+	miTriangleBounds(count, tri, &extents);
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	if (extents.y1 >= extents.y2 || extents.x1 >= extents.x2)
+		return true;
+
+	if (!sna_compute_composite_extents(&extents,
+					   src, NULL, dst,
+					   src_x, src_y,
+					   0, 0,
+					   extents.x1, extents.y1,
+					   extents.x2 - extents.x1,
+					   extents.y2 - extents.y1))
+		return true;
+
+	DBG(("%s: extents (%d, %d), (%d, %d)\n",
+	     __FUNCTION__, extents.x1, extents.y1, extents.x2, extents.y2));
+
+	extents.y2 -= extents.y1;
+	extents.x2 -= extents.x1;
+	extents.x1 -= dst->pDrawable->x;
+	extents.y1 -= dst->pDrawable->y;
+	dst_x = extents.x1;
+	dst_y = extents.y1;
+	dx = -extents.x1 * SAMPLES_X;
+	dy = -extents.y1 * SAMPLES_Y;
+	extents.x1 = extents.y1 = 0;
+
+	DBG(("%s: mask (%dx%d), dx=(%d, %d)\n",
+	     __FUNCTION__, extents.x2, extents.y2, dx, dy));
+	scratch = sna_pixmap_create_upload(screen,
+					   extents.x2, extents.y2, 8,
+					   KGEM_BUFFER_WRITE_INPLACE);
+	if (!scratch)
+		return true;
+
+	DBG(("%s: created buffer %p, stride %d\n",
+	     __FUNCTION__, scratch->devPrivate.ptr, scratch->devKind));
+
+	if (!tor_init(&tor, &extents, 3*count)) {
+		sna_pixmap_destroy(scratch);
+		return true;
+	}
+
+	for (n = 0; n < count; n++)
+		tor_add_triangle(&tor, &tri[n], dx, dy);
+
+	if (extents.x2 <= TOR_INPLACE_SIZE) {
+		tor_inplace(&tor, scratch);
+	} else {
+		tor_render(to_sna_from_pixmap(scratch), &tor,
+			   scratch->devPrivate.ptr,
+			   (void *)(intptr_t)scratch->devKind,
+			   tor_blt_mask,
+			   true);
+	}
+	tor_fini(&tor);
+
+	mask = CreatePicture(0, &scratch->drawable,
+			     PictureMatchFormat(screen, 8, PICT_a8),
+			     0, 0, serverClient, &error);
+	if (mask) {
+		CompositePicture(op, src, mask, dst,
+				 src_x + dst_x - pixman_fixed_to_int(tri[0].p1.x),
+				 src_y + dst_y - pixman_fixed_to_int(tri[0].p1.y),
+				 0, 0,
+				 dst_x, dst_y,
+				 extents.x2, extents.y2);
+		FreePicture(mask, 0);
+	}
+	sna_pixmap_destroy(scratch);
+
+	return true;
+}
+
 struct tristrip_thread {
 	struct sna *sna;
 	const struct sna_composite_spans_op *op;
@@ -3271,7 +3455,7 @@ tristrip_thread(void *arg)
 	if (!tor_init(&tor, &thread->extents, 2*thread->count))
 		return;
 
-	span_thread_boxes_init(&boxes, thread->op, thread->clip);
+	span_thread_boxes_init(&boxes, thread->op, thread->clip, GRID_AREA);
 
 	cw = 0; ccw = 1;
 	polygon_add_line(tor.polygon,
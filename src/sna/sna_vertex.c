@@ -37,5 +37,46 @@ void sna_vertex_init(struct sna *sna)
 {
 	pthread_mutex_init(&sna->render.lock, NULL);
 	pthread_cond_init(&sna->render.wait, NULL);
+	sna->render.reserve_op = NULL;
 	sna->render.active = 0;
 }
+
+/* Claim vertex space for up to *nbox rectangles of @op from a rendering
+ * thread. The fast path is a lock-free reservation in the primitive
+ * already shared by another thread; failing that, we take the lock,
+ * start a new primitive using the backend's @get_rectangles() and share
+ * it (unless @share is false). *nbox is updated with the number of
+ * rectangles claimed, and the caller must sna_vertex_release() once they
+ * are written.
+ */
+float *sna_vertex_reserve__thread(struct sna *sna,
+				  const struct sna_composite_op *op,
+				  int floats_per_rect,
+				  int vertices_per_rect,
+				  bool share,
+				  int *nbox,
+				  int (*get_rectangles)(struct sna *sna,
+							const struct sna_composite_op *op,
+							int want))
+{
+	struct sna_render *r = &sna->render;
+	float *v;
+
+	v = sna_vertex_reserve(r, op, floats_per_rect, nbox);
+	if (v)
+		return v;
+
+	sna_vertex_lock(r);
+	v = sna_vertex_reserve__locked(r, op, floats_per_rect, nbox);
+	if (v == NULL) {
+		*nbox = get_rectangles(sna, op, *nbox);
+		assert(*nbox);
+
+		v = sna_vertex_share__locked(r, share ? op : NULL,
+					     floats_per_rect, *nbox,
+					     vertices_per_rect);
+	}
+	sna_vertex_unlock(r);
+
+	return v;
+}
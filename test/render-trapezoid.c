@@ -521,6 +521,101 @@ static void edge_test(struct test *t,
 	printf("pass\n");
 }
 
+static XFixed random_fixed(int max)
+{
+	return rand() % (max << 16);
+}
+
+/* Overlapping general trapezoids with antialiased edges, accumulated in
+ * an a8 mask. A quarter of the trapezoids are inverted or twisted, with
+ * the left edge crossing to the right of the right edge, which Render
+ * leaves unfilled rather than subtracting from their neighbours.
+ */
+static void precise_trap_tests(struct test *t, int reps, enum target target)
+{
+	struct test_target out, ref;
+	XTrapezoid traps[8];
+	int r, n;
+
+	printf("Testing precise trapezoids (general with mask a8) (%s): ",
+	       test_target_name(target));
+	fflush(stdout);
+
+	test_target_create_render(&t->out, target, &out);
+	set_edge(t->out.dpy, out.picture, EDGE_SMOOTH);
+
+	test_target_create_render(&t->ref, target, &ref);
+	set_edge(t->ref.dpy, ref.picture, EDGE_SMOOTH);
+
+	for (r = 0; r < reps; r++) {
+		XRenderColor render_color;
+		int alpha = rand() % 0xff;
+		int num_traps = 1 + rand() % 8;
+		Picture src;
+
+		for (n = 0; n < num_traps; n++) {
+			XTrapezoid *trap = &traps[n];
+
+			trap->top = random_fixed(out.height);
+			trap->bottom = trap->top + random_fixed(out.height);
+
+			trap->left.p1.x = random_fixed(out.width);
+			trap->left.p2.x = random_fixed(out.width);
+			trap->right.p1.x = random_fixed(out.width);
+			trap->right.p2.x = random_fixed(out.width);
+			if (rand() % 4) {
+				if (trap->right.p1.x < trap->left.p1.x) {
+					XFixed x = trap->right.p1.x;
+					trap->right.p1.x = trap->left.p1.x;
+					trap->left.p1.x = x;
+				}
+				if (trap->right.p2.x < trap->left.p2.x) {
+					XFixed x = trap->right.p2.x;
+					trap->right.p2.x = trap->left.p2.x;
+					trap->left.p2.x = x;
+				}
+			}
+
+			trap->left.p1.y = trap->right.p1.y = trap->top;
+			trap->left.p2.y = trap->right.p2.y = trap->bottom;
+		}
+
+		render_color.red   = 0xffff * alpha / 0xff;
+		render_color.green = 0x8000 * alpha / 0xff;
+		render_color.blue  = 0;
+		render_color.alpha = alpha << 8;
+
+		clear(&t->out, &out);
+		src = XRenderCreateSolidFill(t->out.dpy,
+					     &render_color);
+		XRenderCompositeTrapezoids(t->out.dpy,
+					   PictOpOver, src, out.picture,
+					   mask_format(t->out.dpy, MASK_A8),
+					   0, 0, traps, num_traps);
+		XRenderFreePicture(t->out.dpy, src);
+
+		clear(&t->ref, &ref);
+		src = XRenderCreateSolidFill(t->ref.dpy,
+					     &render_color);
+		XRenderCompositeTrapezoids(t->ref.dpy,
+					   PictOpOver, src, ref.picture,
+					   mask_format(t->ref.dpy, MASK_A8),
+					   0, 0, traps, num_traps);
+		XRenderFreePicture(t->ref.dpy, src);
+
+		test_compare_fuzzy(t,
+				   out.draw, out.format,
+				   ref.draw, ref.format,
+				   0, 0, out.width, out.height,
+				   precise_delta(), "");
+	}
+
+	printf("passed [%d iterations]\n", reps);
+
+	test_target_destroy_render(&t->out, &out);
+	test_target_destroy_render(&t->ref, &ref);
+}
+
 int main(int argc, char **argv)
 {
 	struct test test;
@@ -536,6 +631,7 @@ int main(int argc, char **argv)
 		for (mask = MASK_NONE; mask <= MASK_A8; mask++)
 			for (edge = EDGE_SHARP; edge <= EDGE_SMOOTH; edge++)
 				edge_test(&test, mask, edge, target);
+		precise_trap_tests(&test, 1024, target);
 	}
 
 	for (i = 0; i <= DEFAULT_ITERATIONS; i++) {
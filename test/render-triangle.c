@@ -9,12 +9,18 @@ enum edge {
 	EDGE_SMOOTH,
 };
 
-static void set_edge(Display *dpy, Picture p, enum edge edge)
+enum mode {
+	MODE_PRECISE = PolyModePrecise,
+	MODE_IMPRECISE,
+};
+
+static void set_edge(Display *dpy, Picture p, enum edge edge, enum mode mode)
 {
 	XRenderPictureAttributes a;
 
 	a.poly_edge = edge;
-	XRenderChangePicture(dpy, p, CPPolyEdge, &a);
+	a.poly_mode = mode;
+	XRenderChangePicture(dpy, p, CPPolyEdge | CPPolyMode, &a);
 }
 
 static XRenderPictFormat *mask_format(Display *dpy, enum mask mask)
@@ -46,6 +52,15 @@ static const char *edge_name(enum edge edge)
 	}
 }
 
+static const char *mode_name(enum mode mode)
+{
+	switch (mode) {
+	default:
+	case MODE_PRECISE: return "precise";
+	case MODE_IMPRECISE: return "imprecise";
+	}
+}
+
 static void clear(struct test_display *dpy, struct test_target *tt)
 {
 	XRenderColor render_color = {0};
@@ -86,6 +101,7 @@ static void step_to_point(int step, int width, int height, XPointFixed *p)
 static void edge_test(struct test *t,
 		      enum mask mask,
 		      enum edge edge,
+		      enum mode mode,
 		      enum target target)
 {
 	struct test_target out, ref;
@@ -95,15 +111,16 @@ static void edge_test(struct test *t,
 	unsigned step, max;
 
 	test_target_create_render(&t->out, target, &out);
-	set_edge(t->out.dpy, out.picture, edge);
+	set_edge(t->out.dpy, out.picture, edge, mode);
 	src_out = XRenderCreateSolidFill(t->out.dpy, &white);
 
 	test_target_create_render(&t->ref, target, &ref);
-	set_edge(t->ref.dpy, ref.picture, edge);
+	set_edge(t->ref.dpy, ref.picture, edge, mode);
 	src_ref = XRenderCreateSolidFill(t->ref.dpy, &white);
 
-	printf("Testing edges (with mask %s and %s edges) (%s): ",
+	printf("Testing edges (with mask %s and %s %s edges) (%s): ",
 	       mask_name(mask),
+	       mode_name(mode),
 	       edge_name(edge),
 	       test_target_name(target));
 	fflush(stdout);
@@ -145,11 +162,97 @@ static void edge_test(struct test *t,
 					  0, 0,
 					  &tri, 1);
 
-		test_compare(t,
-			     out.draw, out.format,
-			     ref.draw, ref.format,
-			     0, 0, out.width, out.height,
-			     buf);
+		test_compare_fuzzy(t,
+				   out.draw, out.format,
+				   ref.draw, ref.format,
+				   0, 0, out.width, out.height,
+				   precise_delta(), buf);
+	}
+
+	XRenderFreePicture(t->out.dpy, src_out);
+	test_target_destroy_render(&t->out, &out);
+
+	XRenderFreePicture(t->ref.dpy, src_ref);
+	test_target_destroy_render(&t->ref, &ref);
+
+	printf("pass\n");
+}
+
+/* Fans around an interior point whose rim walks the border of the
+ * target, once or twice around so that the second turn overlaps the
+ * first and the coverage must accumulate.
+ */
+static void fan_test(struct test *t,
+		     enum mask mask,
+		     enum edge edge,
+		     enum mode mode,
+		     enum target target)
+{
+	struct test_target out, ref;
+	XRenderColor white = { 0xffff, 0xffff, 0xffff, 0xffff };
+	Picture src_ref, src_out;
+	XPointFixed points[2*16 + 2];
+	unsigned step, max, perimeter;
+	int n, turns;
+
+	test_target_create_render(&t->out, target, &out);
+	set_edge(t->out.dpy, out.picture, edge, mode);
+	src_out = XRenderCreateSolidFill(t->out.dpy, &white);
+
+	test_target_create_render(&t->ref, target, &ref);
+	set_edge(t->ref.dpy, ref.picture, edge, mode);
+	src_ref = XRenderCreateSolidFill(t->ref.dpy, &white);
+
+	printf("Testing fans (with mask %s and %s %s edges) (%s): ",
+	       mask_name(mask),
+	       mode_name(mode),
+	       edge_name(edge),
+	       test_target_name(target));
+	fflush(stdout);
+
+	perimeter = 2*(out.width + 128 + out.height+128);
+	max = perimeter / 16;
+	for (turns = 1; turns <= 2; turns++) {
+		for (step = 0; step <= max; step += 7) {
+			char buf[80];
+
+			points[0].x = (out.width << 15) + (step << 10);
+			points[0].y = (out.height << 15) - (step << 9);
+			for (n = 0; n <= 16*turns; n++)
+				step_to_point(step + n * perimeter / 16,
+					      out.width, out.height,
+					      &points[n+1]);
+
+			sprintf(buf,
+				"fan=%d points about (%d, %d), %d turns\n",
+				n + 1,
+				points[0].x >> 16, points[0].y >> 16,
+				turns);
+
+			clear(&t->out, &out);
+			XRenderCompositeTriFan(t->out.dpy,
+					       PictOpSrc,
+					       src_out,
+					       out.picture,
+					       mask_format(t->out.dpy, mask),
+					       0, 0,
+					       points, n + 1);
+
+			clear(&t->ref, &ref);
+			XRenderCompositeTriFan(t->ref.dpy,
+					       PictOpSrc,
+					       src_ref,
+					       ref.picture,
+					       mask_format(t->ref.dpy, mask),
+					       0, 0,
+					       points, n + 1);
+
+			test_compare_fuzzy(t,
+					   out.draw, out.format,
+					   ref.draw, ref.format,
+					   0, 0, out.width, out.height,
+					   precise_delta(), buf);
+		}
 	}
 
 	XRenderFreePicture(t->out.dpy, src_out);
@@ -167,13 +270,17 @@ int main(int argc, char **argv)
 	enum target target;
 	enum mask mask;
 	enum edge edge;
+	enum mode mode;
 
 	test_init(&test, argc, argv);
 
 	for (target = TARGET_FIRST; target <= TARGET_LAST; target++) {
 		for (mask = MASK_NONE; mask <= MASK_A8; mask++)
 			for (edge = EDGE_SHARP; edge <= EDGE_SMOOTH; edge++)
-				edge_test(&test, mask, edge, target);
+				for (mode = MODE_PRECISE; mode <= MODE_IMPRECISE; mode++) {
+					edge_test(&test, mask, edge, mode, target);
+					fan_test(&test, mask, edge, mode, target);
+				}
 	}
 
 	return 0;
@@ -2,6 +2,7 @@
 #define TEST_H
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 
 #include <X11/Xlib.h>
@@ -48,10 +49,26 @@ void test_compare(struct test *out,
 		  Drawable out_draw, XRenderPictFormat *out_format,
 		  Drawable ref_draw, XRenderPictFormat *ref_format,
 		  int x, int y, int w, int h, const char *info);
+void test_compare_fuzzy(struct test *out,
+			Drawable out_draw, XRenderPictFormat *out_format,
+			Drawable ref_draw, XRenderPictFormat *ref_format,
+			int x, int y, int w, int h,
+			int delta, const char *info);
 
 #define MAX_DELTA 3
 int pixel_difference(uint32_t a, uint32_t b);
 
+/* With Option "AnalyticCoverage" the server computes the exact area
+ * covered by precise antialiased geometry instead of sampling it on the
+ * 17x15 grid of the reference, so allow for up to one sample row of
+ * difference. Set ANALYTIC_COVERAGE when testing such a server.
+ */
+#define ANALYTIC_DELTA 18
+static inline int precise_delta(void)
+{
+	return getenv("ANALYTIC_COVERAGE") ? ANALYTIC_DELTA : MAX_DELTA;
+}
+
 static inline int pixel_equal(int depth, uint32_t a, uint32_t b)
 {
 	if (depth != 32) {
@@ -70,7 +70,7 @@ show_pixels(char *buf,
 static void test_compare_fallback(struct test *t,
 				  Drawable out_draw, XRenderPictFormat *out_format,
 				  Drawable ref_draw, XRenderPictFormat *ref_format,
-				  int x, int y, int w, int h)
+				  int x, int y, int w, int h, int delta)
 {
 	XImage *out_image, *ref_image;
 	char *out, *ref;
@@ -99,7 +99,7 @@ static void test_compare_fallback(struct test *t,
 		for (i = 0; i < w; i++) {
 			uint32_t a = ((uint32_t *)out)[i] & mask;
 			uint32_t b = ((uint32_t *)ref)[i] & mask;
-			if (a != b && pixel_difference(a, b) > MAX_DELTA) {
+			if (a != b && pixel_difference(a, b) > delta) {
 				show_pixels(buf,
 					    out_image, ref_image,
 					    i, j, w, h);
@@ -190,11 +190,11 @@ out:
 	fclose(file);
 }
 
-void test_compare(struct test *t,
-		  Drawable out_draw, XRenderPictFormat *out_format,
-		  Drawable ref_draw, XRenderPictFormat *ref_format,
-		  int x, int y, int w, int h,
-		  const char *info)
+void test_compare_fuzzy(struct test *t,
+			Drawable out_draw, XRenderPictFormat *out_format,
+			Drawable ref_draw, XRenderPictFormat *ref_format,
+			int x, int y, int w, int h,
+			int delta, const char *info)
 {
 	XImage out_image, ref_image;
 	uint32_t *out, *ref;
@@ -206,7 +206,7 @@ void test_compare(struct test *t,
 		return test_compare_fallback(t,
 					     out_draw, out_format,
 					     ref_draw, ref_format,
-					     x, y, w, h);
+					     x, y, w, h, delta);
 
 	test_init_image(&out_image, &t->out.shm, out_format, w, h);
 	test_init_image(&ref_image, &t->ref.shm, ref_format, w, h);
@@ -229,7 +229,7 @@ void test_compare(struct test *t,
 		for (i = 0; i < w; i++) {
 			uint32_t a = out[i] & mask;
 			uint32_t b = ref[i] & mask;
-			if (a != b && pixel_difference(a, b) > MAX_DELTA) {
+			if (a != b && pixel_difference(a, b) > delta) {
 				show_pixels(buf,
 					    &out_image, &ref_image,
 					    i, j, w, h);
@@ -244,6 +244,19 @@ void test_compare(struct test *t,
 	}
 }
 
+void test_compare(struct test *t,
+		  Drawable out_draw, XRenderPictFormat *out_format,
+		  Drawable ref_draw, XRenderPictFormat *ref_format,
+		  int x, int y, int w, int h,
+		  const char *info)
+{
+	test_compare_fuzzy(t,
+			   out_draw, out_format,
+			   ref_draw, ref_format,
+			   x, y, w, h,
+			   MAX_DELTA, info);
+}
+
 static int
 _native_byte_order_lsb(void)
 {